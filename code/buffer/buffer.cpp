@@ -5,8 +5,13 @@
  */ 
 #include "buffer.h"
 
-// 构造函数，给buffer_(vector)预先设好的大小，当前读写位置都为0
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+// 构造函数，记下第一次分配的大小，当前读写位置都为0
+Buffer::Buffer(int initBuffSize) : buffer_(nullptr), capacity_(0), initSize_(initBuffSize),
+    readPos_(0), writePos_(0) {}
+
+Buffer::~Buffer() {
+    Free_(buffer_, capacity_);
+}
 
 // 对vector<char> Buffer获取到当前可读的大小，由写位-读位得到
 size_t Buffer::ReadableBytes() const {
@@ -14,7 +19,7 @@ size_t Buffer::ReadableBytes() const {
 }
 // 对vector<char> Buffer获取到当前可写的大小
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return capacity_ - writePos_;
 }
 
 size_t Buffer::PrependableBytes() const {
@@ -28,6 +33,11 @@ const char* Buffer::Peek() const {
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
     readPos_ += len;
+    if(readPos_ == writePos_) {
+        // 读完后回到开头，之后的写入不必搬移数据
+        readPos_ = 0;
+        writePos_ = 0;
+    }
 }
 
 void Buffer::RetrieveUntil(const char* end) {
@@ -36,7 +46,6 @@ void Buffer::RetrieveUntil(const char* end) {
 }
 
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size());
     readPos_ = 0;
     writePos_ = 0;
 }
@@ -89,33 +98,38 @@ void Buffer::EnsureWriteable(size_t len) {
     }
     assert(WritableBytes() >= len);
 }
-// 
-ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    char buff[65535];//临时的buff，保证能够把所有的数据都读出来
-    struct iovec iov[2];//结构体数组[2]，第一个元素[0]是结构体的iov_base是vector，第二个iov_len是临时的buff[65535]
-    const size_t writable = WritableBytes();
-    /* 分散读， 保证数据全部读完 */
-    // writePos_初始化为0，根据单词读完的大小，再加上BeginPtr()就可以得到当前vector-BUffer的索引
-    iov[0].iov_base = BeginPtr_() + writePos_;
-    iov[0].iov_len = writable;
-    iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
-    // readv分散读，第三个参数是表示有几个要读的容器
-    const ssize_t len = readv(fd, iov, 2); // len是读到的字节数
+// 按内核中已经到达的字节数(FIONREAD)或调用方给的估计扩容，直接读入存储，不经过临时数组
+ssize_t Buffer::ReadFd(int fd, int* saveErrno, size_t hint, size_t limit) {
+    int pending = 0;
+    if(ioctl(fd, FIONREAD, &pending) < 0) {
+        pending = 0;
+    }
+    size_t want = std::max(static_cast<size_t>(pending), hint);
+    if(limit > 0) {
+        want = std::min(want, limit);
+    }
+    if(want == 0 && WritableBytes() == 0) {
+        // 没有数据(对端关闭或EAGAIN)时不为了探测而分配存储
+        char probe[256];
+        ssize_t len = read(fd, probe, sizeof(probe));
+        if(len < 0) {
+            *saveErrno = errno;
+        } else if(len > 0) {
+            Append(probe, len);
+        }
+        return len;
+    }
+    EnsureWriteable(want);
+    size_t size = WritableBytes();
+    if(limit > 0) {
+        size = std::min(size, limit);
+    }
+    ssize_t len = read(fd, BeginWrite(), size);
     if(len < 0) {
-        // 关闭连接
         *saveErrno = errno;
-    }
-    else if(static_cast<size_t>(len) <= writable) {
-        // writable表示可写的字节数，为buffer_size()-writePos_;
-        // else if判断当前要读的内容是否小于等于可写的空间，可以则写入，并刷新writePos_的位置
+    } else {
         writePos_ += len;
     }
-    else {
-        // else说明要读的内容大于可写的空间，则buffer将无法完全容纳，需要将临时buff[65535]的内容纳入
-        writePos_ = buffer_.size(); // 刷新writePos_，刷新到Buffer队尾
-        Append(buff, len - writable); // 添加(属于buffer扩充的核心部分)
-    }
     return len;
 }
 
@@ -131,19 +145,55 @@ ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
 }
 
 char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+    return buffer_;
 }
 
 const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+    return buffer_;
+}
+
+void Buffer::Release() {
+    Free_(buffer_, capacity_);
+    buffer_ = nullptr;
+    capacity_ = 0;
+    readPos_ = 0;
+    writePos_ = 0;
+}
+
+char* Buffer::Alloc_(size_t* size) {
+    size_t chunk = ChunkPool::ChunkSize(*size);
+    if(chunk > 0) {
+        *size = chunk;
+        return ChunkPool::Instance()->Acquire(chunk);
+    }
+    return static_cast<char*>(malloc(*size));
+}
+
+void Buffer::Free_(char* data, size_t size) {
+    if(!data) { return; }
+    if(ChunkPool::ChunkSize(size) == size) {
+        ChunkPool::Instance()->Release(data, size);
+    } else {
+        free(data);
+    }
 }
 // MakeSpace_(len);对Buffer进行扩容
 void Buffer::MakeSpace_(size_t len) {
     // PrependableBytes()-前面可以用的空间，readPos_前面的空间都是已读过的，可以用作扩充
     if(WritableBytes() + PrependableBytes() < len) {
         // 按照buffer当前的情况，可写大小+已读过的(可支持扩充)的大小<len
-        buffer_.resize(writePos_ + len + 1);
-        // 对容器进行stl操作，扩容
+        // 换一块更大的存储(至少翻倍)，只拷贝还没有读的数据，不清零
+        size_t readable = ReadableBytes();
+        size_t size = std::max(std::max(readable + len, capacity_ * 2), initSize_);
+        char* data = Alloc_(&size);
+        if(readable > 0) {
+            memcpy(data, BeginPtr_() + readPos_, readable);
+        }
+        Free_(buffer_, capacity_);
+        buffer_ = data;
+        capacity_ = size;
+        readPos_ = 0;
+        writePos_ = readable;
     } 
     else {
         // else表示可写大小+已读过的(可支持扩充)的大小足够支撑读取剩余的数据
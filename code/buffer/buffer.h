@@ -10,14 +10,23 @@
 #include <iostream>
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
+#include <sys/ioctl.h> // FIONREAD
 #include <vector> //readv
 #include <atomic>
 #include <assert.h>
+#include <stdlib.h>  // malloc
+#include <algorithm>
+#include "chunkpool.h"
+
+// 连续的读写缓冲区，存储来自ChunkPool(16KB以内)或直接向系统申请；
+// 第一次写入时才分配，RetrieveAll只重置读写位置，不清零
 class Buffer {
 public:
-    // 初始化Buffer为1024
+    // initBuffSize是第一次分配的大小
     Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    ~Buffer();
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
     size_t WritableBytes() const;//可写       
     size_t ReadableBytes() const ;//可读
@@ -41,15 +50,25 @@ public:
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
 
-    ssize_t ReadFd(int fd, int* Errno);
+    // hint是调用方估计的数据量(如连接上以往请求的大小)，与FIONREAD取较大者；
+    // limit不为0时本次最多读limit字节(内存紧张时)，其余留在内核中
+    ssize_t ReadFd(int fd, int* Errno, size_t hint = 0, size_t limit = 0);
     ssize_t WriteFd(int fd, int* Errno);
 
+    // 丢弃数据，把存储还给池(或系统)，下一次写入时重新分配
+    void Release();
+    size_t Capacity() const { return capacity_; }
+
 private:
     char* BeginPtr_();//char指针
     const char* BeginPtr_() const;//
     void MakeSpace_(size_t len);//创建新的空间
+    static char* Alloc_(size_t* size); // 按块大小向上取整
+    static void Free_(char* data, size_t size);
 
-    std::vector<char> buffer_;//具体装数据的vector
+    char* buffer_; // 具体装数据的存储
+    size_t capacity_;
+    size_t initSize_;
     std::atomic<std::size_t> readPos_;// 读的位置(目前)
     std::atomic<std::size_t> writePos_; // 目前写的位置
 };
@@ -0,0 +1,170 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "chainbuffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+using namespace std;
+
+ChainBuffer::ChainBuffer(size_t chunkSize) : head_(0), readable_(0) {
+    chunkSize_ = ChunkPool::ChunkSize(chunkSize);
+    assert(chunkSize_ > 0);
+}
+
+ChainBuffer::~ChainBuffer() {
+    RetrieveAll();
+}
+
+const char* ChainBuffer::Peek() const {
+    if(head_ == chunks_.size()) { return nullptr; }
+    const Chunk& c = chunks_[head_];
+    return c.data + c.read;
+}
+
+size_t ChainBuffer::PeekBytes() const {
+    if(head_ == chunks_.size()) { return 0; }
+    const Chunk& c = chunks_[head_];
+    return c.write - c.read;
+}
+
+void ChainBuffer::Retrieve(size_t len) {
+    assert(len <= readable_);
+    readable_ -= len;
+    while(len > 0) {
+        Chunk& c = chunks_[head_];
+        size_t n = min(len, c.write - c.read);
+        c.read += n;
+        len -= n;
+        // 读完的块(除了还在写的最后一块)还给池
+        if(c.read == c.write && (head_ + 1 < chunks_.size() || readable_ == 0)) {
+            ChunkPool::Instance()->Release(c.data, chunkSize_);
+            head_++;
+        }
+    }
+    Compact_();
+}
+
+void ChainBuffer::RetrieveAll() {
+    for(size_t i = head_; i < chunks_.size(); i++) {
+        ChunkPool::Instance()->Release(chunks_[i].data, chunkSize_);
+    }
+    chunks_.clear();
+    head_ = 0;
+    readable_ = 0;
+}
+
+void ChainBuffer::Compact_() {
+    if(head_ == chunks_.size()) {
+        chunks_.clear();
+        head_ = 0;
+    } else if(head_ > 16 && head_ * 2 > chunks_.size()) {
+        // 块的记录很小，偶尔整体前移一次，均摊O(1)
+        chunks_.erase(chunks_.begin(), chunks_.begin() + head_);
+        head_ = 0;
+    }
+}
+
+void ChainBuffer::PushChunk_(char* data, size_t write) {
+    chunks_.push_back({ data, 0, write });
+}
+
+void ChainBuffer::Append(const string& str) {
+    Append(str.data(), str.size());
+}
+
+void ChainBuffer::Append(const void* data, size_t len) {
+    Append(static_cast<const char*>(data), len);
+}
+
+void ChainBuffer::Append(const char* data, size_t len) {
+    readable_ += len;
+    while(len > 0) {
+        if(chunks_.size() == head_ || Back_().write == chunkSize_) {
+            PushChunk_(ChunkPool::Instance()->Acquire(chunkSize_), 0);
+        }
+        Chunk& c = Back_();
+        size_t n = min(len, chunkSize_ - c.write);
+        memcpy(c.data + c.write, data, n);
+        c.write += n;
+        data += n;
+        len -= n;
+    }
+}
+
+int ChainBuffer::GetIov(struct iovec* iov, int max) const {
+    int n = 0;
+    for(size_t i = head_; i < chunks_.size() && n < max; i++) {
+        const Chunk& c = chunks_[i];
+        if(c.write > c.read) {
+            iov[n].iov_base = c.data + c.read;
+            iov[n].iov_len = c.write - c.read;
+            n++;
+        }
+    }
+    return n;
+}
+
+void ChainBuffer::CopyTo(string& dest) const {
+    dest.reserve(dest.size() + readable_);
+    for(size_t i = head_; i < chunks_.size(); i++) {
+        const Chunk& c = chunks_[i];
+        dest.append(c.data + c.read, c.write - c.read);
+    }
+}
+
+ssize_t ChainBuffer::ReadFd(int fd, int* saveErrno) {
+    struct iovec iov[READ_CHUNKS + 1];
+    char* fresh[READ_CHUNKS];
+    int cnt = 0;
+    size_t tailSpace = 0;
+    if(chunks_.size() > head_ && Back_().write < chunkSize_) {
+        tailSpace = chunkSize_ - Back_().write;
+        iov[cnt].iov_base = Back_().data + Back_().write;
+        iov[cnt].iov_len = tailSpace;
+        cnt++;
+    }
+    for(int i = 0; i < READ_CHUNKS; i++) {
+        fresh[i] = ChunkPool::Instance()->Acquire(chunkSize_);
+        iov[cnt].iov_base = fresh[i];
+        iov[cnt].iov_len = chunkSize_;
+        cnt++;
+    }
+    ssize_t len = readv(fd, iov, cnt);
+    if(len < 0) {
+        *saveErrno = errno;
+    }
+    size_t rest = len > 0 ? len : 0;
+    readable_ += rest;
+    size_t n = min(rest, tailSpace);
+    if(n > 0) {
+        Back_().write += n;
+        rest -= n;
+    }
+    for(int i = 0; i < READ_CHUNKS; i++) {
+        if(rest > 0) {
+            n = min(rest, chunkSize_);
+            PushChunk_(fresh[i], n);
+            rest -= n;
+        } else {
+            ChunkPool::Instance()->Release(fresh[i], chunkSize_);
+        }
+    }
+    return len;
+}
+
+ssize_t ChainBuffer::WriteFd(int fd, int* saveErrno) {
+    struct iovec iov[WRITE_IOV];
+    int cnt = GetIov(iov, WRITE_IOV);
+    if(cnt == 0) { return 0; }
+    ssize_t len = writev(fd, iov, cnt);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    Retrieve(len);
+    return len;
+}
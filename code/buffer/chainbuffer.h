@@ -0,0 +1,70 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef CHAINBUFFER_H
+#define CHAINBUFFER_H
+
+#include <string>
+#include <vector>
+#include <sys/uio.h> // readv/writev
+
+#include "chunkpool.h"
+
+// 由ChunkPool的定长块串成的缓冲区：追加时在末尾接上新块，已有的数据不移动也不拷贝；
+// 取走数据只移动读位置，读完的块立即还给池；空的缓冲区不占用任何块
+// 适合积压的发送队列这类只追加、按顺序取走的数据，可以直接用readv/writev读写多个块
+class ChainBuffer {
+public:
+    explicit ChainBuffer(size_t chunkSize = ChunkPool::MAX_CHUNK);
+    ~ChainBuffer();
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer& operator=(const ChainBuffer&) = delete;
+
+    size_t ReadableBytes() const { return readable_; }
+    size_t ChunkCount() const { return chunks_.size() - head_; }
+    size_t Capacity() const { return ChunkCount() * chunkSize_; } // 占用的块的总大小
+
+    // 第一个块中连续的可读数据
+    const char* Peek() const;
+    size_t PeekBytes() const;
+
+    void Retrieve(size_t len);
+    void RetrieveAll(); // 归还所有块，不清零
+
+    void Append(const std::string& str);
+    void Append(const char* data, size_t len);
+    void Append(const void* data, size_t len);
+
+    // 可读数据按块填入iov，最多max个，返回个数
+    int GetIov(struct iovec* iov, int max) const;
+    // 可读数据全部拷贝到dest
+    void CopyTo(std::string& dest) const;
+
+    // 读到末尾的块和至多READ_CHUNKS个新块中，没有用到的新块还给池
+    ssize_t ReadFd(int fd, int* saveErrno);
+    // 一次writev写出至多WRITE_IOV个块
+    ssize_t WriteFd(int fd, int* saveErrno);
+
+private:
+    struct Chunk {
+        char* data;
+        size_t read;
+        size_t write;
+    };
+
+    void Compact_(); // 去掉开头已经归还的块的记录
+    Chunk& Back_() { return chunks_.back(); }
+    void PushChunk_(char* data, size_t write);
+
+    size_t chunkSize_;
+    std::vector<Chunk> chunks_; // [head_, size)是在用的块
+    size_t head_;
+    size_t readable_;
+
+    static const int READ_CHUNKS = 4;
+    static const int WRITE_IOV = 64;
+};
+
+#endif //CHAINBUFFER_H
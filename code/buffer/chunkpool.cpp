@@ -0,0 +1,146 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "chunkpool.h"
+
+#include <stdlib.h>
+#include <assert.h>
+using namespace std;
+
+atomic<uint64_t> ChunkPool::allocBytes;
+atomic<uint64_t> ChunkPool::inUseBytes;
+atomic<uint64_t> ChunkPool::acquireCount;
+atomic<uint64_t> ChunkPool::globalCount;
+
+// 线程缓存，线程退出时把缓存的块还给全局空闲链表
+struct ChunkCache {
+    vector<char*> chunks[ChunkPool::CLASS_COUNT];
+    ~ChunkCache() {
+        for(int i = 0; i < ChunkPool::CLASS_COUNT; i++) {
+            ChunkPool::Instance()->Spill_(i, chunks[i], 0);
+        }
+    }
+};
+
+static thread_local ChunkCache cache;
+
+ChunkPool* ChunkPool::Instance() {
+    // 不析构：静态对象(如日志的缓冲区)析构时仍然会归还块
+    static ChunkPool* pool = new ChunkPool();
+    return pool;
+}
+
+size_t ChunkPool::ChunkSize(size_t len) {
+    size_t size = MIN_CHUNK;
+    while(size < len && size < MAX_CHUNK) {
+        size *= 2;
+    }
+    return len <= size ? size : 0;
+}
+
+int ChunkPool::Class_(size_t size) {
+    int cls = 0;
+    for(size_t s = MIN_CHUNK; s < size; s *= 2) {
+        cls++;
+    }
+    assert(cls < CLASS_COUNT && (MIN_CHUNK << cls) == size);
+    return cls;
+}
+
+char* ChunkPool::Acquire(size_t size) {
+    int cls = Class_(size);
+    vector<char*>& chunks = cache.chunks[cls];
+    acquireCount++;
+    inUseBytes += size;
+    if(chunks.empty()) {
+        globalCount++;
+        Refill_(cls, chunks);
+        if(chunks.empty()) {
+            allocBytes += size;
+            return static_cast<char*>(malloc(size));
+        }
+    }
+    char* chunk = chunks.back();
+    chunks.pop_back();
+    return chunk;
+}
+
+void ChunkPool::Release(char* chunk, size_t size) {
+    if(!chunk) { return; }
+    int cls = Class_(size);
+    vector<char*>& chunks = cache.chunks[cls];
+    inUseBytes -= size;
+    chunks.push_back(chunk);
+    size_t cacheMax = cacheMax_;
+    if(chunks.size() > cacheMax) {
+        Spill_(cls, chunks, cacheMax / 2);
+    }
+}
+
+void ChunkPool::Refill_(int cls, vector<char*>& chunks) {
+    lock_guard<mutex> locker(mtx_);
+    vector<char*>& list = free_[cls];
+    size_t n = list.size() < BATCH ? list.size() : BATCH;
+    chunks.insert(chunks.end(), list.end() - n, list.end());
+    list.resize(list.size() - n);
+}
+
+void ChunkPool::Spill_(int cls, vector<char*>& chunks, size_t keep) {
+    if(chunks.size() <= keep) { return; }
+    size_t size = MIN_CHUNK << cls;
+    vector<char*> extra;
+    {
+        lock_guard<mutex> locker(mtx_);
+        vector<char*>& list = free_[cls];
+        while(chunks.size() > keep) {
+            if((list.size() + 1) * size <= maxFreeBytes_ / CLASS_COUNT) {
+                list.push_back(chunks.back());
+            } else {
+                extra.push_back(chunks.back());
+            }
+            chunks.pop_back();
+        }
+    }
+    for(char* chunk : extra) {
+        allocBytes -= size;
+        free(chunk);
+    }
+}
+
+void ChunkPool::FlushCache() {
+    for(int i = 0; i < CLASS_COUNT; i++) {
+        Spill_(i, cache.chunks[i], 0);
+    }
+}
+
+void ChunkPool::Trim(size_t maxBytes) {
+    vector<pair<char*, size_t>> extra;
+    {
+        lock_guard<mutex> locker(mtx_);
+        maxFreeBytes_ = maxBytes;
+        cacheMax_ = maxBytes < MAX_FREE_BYTES ? (size_t)BATCH : (size_t)CACHE_MAX;
+        for(int i = 0; i < CLASS_COUNT; i++) {
+            size_t size = MIN_CHUNK << i;
+            vector<char*>& list = free_[i];
+            while(!list.empty() && list.size() * size > maxBytes / CLASS_COUNT) {
+                extra.emplace_back(list.back(), size);
+                list.pop_back();
+            }
+        }
+    }
+    for(auto& e : extra) {
+        allocBytes -= e.second;
+        free(e.first);
+    }
+}
+
+size_t ChunkPool::FreeBytes() {
+    lock_guard<mutex> locker(mtx_);
+    size_t bytes = 0;
+    for(int i = 0; i < CLASS_COUNT; i++) {
+        bytes += free_[i].size() * (MIN_CHUNK << i);
+    }
+    return bytes;
+}
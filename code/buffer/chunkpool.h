@@ -0,0 +1,64 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef CHUNKPOOL_H
+#define CHUNKPOOL_H
+
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <stddef.h>
+
+// 固定大小内存块(4KB、8KB、16KB三种)的全局池，缓冲区的存储都从这里取
+// 每个线程有自己的缓存，取还都不加锁；缓存为空或过多时才与全局空闲链表成批交换
+// 归还的块不清零；全局空闲链表有上限，超出的块还给系统
+class ChunkPool {
+public:
+    static const size_t MIN_CHUNK = 4 * 1024;
+    static const size_t MAX_CHUNK = 16 * 1024;
+    static const int CLASS_COUNT = 3;
+    static const size_t MAX_FREE_BYTES = 64 * 1024 * 1024; // 全局空闲链表默认的上限
+
+    static ChunkPool* Instance();
+
+    // 能容纳len字节的块大小，大于MAX_CHUNK时返回0(由调用方直接向系统申请)
+    static size_t ChunkSize(size_t len);
+
+    // size必须是ChunkSize返回的大小
+    char* Acquire(size_t size);
+    void Release(char* chunk, size_t size);
+
+    // 把当前线程缓存的块全部还给全局空闲链表(线程长时间空闲时调用)
+    void FlushCache();
+    // 全局空闲链表只保留maxBytes(之后也以此为上限)，多出的块还给系统；
+    // maxBytes小于默认上限时各线程的缓存也缩小到BATCH块(在各线程下一次归还时生效)
+    void Trim(size_t maxBytes);
+
+    size_t FreeBytes(); // 全局空闲链表中的字节数(不含线程缓存)
+
+    static std::atomic<uint64_t> allocBytes; // 从系统申请、还没有释放的字节数
+    static std::atomic<uint64_t> inUseBytes; // 正在被缓冲区使用的字节数
+    static std::atomic<uint64_t> acquireCount; // 取块次数
+    static std::atomic<uint64_t> globalCount; // 其中需要访问全局空闲链表或系统的次数
+
+private:
+    ChunkPool() = default;
+
+    static int Class_(size_t size);
+    void Refill_(int cls, std::vector<char*>& cache);
+    void Spill_(int cls, std::vector<char*>& cache, size_t keep);
+
+    std::mutex mtx_;
+    std::vector<char*> free_[CLASS_COUNT];
+    size_t maxFreeBytes_ = MAX_FREE_BYTES;
+    std::atomic<size_t> cacheMax_{CACHE_MAX}; // 每个线程每种大小最多缓存的块数
+
+    static const size_t CACHE_MAX = 64; // 线程缓存默认的块数上限
+    static const size_t BATCH = 16; // 与全局空闲链表一次交换的块数
+
+    friend struct ChunkCache;
+};
+
+#endif //CHUNKPOOL_H
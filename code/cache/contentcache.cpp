@@ -0,0 +1,281 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-04
+ * @copyleft Apache 2.0
+ */
+#include "contentcache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include "../log/stats.h"
+#include "variantcache.h"
+
+using namespace std;
+
+ContentCache::ContentCache() {
+    maxBytes_ = 64 << 20;
+    maxFileSize_ = 256 << 10;
+    inotifyFd_ = -1;
+    hits_ = misses_ = evictions_ = invalidations_ = 0;
+}
+
+ContentCache::~ContentCache() {
+    if(inotifyFd_ >= 0) {
+        close(inotifyFd_);
+    }
+}
+
+const char* ContentCache::PRECOMPRESSED[] = { "br", "zstd", "gzip" };
+
+ContentCache* ContentCache::Instance() {
+    static ContentCache inst;
+    return &inst;
+}
+
+int ContentCache::Init(const string& srcDir, size_t maxBytes, size_t maxFileSize) {
+    maxBytes_ = maxBytes;
+    maxFileSize_ = maxFileSize;
+    Stats::Instance()->Register("content_cache", [this](string& out) { DumpStats(out); });
+    if(inotifyFd_ < 0) {
+        inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(inotifyFd_ < 0) {
+            LOG_ERROR("inotify init error: %s", strerror(errno));
+            return -1;
+        }
+        AddWatch_(srcDir);
+    }
+    return inotifyFd_;
+}
+
+// inotify不能递归监听，逐个目录添加
+void ContentCache::AddWatch_(const string& dir) {
+    string path = dir;
+    if(path.empty() || path.back() != '/') { path += '/'; }
+    int wd = inotify_add_watch(inotifyFd_, path.c_str(),
+                               IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+                               | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF);
+    if(wd < 0) {
+        LOG_WARN("inotify watch %s error: %s", path.c_str(), strerror(errno));
+        return;
+    }
+    watchDir_[wd] = path;
+    DIR* d = opendir(path.c_str());
+    if(!d) { return; }
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            AddWatch_(path + ent->d_name);
+        }
+    }
+    closedir(d);
+}
+
+ContentCache::Shard& ContentCache::ShardOf_(const string& path) {
+    return shards_[hash<string>()(path) % SHARD_NUM];
+}
+
+ContentCache::EntryPtr ContentCache::Get(const string& path) {
+    Shard& shard = ShardOf_(path);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.map.find(path);
+    if(it == shard.map.end()) {
+        misses_++;
+        return nullptr;
+    }
+    hits_++;
+    it->second->ref = true;
+    return it->second;
+}
+
+ContentCache::EntryPtr ContentCache::Load(const string& path, const string& head, const struct stat& st) {
+    if(!S_ISREG(st.st_mode) || (size_t)st.st_size > maxFileSize_
+        || head.size() + st.st_size > maxBytes_ / SHARD_NUM) {
+        return nullptr;
+    }
+    Shard& shard = ShardOf_(path);
+    uint64_t generation;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.map.find(path);
+        if(it != shard.map.end()) {
+            return it->second; // 其他线程已经加载过
+        }
+        generation = shard.generation;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return nullptr;
+    }
+    // 文件和生成实体头时的状态不一致(刚被修改)，不缓存
+    struct stat cur;
+    if(fstat(fd, &cur) < 0 || cur.st_ino != st.st_ino || cur.st_size != st.st_size
+        || cur.st_mtim.tv_sec != st.st_mtim.tv_sec || cur.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+        close(fd);
+        return nullptr;
+    }
+    EntryPtr entry = make_shared<Entry>();
+    entry->path = path;
+    entry->st = cur;
+    entry->headLen = head.size();
+    entry->blockLen = head.size() + cur.st_size;
+    void* block = nullptr;
+    if(posix_memalign(&block, CACHELINE, entry->blockLen) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    entry->block = (char*)block;
+    memcpy(entry->block, head.data(), head.size());
+    size_t done = 0;
+    while(done < (size_t)cur.st_size) {
+        ssize_t len = pread(fd, entry->block + entry->headLen + done, cur.st_size - done, done);
+        if(len <= 0) {
+            close(fd);
+            return nullptr;
+        }
+        done += len;
+    }
+    close(fd);
+    // 在取得generation之后查找，之后预压缩文件的变化会使本次加载或者加载好的条目失效
+    FindSiblings_(*entry);
+
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.generation != generation) {
+        return entry; // 加载期间发生过失效，本次可以使用但不放入缓存
+    }
+    auto it = shard.map.find(path);
+    if(it != shard.map.end()) {
+        return it->second;
+    }
+    Evict_(shard, entry->blockLen, maxBytes_ / SHARD_NUM);
+    entry->slot = shard.ring.size();
+    shard.ring.push_back(entry);
+    shard.map[path] = entry;
+    shard.bytes += entry->blockLen;
+    MemoryBudget::Instance()->Charge(MemoryBudget::CONTENT_CACHE, entry->blockLen);
+    return entry;
+}
+
+void ContentCache::FindSiblings_(Entry& entry) {
+    for(const char* encoding: PRECOMPRESSED) {
+        struct stat st;
+        string sibling = entry.path + VariantCache::Suffix(encoding);
+        // 要求比原文件新，否则是原文件修改之前生成的
+        if(stat(sibling.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime >= entry.st.st_mtime) {
+            entry.siblings.push_back({ encoding, st.st_size });
+        }
+    }
+}
+
+// CLOCK淘汰：指针扫过时钟环，访问位为1的清零给第二次机会，为0的淘汰
+void ContentCache::Evict_(Shard& shard, size_t need, size_t budget) {
+    while(!shard.ring.empty() && shard.bytes + need > budget) {
+        if(shard.hand >= shard.ring.size()) {
+            shard.hand = 0;
+        }
+        EntryPtr& entry = shard.ring[shard.hand];
+        if(entry->ref) {
+            entry->ref = false;
+            shard.hand++;
+        } else {
+            shard.map.erase(entry->path);
+            Remove_(shard, EntryPtr(entry));
+            evictions_++;
+        }
+    }
+}
+
+// 从时钟环中删除：与最后一个交换后弹出，正在发送的响应仍持有shared_ptr，内存不会提前释放
+void ContentCache::Remove_(Shard& shard, const EntryPtr& entry) {
+    size_t slot = entry->slot;
+    assert(slot < shard.ring.size() && shard.ring[slot] == entry);
+    shard.bytes -= entry->blockLen;
+    MemoryBudget::Instance()->Charge(MemoryBudget::CONTENT_CACHE, -(int64_t)entry->blockLen);
+    if(slot != shard.ring.size() - 1) {
+        shard.ring[slot] = shard.ring.back();
+        shard.ring[slot]->slot = slot;
+    }
+    shard.ring.pop_back();
+}
+
+size_t ContentCache::Trim(size_t maxBytes) {
+    // 内存不足时临时收缩，不改变之后加载时的预算
+    size_t freed = 0;
+    for(int i = 0; i < SHARD_NUM; i++) {
+        lock_guard<mutex> locker(shards_[i].mtx);
+        size_t before = shards_[i].bytes;
+        Evict_(shards_[i], 0, maxBytes / SHARD_NUM);
+        freed += before - shards_[i].bytes;
+    }
+    return freed;
+}
+
+void ContentCache::Invalidate(const string& path) {
+    Shard& shard = ShardOf_(path);
+    lock_guard<mutex> locker(shard.mtx);
+    shard.generation++;
+    auto it = shard.map.find(path);
+    if(it == shard.map.end()) {
+        return;
+    }
+    EntryPtr entry = it->second;
+    shard.map.erase(it);
+    Remove_(shard, entry);
+    invalidations_++;
+    LOG_DEBUG("ContentCache invalidate %s", path.c_str());
+}
+
+void ContentCache::HandleNotify() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true) {
+        ssize_t len = read(inotifyFd_, buf, sizeof(buf));
+        if(len <= 0) {
+            break;
+        }
+        for(char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if(ev->mask & IN_IGNORED) {
+                watchDir_.erase(ev->wd);
+                continue;
+            }
+            auto it = watchDir_.find(ev->wd);
+            if(it == watchDir_.end() || ev->len == 0) {
+                continue;
+            }
+            string path = it->second + ev->name;
+            if(ev->mask & IN_ISDIR) {
+                // 新建或移入的子目录也需要监听；目录被移走时其下的文件会在访问时重新stat
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    AddWatch_(path);
+                }
+                continue;
+            }
+            Invalidate(path);
+            // 预压缩文件变化时，原文件条目中记录的状态也失效
+            for(const char* encoding: PRECOMPRESSED) {
+                const char* suffix = VariantCache::Suffix(encoding);
+                size_t len = strlen(suffix);
+                if(path.size() > len && path.compare(path.size() - len, len, suffix) == 0) {
+                    Invalidate(path.substr(0, path.size() - len));
+                }
+            }
+        }
+    }
+}
+
+void ContentCache::DumpStats(string& out) {
+    size_t bytes = 0, entries = 0;
+    for(int i = 0; i < SHARD_NUM; i++) {
+        lock_guard<mutex> locker(shards_[i].mtx);
+        bytes += shards_[i].bytes;
+        entries += shards_[i].map.size();
+    }
+    Stats::Line(out, "content_cache_hits", hits_);
+    Stats::Line(out, "content_cache_misses", misses_);
+    Stats::Line(out, "content_cache_evictions", evictions_);
+    Stats::Line(out, "content_cache_invalidations", invalidations_);
+    Stats::Line(out, "content_cache_entries", entries);
+    Stats::Line(out, "content_cache_bytes", bytes);
+}
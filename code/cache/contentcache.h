@@ -0,0 +1,114 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-04
+ * @copyleft Apache 2.0
+ */
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "../log/log.h"
+#include "../pool/memorybudget.h"
+
+// 热点小文件的内存缓存
+// 每个条目是一块对齐的连续内存：[实体头(Content-type...Content-length)\r\n\r\n][文件内容]
+// 命中时响应只需要状态行+Connection，再接上这一整块，一次writev发送，不经过文件系统
+// 按路径哈希分片加锁，每个分片用CLOCK算法在字节预算内淘汰；通过inotify监听资源目录及时失效
+class ContentCache {
+public:
+    // 加载时存在且不比原文件旧的预压缩文件(例如style.css.gz)
+    struct Sibling {
+        std::string encoding;
+        off_t size;
+    };
+
+    struct Entry {
+        std::string path;
+        struct stat st; // 加载时的文件状态，命中时代替stat()
+        std::vector<Sibling> siblings; // 命中时代替对预压缩文件的stat()，预压缩文件变化时条目同样失效
+        char* block; // 实体头+文件内容，按CACHELINE对齐
+        size_t headLen;
+        size_t blockLen;
+        std::atomic<bool> ref; // CLOCK访问位
+        size_t slot; // 在分片时钟环中的位置
+
+        Entry(): block(nullptr), headLen(0), blockLen(0), ref(false), slot(0) {}
+        ~Entry() { free(block); }
+        const char* Body() const { return block + headLen; }
+        size_t BodyLen() const { return blockLen - headLen; }
+        const Sibling* FindSibling(const std::string& encoding) const {
+            for(const Sibling& sibling: siblings) {
+                if(sibling.encoding == encoding) { return &sibling; }
+            }
+            return nullptr;
+        }
+    };
+    typedef std::shared_ptr<Entry> EntryPtr;
+
+    static ContentCache* Instance();
+
+    // 返回inotify描述符(失败返回-1)，由WebServer加入epoll
+    int Init(const std::string& srcDir, size_t maxBytes = 64 << 20, size_t maxFileSize = 256 << 10);
+
+    EntryPtr Get(const std::string& path);
+
+    // 读入文件，head是响应的实体头(以空行结尾)；st是生成head时的文件状态，文件已变化则放弃
+    // 同时记录同名的预压缩文件
+    EntryPtr Load(const std::string& path, const std::string& head, const struct stat& st);
+
+    // 处理inotify事件(在主线程epoll中可读时调用)
+    void HandleNotify();
+
+    void Invalidate(const std::string& path);
+
+    // 淘汰到总共不超过maxBytes，返回释放的字节数(内存预算紧张时由WebServer调用)
+    size_t Trim(size_t maxBytes);
+
+    size_t MaxFileSize() const { return maxFileSize_; }
+
+    void DumpStats(std::string& out);
+
+private:
+    ContentCache();
+    ~ContentCache();
+
+    static const int SHARD_NUM = 16;
+    static const size_t CACHELINE = 64;
+    static const char* PRECOMPRESSED[]; // 可能有预压缩文件的编码
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, EntryPtr> map;
+        std::vector<EntryPtr> ring; // CLOCK时钟环
+        size_t hand = 0;
+        size_t bytes = 0;
+        uint64_t generation = 0; // 每次失效加一，防止把加载过程中被修改的旧内容放入缓存
+    };
+
+    Shard& ShardOf_(const std::string& path);
+    void Remove_(Shard& shard, const EntryPtr& entry);
+    void Evict_(Shard& shard, size_t need, size_t budget);
+    void AddWatch_(const std::string& dir);
+    void FindSiblings_(Entry& entry); // 查找entry的预压缩文件
+
+    Shard shards_[SHARD_NUM];
+    size_t maxBytes_;
+    size_t maxFileSize_;
+
+    int inotifyFd_;
+    std::unordered_map<int, std::string> watchDir_; // wd -> 目录(以/结尾)
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> evictions_;
+    std::atomic<uint64_t> invalidations_;
+};
+
+#endif //CONTENT_CACHE_H
@@ -0,0 +1,122 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-06
+ * @copyleft Apache 2.0
+ */
+#include "resarchive.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "../log/log.h"
+
+using namespace std;
+
+const char ResArchive::MAGIC[8] = { 'W', 'S', 'P', 'A', 'C', 'K', '0', '1' };
+
+ResArchive::ResArchive() {
+    base_ = nullptr;
+    size_ = 0;
+    index_ = nullptr;
+    strings_ = nullptr;
+    count_ = 0;
+}
+
+ResArchive::~ResArchive() {
+    if(base_) {
+        munmap(base_, size_);
+    }
+}
+
+ResArchive* ResArchive::Instance() {
+    static ResArchive inst;
+    return &inst;
+}
+
+bool ResArchive::Open(const char* path) {
+    assert(path && !base_);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        LOG_ERROR("Open archive %s error: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ArchiveHeader)) {
+        LOG_ERROR("Archive %s too small", path);
+        close(fd);
+        return false;
+    }
+    // 启动时一次性映射并预读，之后的请求不再有文件系统调用
+    void* base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        LOG_ERROR("Mmap archive %s error: %s", path, strerror(errno));
+        return false;
+    }
+    const ArchiveHeader* head = (const ArchiveHeader*)base;
+    size_t size = st.st_size;
+    if(memcmp(head->magic, MAGIC, sizeof(MAGIC)) != 0 || head->version != VERSION
+        || head->fileSize != size || head->indexOffset + head->count * sizeof(ArchiveEntry) > size
+        || head->stringsOffset > size || head->dataOffset > size) {
+        LOG_ERROR("Archive %s is broken or has a wrong version", path);
+        munmap(base, size);
+        return false;
+    }
+    // 逐个检查索引中的偏移，损坏的资源包不能在请求时越界访问
+    const ArchiveEntry* index = (const ArchiveEntry*)((const char*)base + head->indexOffset);
+    for(uint32_t i = 0; i < head->count; i++) {
+        const ArchiveEntry& e = index[i];
+        const ArchiveSlice* slices[] = { &e.data, &e.gzip, &e.br };
+        bool ok = head->stringsOffset + e.pathOff + e.pathLen <= size
+            && head->stringsOffset + e.mimeOff + e.mimeLen <= size
+            && head->stringsOffset + e.etagOff + e.etagLen <= size;
+        for(const ArchiveSlice* slice: slices) {
+            ok = ok && slice->offset <= size && slice->length <= size - slice->offset;
+        }
+        if(!ok) {
+            LOG_ERROR("Archive %s entry %u out of range", path, i);
+            munmap(base, size);
+            return false;
+        }
+    }
+    base_ = (char*)base;
+    size_ = size;
+    count_ = head->count;
+    index_ = (const ArchiveEntry*)(base_ + head->indexOffset);
+    strings_ = base_ + head->stringsOffset;
+    LOG_INFO("Archive %s: %u files, %zu bytes", path, count_, size_);
+    return true;
+}
+
+bool ResArchive::Find(const string& path, File* file) const {
+    if(!base_) {
+        return false;
+    }
+    uint64_t h = Hash(path.data(), path.size());
+    // 索引按哈希排序，二分查找第一个相同哈希，再比较路径处理冲突
+    size_t lo = 0, hi = count_;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(index_[mid].hash < h) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    for(size_t i = lo; i < count_ && index_[i].hash == h; i++) {
+        const ArchiveEntry& e = index_[i];
+        if(e.pathLen != path.size() || memcmp(strings_ + e.pathOff, path.data(), e.pathLen) != 0) {
+            continue;
+        }
+        file->data = base_ + e.data.offset;
+        file->len = e.data.length;
+        file->gzip = Slice_(e.gzip);
+        file->gzipLen = e.gzip.length;
+        file->br = Slice_(e.br);
+        file->brLen = e.br.length;
+        file->mime = String_(e.mimeOff, e.mimeLen);
+        file->etag = String_(e.etagOff, e.etagLen);
+        file->mtime = e.mtime;
+        return true;
+    }
+    return false;
+}
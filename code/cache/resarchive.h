@@ -0,0 +1,102 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-06
+ * @copyleft Apache 2.0
+ */
+#ifndef RES_ARCHIVE_H
+#define RES_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+
+// 资源包：把resources目录打包成一个文件(由tools/packres生成)，启动时整体mmap
+// 请求时按路径哈希二分查找索引，直接从映射区域发送，不需要open/stat
+//
+// 文件布局：
+//   ArchiveHeader
+//   ArchiveEntry[count]   按hash升序
+//   字符串区              路径、MIME、ETag
+//   数据区                每个文件及其压缩版本，按ALIGN对齐
+struct ArchiveHeader {
+    char magic[8]; // "WSPACK01"
+    uint32_t version;
+    uint32_t count; // 文件个数
+    uint64_t indexOffset;
+    uint64_t stringsOffset;
+    uint64_t dataOffset;
+    uint64_t fileSize; // 整个资源包的大小，用于校验
+};
+
+struct ArchiveSlice {
+    uint64_t offset; // 相对文件开头
+    uint64_t length; // 0表示没有
+};
+
+struct ArchiveEntry {
+    uint64_t hash; // 路径的FNV-1a哈希
+    uint32_t pathOff, pathLen; // 字符串区中的偏移，路径以/开头，例如/css/style.css
+    uint32_t mimeOff, mimeLen;
+    uint32_t etagOff, etagLen; // 带引号的强ETag，由内容哈希生成
+    int64_t mtime; // 打包时文件的修改时间
+    ArchiveSlice data; // 原文件
+    ArchiveSlice gzip; // 预压缩版本
+    ArchiveSlice br;
+};
+
+class ResArchive {
+public:
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+    static const size_t ALIGN = 64;
+
+    // 查询结果，指针指向映射区域，整个进程运行期间有效
+    struct File {
+        const char* data;
+        size_t len;
+        const char* gzip;
+        size_t gzipLen;
+        const char* br;
+        size_t brLen;
+        std::string mime;
+        std::string etag;
+        time_t mtime;
+    };
+
+    static ResArchive* Instance();
+
+    bool Open(const char* path);
+    bool IsOpen() const { return base_ != nullptr; }
+
+    // path以/开头；找不到返回false
+    bool Find(const std::string& path, File* file) const;
+
+    size_t Count() const { return count_; }
+
+    static uint64_t Hash(const char* str, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for(size_t i = 0; i < len; i++) {
+            h ^= (unsigned char)str[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+private:
+    ResArchive();
+    ~ResArchive();
+
+    std::string String_(uint32_t off, uint32_t len) const { return std::string(strings_ + off, len); }
+    const char* Slice_(const ArchiveSlice& slice) const {
+        return slice.length ? base_ + slice.offset : nullptr;
+    }
+
+    char* base_; // 映射的起始地址
+    size_t size_;
+    const ArchiveEntry* index_;
+    const char* strings_;
+    uint32_t count_;
+};
+
+#endif //RES_ARCHIVE_H
@@ -0,0 +1,200 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+#include "variantcache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+VariantCache::VariantCache() {
+    maxBytes_ = 32 << 20;
+    maxFileSize_ = 8 << 20;
+    bytes_ = 0;
+}
+
+VariantCache* VariantCache::Instance() {
+    static VariantCache inst;
+    return &inst;
+}
+
+void VariantCache::Init(size_t maxBytes, size_t maxFileSize) {
+    lock_guard<mutex> locker(mtx_);
+    maxBytes_ = maxBytes;
+    maxFileSize_ = maxFileSize;
+    if(!worker_) {
+        worker_.reset(new ThreadPool(1));
+    }
+}
+
+const vector<string>& VariantCache::Encodings() {
+    static const vector<string> encodings = {
+#ifdef USE_BROTLI
+        "br",
+#endif
+#ifdef USE_ZSTD
+        "zstd",
+#endif
+        "gzip",
+    };
+    return encodings;
+}
+
+const char* VariantCache::Suffix(const string& encoding) {
+    if(encoding == "br") { return ".br"; }
+    if(encoding == "zstd") { return ".zst"; }
+    return ".gz";
+}
+
+VariantCache::Variant VariantCache::Get(const string& file, const string& encoding, const string& etag) {
+    lock_guard<mutex> locker(mtx_);
+    auto it = index_.find(file + '\n' + encoding);
+    if(it == index_.end()) {
+        return nullptr;
+    }
+    if(it->second->etag != etag) {
+        /* 文件已经修改，旧的压缩结果作废 */
+        Erase_(it->second);
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->data;
+}
+
+void VariantCache::Submit(const string& file, const string& encoding,
+                          const string& etag, size_t fileSize) {
+    string key = file + '\n' + encoding;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(!worker_ || fileSize == 0 || fileSize > maxFileSize_
+            || index_.count(key) || !pending_.insert(key).second) {
+            return;
+        }
+    }
+    worker_->AddTask(std::bind(&VariantCache::Compress_, this, file, encoding, etag));
+}
+
+size_t VariantCache::Bytes() {
+    lock_guard<mutex> locker(mtx_);
+    return bytes_;
+}
+
+// 运行在后台压缩线程中
+void VariantCache::Compress_(const string& file, const string& encoding, const string& etag) {
+    string key = file + '\n' + encoding;
+    Variant data;
+    int fd = open(file.data(), O_RDONLY);
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* src = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(src != MAP_FAILED) {
+            shared_ptr<string> out = make_shared<string>();
+            // 压缩后没有变小的文件也缓存一个空结果，避免每次请求都重新压缩
+            if(Encode(encoding, (const char*)src, st.st_size, *out) && out->size() < (size_t)st.st_size) {
+                out->shrink_to_fit();
+                data = out;
+            } else {
+                data = make_shared<string>();
+            }
+            munmap(src, st.st_size);
+        }
+    }
+    if(fd >= 0) { close(fd); }
+    if(data) {
+        LOG_DEBUG("Compress %s %s: %d bytes", file.c_str(), encoding.c_str(), (int)data->size());
+        Insert_(key, etag, data);
+    }
+    lock_guard<mutex> locker(mtx_);
+    pending_.erase(key);
+}
+
+void VariantCache::Insert_(const string& key, const string& etag, Variant data) {
+    lock_guard<mutex> locker(mtx_);
+    if(data->size() > maxBytes_) {
+        return;
+    }
+    auto it = index_.find(key);
+    if(it != index_.end()) {
+        Erase_(it->second);
+    }
+    // 超出预算，从最久未使用的一端淘汰
+    while(!lru_.empty() && bytes_ + data->size() > maxBytes_) {
+        Erase_(--lru_.end());
+    }
+    lru_.push_front({ key, etag, data });
+    index_[key] = lru_.begin();
+    bytes_ += data->size();
+    MemoryBudget::Instance()->Charge(MemoryBudget::VARIANT_CACHE, data->size());
+}
+
+void VariantCache::Erase_(list<Entry>::iterator it) {
+    bytes_ -= it->data->size();
+    MemoryBudget::Instance()->Charge(MemoryBudget::VARIANT_CACHE, -(int64_t)it->data->size());
+    index_.erase(it->key);
+    lru_.erase(it);
+}
+
+size_t VariantCache::Trim(size_t maxBytes) {
+    // 内存不足时临时收缩，正在压缩的任务照常完成
+    lock_guard<mutex> locker(mtx_);
+    size_t before = bytes_;
+    while(!lru_.empty() && bytes_ > maxBytes) {
+        Erase_(--lru_.end());
+    }
+    return before - bytes_;
+}
+
+bool VariantCache::Encode(const string& encoding, const char* src, size_t len, string& out) {
+    if(encoding == "gzip") {
+        z_stream zs = { 0 };
+        // windowBits = 15 + 16 输出gzip格式
+        if(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        out.resize(deflateBound(&zs, len));
+        zs.next_in = (Bytef*)src;
+        zs.avail_in = len;
+        zs.next_out = (Bytef*)&out[0];
+        zs.avail_out = out.size();
+        int ret = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return ret == Z_STREAM_END;
+    }
+#ifdef USE_BROTLI
+    if(encoding == "br") {
+        size_t outLen = BrotliEncoderMaxCompressedSize(len);
+        out.resize(outLen);
+        if(!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                                  (const uint8_t*)src, &outLen, (uint8_t*)&out[0])) {
+            return false;
+        }
+        out.resize(outLen);
+        return true;
+    }
+#endif
+#ifdef USE_ZSTD
+    if(encoding == "zstd") {
+        out.resize(ZSTD_compressBound(len));
+        size_t outLen = ZSTD_compress(&out[0], out.size(), src, len, 12);
+        if(ZSTD_isError(outLen)) {
+            return false;
+        }
+        out.resize(outLen);
+        return true;
+    }
+#endif
+    return false;
+}
@@ -0,0 +1,76 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+#ifndef VARIANT_CACHE_H
+#define VARIANT_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../log/log.h"
+#include "../pool/threadpool.h"
+#include "../pool/memorybudget.h"
+
+// 压缩变体缓存：保存静态文件压缩后的结果(gzip/br/zstd)
+// 第一次请求时只提交后台压缩任务，本次仍然发送原文件；压缩完成后的请求直接从内存发送
+// 按字节数限制总容量，超出时按LRU淘汰，同一个文件的同一种编码只压缩一次
+class VariantCache {
+public:
+    typedef std::shared_ptr<const std::string> Variant;
+
+    static VariantCache* Instance();
+
+    void Init(size_t maxBytes = 32 << 20, size_t maxFileSize = 8 << 20);
+
+    // 查找file在encoding下的压缩结果，etag是原文件当前的ETag，不一致说明文件已修改
+    Variant Get(const std::string& file, const std::string& encoding, const std::string& etag);
+
+    // 提交后台压缩任务(已在缓存中或正在压缩时忽略)
+    void Submit(const std::string& file, const std::string& encoding,
+                const std::string& etag, size_t fileSize);
+
+    // 本进程能够现场压缩的编码(按优先级从高到低)
+    static const std::vector<std::string>& Encodings();
+    // 编码对应的预压缩文件后缀，例如gzip -> .gz
+    static const char* Suffix(const std::string& encoding);
+
+    size_t Bytes();
+    // 从最久未使用的一端淘汰到不超过maxBytes，返回释放的字节数
+    size_t Trim(size_t maxBytes);
+
+    // 用指定编码压缩一段数据(离线打包工具也使用)
+    static bool Encode(const std::string& encoding, const char* src, size_t len, std::string& out);
+
+private:
+    VariantCache();
+    ~VariantCache() = default;
+
+    struct Entry {
+        std::string key;
+        std::string etag;
+        Variant data;
+    };
+
+    void Compress_(const std::string& file, const std::string& encoding, const std::string& etag);
+    void Insert_(const std::string& key, const std::string& etag, Variant data);
+    void Erase_(std::list<Entry>::iterator it); // 持有mtx_时调用
+
+    size_t maxBytes_; // 缓存的字节预算
+    size_t maxFileSize_; // 超过这个大小的文件不做现场压缩
+    size_t bytes_; // 当前缓存的字节数
+
+    std::list<Entry> lru_; // 头部是最近使用的
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::unordered_set<std::string> pending_; // 正在压缩的key
+    std::mutex mtx_;
+    std::unique_ptr<ThreadPool> worker_; // 后台压缩线程，不占用处理请求的线程
+};
+
+#endif //VARIANT_CACHE_H
@@ -0,0 +1,198 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-18
+ * @copyleft Apache 2.0
+ */
+#include "asynctask.h"
+
+#ifdef USE_CORO
+
+#include <poll.h>        // poll()
+#include <assert.h>
+#include <mysql/mysql.h>
+
+#include "../log/log.h"
+#include "../pool/threadpool.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/sqlconnRAII.h"
+using namespace std;
+
+atomic<uint64_t> AsyncCall::startCount;
+atomic<uint64_t> AsyncCall::suspendCount;
+atomic<int64_t> AsyncCall::activeCount;
+mutex AsyncCall::timerMtx_;
+vector<pair<AsyncCall::Ptr, int>> AsyncCall::timers_;
+
+static thread_local AsyncCall* current = nullptr;
+static unique_ptr<ThreadPool> workers; // 执行阻塞操作的后台线程
+
+AsyncCall::AsyncCall(int fd, Task<Reply>&& task) : PushTarget(fd), task_(move(task)) {
+    resume_ = task_.GetHandle();
+    want_ = RUNNING;
+    waitFd_ = -1;
+    sleepMs_ = 0;
+    ready_ = false;
+    startCount++;
+    activeCount++;
+}
+
+AsyncCall::~AsyncCall() {
+    activeCount--;
+}
+
+AsyncCall* AsyncCall::Current() {
+    assert(current);
+    return current;
+}
+
+void AsyncCall::SetThreads(size_t threads) {
+    workers.reset(threads > 0 ? new ThreadPool(threads) : nullptr);
+}
+
+void AsyncCall::Resume() {
+    assert(resume_ && want_ != DONE);
+    AsyncCall* prev = current;
+    current = this;
+    want_ = RUNNING;
+    coroutine_handle<> h = resume_;
+    resume_ = nullptr;
+    h.resume(); // 执行到下一个挂起点，等待对象在挂起时设置want_
+    current = prev;
+    if(!task_.Done()) {
+        assert(want_ != RUNNING); // 只能等待Async提供的对象
+        return;
+    }
+    want_ = DONE;
+    try {
+        reply_ = task_.Result();
+    } catch(const exception& e) {
+        LOG_ERROR("Async handler failed: %s", e.what());
+        reply_ = Reply();
+        reply_.code = 500;
+    } catch(...) {
+        LOG_ERROR("Async handler failed");
+        reply_ = Reply();
+        reply_.code = 500;
+    }
+}
+
+void AsyncCall::Suspend(coroutine_handle<> h, Want want, int fd) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        ready_ = false;
+    }
+    resume_ = h;
+    want_ = want;
+    waitFd_ = fd;
+    suspendCount++;
+}
+
+void AsyncCall::SuspendSleep(coroutine_handle<> h, int ms) {
+    Suspend(h, WAIT_EVENT);
+    if(Fd() < 0) {
+        sleepMs_ = ms;
+        return;
+    }
+    // HeapTimer只在主线程中使用，交给主线程登记
+    bool first;
+    {
+        lock_guard<mutex> locker(timerMtx_);
+        first = timers_.empty();
+        timers_.emplace_back(static_pointer_cast<AsyncCall>(shared_from_this()), ms);
+    }
+    if(first) { NotifyReactor_(); }
+}
+
+vector<pair<AsyncCall::Ptr, int>> AsyncCall::TakeTimers() {
+    vector<pair<Ptr, int>> list;
+    lock_guard<mutex> locker(timerMtx_);
+    list.swap(timers_);
+    return list;
+}
+
+void AsyncCall::Offload(coroutine_handle<> h, function<void()>&& work) {
+    Suspend(h, WAIT_EVENT);
+    if(!workers) {
+        work();
+        Complete();
+        return;
+    }
+    // 持有请求，连接中途关闭时协程帧(包括work引用的等待对象)也保持有效
+    Ptr self = static_pointer_cast<AsyncCall>(shared_from_this());
+    workers->AddTask([self, work = move(work)]() {
+        work();
+        self->Complete();
+    });
+}
+
+void AsyncCall::Complete() {
+    bool schedule;
+    {
+        lock_guard<mutex> locker(mtx_);
+        ready_ = true;
+        schedule = !detached_ && Schedule_();
+    }
+    cond_.notify_all();
+    if(schedule) { Notify_(); }
+}
+
+bool AsyncCall::TakeReady() {
+    lock_guard<mutex> locker(mtx_);
+    bool ready = ready_;
+    ready_ = false;
+    return ready;
+}
+
+void AsyncCall::RunBlocking() {
+    while(true) {
+        Resume();
+        if(want_ == DONE) {
+            return;
+        }
+        if(want_ == WAIT_READ || want_ == WAIT_WRITE) {
+            struct pollfd pfd = { waitFd_, (short)(want_ == WAIT_READ ? POLLIN : POLLOUT), 0 };
+            while(poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+            continue;
+        }
+        unique_lock<mutex> locker(mtx_);
+        if(sleepMs_ > 0) {
+            cond_.wait_for(locker, chrono::milliseconds(sleepMs_));
+            sleepMs_ = 0;
+        } else {
+            cond_.wait(locker, [this] { return ready_; });
+        }
+        ready_ = false;
+    }
+}
+
+Async::Offloaded<Async::QueryResult> Async::Query(const string& sql) {
+    return Run([sql]() {
+        QueryResult result;
+        MYSQL* conn;
+        SqlConnRAII guard(&conn, SqlConnPool::Instance());
+        if(!conn) {
+            return result;
+        }
+        if(mysql_query(conn, sql.c_str())) {
+            LOG_WARN("Async query failed: %s", sql.c_str());
+            return result;
+        }
+        result.ok = true;
+        MYSQL_RES* res = mysql_store_result(conn);
+        if(!res) {
+            return result; // 没有结果集的语句(INSERT等)
+        }
+        unsigned int fields = mysql_num_fields(res);
+        while(MYSQL_ROW row = mysql_fetch_row(res)) {
+            vector<string> values(fields);
+            for(unsigned int i = 0; i < fields; i++) {
+                if(row[i]) { values[i] = row[i]; }
+            }
+            result.rows.push_back(move(values));
+        }
+        mysql_free_result(res);
+        return result;
+    });
+}
+
+#endif // USE_CORO
@@ -0,0 +1,220 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-18
+ * @copyleft Apache 2.0
+ */
+#ifndef ASYNC_TASK_H
+#define ASYNC_TASK_H
+
+// 协程形式的异步处理函数，需要C++20(make CORO=1)
+#ifdef USE_CORO
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include "pushtarget.h"
+
+// 异步处理函数的响应
+struct Reply {
+    int code = 200;
+    std::string type = "text/html";
+    std::string body;
+};
+
+// 惰性启动的协程：创建时不执行，第一次被co_await(或由AsyncCall恢复)时才开始
+// 在另一个协程中co_await时挂起调用方、执行本协程，本协程结束时直接转回调用方(对称转移，不增长栈)
+template<typename T>
+class Task {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(Handle h) noexcept {
+            std::coroutine_handle<> caller = h.promise().continuation;
+            return caller ? caller : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation; // co_await本协程的调用方，最外层为空
+
+        Task get_return_object() { return Task(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        template<typename U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task(Task&& other) noexcept : h_(other.h_) { other.h_ = nullptr; }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if(h_) { h_.destroy(); } }
+
+    bool await_ready() const noexcept { return h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        h_.promise().continuation = caller;
+        return h_;
+    }
+    T await_resume() { return Result(); }
+
+    Handle GetHandle() const { return h_; }
+    bool Done() const { return h_.done(); }
+    // 协程中未捕获的异常在这里重新抛出
+    T Result() {
+        if(h_.promise().error) { std::rethrow_exception(h_.promise().error); }
+        return std::move(*h_.promise().value);
+    }
+
+private:
+    explicit Task(Handle h) : h_(h) {}
+    Handle h_;
+};
+
+// 一个进行中的异步请求：持有最外层的协程，记录它挂起时在等什么
+// 连接用EPOLLONESHOT登记，协程只在持有连接的线程中恢复：等待fd时fd带着连接的fd登记到epoll，
+// 等待事件(定时器、后台任务)时连接以PushTarget的方式登记，事件到达后经eventfd唤醒reactor，
+// 再分发给工作线程继续执行；挂起期间不占用任何线程
+class AsyncCall : public PushTarget {
+public:
+    typedef std::shared_ptr<AsyncCall> Ptr;
+
+    enum Want {
+        RUNNING,
+        WAIT_READ, // 等待fd可读
+        WAIT_WRITE, // 等待fd可写
+        WAIT_EVENT, // 等待Complete
+        DONE,
+    };
+
+    // fd为连接的fd；-1表示没有连接(HTTP/2的流)，用RunBlocking执行
+    AsyncCall(int fd, Task<Reply>&& task);
+    ~AsyncCall() override;
+
+    // 从挂起点继续执行，直到再次挂起或结束
+    void Resume();
+    // 等待的事件已经到达，可以在任何线程调用
+    void Complete();
+    // 等待事件时：事件是否已经到达(取走)，没有到达时不应恢复
+    bool TakeReady();
+    // 在当前线程执行到结束，等待期间阻塞
+    void RunBlocking();
+
+    Want GetWant() const { return want_; }
+    int WaitFd() const { return waitFd_; }
+    // 结束后的响应，协程抛出异常时为500
+    Reply& GetReply() { return reply_; }
+
+    bool Heartbeat() override { return true; }
+
+    // 当前线程正在执行的请求(协程内部的等待对象使用)
+    static AsyncCall* Current();
+
+    /* 等待对象挂起时调用 */
+    void Suspend(std::coroutine_handle<> h, Want want, int fd = -1);
+    // 等待ms毫秒：由服务器的定时器计时(主线程)，没有连接时在当前线程等待
+    void SuspendSleep(std::coroutine_handle<> h, int ms);
+    // 在后台线程执行阻塞的操作(如数据库查询)，完成后Complete
+    void Offload(std::coroutine_handle<> h, std::function<void()>&& work);
+
+    // 后台线程数(在Start之前调用)，0表示阻塞操作直接在工作线程中执行
+    static void SetThreads(size_t threads);
+    // 主线程：取出等待登记的定时器
+    static std::vector<std::pair<Ptr, int>> TakeTimers();
+
+    static std::atomic<uint64_t> startCount; // 启动的异步请求数
+    static std::atomic<uint64_t> suspendCount; // 挂起次数
+    static std::atomic<int64_t> activeCount; // 进行中的异步请求数
+
+private:
+    bool Pending_() const override { return ready_; }
+
+    Task<Reply> task_;
+    std::coroutine_handle<> resume_; // 下一次要恢复的协程(最内层的挂起点)
+    Want want_;
+    int waitFd_;
+    int sleepMs_; // 没有连接时的等待时间
+    bool ready_; // 受mtx_保护
+    std::condition_variable cond_; // 没有连接时等待Complete
+    Reply reply_;
+
+    static std::mutex timerMtx_;
+    static std::vector<std::pair<Ptr, int>> timers_;
+};
+
+// 协程中使用的等待对象
+class Async {
+public:
+    struct Sleeper {
+        int ms;
+        bool await_ready() const noexcept { return ms <= 0; }
+        void await_suspend(std::coroutine_handle<> h) { AsyncCall::Current()->SuspendSleep(h, ms); }
+        void await_resume() const noexcept {}
+    };
+
+    struct FdWaiter {
+        int fd;
+        bool write;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            AsyncCall::Current()->Suspend(h, write ? AsyncCall::WAIT_WRITE : AsyncCall::WAIT_READ, fd);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    // 在后台线程执行fn，co_await的结果是fn的返回值(fn的异常在co_await处抛出)
+    template<typename R>
+    struct Offloaded {
+        std::function<R()> fn;
+        std::optional<R> result;
+        std::exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            AsyncCall::Current()->Offload(h, [this]() {
+                try {
+                    result.emplace(fn());
+                } catch(...) {
+                    error = std::current_exception();
+                }
+            });
+        }
+        R await_resume() {
+            if(error) { std::rethrow_exception(error); }
+            return std::move(*result);
+        }
+    };
+
+    struct QueryResult {
+        bool ok = false;
+        std::vector<std::vector<std::string>> rows; // NULL为空串
+    };
+
+    static Sleeper Sleep(int ms) { return { ms }; }
+    // 等待fd就绪(例如自己建立的上游连接)；fd在连接的epoll中登记为单次触发
+    static FdWaiter Readable(int fd) { return { fd, false }; }
+    static FdWaiter Writable(int fd) { return { fd, true }; }
+
+    template<typename F>
+    static Offloaded<decltype(std::declval<F>()())> Run(F&& fn) {
+        return { std::forward<F>(fn) };
+    }
+    // 从连接池取一个连接执行sql
+    static Offloaded<QueryResult> Query(const std::string& sql);
+};
+
+#endif // USE_CORO
+
+#endif //ASYNC_TASK_H
@@ -0,0 +1,36 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+// 标准Base64编码(带=填充)，WebSocket握手的Sec-WebSocket-Accept和Basic认证共用
+
+inline std::string Base64(const void* src, size_t len) {
+    static const char TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t* data = static_cast<const uint8_t*>(src);
+    std::string out;
+    out.reserve((len + 2) / 3 * 4);
+    for(size_t i = 0; i < len; i += 3) {
+        uint32_t v = data[i] << 16;
+        if(i + 1 < len) { v |= data[i + 1] << 8; }
+        if(i + 2 < len) { v |= data[i + 2]; }
+        out.push_back(TABLE[(v >> 18) & 63]);
+        out.push_back(TABLE[(v >> 12) & 63]);
+        out.push_back(i + 1 < len ? TABLE[(v >> 6) & 63] : '=');
+        out.push_back(i + 2 < len ? TABLE[v & 63] : '=');
+    }
+    return out;
+}
+
+inline std::string Base64(const std::string& in) {
+    return Base64(in.data(), in.size());
+}
+
+#endif //BASE64_H
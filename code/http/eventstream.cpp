@@ -0,0 +1,181 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-14
+ * @copyleft Apache 2.0
+ */
+#include "eventstream.h"
+using namespace std;
+
+std::unordered_map<std::string, std::unique_ptr<EventStream::Topic>> EventStream::TOPICS;
+const EventStream::Event EventStream::HEARTBEAT = std::make_shared<const std::string>(": ping\n\n");
+std::atomic<int> EventStream::subscriberCount;
+std::atomic<uint64_t> EventStream::publishCount;
+std::atomic<uint64_t> EventStream::deliverCount;
+std::atomic<uint64_t> EventStream::coalesceCount;
+std::atomic<uint64_t> EventStream::dropCount;
+
+void EventStream::Register(const string& topic, Policy policy) {
+    unique_ptr<Topic> t(new Topic());
+    t->policy = policy;
+    TOPICS[topic] = move(t);
+}
+
+bool EventStream::IsTopic(const string& path) {
+    return TOPICS.count(path) > 0;
+}
+
+EventStream::Event EventStream::Serialize(const string& data, const string& event, const string& id) {
+    string out;
+    out.reserve(data.size() + event.size() + id.size() + 32);
+    if(!event.empty()) { out += "event: " + event + "\n"; }
+    if(!id.empty()) { out += "id: " + id + "\n"; }
+    size_t begin = 0;
+    do {
+        size_t end = data.find('\n', begin);
+        if(end == string::npos) { end = data.size(); }
+        out += "data: ";
+        out.append(data, begin, end - begin);
+        out += '\n';
+        begin = end + 1;
+    } while(begin <= data.size());
+    out += '\n';
+    return std::make_shared<const string>(move(out));
+}
+
+size_t EventStream::Publish(const string& topic, const string& data, const string& event, const string& id) {
+    return Publish(topic, Serialize(data, event, id));
+}
+
+size_t EventStream::Publish(const string& topic, const Event& event) {
+    auto it = TOPICS.find(topic);
+    if(it == TOPICS.end()) {
+        return 0;
+    }
+    Topic& t = *it->second;
+    publishCount++;
+    // 需要唤醒的订阅者，容量在多次广播之间复用
+    static thread_local vector<PushTarget::Ptr> wake;
+    size_t cnt = 0;
+    {
+        lock_guard<mutex> locker(t.mtx);
+        for(EventStream* sub: t.subscribers) {
+            bool notify;
+            {
+                lock_guard<mutex> subLocker(sub->mtx_);
+                if(!sub->Push_(event, t.policy)) { continue; }
+                notify = sub->Schedule_();
+            }
+            cnt++;
+            if(notify) { wake.push_back(sub->shared_from_this()); }
+        }
+    }
+    deliverCount += cnt;
+    Notify_(wake); // 整批加入唤醒列表，只写一次eventfd
+    return cnt;
+}
+
+EventStream::Ptr EventStream::Subscribe(const string& topic, int fd) {
+    auto it = TOPICS.find(topic);
+    assert(it != TOPICS.end());
+    Topic* t = it->second.get();
+    Ptr sub(new EventStream(t, fd));
+    lock_guard<mutex> locker(t->mtx);
+    sub->index_ = t->subscribers.size();
+    t->subscribers.push_back(sub.get());
+    return sub;
+}
+
+EventStream::EventStream(Topic* topic, int fd): PushTarget(fd) {
+    topic_ = topic;
+    index_ = 0;
+    queue_.resize(QUEUE_SIZE);
+    inflight_.reserve(QUEUE_SIZE);
+    head_ = 0;
+    count_ = 0;
+    dropped_ = false;
+    subscriberCount++;
+}
+
+EventStream::~EventStream() {
+    Detach();
+    subscriberCount--;
+}
+
+void EventStream::OnDetach_() {
+    lock_guard<mutex> locker(topic_->mtx);
+    vector<EventStream*>& subs = topic_->subscribers;
+    assert(index_ < subs.size() && subs[index_] == this);
+    subs[index_] = subs.back();
+    subs[index_]->index_ = index_;
+    subs.pop_back();
+}
+
+bool EventStream::Push_(const Event& event, Policy policy) {
+    if(detached_ || dropped_) {
+        return false;
+    }
+    if(count_ == queue_.size()) {
+        if(policy == DROP) {
+            // 不再接收事件，唤醒后由IsClosing()关闭连接
+            dropped_ = true;
+            dropCount++;
+            return true;
+        }
+        // 最旧的事件所在的位置就是队尾，覆盖后队头后移
+        queue_[head_] = event;
+        head_ = (head_ + 1) % queue_.size();
+        coalesceCount++;
+        return true;
+    }
+    queue_[(head_ + count_) % queue_.size()] = event;
+    count_++;
+    return true;
+}
+
+bool EventStream::Heartbeat() {
+    bool notify;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(detached_ || dropped_) {
+            return false;
+        }
+        if(count_ > 0) {
+            return true; // 已经有数据要发送
+        }
+        Push_(HEARTBEAT, COALESCE);
+        notify = Schedule_();
+    }
+    if(notify) {
+        Notify_();
+    }
+    return true;
+}
+
+bool EventStream::Fill(Buffer& out, vector<struct iovec>& iov, bool copy) {
+    inflight_.clear(); // 上一批已经写完，释放对共享缓冲的引用
+    iov.clear();
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(dropped_) {
+            return false;
+        }
+        while(count_ > 0) {
+            inflight_.push_back(move(queue_[head_]));
+            head_ = (head_ + 1) % queue_.size();
+            count_--;
+        }
+    }
+    if(inflight_.empty()) {
+        return false;
+    }
+    iov.push_back({ nullptr, 0 }); // 占位，最后指向out
+    for(const Event& event: inflight_) {
+        if(copy) {
+            out.Append(event->data(), event->size());
+        } else {
+            iov.push_back({ const_cast<char*>(event->data()), event->size() });
+        }
+    }
+    iov[0] = { const_cast<char*>(out.Peek()), out.ReadableBytes() };
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-14
+ * @copyleft Apache 2.0
+ */
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/uio.h>     // iovec
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "pushtarget.h"
+
+// Server-Sent Events：GET已注册的主题路径后连接成为订阅者，响应体是持续推送的text/event-stream
+// 每个事件只序列化一次，放在引用计数的共享缓冲中；广播时只把引用排入每个订阅者的定长环形队列，
+// 发送时iov直接指向共享缓冲，一个事件推送给任意多的订阅者都没有拷贝和逐个的内存分配
+// 队列满(对端读得慢)时按主题的策略丢弃最旧的事件或断开订阅者，写缓冲不会无限增长
+class EventStream : public PushTarget {
+public:
+    typedef std::shared_ptr<const std::string> Event; // 序列化好的事件，所有订阅者共享
+    typedef std::shared_ptr<EventStream> Ptr;
+
+    enum Policy {
+        COALESCE, // 队列满时丢弃最旧的未发送事件，只保留最新的QUEUE_SIZE个
+        DROP, // 队列满时断开订阅者，由客户端重连(EventSource会自动重连)
+    };
+
+    // 注册主题(仅在启动时调用)，主题名就是订阅的路径
+    static void Register(const std::string& topic, Policy policy = COALESCE);
+    static bool IsTopic(const std::string& path);
+
+    /* 任意线程调用，返回收到事件的订阅者数 */
+    static size_t Publish(const std::string& topic, const std::string& data,
+                          const std::string& event = "", const std::string& id = "");
+    static size_t Publish(const std::string& topic, const Event& event);
+    // 按event-stream格式序列化：多行data拆成多个data字段，以空行结束
+    static Event Serialize(const std::string& data, const std::string& event = "", const std::string& id = "");
+
+    // 订阅topic(必须已注册)，连接关闭时Detach取消订阅
+    static Ptr Subscribe(const std::string& topic, int fd);
+    ~EventStream() override;
+
+    /* 处理该连接的工作线程调用 */
+    // 取出排队的事件：copy为false时iov指向共享缓冲，否则拷贝到out(用户态TLS)；iov[0]总是out
+    // 只能在上一批全部写出后调用，上一批事件的引用在这里释放
+    bool Fill(Buffer& out, std::vector<struct iovec>& iov, bool copy);
+    bool IsClosing() const { return dropped_; }
+
+    // 空闲时发送注释行，避免代理因为长时间没有数据而断开
+    bool Heartbeat() override;
+
+    /* 统计 */
+    static std::atomic<int> subscriberCount;
+    static std::atomic<uint64_t> publishCount; // 发布的事件数
+    static std::atomic<uint64_t> deliverCount; // 排入订阅者队列的次数
+    static std::atomic<uint64_t> coalesceCount; // 队列满而丢弃的事件数
+    static std::atomic<uint64_t> dropCount; // 队列满而断开的订阅者数
+
+    static const size_t QUEUE_SIZE = 64; // 每个订阅者最多排队的事件数
+
+private:
+    struct Topic {
+        Policy policy;
+        std::mutex mtx; // 保护subscribers，广播时先持有它再持有订阅者的mtx_
+        std::vector<EventStream*> subscribers; // 连续存放，取消订阅时用最后一个填补空位
+    };
+
+    EventStream(Topic* topic, int fd);
+
+    bool Pending_() const override { return count_ > 0 || dropped_; }
+    void OnDetach_() override; // 从主题中移除
+    bool Push_(const Event& event, Policy policy); // 持有mtx_时调用，返回false表示已经关闭
+
+    Topic* topic_;
+    size_t index_; // 在topic_->subscribers中的下标，由topic_->mtx保护
+
+    // 环形队列，由mtx_保护；容量在订阅时一次分配
+    std::vector<Event> queue_;
+    size_t head_;
+    size_t count_;
+    std::atomic<bool> dropped_;
+
+    std::vector<Event> inflight_; // 正在发送的一批事件，写完之前保持引用
+
+    static std::unordered_map<std::string, std::unique_ptr<Topic>> TOPICS;
+    static const Event HEARTBEAT;
+};
+
+#endif //EVENT_STREAM_H
@@ -0,0 +1,449 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-12
+ * @copyleft Apache 2.0
+ */
+#include "hpack.h"
+#include <array>
+using namespace std;
+
+// RFC 7541 附录A
+const Hpack::Entry Hpack::STATIC_TABLE[STATIC_SIZE] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+// RFC 7541 附录B，下标是字节值，EOS(0x3fffffff, 30位)单独处理
+static const uint32_t HUFFMAN_CODES[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+static const uint8_t HUFFMAN_BITS[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+static const uint32_t HUFFMAN_EOS = 0x3fffffff;
+static const uint8_t HUFFMAN_EOS_BITS = 30;
+
+// Huffman解码树：非负数是内部节点的下标，负数是叶子(-(符号+1))，0表示没有子节点(根不会是子节点)
+typedef vector<array<int32_t, 2>> HuffmanTree;
+
+static void AddCode(HuffmanTree& tree, uint32_t code, uint8_t bits, int32_t sym) {
+    size_t node = 0;
+    for(int i = bits - 1; i >= 0; i--) {
+        int b = (code >> i) & 1;
+        if(i == 0) {
+            tree[node][b] = -(sym + 1);
+            break;
+        }
+        if(tree[node][b] == 0) {
+            tree[node][b] = (int32_t)tree.size();
+            tree.push_back({ 0, 0 });
+        }
+        node = tree[node][b];
+    }
+}
+
+static const HuffmanTree& DecodeTree() {
+    static const HuffmanTree tree = [] {
+        HuffmanTree t(1, { 0, 0 });
+        for(int i = 0; i < 256; i++) {
+            AddCode(t, HUFFMAN_CODES[i], HUFFMAN_BITS[i], i);
+        }
+        AddCode(t, HUFFMAN_EOS, HUFFMAN_EOS_BITS, 256);
+        return t;
+    }();
+    return tree;
+}
+
+// 每个响应都不同的头部，放进动态表只会挤掉有用的项
+static bool IsVolatile(const string& name) {
+    return name == "content-length" || name == "content-range" || name == "etag" ||
+           name == "last-modified" || name == "date" || name == "set-cookie";
+}
+
+Hpack::Hpack(size_t maxTableSize) {
+    tableSize_ = 0;
+    maxTableSize_ = maxTableSize;
+    limit_ = maxTableSize;
+    pendingUpdate_ = false;
+    minUpdate_ = maxTableSize;
+}
+
+const Hpack::Entry* Hpack::Lookup_(size_t index) const {
+    if(index == 0) {
+        return nullptr;
+    }
+    if(index <= STATIC_SIZE) {
+        return &STATIC_TABLE[index - 1];
+    }
+    index -= STATIC_SIZE + 1;
+    return index < dynamic_.size() ? &dynamic_[index] : nullptr;
+}
+
+void Hpack::Insert_(const string& name, const string& value) {
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    // 比整个表还大的项会清空动态表，自己也不插入
+    if(size > maxTableSize_) {
+        dynamic_.clear();
+        tableSize_ = 0;
+        return;
+    }
+    dynamic_.push_front({ name, value });
+    tableSize_ += size;
+    Evict_();
+}
+
+void Hpack::Evict_() {
+    while(tableSize_ > maxTableSize_ && !dynamic_.empty()) {
+        const Entry& e = dynamic_.back();
+        tableSize_ -= e.name.size() + e.value.size() + ENTRY_OVERHEAD;
+        dynamic_.pop_back();
+    }
+}
+
+int Hpack::Find_(const string& name, const string& value) const {
+    int nameIdx = 0;
+    for(size_t i = 0; i < STATIC_SIZE; i++) {
+        if(STATIC_TABLE[i].name != name) { continue; }
+        if(STATIC_TABLE[i].value == value) { return i + 1; }
+        if(nameIdx == 0) { nameIdx = i + 1; }
+    }
+    for(size_t i = 0; i < dynamic_.size(); i++) {
+        if(dynamic_[i].name != name) { continue; }
+        if(dynamic_[i].value == value) { return STATIC_SIZE + i + 1; }
+        if(nameIdx == 0) { nameIdx = STATIC_SIZE + i + 1; }
+    }
+    return -nameIdx;
+}
+
+bool Hpack::DecodeInt_(const uint8_t*& p, const uint8_t* end, int prefix, size_t* value) {
+    if(p >= end) {
+        return false;
+    }
+    size_t max = (1u << prefix) - 1;
+    size_t v = *p++ & max;
+    if(v == max) {
+        int shift = 0;
+        uint8_t b;
+        do {
+            // 超过28位的整数在这里没有意义，当作错误防止溢出
+            if(p >= end || shift > 21) {
+                return false;
+            }
+            b = *p++;
+            v += (size_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while(b & 0x80);
+    }
+    *value = v;
+    return true;
+}
+
+bool Hpack::DecodeString_(const uint8_t*& p, const uint8_t* end, string& str) {
+    if(p >= end) {
+        return false;
+    }
+    bool huffman = *p & 0x80;
+    size_t len;
+    if(!DecodeInt_(p, end, 7, &len) || len > (size_t)(end - p)) {
+        return false;
+    }
+    str.clear();
+    if(huffman) {
+        if(!HuffmanDecode_(p, len, str)) {
+            return false;
+        }
+    } else {
+        str.assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+bool Hpack::HuffmanDecode_(const uint8_t* p, size_t len, string& str) {
+    const HuffmanTree& tree = DecodeTree();
+    size_t node = 0;
+    int bits = 0; // 当前符号已经读了几位
+    bool ones = true; // 这几位是否全是1(只能是EOS的前缀，作为填充)
+    for(size_t i = 0; i < len; i++) {
+        for(int j = 7; j >= 0; j--) {
+            int b = (p[i] >> j) & 1;
+            int32_t next = tree[node][b];
+            if(next < 0) {
+                if(next == -257) {
+                    return false; // 出现EOS
+                }
+                str.push_back((char)(-next - 1));
+                node = 0;
+                bits = 0;
+                ones = true;
+            } else if(next == 0) {
+                return false;
+            } else {
+                node = next;
+                bits++;
+                ones = ones && b;
+            }
+        }
+    }
+    // 填充不能超过7位，而且必须是EOS的高位(全1)
+    return bits <= 7 && ones;
+}
+
+bool Hpack::Decode(const uint8_t* data, size_t len, vector<Header>& headers) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    size_t listSize = 0;
+    bool first = true;
+    headers.clear();
+    while(p < end) {
+        uint8_t b = *p;
+        size_t index;
+        if(b & 0x80) {
+            /* 索引 */
+            const Entry* e;
+            if(!DecodeInt_(p, end, 7, &index) || !(e = Lookup_(index))) {
+                return false;
+            }
+            headers.emplace_back(e->name, e->value);
+        }
+        else if((b & 0xe0) == 0x20) {
+            /* 动态表大小更新，只能出现在头部块开头 */
+            if(!first || !DecodeInt_(p, end, 5, &index) || index > limit_) {
+                return false;
+            }
+            maxTableSize_ = index;
+            Evict_();
+            continue;
+        }
+        else {
+            /* 字面值：增量索引(01)、不索引(0000)、永不索引(0001) */
+            bool indexing = (b & 0xc0) == 0x40;
+            string name, value;
+            if(!DecodeInt_(p, end, indexing ? 6 : 4, &index)) {
+                return false;
+            }
+            if(index > 0) {
+                const Entry* e = Lookup_(index);
+                if(!e) {
+                    return false;
+                }
+                name = e->name;
+            } else if(!DecodeString_(p, end, name)) {
+                return false;
+            }
+            if(!DecodeString_(p, end, value)) {
+                return false;
+            }
+            if(indexing) {
+                Insert_(name, value);
+            }
+            headers.emplace_back(move(name), move(value));
+        }
+        first = false;
+        const Header& h = headers.back();
+        listSize += h.first.size() + h.second.size() + ENTRY_OVERHEAD;
+        if(listSize > MAX_HEADER_LIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Hpack::EncodeInt_(string& out, uint8_t flags, int prefix, size_t value) {
+    size_t max = (1u << prefix) - 1;
+    if(value < max) {
+        out.push_back((char)(flags | value));
+        return;
+    }
+    out.push_back((char)(flags | max));
+    value -= max;
+    while(value >= 0x80) {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+size_t Hpack::HuffmanLen_(const string& str) {
+    size_t bits = 0;
+    for(unsigned char c: str) {
+        bits += HUFFMAN_BITS[c];
+    }
+    return (bits + 7) / 8;
+}
+
+void Hpack::EncodeString_(string& out, const string& str) {
+    // 只有变短时才用Huffman编码
+    size_t len = HuffmanLen_(str);
+    if(len >= str.size()) {
+        EncodeInt_(out, 0, 7, str.size());
+        out += str;
+        return;
+    }
+    EncodeInt_(out, 0x80, 7, len);
+    uint64_t acc = 0;
+    int bits = 0;
+    for(unsigned char c: str) {
+        acc = (acc << HUFFMAN_BITS[c]) | HUFFMAN_CODES[c];
+        bits += HUFFMAN_BITS[c];
+        while(bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    if(bits > 0) {
+        // 用EOS的高位(全1)填充最后一个字节
+        out.push_back((char)((acc << (8 - bits)) | (0xff >> bits)));
+    }
+}
+
+void Hpack::SetMaxTableSize(size_t size) {
+    // 对端允许更大的表也只用默认大小，限制每个连接的内存
+    size = min(size, (size_t)DEFAULT_TABLE_SIZE);
+    if(size == maxTableSize_ && !pendingUpdate_) {
+        return;
+    }
+    minUpdate_ = pendingUpdate_ ? min(minUpdate_, size) : size;
+    limit_ = size;
+    maxTableSize_ = size;
+    pendingUpdate_ = true;
+    Evict_();
+}
+
+void Hpack::Encode(const vector<Header>& headers, string& out) {
+    if(pendingUpdate_) {
+        // 上限先缩小再扩大时两次都要通知，对端才会驱逐相应的项
+        if(minUpdate_ < maxTableSize_) {
+            EncodeInt_(out, 0x20, 5, minUpdate_);
+        }
+        EncodeInt_(out, 0x20, 5, maxTableSize_);
+        pendingUpdate_ = false;
+    }
+    for(const Header& h: headers) {
+        int idx = Find_(h.first, h.second);
+        if(idx > 0) {
+            EncodeInt_(out, 0x80, 7, idx);
+            continue;
+        }
+        bool indexing = !IsVolatile(h.first);
+        if(indexing) {
+            EncodeInt_(out, 0x40, 6, -idx);
+        } else {
+            EncodeInt_(out, 0x00, 4, -idx);
+        }
+        if(idx == 0) {
+            EncodeString_(out, h.first);
+        }
+        EncodeString_(out, h.second);
+        if(indexing) {
+            Insert_(h.first, h.second);
+        }
+    }
+}
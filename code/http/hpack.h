@@ -0,0 +1,66 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-12
+ * @copyleft Apache 2.0
+ */
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdint.h>
+
+// HTTP/2头部压缩(RFC 7541)：静态表+动态表+Huffman编码
+// 每个方向各用一个对象：解码对端的头部块，或者编码自己的响应头，两个方向的动态表互相独立
+class Hpack {
+public:
+    typedef std::pair<std::string, std::string> Header; // 名称(小写)-值
+
+    explicit Hpack(size_t maxTableSize = DEFAULT_TABLE_SIZE);
+
+    // 解码一个完整的头部块(HEADERS+CONTINUATION拼接后)，压缩错误返回false，此时连接必须关闭
+    bool Decode(const uint8_t* data, size_t len, std::vector<Header>& headers);
+
+    // 编码头部块追加到out；content-length、etag等每个响应都不同的头部不进入动态表
+    void Encode(const std::vector<Header>& headers, std::string& out);
+
+    // 编码端：对端通过SETTINGS_HEADER_TABLE_SIZE限制动态表大小，下一个头部块开头发送大小更新
+    void SetMaxTableSize(size_t size);
+
+    static const size_t DEFAULT_TABLE_SIZE = 4096;
+    static const size_t MAX_HEADER_LIST = 64 * 1024; // 解码后头部总大小的上限
+
+private:
+    struct Entry {
+        std::string name;
+        std::string value;
+    };
+
+    const Entry* Lookup_(size_t index) const; // 1开始，先静态表后动态表
+    void Insert_(const std::string& name, const std::string& value);
+    void Evict_();
+    // 查找完全匹配(返回正数)或只有名称匹配(返回负数)的索引，都没有返回0
+    int Find_(const std::string& name, const std::string& value) const;
+
+    static bool DecodeInt_(const uint8_t*& p, const uint8_t* end, int prefix, size_t* value);
+    static bool DecodeString_(const uint8_t*& p, const uint8_t* end, std::string& str);
+    static bool HuffmanDecode_(const uint8_t* p, size_t len, std::string& str);
+    static void EncodeInt_(std::string& out, uint8_t flags, int prefix, size_t value);
+    static void EncodeString_(std::string& out, const std::string& str);
+    static size_t HuffmanLen_(const std::string& str);
+
+    std::deque<Entry> dynamic_; // 最新插入的在前面
+    size_t tableSize_; // 动态表当前大小(每项长度+32)
+    size_t maxTableSize_; // 动态表当前上限
+    size_t limit_; // SETTINGS允许的上限，大小更新不能超过它
+    bool pendingUpdate_; // 编码端：下一个头部块需要先发送大小更新
+    size_t minUpdate_; // 两个头部块之间上限缩小到的最小值，需要先通知
+
+    static const size_t STATIC_SIZE = 61;
+    static const size_t ENTRY_OVERHEAD = 32;
+    static const Entry STATIC_TABLE[STATIC_SIZE];
+};
+
+#endif //HPACK_H
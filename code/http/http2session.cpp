@@ -0,0 +1,741 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-12
+ * @copyleft Apache 2.0
+ */
+#include "http2session.h"
+using namespace std;
+
+const char* Http2Session::PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t Http2Session::PREFACE_LEN; // min()按引用取参数，需要类外的定义
+std::atomic<uint64_t> Http2Session::sessionCount;
+std::atomic<uint64_t> Http2Session::streamCount;
+std::atomic<uint64_t> Http2Session::resetCount;
+std::atomic<uint64_t> Http2Session::goawayCount;
+
+Http2Session::Http2Session(const char* srcDir, const sockaddr_in& peer, bool tls) {
+    srcDir_ = srcDir;
+    peer_ = peer;
+    tls_ = tls;
+    lastStreamId_ = 0;
+    nextRound_ = 0;
+    prefaceDone_ = false;
+    goaway_ = false;
+    error_ = false;
+    headerStream_ = 0;
+    headerEndStream_ = false;
+    connWindow_ = DEFAULT_WINDOW;
+    peerInitialWindow_ = DEFAULT_WINDOW;
+    peerMaxFrame_ = MAX_FRAME;
+    // 服务端的第一个帧必须是SETTINGS，其余参数使用默认值
+    char settings[6];
+    settings[0] = 0;
+    settings[1] = MAX_CONCURRENT_STREAMS;
+    Put32_(settings + 2, MAX_STREAMS);
+    AppendFrame_(ctrl_, SETTINGS, 0, 0, settings, sizeof(settings));
+    sessionCount++;
+}
+
+Http2Session::~Http2Session() = default;
+
+bool Http2Session::IsPreface(const char* data, size_t len) {
+    // "PRI "不是合法的HTTP/1.x方法，看到它就可以确定是HTTP/2
+    return len >= 4 && memcmp(data, PREFACE, min(len, PREFACE_LEN)) == 0;
+}
+
+bool Http2Session::Upgrade(const HttpRequest& request, const string& settings) {
+    string payload;
+    if(!Base64UrlDecode_(settings, payload) || payload.size() % 6 != 0 ||
+       !ApplySettings_((const uint8_t*)payload.data(), payload.size())) {
+        return false;
+    }
+    // 101之后紧接着是服务端的SETTINGS，然后才是流1的响应
+    ctrl_.insert(0, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    StreamPtr s(new Stream);
+    s->id = 1;
+    s->remoteClosed = true;
+    s->responding = false;
+    s->headersSent = false;
+    s->done = false;
+    s->window = peerInitialWindow_;
+    s->dataIdx = 0;
+    s->request = request;
+    lastStreamId_ = 1;
+    Stream& stream = *s;
+    streams_[1] = move(s);
+    streamCount++;
+    Respond_(stream, true);
+    return true;
+}
+
+bool Http2Session::Feed(Buffer& in) {
+    if(error_) {
+        in.RetrieveAll();
+        return false;
+    }
+    if(!prefaceDone_) {
+        if(in.ReadableBytes() < PREFACE_LEN) {
+            return memcmp(in.Peek(), PREFACE, in.ReadableBytes()) == 0 || Error_(PROTOCOL_ERROR, "bad preface");
+        }
+        if(memcmp(in.Peek(), PREFACE, PREFACE_LEN) != 0) {
+            return Error_(PROTOCOL_ERROR, "bad preface");
+        }
+        in.Retrieve(PREFACE_LEN);
+        prefaceDone_ = true;
+    }
+    while(in.ReadableBytes() >= FRAME_HEADER_LEN) {
+        const uint8_t* p = (const uint8_t*)in.Peek();
+        size_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+        uint8_t type = p[3], flags = p[4];
+        uint32_t id = Get32_(p + 5) & 0x7fffffff;
+        if(len > MAX_FRAME) {
+            in.RetrieveAll();
+            return Error_(FRAME_SIZE_ERROR, "frame too large");
+        }
+        if(in.ReadableBytes() < FRAME_HEADER_LEN + len) {
+            break; // 等待帧的剩余部分
+        }
+        bool ok = OnFrame_(type, flags, id, p + FRAME_HEADER_LEN, len);
+        in.Retrieve(FRAME_HEADER_LEN + len);
+        if(!ok) {
+            in.RetrieveAll();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    // 头部块没有结束之前只能收到同一个流的CONTINUATION
+    if(headerStream_ != 0 && type != CONTINUATION) {
+        return Error_(PROTOCOL_ERROR, "expected CONTINUATION");
+    }
+    switch(type) {
+    case DATA:
+        return OnData_(flags, id, p, len);
+    case HEADERS:
+        return OnHeaders_(flags, id, p, len);
+    case PRIORITY:
+        // 优先级只是建议，这里按轮转调度，不使用
+        if(id == 0) {
+            return Error_(PROTOCOL_ERROR, "PRIORITY on stream 0");
+        }
+        if(len != 5) {
+            Reset_(id, FRAME_SIZE_ERROR);
+        }
+        return true;
+    case RST_STREAM: {
+        if(id == 0 || id > lastStreamId_) {
+            return Error_(PROTOCOL_ERROR, "RST_STREAM on idle stream");
+        }
+        if(len != 4) {
+            return Error_(FRAME_SIZE_ERROR, "bad RST_STREAM");
+        }
+        Stream* s = Find_(id);
+        if(s && !s->done) {
+            s->done = true;
+            resetCount++;
+        }
+        return true;
+    }
+    case SETTINGS:
+        return OnSettings_(flags, id, p, len);
+    case PUSH_PROMISE:
+        return Error_(PROTOCOL_ERROR, "PUSH_PROMISE from client");
+    case PING:
+        if(id != 0) {
+            return Error_(PROTOCOL_ERROR, "PING on stream");
+        }
+        if(len != 8) {
+            return Error_(FRAME_SIZE_ERROR, "bad PING");
+        }
+        if(!(flags & ACK)) {
+            AppendFrame_(ctrl_, PING, ACK, 0, p, len);
+        }
+        return true;
+    case GOAWAY:
+        if(id != 0) {
+            return Error_(PROTOCOL_ERROR, "GOAWAY on stream");
+        }
+        // 不再接受新的流，已有的流处理完后关闭连接
+        goaway_ = true;
+        return true;
+    case WINDOW_UPDATE:
+        return OnWindowUpdate_(id, p, len);
+    case CONTINUATION:
+        if(headerStream_ == 0 || id != headerStream_) {
+            return Error_(PROTOCOL_ERROR, "unexpected CONTINUATION");
+        }
+        headerBlock_.append((const char*)p, len);
+        if(headerBlock_.size() > Hpack::MAX_HEADER_LIST) {
+            return Error_(PROTOCOL_ERROR, "header block too large");
+        }
+        return (flags & END_HEADERS) ? OnHeaderBlock_() : true;
+    default:
+        return true; // 未知类型的帧必须忽略
+    }
+}
+
+bool Http2Session::OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if(id == 0 || (id & 1) == 0) {
+        return Error_(PROTOCOL_ERROR, "bad stream id");
+    }
+    if(flags & PADDED) {
+        if(len < 1 || p[0] >= len) {
+            return Error_(PROTOCOL_ERROR, "bad padding");
+        }
+        len -= p[0] + 1;
+        p++;
+    }
+    if(flags & PRIORITY_FLAG) {
+        if(len < 5) {
+            return Error_(FRAME_SIZE_ERROR, "bad priority");
+        }
+        p += 5;
+        len -= 5;
+    }
+    // 新的流号必须递增；已有的流上的HEADERS是trailer
+    if(id <= lastStreamId_ && !Find_(id)) {
+        return Error_(STREAM_CLOSED, "HEADERS on closed stream");
+    }
+    headerStream_ = id;
+    headerEndStream_ = flags & END_STREAM;
+    headerBlock_.assign((const char*)p, len);
+    return (flags & END_HEADERS) ? OnHeaderBlock_() : true;
+}
+
+bool Http2Session::OnHeaderBlock_() {
+    uint32_t id = headerStream_;
+    headerStream_ = 0;
+    // 即使要拒绝这个流也必须解码，否则两端的动态表不一致
+    vector<Hpack::Header> headers;
+    if(!decoder_.Decode((const uint8_t*)headerBlock_.data(), headerBlock_.size(), headers)) {
+        return Error_(COMPRESSION_ERROR, "hpack decode failed");
+    }
+    headerBlock_.clear();
+    Stream* s = Find_(id);
+    if(s) {
+        // trailer：忽略其内容，只表示请求结束
+        if(s->remoteClosed || !headerEndStream_) {
+            Reset_(id, s->remoteClosed ? STREAM_CLOSED : PROTOCOL_ERROR);
+        } else {
+            s->remoteClosed = true;
+            Dispatch_(*s);
+        }
+        return true;
+    }
+    lastStreamId_ = id;
+    if(goaway_) {
+        return true;
+    }
+    if(streams_.size() >= MAX_STREAMS) {
+        Reset_(id, REFUSED_STREAM);
+        return true;
+    }
+    StreamPtr ns(new Stream);
+    ns->id = id;
+    ns->remoteClosed = headerEndStream_;
+    ns->responding = false;
+    ns->headersSent = false;
+    ns->done = false;
+    ns->window = peerInitialWindow_;
+    ns->dataIdx = 0;
+    ns->reqHeaders = move(headers);
+    s = ns.get();
+    streams_[id] = move(ns);
+    streamCount++;
+    if(s->remoteClosed) {
+        Dispatch_(*s);
+    }
+    return true;
+}
+
+bool Http2Session::OnData_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if(id == 0 || id > lastStreamId_) {
+        return Error_(PROTOCOL_ERROR, "DATA on idle stream");
+    }
+    // 填充也计入流量控制；收到多少就立即归还多少窗口，请求体的大小另外限制
+    if(len > 0) {
+        char inc[4];
+        Put32_(inc, len);
+        AppendFrame_(ctrl_, WINDOW_UPDATE, 0, 0, inc, sizeof(inc));
+    }
+    if(flags & PADDED) {
+        if(len < 1 || p[0] >= len) {
+            return Error_(PROTOCOL_ERROR, "bad padding");
+        }
+        len -= p[0] + 1;
+        p++;
+    }
+    Stream* s = Find_(id);
+    if(!s || s->remoteClosed || s->done) {
+        Reset_(id, STREAM_CLOSED);
+        return true;
+    }
+    if(s->body.size() + len > MAX_BODY) {
+        Reset_(id, CANCEL);
+        return true;
+    }
+    s->body.append((const char*)p, len);
+    if(flags & END_STREAM) {
+        s->remoteClosed = true;
+        Dispatch_(*s);
+    } else if(len > 0) {
+        char inc[4];
+        Put32_(inc, len);
+        AppendFrame_(ctrl_, WINDOW_UPDATE, 0, id, inc, sizeof(inc));
+    }
+    return true;
+}
+
+bool Http2Session::OnSettings_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if(id != 0) {
+        return Error_(PROTOCOL_ERROR, "SETTINGS on stream");
+    }
+    if(flags & ACK) {
+        return len == 0 || Error_(FRAME_SIZE_ERROR, "SETTINGS ACK with payload");
+    }
+    if(len % 6 != 0) {
+        return Error_(FRAME_SIZE_ERROR, "bad SETTINGS");
+    }
+    if(!ApplySettings_(p, len)) {
+        return false;
+    }
+    AppendFrame_(ctrl_, SETTINGS, ACK, 0, nullptr, 0);
+    return true;
+}
+
+bool Http2Session::ApplySettings_(const uint8_t* p, size_t len) {
+    for(size_t i = 0; i + 6 <= len; i += 6) {
+        uint16_t key = (p[i] << 8) | p[i + 1];
+        uint32_t value = Get32_(p + i + 2);
+        switch(key) {
+        case HEADER_TABLE_SIZE:
+            encoder_.SetMaxTableSize(value);
+            break;
+        case ENABLE_PUSH:
+            if(value > 1) {
+                return Error_(PROTOCOL_ERROR, "bad ENABLE_PUSH");
+            }
+            break;
+        case INITIAL_WINDOW_SIZE: {
+            if(value > MAX_WINDOW) {
+                return Error_(FLOW_CONTROL_ERROR, "bad INITIAL_WINDOW_SIZE");
+            }
+            // 已有的流按差值调整发送窗口，窗口可以变成负数
+            int64_t delta = (int64_t)value - peerInitialWindow_;
+            for(auto& it: streams_) {
+                it.second->window += delta;
+                if(it.second->window > MAX_WINDOW) {
+                    return Error_(FLOW_CONTROL_ERROR, "window overflow");
+                }
+            }
+            peerInitialWindow_ = value;
+            break;
+        }
+        case MAX_FRAME_SIZE:
+            if(value < MAX_FRAME || value > 0xffffff) {
+                return Error_(PROTOCOL_ERROR, "bad MAX_FRAME_SIZE");
+            }
+            peerMaxFrame_ = value;
+            break;
+        default:
+            break; // 未知的参数必须忽略
+        }
+    }
+    return true;
+}
+
+bool Http2Session::OnWindowUpdate_(uint32_t id, const uint8_t* p, size_t len) {
+    if(len != 4) {
+        return Error_(FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+    }
+    uint32_t inc = Get32_(p) & 0x7fffffff;
+    if(id == 0) {
+        if(inc == 0) {
+            return Error_(PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+        }
+        connWindow_ += inc;
+        return connWindow_ <= MAX_WINDOW || Error_(FLOW_CONTROL_ERROR, "window overflow");
+    }
+    Stream* s = Find_(id);
+    if(inc == 0) {
+        Reset_(id, PROTOCOL_ERROR);
+    } else if(s && !s->done) {
+        s->window += inc;
+        if(s->window > MAX_WINDOW) {
+            Reset_(id, FLOW_CONTROL_ERROR);
+        }
+    }
+    return true;
+}
+
+void Http2Session::Dispatch_(Stream& s) {
+    // 伪头部必须在前面，头部名称必须是小写，不能有HTTP/1.1的连接相关头部
+    string method, path, authority, cookie, lines;
+    bool regular = false, bad = false;
+    for(const Hpack::Header& h: s.reqHeaders) {
+        const string& name = h.first;
+        const string& value = h.second;
+        if(name.empty() || value.find_first_of("\r\n\0", 0, 3) != string::npos) {
+            bad = true;
+        }
+        else if(name[0] == ':') {
+            if(regular) { bad = true; }
+            else if(name == ":method") { method = value; }
+            else if(name == ":path") { path = value; }
+            else if(name == ":authority") { authority = value; }
+            else if(name != ":scheme") { bad = true; }
+        }
+        else {
+            regular = true;
+            if(any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; }) ||
+               name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+               name == "transfer-encoding" || name == "upgrade" || (name == "te" && value != "trailers")) {
+                bad = true;
+            }
+            else if(name == "cookie") {
+                // 分开发送的cookie合并成一行
+                cookie += (cookie.empty() ? "" : "; ") + value;
+            }
+            else {
+                lines += Canonical_(name) + ": " + value + "\r\n";
+            }
+        }
+    }
+    if(bad || method.empty() || path.empty()) {
+        Reset_(s.id, PROTOCOL_ERROR);
+        return;
+    }
+    s.reqHeaders.clear();
+    if(!authority.empty()) { lines = "Host: " + authority + "\r\n" + lines; }
+    if(!cookie.empty()) { lines += "Cookie: " + cookie + "\r\n"; }
+    // 请求体由DATA帧界定，按HTTP/1.1的方式解析时以Content-Length给出(覆盖客户端发送的)
+    if(!s.body.empty()) { lines += "Content-Length: " + to_string(s.body.size()) + "\r\n"; }
+    Buffer buff(method.size() + path.size() + lines.size() + s.body.size() + 32);
+    buff.Append(method + " " + path + " HTTP/2.0\r\n" + lines + "\r\n");
+    buff.Append(s.body);
+    string().swap(s.body);
+    Respond_(s, s.request.parse(buff) == HttpRequest::GET_REQUEST);
+}
+
+void Http2Session::Respond_(Stream& s, bool parsed) {
+    // 与HTTP/1.1走同一条路径，只是响应体不和实体头合在一个缓存块里
+    ServerPipeline* middleware = ServerPipeline::Instance();
+    if(parsed) {
+        s.ctx.Reset(&s.request, peer_, tls_);
+        int code = middleware->Before(s.ctx) ? 200 : s.ctx.Code();
+        s.response.Init(srcDir_, s.request.path(), false, code, &s.request);
+        s.response.SetExtraHeaders(s.ctx.Headers(), s.ctx.HeadersLen());
+    } else {
+        s.response.Init(srcDir_, s.request.path(), false, 400);
+    }
+    s.response.SetHttp2();
+    if(!parsed || !RespondAsync_(s)) {
+        s.response.MakeResponse(s.head);
+    }
+    if(parsed) {
+        s.ctx.SetCode(s.response.Code());
+        s.ctx.SetBytes(s.head.ReadableBytes() + s.response.BodyBytes());
+        middleware->After(s.ctx);
+    }
+    s.responding = true;
+    ParseHead_(s);
+}
+
+bool Http2Session::RespondAsync_(Stream& s) {
+#ifdef USE_CORO
+    const Router::Route* route = s.request.GetRoute();
+    if(s.response.Code() != 200 || !route || !route->async) {
+        return false;
+    }
+    // 流没有自己的epoll登记，异步处理函数在当前线程执行到结束
+    AsyncCall::Ptr call = std::make_shared<AsyncCall>(-1, route->async(s.request));
+    call->RunBlocking();
+    Reply& reply = call->GetReply();
+    s.response.Init(srcDir_, s.request.path(), false, reply.code, &s.request);
+    s.response.SetHttp2();
+    s.response.SetExtraHeaders(s.ctx.Headers(), s.ctx.HeadersLen());
+    s.response.MakeReply(s.head, reply.type, reply.body);
+    return true;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+void Http2Session::ParseHead_(Stream& s) {
+    const char CRLF[] = "\r\n";
+    const char* begin = s.head.Peek();
+    const char* end = s.head.BeginWriteConst();
+    const char* headEnd = search(begin, end, "\r\n\r\n", "\r\n\r\n" + 4);
+    // 状态行"HTTP/1.1 200 OK"
+    const char* lineEnd = search(begin, headEnd, CRLF, CRLF + 2);
+    string status = string(begin, lineEnd).substr(9, 3);
+    s.respHeaders.emplace_back(":status", status);
+    while(lineEnd < headEnd) {
+        const char* line = lineEnd + 2;
+        lineEnd = search(line, headEnd, CRLF, CRLF + 2);
+        const char* colon = find(line, lineEnd, ':');
+        if(colon == lineEnd) { continue; }
+        string name(line, colon);
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if(name == "connection" || name == "keep-alive" || name == "transfer-encoding" || name == "upgrade") {
+            continue;
+        }
+        const char* value = colon + 1;
+        while(value < lineEnd && *value == ' ') { value++; }
+        s.respHeaders.emplace_back(name, string(value, lineEnd));
+    }
+    s.head.RetrieveUntil(min(headEnd + 4, end));
+    s.data.clear();
+    s.dataIdx = 0;
+    if(s.request.method() == "HEAD") {
+        s.response.Stream().Reset();
+        return;
+    }
+    // 错误页等内嵌在响应头后面的响应体，然后是文件切片
+    if(s.head.ReadableBytes() > 0) {
+        s.data.push_back({ const_cast<char*>(s.head.Peek()), s.head.ReadableBytes() });
+    }
+    const vector<struct iovec>& body = s.response.BodyIov();
+    s.data.insert(s.data.end(), body.begin(), body.end());
+}
+
+bool Http2Session::NextData_(Stream& s) {
+    HttpStream& stream = s.response.Stream();
+    if(Pending_(s) > 0 || !stream.IsActive()) {
+        return false;
+    }
+    s.chunk.RetrieveAll();
+    while(stream.IsActive() && s.chunk.ReadableBytes() == 0) {
+        stream.Next(s.chunk);
+    }
+    s.data.clear();
+    s.dataIdx = 0;
+    if(s.chunk.ReadableBytes() > 0) {
+        s.data.push_back({ const_cast<char*>(s.chunk.Peek()), s.chunk.ReadableBytes() });
+        return true;
+    }
+    return false;
+}
+
+size_t Http2Session::Pending_(const Stream& s) const {
+    size_t bytes = 0;
+    for(size_t i = s.dataIdx; i < s.data.size(); i++) {
+        bytes += s.data[i].iov_len;
+    }
+    return bytes;
+}
+
+bool Http2Session::Fill(Buffer& out, vector<struct iovec>& iov, size_t budget, bool copy) {
+    // 分段：ext为空表示out中从off开始的len字节，否则是响应体中的切片
+    struct Segment {
+        const char* ext;
+        size_t off;
+        size_t len;
+    };
+    vector<Segment> segs;
+    size_t mark = 0; // out中还没有记录成分段的起点
+    auto flushOut = [&]() {
+        if(out.ReadableBytes() > mark) {
+            segs.push_back({ nullptr, mark, out.ReadableBytes() - mark });
+            mark = out.ReadableBytes();
+        }
+    };
+
+    // 上一批已经全部写出，此时才能释放结束的流、覆盖流式响应的分段缓冲
+    for(auto it = streams_.begin(); it != streams_.end();) {
+        Stream& s = *it->second;
+        if(s.done || error_) {
+            it = streams_.erase(it);
+            continue;
+        }
+        if(s.responding) {
+            NextData_(s);
+        }
+        ++it;
+    }
+    out.Append(ctrl_);
+    ctrl_.clear();
+
+    /* 响应头：在发送时编码，保证编码顺序与对端解码顺序一致 */
+    vector<Stream*> active;
+    auto first = streams_.lower_bound(nextRound_);
+    for(size_t i = 0; i < streams_.size(); i++, first++) {
+        if(first == streams_.end()) { first = streams_.begin(); }
+        Stream& s = *first->second;
+        if(!s.responding || s.done) { continue; }
+        if(!s.headersSent) {
+            string block;
+            encoder_.Encode(s.respHeaders, block);
+            s.respHeaders.clear();
+            bool endStream = Pending_(s) == 0 && !s.response.Stream().IsActive();
+            // 超过对端最大帧长的部分放在CONTINUATION中
+            size_t off = 0;
+            do {
+                size_t n = min(block.size() - off, peerMaxFrame_);
+                uint8_t flags = (off + n == block.size()) ? END_HEADERS : 0;
+                if(off == 0 && endStream) { flags |= END_STREAM; }
+                string frame;
+                AppendFrame_(frame, off == 0 ? HEADERS : CONTINUATION, flags, s.id, block.data() + off, n);
+                out.Append(frame);
+                off += n;
+            } while(off < block.size());
+            s.headersSent = true;
+            if(endStream) {
+                s.done = true;
+                continue;
+            }
+        }
+        active.push_back(&s);
+    }
+
+    /* 响应体：轮转调度，每个流每轮至多一帧，受流窗口、连接窗口和本轮预算限制 */
+    size_t sent = 0;
+    bool progress = true;
+    while(progress && sent < budget) {
+        progress = false;
+        for(Stream* s: active) {
+            if(s->done || sent >= budget) { continue; }
+            size_t pending = Pending_(*s);
+            bool more = s->response.Stream().IsActive();
+            char head[FRAME_HEADER_LEN];
+            if(pending == 0) {
+                if(!more) {
+                    // 最后一段之后才知道响应结束，用空的DATA帧结束流
+                    FrameHeader_(head, 0, DATA, END_STREAM, s->id);
+                    out.Append(head, sizeof(head));
+                    s->done = true;
+                    progress = true;
+                }
+                continue;
+            }
+            int64_t window = min(s->window, connWindow_);
+            if(window <= 0) { continue; }
+            size_t n = min(min(pending, peerMaxFrame_), min((size_t)window, budget - sent));
+            bool end = (n == pending && !more);
+            FrameHeader_(head, n, DATA, end ? END_STREAM : 0, s->id);
+            out.Append(head, sizeof(head));
+            if(!copy) { flushOut(); }
+            for(size_t left = n; left > 0;) {
+                struct iovec& d = s->data[s->dataIdx];
+                size_t k = min(left, d.iov_len);
+                if(k > 0) {
+                    if(copy) {
+                        out.Append(d.iov_base, k);
+                    } else {
+                        segs.push_back({ (const char*)d.iov_base, 0, k });
+                    }
+                    d.iov_base = (char*)d.iov_base + k;
+                    d.iov_len -= k;
+                    left -= k;
+                }
+                if(d.iov_len == 0) { s->dataIdx++; }
+            }
+            s->window -= n;
+            connWindow_ -= n;
+            sent += n;
+            progress = true;
+            nextRound_ = s->id + 1;
+            if(end) { s->done = true; }
+        }
+    }
+    flushOut();
+
+    // out在这一批中不再追加，可以取指针了
+    iov.clear();
+    for(const Segment& seg: segs) {
+        char* base = seg.ext ? const_cast<char*>(seg.ext) : const_cast<char*>(out.Peek()) + seg.off;
+        iov.push_back({ base, seg.len });
+    }
+    return !iov.empty();
+}
+
+Http2Session::Stream* Http2Session::Find_(uint32_t id) {
+    auto it = streams_.find(id);
+    return it == streams_.end() ? nullptr : it->second.get();
+}
+
+void Http2Session::Reset_(uint32_t id, ErrorCode code) {
+    char payload[4];
+    Put32_(payload, code);
+    AppendFrame_(ctrl_, RST_STREAM, 0, id, payload, sizeof(payload));
+    Stream* s = Find_(id);
+    if(s) { s->done = true; }
+    resetCount++;
+}
+
+bool Http2Session::Error_(ErrorCode code, const char* reason) {
+    if(!error_) {
+        error_ = true;
+        goawayCount++;
+        char payload[8];
+        Put32_(payload, lastStreamId_);
+        Put32_(payload + 4, code);
+        AppendFrame_(ctrl_, GOAWAY, 0, 0, payload, sizeof(payload));
+        LOG_WARN("HTTP/2 connection error %d: %s", (int)code, reason);
+    }
+    return false;
+}
+
+void Http2Session::AppendFrame_(string& out, uint8_t type, uint8_t flags, uint32_t id, const void* p, size_t len) {
+    char head[FRAME_HEADER_LEN];
+    FrameHeader_(head, len, type, flags, id);
+    out.append(head, sizeof(head));
+    if(len > 0) { out.append((const char*)p, len); }
+}
+
+void Http2Session::FrameHeader_(char* buf, size_t len, uint8_t type, uint8_t flags, uint32_t id) {
+    buf[0] = (char)(len >> 16);
+    buf[1] = (char)(len >> 8);
+    buf[2] = (char)len;
+    buf[3] = (char)type;
+    buf[4] = (char)flags;
+    Put32_(buf + 5, id & 0x7fffffff);
+}
+
+uint32_t Http2Session::Get32_(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void Http2Session::Put32_(char* p, uint32_t v) {
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+string Http2Session::Canonical_(const string& name) {
+    // HttpRequest按HTTP/1.1的习惯写法查找头部(If-None-Match、Accept-Encoding等)
+    string str = name;
+    bool upper = true;
+    for(char& c: str) {
+        if(upper && c >= 'a' && c <= 'z') { c = c - 'a' + 'A'; }
+        upper = (c == '-');
+    }
+    return str;
+}
+
+bool Http2Session::Base64UrlDecode_(const string& in, string& out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    out.clear();
+    for(char c: in) {
+        int v;
+        if(c >= 'A' && c <= 'Z') { v = c - 'A'; }
+        else if(c >= 'a' && c <= 'z') { v = c - 'a' + 26; }
+        else if(c >= '0' && c <= '9') { v = c - '0' + 52; }
+        else if(c == '-') { v = 62; }
+        else if(c == '_') { v = 63; }
+        else if(c == '=') { break; }
+        else { return false; }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return true;
+}
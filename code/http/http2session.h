@@ -0,0 +1,157 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-12
+ * @copyleft Apache 2.0
+ */
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <map>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sys/uio.h>     // iovec
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+#include "hpack.h"
+#include "middleware.h"
+
+// HTTP/2连接(RFC 7540)：一个TCP连接上多路复用多个请求
+// 每个流把请求头转换成HTTP/1.1形式交给HttpRequest解析，再由HttpResponse生成响应，
+// 文件切片、内存缓存、压缩结果和流式响应都沿用原来的路径，这里只负责分帧、流量控制和调度
+// 对象只在持有连接的工作线程中使用(EPOLLONESHOT)，不需要加锁
+class Http2Session {
+public:
+    // peer和tls是连接的属性，交给每个流的中间件上下文
+    Http2Session(const char* srcDir, const sockaddr_in& peer, bool tls);
+    ~Http2Session();
+
+    // data是否为连接前言的开头(h2c prior knowledge)，不完整的前言等后续数据
+    static bool IsPreface(const char* data, size_t len);
+
+    // h2c升级：先回复101，request作为流1的请求，settings是HTTP2-Settings头部(base64url)
+    bool Upgrade(const HttpRequest& request, const std::string& settings);
+
+    // 解析in中所有完整的帧，不完整的帧留在in中；连接错误返回false(已排队GOAWAY)
+    bool Feed(Buffer& in);
+
+    // 生成下一批要发送的数据：控制帧和帧头写入out，响应体切片直接引用(不拷贝)，
+    // 至多budget字节的DATA；没有可发送的数据返回false
+    // 只能在上一批全部写出后调用，被引用的内存在下一次Fill之前保持有效
+    // copy为true时响应体也拷贝到out中(用户态TLS逐段SSL_write，分段太碎会产生很多小记录)
+    bool Fill(Buffer& out, std::vector<struct iovec>& iov, size_t budget, bool copy = false);
+
+    bool HasStreams() const { return !streams_.empty(); }
+    // 发送或收到了GOAWAY并且没有进行中的流，写完后关闭连接
+    bool IsClosing() const { return error_ || (goaway_ && streams_.empty()); }
+
+    /* 统计 */
+    static std::atomic<uint64_t> sessionCount; // 建立的HTTP/2连接数
+    static std::atomic<uint64_t> streamCount; // 处理的流(请求)数
+    static std::atomic<uint64_t> resetCount; // 收到或发送RST_STREAM的流数
+    static std::atomic<uint64_t> goawayCount; // 因协议错误发送GOAWAY的连接数
+
+    static const char* PREFACE;
+    static const size_t PREFACE_LEN = 24;
+
+private:
+    enum FrameType {
+        DATA = 0x0, HEADERS = 0x1, PRIORITY = 0x2, RST_STREAM = 0x3, SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5, PING = 0x6, GOAWAY = 0x7, WINDOW_UPDATE = 0x8, CONTINUATION = 0x9,
+    };
+    enum Flag {
+        END_STREAM = 0x1, ACK = 0x1, END_HEADERS = 0x4, PADDED = 0x8, PRIORITY_FLAG = 0x20,
+    };
+    enum ErrorCode {
+        NO_ERROR = 0x0, PROTOCOL_ERROR = 0x1, INTERNAL_ERROR = 0x2, FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5, FRAME_SIZE_ERROR = 0x6, REFUSED_STREAM = 0x7, CANCEL = 0x8,
+        COMPRESSION_ERROR = 0x9,
+    };
+    enum Setting {
+        HEADER_TABLE_SIZE = 0x1, ENABLE_PUSH = 0x2, MAX_CONCURRENT_STREAMS = 0x3,
+        INITIAL_WINDOW_SIZE = 0x4, MAX_FRAME_SIZE = 0x5, MAX_HEADER_LIST_SIZE = 0x6,
+    };
+
+    struct Stream {
+        uint32_t id;
+        bool remoteClosed; // 请求已经收完(END_STREAM)
+        bool responding; // 已经生成响应
+        bool headersSent;
+        bool done; // 已经发送END_STREAM或被重置
+        int64_t window; // 发送窗口
+        std::string body; // 请求体
+        std::vector<Hpack::Header> reqHeaders;
+        HttpRequest request;
+        HttpResponse response;
+        RequestContext ctx; // 中间件上下文
+        Buffer head; // MakeResponse生成的HTTP/1.1响应头，之后只剩下其中内嵌的响应体
+        std::vector<Hpack::Header> respHeaders;
+        std::vector<struct iovec> data; // 待发送的响应体分段
+        size_t dataIdx;
+        Buffer chunk; // 流式响应的当前一段
+    };
+    typedef std::unique_ptr<Stream> StreamPtr;
+
+    bool OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnHeaderBlock_(); // 头部块收完(END_HEADERS)
+    bool OnData_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnSettings_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnWindowUpdate_(uint32_t id, const uint8_t* p, size_t len);
+    bool ApplySettings_(const uint8_t* p, size_t len);
+
+    void Dispatch_(Stream& s); // 请求收完，转换成HTTP/1.1形式解析
+    void Respond_(Stream& s, bool parsed); // 生成响应
+    bool RespondAsync_(Stream& s); // 路由到异步处理函数时生成响应，否则返回false
+    void ParseHead_(Stream& s); // 把MakeResponse的HTTP/1.1响应头转换成HTTP/2头部
+    bool NextData_(Stream& s); // 流式响应：取下一段
+    size_t Pending_(const Stream& s) const;
+
+    Stream* Find_(uint32_t id);
+    void Reset_(uint32_t id, ErrorCode code); // 流错误：发送RST_STREAM
+    bool Error_(ErrorCode code, const char* reason); // 连接错误：发送GOAWAY，返回false
+
+    static void AppendFrame_(std::string& out, uint8_t type, uint8_t flags, uint32_t id, const void* p, size_t len);
+    static void FrameHeader_(char* buf, size_t len, uint8_t type, uint8_t flags, uint32_t id);
+    static uint32_t Get32_(const uint8_t* p);
+    static void Put32_(char* p, uint32_t v);
+    static std::string Canonical_(const std::string& name); // content-type => Content-Type
+    static bool Base64UrlDecode_(const std::string& in, std::string& out);
+
+    const char* srcDir_;
+    sockaddr_in peer_;
+    bool tls_;
+    std::map<uint32_t, StreamPtr> streams_;
+    uint32_t lastStreamId_; // 对端打开的最大流号
+    uint32_t nextRound_; // 轮转调度：下一批从这个流号开始
+    bool prefaceDone_;
+    bool goaway_;
+    bool error_;
+
+    Hpack decoder_;
+    Hpack encoder_;
+    std::string ctrl_; // 待发送的控制帧(SETTINGS ACK、PING ACK、WINDOW_UPDATE等)
+
+    // 正在接收的头部块(HEADERS之后必须紧跟同一个流的CONTINUATION)
+    uint32_t headerStream_;
+    bool headerEndStream_;
+    std::string headerBlock_;
+
+    int64_t connWindow_; // 连接级发送窗口
+    int64_t peerInitialWindow_; // 对端的SETTINGS_INITIAL_WINDOW_SIZE
+    size_t peerMaxFrame_; // 对端的SETTINGS_MAX_FRAME_SIZE
+
+    static const size_t FRAME_HEADER_LEN = 9;
+    static const size_t MAX_FRAME = 16384; // 本端接收的最大帧
+    static const uint32_t MAX_STREAMS = 128; // 本端允许的最大并发流数
+    static const int64_t DEFAULT_WINDOW = 65535;
+    static const int64_t MAX_WINDOW = 0x7fffffff;
+    static const size_t MAX_BODY = 1024 * 1024; // 请求体上限
+};
+
+#endif //HTTP2_SESSION_H
@@ -9,35 +9,111 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+size_t HttpConn::writeQuantum = 256 * 1024;
+size_t HttpConn::rateLimit = 0;
+int HttpConn::maxRequests = 0;
+std::atomic<uint64_t> HttpConn::requestCount;
+std::atomic<uint64_t> HttpConn::reuseCount;
+std::atomic<uint64_t> HttpConn::maxRequestCloseCount;
+std::atomic<uint64_t> HttpConn::serialCount_;
+std::atomic<int64_t> HttpConn::memoryConns[HttpConn::MEMORY_BUCKETS];
+const size_t HttpConn::MEMORY_LIMITS[HttpConn::MEMORY_BUCKETS - 1] = { 0, 4 * 1024, 16 * 1024, 64 * 1024 };
 
 HttpConn::HttpConn() { 
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    iovIdx_ = 0;
+    serial_ = 0;
+    nextSendUs_ = 0;
+    requests_ = 0;
+    idleSinceMs_ = 0;
+    lastActiveMs_ = 0;
+    proxied_ = false;
+    readHint_ = 0;
+    memBytes_ = 0;
+    memPeak_ = 0;
+#ifdef USE_TLS
+    ssl_ = nullptr;
+    handshakeDone_ = false;
+    ktlsSend_ = false;
+#endif
 };
 
 HttpConn::~HttpConn() { 
     Close(); 
 };
 
-void HttpConn::init(int fd, const sockaddr_in& addr) {
+void HttpConn::init(int fd, const sockaddr_in& addr, bool tls) {
     assert(fd > 0);
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    serial_ = ++serialCount_;
+    nextSendUs_ = 0;
+    requests_ = 0;
+    idleSinceMs_ = 0;
+    lastActiveMs_ = NowMs();
+    iov_.clear();
+    iovIdx_ = 0;
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    h2_.reset();
+    ws_.reset();
+    sse_.reset();
+    proxy_.reset();
+    proxied_ = false;
     isClose_ = false;
+    readHint_ = 0;
+    memBytes_ = 0;
+    memPeak_ = 0;
+    memoryConns[0]++;
+#ifdef USE_TLS
+    ssl_ = tls ? TlsContext::Instance()->NewSsl(fd) : nullptr;
+    handshakeDone_ = false;
+    ktlsSend_ = false;
+#endif
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
 void HttpConn::Close() {
     response_.UnmapFile();
+    response_.Stream().Reset();
+    h2_.reset(); // 释放各个流的响应(文件映射等)
+    if(ws_) {
+        ws_->Detach(); // 处理函数中保存的对象之后Send都失败
+        ws_.reset();
+    }
+    if(sse_) {
+        sse_->Detach(); // 取消订阅
+        sse_.reset();
+    }
+    proxy_.reset(); // 未完成的上游连接直接关闭
+    proxied_ = false;
+    readBuff_.Release(); // 关闭的连接不占用缓冲区，存储还给池
+    writeBuff_.Release();
+    std::vector<struct iovec>().swap(iov_);
+    iovIdx_ = 0;
+#ifdef USE_CORO
+    if(async_) {
+        async_->Detach(); // 后台任务完成时不再唤醒
+        async_.reset();
+    }
+#endif
     if(isClose_ == false){
         isClose_ = true; 
         userCount--;
+        UpdateMemory_(0);
+        memoryConns[0]--;
+#ifdef USE_TLS
+        if(ssl_) {
+            if(handshakeDone_) { SSL_shutdown(ssl_); } // 非阻塞，只尝试发送close_notify
+            SSL_free(ssl_);
+            ssl_ = nullptr;
+        }
+#endif
         close(fd_);
-        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d, peak memory:%zu", fd_, GetIP(), GetPort(), (int)userCount, memPeak_);
     }
 }
 
@@ -58,77 +134,562 @@ int HttpConn::GetPort() const {
 }
 
 ssize_t HttpConn::read(int* saveErrno) {
+#ifdef USE_TLS
+    if(ssl_) {
+        return TlsRead_(saveErrno);
+    }
+#endif
     ssize_t len = -1;
+    size_t total = 0;
+    // 内存紧张时读缓冲区最多读到暂停的阈值，剩下的留在内核中，处理完重新登记事件时会再次触发
+    size_t threshold = MemoryBudget::Instance()->PauseThreshold();
     do {
-        // 读数据，并存储在readBuff_中，readBuff在httpconn对象中
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        size_t limit = 0;
+        if(threshold > 0) {
+            size_t readable = readBuff_.ReadableBytes();
+            limit = readable < threshold ? threshold - readable : (size_t)ChunkPool::MIN_CHUNK;
+        }
+        // 读数据，并存储在readBuff_中，按FIONREAD和以往请求的大小扩容
+        len = readBuff_.ReadFd(fd_, saveErrno, readHint_, limit);
         if (len <= 0) {
             break; // 缓冲区内容为0
         }
-    } while (isET); // 判断是否是ET模式，是ET模式则需要一次性读完直到缓冲区内容为0
+        total += len;
+    } while (isET && (threshold == 0 || readBuff_.ReadableBytes() < threshold)); // ET模式需要一次性读完直到缓冲区内容为0
+    UpdateReadHint_(total);
     return len;
 }
 
+void HttpConn::UpdateReadHint_(size_t bytes) {
+    // 缓慢衰减：偶尔的小请求不会让下一个大请求分多次读
+    if(bytes > 0) {
+        readHint_ = std::min(std::max(bytes, readHint_ - readHint_ / 4), (size_t)MAX_READ_HINT);
+    }
+}
+
+void HttpConn::Reclaim_() {
+    // 空闲连接不保留缓冲区，存储还给池，下一次有数据时重新取
+    if(readBuff_.ReadableBytes() == 0) {
+        readBuff_.Release();
+    }
+    if(ToWriteBytes() == 0) {
+        writeBuff_.Release();
+        iov_.clear();
+        iovIdx_ = 0;
+        if(iov_.capacity() > IOV_KEEP) { iov_.shrink_to_fit(); }
+    }
+}
+
+size_t HttpConn::MemoryBytes() const {
+    return readBuff_.Capacity() + writeBuff_.Capacity();
+}
+
+int HttpConn::MemoryBucket_(size_t bytes) {
+    int i = 0;
+    while(i < MEMORY_BUCKETS - 1 && bytes > MEMORY_LIMITS[i]) { i++; }
+    return i;
+}
+
+void HttpConn::UpdateMemory_(size_t bytes) {
+    if(bytes == memBytes_) { return; }
+    MemoryBudget::Instance()->Charge(MemoryBudget::CONN_BUFFER, (int64_t)bytes - (int64_t)memBytes_);
+    memPeak_ = std::max(memPeak_, bytes);
+    int from = MemoryBucket_(memBytes_), to = MemoryBucket_(bytes);
+    if(from != to) {
+        memoryConns[from]--;
+        memoryConns[to]++;
+    }
+    memBytes_ = bytes;
+}
+
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
+    // 每轮最多写writeQuantum字节，剩下的交回reactor排队，其他连接的小响应不必等大文件写完
+    size_t budget = writeQuantum;
+    if(rateLimit > 0) {
+        budget = std::min(budget, std::max<size_t>(rateLimit * BURST_US / 1000000, 1));
+    }
+    size_t written = 0;
     do {
-        // iov_,iovCnt都在httpresponse.h中处理
-        len = writev(fd_, iov_, iovCnt_);
+        while(iovIdx_ < iov_.size() && iov_[iovIdx_].iov_len == 0) { iovIdx_++; }
+        // 推送连接被唤醒时iov_已经写完，先取出排队的数据
+        bool piped = proxy_ && proxy_->PipeBytes() > 0;
+        if(iovIdx_ == iov_.size() && !piped && (!IsPush() || !NextChunk_())) {
+            len = 0;
+            break;
+        }
+        // 代理的响应体在管道中时，iov_一定已经写完
+        len = iovIdx_ < iov_.size() ? Send_(budget - written, saveErrno)
+                                    : proxy_->SpliceTo(fd_, budget - written, saveErrno);
         if(len <= 0) {
-            *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
+        written += len;
+        Pace_(len);
+        size_t left = len;
+        while(left > 0 && iovIdx_ < iov_.size()) {
+            struct iovec& iov = iov_[iovIdx_];
+            size_t n = std::min(left, iov.iov_len);
+            iov.iov_base = (uint8_t*)iov.iov_base + n;
+            iov.iov_len -= n;
+            left -= n;
+            if(iovIdx_ == 0) { writeBuff_.Retrieve(n); } // 响应头在writeBuff_中
+            if(iov.iov_len == 0) { iovIdx_++; }
         }
-        else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
+        if(ToWriteBytes() == 0 && !NextChunk_()) { break; } /* 传输结束 */
+    } while(written < budget && (isET || ToWriteBytes() > 10240));
+    return len;
+}
+
+ssize_t HttpConn::Send_(size_t limit, int* saveErrno) {
+#ifdef USE_TLS
+    if(ssl_ && !ktlsSend_) {
+        // 用户态加密：逐段SSL_write，重试时参数必须与上次相同，所以只按段长和记录大小截断
+        const struct iovec& iov = iov_[iovIdx_];
+        int ret = SSL_write(ssl_, iov.iov_base, std::min(iov.iov_len, (size_t)TLS_RECORD));
+        if(ret <= 0) {
+            *saveErrno = SslErrno_(ssl_, ret);
+            return -1;
         }
-    } while(isET || ToWriteBytes() > 10240);
+        return ret;
+    }
+#endif
+    // iov_在process()中由响应头和响应体分段组成，本轮只提交预算之内的部分
+    size_t cnt = 0, bytes = 0;
+    while(iovIdx_ + cnt < iov_.size() && bytes < limit) {
+        bytes += iov_[iovIdx_ + cnt].iov_len;
+        cnt++;
+    }
+    struct iovec& last = iov_[iovIdx_ + cnt - 1];
+    size_t lastLen = last.iov_len;
+    if(bytes > limit) { last.iov_len -= bytes - limit; }
+    // 用sendmsg+MSG_NOSIGNAL代替writev，客户端中途断开(如视频拖动)时返回EPIPE而不是触发SIGPIPE
+    // 开启kTLS后内核负责加密，同样直接写socket
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov_[iovIdx_];
+    msg.msg_iovlen = cnt;
+    ssize_t len = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    last.iov_len = lastLen;
+    if(len < 0) {
+        *saveErrno = errno;
+    }
     return len;
 }
 
+#ifdef USE_TLS
+bool HttpConn::Handshake_(int* saveErrno) {
+    int ret = SSL_do_handshake(ssl_);
+    if(ret == 1) {
+        handshakeDone_ = true;
+        ktlsSend_ = TlsContext::Instance()->OnHandshake(ssl_);
+        // ALPN选中h2时不需要升级，握手之后直接是HTTP/2的连接前言
+        const unsigned char* alpn = nullptr;
+        unsigned int alpnLen = 0;
+        SSL_get0_alpn_selected(ssl_, &alpn, &alpnLen);
+        if(alpnLen == 2 && memcmp(alpn, "h2", 2) == 0) {
+            h2_.reset(new Http2Session(srcDir, addr_, IsTls()));
+        }
+        return true;
+    }
+    *saveErrno = SslErrno_(ssl_, ret);
+    if(*saveErrno != EAGAIN) {
+        LOG_WARN("Client[%d] TLS handshake failed: %s", fd_, TlsContext::LastError().c_str());
+    }
+    return false;
+}
+
+ssize_t HttpConn::TlsRead_(int* saveErrno) {
+    if(!handshakeDone_ && !Handshake_(saveErrno)) {
+        return -1;
+    }
+    // SSL内部可能缓存了已解密的数据，socket不会再次可读，所以无论ET/LT都读到WANT_READ为止
+    // 直接解密到readBuff_中，大小按已解密未取走的、内核中的密文和以往的数据量预留
+    ssize_t total = 0;
+    while(true) {
+        int pending = 0;
+        if(ioctl(fd_, FIONREAD, &pending) < 0) {
+            pending = 0;
+        }
+        size_t want = std::max(std::max<size_t>(pending, SSL_pending(ssl_)), readHint_);
+        readBuff_.EnsureWriteable(std::min(std::max<size_t>(want, 1), (size_t)TLS_RECORD));
+        int ret = SSL_read(ssl_, readBuff_.BeginWrite(), (int)std::min(readBuff_.WritableBytes(), (size_t)TLS_RECORD));
+        if(ret > 0) {
+            readBuff_.HasWritten(ret);
+            total += ret;
+            continue;
+        }
+        int err = SSL_get_error(ssl_, ret);
+        UpdateReadHint_(total);
+        if(total > 0) {
+            return total;
+        }
+        if(err == SSL_ERROR_ZERO_RETURN) {
+            return 0; // 对端发送了close_notify
+        }
+        *saveErrno = SslErrno_(ssl_, ret);
+        return -1;
+    }
+}
+
+int HttpConn::SslErrno_(SSL* ssl, int ret) {
+    int err = SSL_get_error(ssl, ret);
+    if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return EAGAIN;
+    }
+    if(err == SSL_ERROR_SYSCALL && errno != 0) {
+        return errno;
+    }
+    ERR_clear_error();
+    return EPROTO;
+}
+#endif
+
+bool HttpConn::IsTls() const {
+#ifdef USE_TLS
+    return ssl_ != nullptr;
+#else
+    return false;
+#endif
+}
+
+int64_t HttpConn::NowUs_() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void HttpConn::Pace_(size_t bytes) {
+    if(rateLimit == 0) { return; }
+    // 空闲一段时间后最多积攒BURST_US的额度
+    int64_t now = NowUs_();
+    int64_t next = std::max<int64_t>(nextSendUs_, now - BURST_US);
+    nextSendUs_ = next + (int64_t)(bytes * 1000000 / rateLimit);
+}
+
+int HttpConn::ThrottleDelayMs() const {
+    if(rateLimit == 0) { return 0; }
+    int64_t delay = nextSendUs_ - NowUs_();
+    return delay > 0 ? (int)((delay + 999) / 1000) : 0;
+}
+
+bool HttpConn::NextChunk_() {
+    // 上一段已经全部写出才生成下一段，socket写不动时生产者自然暂停
+    HttpStream& stream = response_.Stream();
+    writeBuff_.RetrieveAll();
+    // 用户态TLS逐段加密，把引用的数据拷贝到writeBuff_中，避免产生很多小记录
+    bool copy = false;
+#ifdef USE_TLS
+    copy = ssl_ && !ktlsSend_;
+#endif
+    if(h2_) {
+        iovIdx_ = 0;
+        return h2_->Fill(writeBuff_, iov_, writeQuantum, copy);
+    }
+    if(proxied_) {
+        // 接着读上游，读不到时由reactor等待上游可读
+        return proxy_->GetWant() == ProxyConn::CLIENT_WRITE && ProxyStep_() && ToWriteBytes() > 0;
+    }
+    if(sse_) {
+        iovIdx_ = 0;
+        return sse_->Fill(writeBuff_, iov_, copy);
+    }
+    if(ws_ && !ws_->Fill(writeBuff_)) {
+        return false;
+    }
+    while(stream.IsActive() && writeBuff_.ReadableBytes() == 0) {
+        stream.Next(writeBuff_);
+    }
+    if(writeBuff_.ReadableBytes() == 0) {
+        return false;
+    }
+    iov_.clear();
+    iovIdx_ = 0;
+    iov_.push_back({ const_cast<char*>(writeBuff_.Peek()), writeBuff_.ReadableBytes() });
+    return true;
+}
+
+bool HttpConn::ProcessH2_() {
+    // 连接错误时已经排队了GOAWAY，发送之后IsKeepAlive()为false，连接随之关闭
+    h2_->Feed(readBuff_);
+    if(ToWriteBytes() > 0) {
+        return true; // 上一批还没有写完，新的帧等它写完后再生成
+    }
+    if(!NextChunk_()) {
+        if(!h2_->HasStreams()) { idleSinceMs_ = NowMs(); }
+        Reclaim_();
+        return false;
+    }
+    idleSinceMs_ = 0;
+    return true;
+}
+
+bool HttpConn::UpgradeH2c_() {
+    // 只在明文连接上升级(TLS用ALPN)，带请求体的请求不升级
+    if(IsTls() || (request_.method() != "GET" && request_.method() != "HEAD")) {
+        return false;
+    }
+    string settings = request_.GetHeader("HTTP2-Settings");
+    if(!request_.IsUpgrade("h2c") || settings.empty()) {
+        return false;
+    }
+    std::unique_ptr<Http2Session> h2(new Http2Session(srcDir, addr_, IsTls()));
+    if(!h2->Upgrade(request_, settings)) {
+        return false;
+    }
+    h2_ = std::move(h2);
+    return true;
+}
+
+bool HttpConn::ProcessPush_() {
+    if(ws_) {
+        // 协议错误时已经排队了关闭帧，发送之后IsKeepAlive()为false，连接随之关闭
+        ws_->Feed(readBuff_);
+    } else {
+        readBuff_.RetrieveAll(); // SSE是单向的
+    }
+    if(ToWriteBytes() > 0) {
+        return true;
+    }
+    if(!NextChunk_()) {
+        Reclaim_(); // 等待推送的数据期间不占用缓冲区
+        return false;
+    }
+    return true;
+}
+
+bool HttpConn::UpgradeWebSocket_() {
+    // 只有注册了处理函数的路径才升级，其他路径的升级请求当作普通请求处理
+    const WebSocket::Handler* handler = WebSocket::Find(request_.path());
+    if(!handler || request_.method() != "GET" || !request_.IsUpgrade("websocket")) {
+        return false;
+    }
+    string key = request_.GetHeader("Sec-WebSocket-Key");
+    if(key.empty() || request_.GetHeader("Sec-WebSocket-Version") != "13") {
+        return false;
+    }
+    writeBuff_.RetrieveAll();
+    writeBuff_.Append("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n");
+    writeBuff_.Append("Sec-WebSocket-Accept: " + WebSocket::AcceptKey(key) + "\r\n\r\n");
+    iov_.clear();
+    iovIdx_ = 0;
+    iov_.push_back({ const_cast<char*>(writeBuff_.Peek()), writeBuff_.ReadableBytes() });
+    ws_ = std::make_shared<WebSocket>(handler, fd_, serial_);
+    ws_->Open(); // onOpen中发送的消息排在101之后
+    return true;
+}
+
+bool HttpConn::SubscribeSse_() {
+    if(request_.method() != "GET" || !EventStream::IsTopic(request_.path())) {
+        return false;
+    }
+    // 没有Content-Length，响应体一直持续到连接关闭
+    writeBuff_.RetrieveAll();
+    writeBuff_.Append("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                      "Connection: keep-alive\r\nX-Accel-Buffering: no\r\n\r\n");
+    iov_.clear();
+    iovIdx_ = 0;
+    iov_.push_back({ const_cast<char*>(writeBuff_.Peek()), writeBuff_.ReadableBytes() });
+    sse_ = EventStream::Subscribe(request_.path(), fd_);
+    return true;
+}
+
+bool HttpConn::StartProxy_(ProxyRoute* route, size_t headLen) {
+    if(!proxy_) {
+        // 用户态TLS必须在用户态加密，不能把上游的数据直接splice到socket
+        bool splice = true;
+#ifdef USE_TLS
+        splice = !ssl_ || ktlsSend_;
+#endif
+        proxy_.reset(new ProxyConn(splice));
+    }
+    bool keepAlive = maxRequests == 0 || requests_ < maxRequests;
+    if(!keepAlive) { maxRequestCloseCount++; }
+    proxy_->Start(route, readBuff_, headLen, addr_, IsTls(), keepAlive);
+    proxied_ = true;
+    return ProxyStep_();
+}
+
+bool HttpConn::RejectProxy_(size_t headLen) {
+    // 不读请求体：没有请求体时只丢弃请求头，保持连接；否则回复之后关闭连接
+    bool hasBody = request_.Header("Content-Length") || request_.Header("Transfer-Encoding");
+    if(hasBody) {
+        readBuff_.RetrieveAll();
+    } else {
+        readBuff_.Retrieve(headLen);
+    }
+    InitResponse_(ctx_.Code(), !hasBody);
+    response_.MakeResponse(writeBuff_);
+    ctx_.SetCode(response_.Code());
+    ctx_.SetBytes(writeBuff_.ReadableBytes() + response_.BodyBytes());
+    ServerPipeline::Instance()->After(ctx_);
+    PrepareIov_();
+    return true;
+}
+
+bool HttpConn::ProxyStep_() {
+    writeBuff_.RetrieveAll();
+    proxy_->Advance(readBuff_, writeBuff_);
+    iov_.clear();
+    iovIdx_ = 0;
+    if(writeBuff_.ReadableBytes() > 0) {
+        iov_.push_back({ const_cast<char*>(writeBuff_.Peek()), writeBuff_.ReadableBytes() });
+    }
+    // 出错结束时即使没有数据要发也走写流程，由IsKeepAlive()决定是否关闭连接
+    return ToWriteBytes() > 0 || proxy_->GetWant() == ProxyConn::DONE;
+}
+
 // HttpConn是连接，对应请求和相应
 bool HttpConn::process() {
+    if(IsPush()) {
+        return ProcessPush_();
+    }
+    if(IsProxying()) {
+        assert(proxy_->GetWant() == ProxyConn::CLIENT_READ);
+        return ProxyStep_(); // 收到了更多的请求体
+    }
+#ifdef USE_CORO
+    if(IsAsync()) {
+        return ProcessAsync_(false); // 被唤醒或收到了后续数据
+    }
+#endif
+    // 连接前言(h2c prior knowledge)或ALPN协商之后是HTTP/2，不再按HTTP/1.1解析
+    if(!h2_ && Http2Session::IsPreface(readBuff_.Peek(), readBuff_.ReadableBytes())) {
+        h2_.reset(new Http2Session(srcDir, addr_, IsTls()));
+    }
+    if(h2_) {
+        return ProcessH2_();
+    }
     // Http request初始化，封装为request对象
     request_.Init();
     // 检查是否有数据可读
     if(readBuff_.ReadableBytes() <= 0) {
         // 判断readBuff可读的字节数是否小于等于0，是的话不需要解析
+        // 上一个响应已经发完，连接进入空闲，等待下一个请求
+        if(requests_ > 0) { idleSinceMs_ = NowMs(); }
+        Reclaim_();
         return false;
     }
-    // 调用parse解析readBuff_(重点！)
-    else if(request_.parse(readBuff_)) {
+    // 反向代理：只看请求行的目标，请求头完整之后原样改写转发
+    ProxyRoute* route = nullptr;
+    size_t headLen = 0;
+    proxied_ = false;
+    if(!ProxyRoute::Empty()) {
+        route = ProxyConn::Peek(readBuff_, &headLen);
+        if(route && headLen == 0 && readBuff_.ReadableBytes() < ProxyConn::MAX_HEAD) {
+            return false; // 等待请求头的剩余部分
+        }
+    }
+    // 调用parse解析readBuff_(重点！)：请求头和请求体到齐之后才处理，只取走这一个请求，
+    // 流水线中的下一个请求留在readBuff_中，本次响应发完之后处理；请求头过长的代理请求直接回复400
+    HttpRequest::HTTP_CODE parsed = HttpRequest::BAD_REQUEST;
+    if(!route) {
+        parsed = request_.parse(readBuff_);
+        if(parsed == HttpRequest::NO_REQUEST) {
+            return false; // 等待请求的剩余部分
+        }
+    }
+    idleSinceMs_ = 0;
+    requests_++;
+    requestCount++;
+    if(requests_ > 1) { reuseCount++; }
+    ServerPipeline* middleware = ServerPipeline::Instance();
+    if(route && headLen > 0) {
+        // 代理的请求同样要经过中间件(限流、认证)：只解析请求头，readBuff_中的数据不动，通过后原样转发
+        ctx_.Reset(&request_, addr_, IsTls());
+        if(!request_.ParseHead(readBuff_.Peek(), headLen)) {
+            ctx_.Reject(400);
+            return RejectProxy_(headLen);
+        }
+        if(!middleware->Before(ctx_)) {
+            return RejectProxy_(headLen);
+        }
+        return StartProxy_(route, headLen);
+    }
+    if(parsed == HttpRequest::GET_REQUEST) {
         LOG_DEBUG("%s", request_.path().c_str());
+        // 中间件在升级和路由之前检查请求，拒绝时code为错误码
+        ctx_.Reset(&request_, addr_, IsTls());
+        int code = middleware->Before(ctx_) ? 200 : ctx_.Code();
+        if(code == 200) {
+            if(UpgradeH2c_()) {
+                ctx_.SetCode(101);
+                middleware->After(ctx_);
+                return ProcessH2_();
+            }
+            if(UpgradeWebSocket_() || SubscribeSse_()) {
+                ctx_.SetCode(ws_ ? 101 : 200);
+                ctx_.SetBytes(writeBuff_.ReadableBytes()); // 握手响应或事件流的响应头
+                middleware->After(ctx_);
+                return true;
+            }
+        }
+#ifdef USE_CORO
+        const Router::Route* handler = request_.GetRoute();
+        if(code == 200 && handler && handler->async) {
+            // 协程在这里开始执行，挂起时连接按等待的对象登记
+            async_ = std::make_shared<AsyncCall>(fd_, handler->async(request_));
+            return ProcessAsync_(true);
+        }
+#endif
         // 解析成功，初始化响应
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);// response_响应，即生成的响应对象
-        // 因为是解析成功，所以状态码为200
+        InitResponse_(code);
     } else {
         // 解析失败，状态码为400
         response_.Init(srcDir, request_.path(), false, 400);
     }
     // 放在writeBuff_中，响应的缓冲区
     response_.MakeResponse(writeBuff_);// 创造响应，数据保存在writeBuff_(因为响应是在请求被读取存储在readBuff_后解析之后发送的，存储在writeBuff_)
+    if(parsed == HttpRequest::GET_REQUEST) {
+        ctx_.SetCode(response_.Code());
+        ctx_.SetBytes(writeBuff_.ReadableBytes() + response_.BodyBytes());
+        middleware->After(ctx_);
+    }
+    PrepareIov_();
+    return true;
+}
+
+void HttpConn::InitResponse_(int code, bool keepAlive) {
+    // 达到单个连接的请求数上限后本次响应关闭连接
+    keepAlive = keepAlive && request_.IsKeepAlive();
+    if(keepAlive && maxRequests > 0 && requests_ >= maxRequests) {
+        keepAlive = false;
+        maxRequestCloseCount++;
+    }
+    response_.Init(srcDir, request_.path(), keepAlive, code, &request_);// response_响应，即生成的响应对象
+    response_.SetKeepAliveMax(maxRequests > 0 ? maxRequests - requests_ : -1);
+    response_.SetExtraHeaders(ctx_.Headers(), ctx_.HeadersLen());
+}
+
+void HttpConn::PrepareIov_() {
     // read请求的时候分散读，write响应的时候也是分散写
     /* 响应头 */
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
+    iov_.clear();
+    iovIdx_ = 0;
+    iov_.push_back({ const_cast<char*>(writeBuff_.Peek()), writeBuff_.ReadableBytes() });
 
-    /* 文件 */
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;// 内存块的大小为2
+    /* 响应体：整个文件、单个范围，或multipart的多个分段 */
+    const std::vector<struct iovec>& body = response_.BodyIov();
+    iov_.insert(iov_.end(), body.begin(), body.end());
+    LOG_DEBUG("filesize:%zu, %d  to %zu", response_.FileLen() , (int)iov_.size(), ToWriteBytes());
+}
+
+#ifdef USE_CORO
+bool HttpConn::ProcessAsync_(bool ready) {
+    // 等待事件时，其他原因的唤醒(如客户端发来的后续请求)不恢复协程
+    if(!ready && async_->GetWant() == AsyncCall::WAIT_EVENT && !async_->TakeReady()) {
+        return false;
+    }
+    async_->Resume();
+    if(async_->GetWant() != AsyncCall::DONE) {
+        return false; // 再次挂起，由WebServer::Rearm_按等待的对象登记
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
+    Reply& reply = async_->GetReply();
+    InitResponse_(reply.code);
+    response_.MakeReply(writeBuff_, reply.type, reply.body);
+    async_.reset();
+    ctx_.SetCode(response_.Code());
+    ctx_.SetBytes(writeBuff_.ReadableBytes() + response_.BodyBytes());
+    ServerPipeline::Instance()->After(ctx_);
+    PrepareIov_();
     return true;
 }
+#endif
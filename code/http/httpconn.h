@@ -9,15 +9,26 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/ioctl.h>   // FIONREAD
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <chrono>
+#include <memory>
 
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
+#include "../pool/memorybudget.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "http2session.h"
+#include "websocket.h"
+#include "eventstream.h"
+#include "proxyconn.h"
+#include "middleware.h"
+#include "asynctask.h"
+#include "tlscontext.h"
 
 class HttpConn {
 public:
@@ -25,7 +36,8 @@ public:
 
     ~HttpConn();
 
-    void init(int sockFd, const sockaddr_in& addr);
+    // tls为true时在这个连接上进行TLS握手
+    void init(int sockFd, const sockaddr_in& addr, bool tls = false);
 
     ssize_t read(int* saveErrno);
 
@@ -43,33 +55,189 @@ public:
     
     bool process();
 
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    // 64位，超过2GB的文件不会溢出
+    size_t ToWriteBytes() const {
+        size_t bytes = proxy_ ? proxy_->PipeBytes() : 0;
+        for(size_t i = iovIdx_; i < iov_.size(); i++) {
+            bytes += iov_[i].iov_len;
+        }
+        return bytes;
     }
 
+    // 由请求的Connection头部、协议版本和单个连接的请求数上限共同决定；
+    // HTTP/2直到GOAWAY、WebSocket直到关闭帧、SSE直到被断开都保持连接
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        if(IsAsync()) { return true; } // 响应还没有生成
+        if(proxied_) { return proxy_->KeepAlive(); }
+        if(ws_) { return !ws_->IsClosing(); }
+        if(sse_) { return !sse_->IsClosing(); }
+        return h2_ ? !h2_->IsClosing() : response_.IsKeepAlive();
     }
 
+    // 空闲(上一个响应已发完，还没有收到下一个请求)开始的时间，0表示不在空闲状态
+    int64_t IdleSinceMs() const { return idleSinceMs_; }
+    // 最近一次有读写事件的时间，只在主线程中读写
+    int64_t LastActiveMs() const { return lastActiveMs_; }
+    void SetLastActiveMs(int64_t ms) { lastActiveMs_ = ms; }
+    static int64_t NowMs() { return NowUs_() / 1000; }
+
+    // 限速时距离下一次允许发送还有多少毫秒，0表示可以立即发送
+    int ThrottleDelayMs() const;
+    // 连接序号，fd被复用后序号不同，用于判断延迟任务是否还属于原来的连接
+    uint64_t Serial() const { return serial_; }
+    bool IsClosed() const { return isClose_; }
+    bool IsTls() const;
+    // 已切换到HTTP/2：写响应的同时也要读对端的帧(WINDOW_UPDATE、新的请求)
+    bool IsHttp2() const { return h2_ != nullptr; }
+    // 已升级为WebSocket或SSE订阅：可能有其他线程推送的数据要发送
+    bool IsPush() const { return Push_() != nullptr; }
+    // 工作线程处理完推送连接后登记事件，见PushTarget::Arm
+    void ArmPush(const std::function<void(bool pending)>& mod) { Push_()->Arm(mod); }
+    // 主线程分发事件之前调用
+    void DisarmPush() {
+        if(IsPush()) { Push_()->Disarm(); }
+#ifdef USE_CORO
+        if(async_) { async_->Disarm(); }
+#endif
+    }
+    // 主线程的定时器：发送WebSocket的ping或SSE的注释行，对端失去响应时返回false
+    bool Heartbeat() { return Push_()->Heartbeat(); }
+    // 当前请求由反向代理转发且还没有结束
+    bool IsProxying() const { return proxied_ && proxy_->GetWant() != ProxyConn::DONE; }
+    ProxyConn::Want ProxyWant() const { return proxy_->GetWant(); }
+    int UpstreamFd() const {
+#ifdef USE_CORO
+        if(IsAsync()) { return async_->WaitFd(); }
+#endif
+        return proxied_ ? proxy_->UpstreamFd() : -1;
+    }
+    // 上游fd(或异步处理函数等待的fd)就绪时调用，返回true表示有数据要发给客户端
+    bool ProcessUpstream() {
+#ifdef USE_CORO
+        if(IsAsync()) { return ProcessAsync_(true); }
+#endif
+        return ProxyStep_();
+    }
+    // 异步处理函数挂起，等待fd就绪或事件到达
+    bool IsAsync() const {
+#ifdef USE_CORO
+        return async_ != nullptr;
+#else
+        return false;
+#endif
+    }
+    // 等待的fd，-1表示等待事件；write为等待可写
+    int AsyncWaitFd(bool* write) const {
+#ifdef USE_CORO
+        *write = async_->GetWant() == AsyncCall::WAIT_WRITE;
+        return async_->GetWant() == AsyncCall::WAIT_EVENT ? -1 : async_->WaitFd();
+#else
+        return -1;
+#endif
+    }
+    // 等待事件时登记连接，见PushTarget::Arm
+    void ArmAsync(const std::function<void(bool pending)>& mod) {
+#ifdef USE_CORO
+        async_->Arm(mod);
+#endif
+    }
+
+    // 读写缓冲区当前占用的内存
+    size_t MemoryBytes() const;
+    // 工作线程处理完一轮之后更新内存统计，总量登记在MemoryBudget::CONN_BUFFER
+    void UpdateMemory() { UpdateMemory_(MemoryBytes()); }
+
     static bool isET;
     static const char* srcDir; // 资源的目录(静态，被所有资源共享)
     static std::atomic<int> userCount; // 总共的客户端连接数(静态，被所有资源共享)
+    static size_t writeQuantum; // 每轮最多写出的字节数，写满后让出线程回到reactor，大文件不会长期占用线程
+    static size_t rateLimit; // 每个连接的发送速率上限(字节/秒)，0表示不限速
+    static int maxRequests; // 单个连接最多处理的请求数，0表示不限
+
+    /* 连接复用统计 */
+    static std::atomic<uint64_t> requestCount; // 处理的请求总数
+    static std::atomic<uint64_t> reuseCount; // 在已有连接上处理的请求数(不是连接上的第一个请求)
+    static std::atomic<uint64_t> maxRequestCloseCount; // 达到请求数上限而关闭的连接数
+
+    /* 连接内存统计 */
+    static const int MEMORY_BUCKETS = 5;
+    static const size_t MEMORY_LIMITS[MEMORY_BUCKETS - 1]; // 各档的上限：0、4KB、16KB、64KB，最后一档不限
+    static std::atomic<int64_t> memoryConns[MEMORY_BUCKETS]; // 占用内存在各档的连接数
     
 private:
+    bool NextChunk_(); // 响应体是流式的时候，取下一段放入writeBuff_
+    bool ProcessH2_(); // HTTP/2：处理收到的帧，生成下一批要发送的帧
+    bool UpgradeH2c_(); // HTTP/1.1请求带Upgrade: h2c时切换到HTTP/2
+    bool ProcessPush_(); // WebSocket解析收到的帧，SSE丢弃收到的数据；取出排队的数据发送
+    bool UpgradeWebSocket_(); // 请求升级到已注册处理函数的路径时回复101，切换到WebSocket
+    bool SubscribeSse_(); // GET已注册的SSE主题时回复event-stream响应头，成为订阅者
+    bool StartProxy_(ProxyRoute* route, size_t headLen); // 请求目标匹配代理路由时转发给上游
+    bool ProxyStep_(); // 推进代理，要发给客户端的数据放入writeBuff_或管道
+    bool RejectProxy_(size_t headLen); // 中间件拒绝了代理的请求，回复错误页，不转发
+    void InitResponse_(int code, bool keepAlive = true); // 按请求和连接的请求数上限初始化response_
+    void PrepareIov_(); // 响应头和响应体分段放入iov_
+    void Reclaim_(); // 连接空闲时把缓冲区的存储还给池
+    void UpdateReadHint_(size_t bytes); // 按本次读到的字节数调整下一次读的预估大小
+    void UpdateMemory_(size_t bytes);
+    static int MemoryBucket_(size_t bytes);
+#ifdef USE_CORO
+    // 恢复异步处理函数，结束时生成响应；ready为false时只在等待的事件已经到达时恢复
+    bool ProcessAsync_(bool ready);
+#endif
+    PushTarget* Push_() const { return ws_ ? (PushTarget*)ws_.get() : sse_.get(); }
+    ssize_t Send_(size_t limit, int* saveErrno); // 从iov_[iovIdx_]开始发送至多limit字节
+    void Pace_(size_t bytes); // 限速：记录本次发送的字节数
+    static int64_t NowUs_();
+
+    static const int64_t BURST_US = 100 * 1000; // 限速时允许积攒的突发额度(100ms)
+    static const size_t MAX_READ_HINT = 64 * 1024; // 读的预估大小上限
+    static const size_t IOV_KEEP = 64; // 空闲时分段表保留的容量
+    static std::atomic<uint64_t> serialCount_;
    
     int fd_;
     struct  sockaddr_in addr_;
 
     bool isClose_;
+    uint64_t serial_;
+    std::atomic<int64_t> nextSendUs_; // 限速：按已发送字节数推算的下一次允许发送的时间
+    int requests_; // 本连接已处理的请求数
+    std::atomic<int64_t> idleSinceMs_; // 由工作线程设置，主线程的超时回调读取
+    int64_t lastActiveMs_;
+    size_t readHint_; // 以往读到的数据量，FIONREAD偏小(如TLS)时按它预留读缓冲区
+    size_t memBytes_; // 上次统计时占用的内存
+    size_t memPeak_; // 占用内存的峰值，关闭时记入日志
+
+#ifdef USE_TLS
+    ssize_t TlsRead_(int* saveErrno);
+    bool Handshake_(int* saveErrno);
+    static int SslErrno_(SSL* ssl, int ret); // SSL错误转换为errno，需要等待读写时为EAGAIN
+
+    SSL* ssl_;
+    bool handshakeDone_;
+    bool ktlsSend_; // 发送方向由内核加密，可以继续用sendmsg直接写socket
+    static const size_t TLS_RECORD = 16 * 1024; // 用户态加密时每次SSL_write的最大长度
+#endif
     
-    int iovCnt_;
-    struct iovec iov_[2];
+    std::unique_ptr<Http2Session> h2_; // 非空表示这是HTTP/2连接
+    std::shared_ptr<WebSocket> ws_; // 非空表示这是WebSocket连接，处理函数可以持有它在其他线程推送
+    std::shared_ptr<EventStream> sse_; // 非空表示这是SSE订阅连接
+    std::unique_ptr<ProxyConn> proxy_; // 第一次代理请求时创建，管道在之后的请求中复用
+    bool proxied_; // 当前请求由proxy_处理
+#ifdef USE_CORO
+    AsyncCall::Ptr async_; // 进行中的异步处理函数，结束后释放
+#endif
+
+    // iov_[0]是writeBuff_中的响应头，其后是响应体的各个分段
+    // HTTP/2连接中是writeBuff_中的帧头和响应体切片交替排列
+    std::vector<struct iovec> iov_;
+    size_t iovIdx_; // 第一个还没有写完的分段
     
     Buffer readBuff_; // 读缓冲区
     Buffer writeBuff_; // 写缓冲区
 
     HttpRequest request_;
     HttpResponse response_;
+    RequestContext ctx_; // 中间件上下文，保持连接的各个请求复用
 };
 
 
@@ -6,93 +6,242 @@
 #include "httprequest.h"
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
-
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
-
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    // 只清空，字符串和字段表的容量、arena_的块都留给下一个请求
+    method_.clear();
+    path_.clear();
+    version_.clear();
+    target_.clear();
     state_ = REQUEST_LINE;
-    header_.clear(); // map集合，清空
-    post_.clear(); // map集合，清空
+    header_.clear();
+    post_.clear();
+    body_ = nullptr;
+    bodyLen_ = 0;
+    arena_.Reset();
+    route_ = nullptr;
+    params_.count = 0;
+    dbUs_ = -1;
+}
+
+HttpRequest& HttpRequest::operator=(const HttpRequest& other) {
+    if(this == &other) {
+        return *this;
+    }
+    Init();
+    state_ = other.state_;
+    method_ = other.method_;
+    path_ = other.path_;
+    version_ = other.version_;
+    target_ = other.target_;
+    dbUs_ = other.dbUs_;
+    for(const Field& field: other.header_) {
+        SetField_(header_, field.name, strlen(field.name), field.value, field.valueLen);
+    }
+    for(const Field& field: other.post_) {
+        SetField_(post_, field.name, strlen(field.name), field.value, field.valueLen);
+    }
+    if(other.body_) {
+        bodyLen_ = other.bodyLen_;
+        body_ = arena_.Copy(other.body_, bodyLen_);
+    }
+    route_ = other.route_;
+    params_ = other.params_;
+    return *this;
 }
 
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    // HTTP/1.1默认保持连接，除非带Connection: close；HTTP/1.0需要显式的Connection: keep-alive
+    if(HasToken_("Connection", "close")) {
+        return false;
+    }
+    return version_ == "1.1" || HasToken_("Connection", "keep-alive");
+}
+
+bool HttpRequest::IsUpgrade(const char* protocol) const {
+    // 例如 Connection: keep-alive, Upgrade 和 Upgrade: websocket
+    return version_ == "1.1" && HasToken_("Connection", "upgrade") && HasToken_("Upgrade", protocol);
+}
+
+const HttpRequest::Field* HttpRequest::FindField_(const vector<Field>& fields, const char* name, size_t len) {
+    for(const Field& field: fields) {
+        if(strncmp(field.name, name, len) == 0 && field.name[len] == '\0') {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+void HttpRequest::SetField_(vector<Field>& fields, const char* name, size_t nameLen,
+                            const char* value, size_t valueLen) {
+    // 同名字段后出现的覆盖之前的
+    Field* field = const_cast<Field*>(FindField_(fields, name, nameLen));
+    if(!field) {
+        fields.push_back({ arena_.Copy(name, nameLen), nullptr, 0 });
+        field = &fields.back();
+    }
+    field->value = arena_.Copy(value, valueLen);
+    field->valueLen = valueLen;
+}
+
+const HttpRequest::Field* HttpRequest::FindHeader_(const char* key) const {
+    // 头部名称大小写无关
+    for(const Field& field: header_) {
+        if(strcasecmp(field.name, key) == 0) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+const char* HttpRequest::Header(const char* key) const {
+    const Field* field = FindHeader_(key);
+    return field ? field->value : nullptr;
+}
+
+bool HttpRequest::HasToken_(const char* key, const char* token) const {
+    // 值是逗号分隔、大小写无关的列表
+    const Field* field = FindHeader_(key);
+    if(!field) {
+        return false;
+    }
+    const char* p = field->value;
+    const char* end = p + field->valueLen;
+    size_t tokenLen = strlen(token);
+    while(p < end) {
+        const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+        if(!comma) { comma = end; }
+        const char* first = p;
+        const char* last = comma;
+        while(first < last && (*first == ' ' || *first == '\t')) { first++; }
+        while(last > first && (last[-1] == ' ' || last[-1] == '\t')) { last--; }
+        if((size_t)(last - first) == tokenLen && strncasecmp(first, token, tokenLen) == 0) {
+            return true;
+        }
+        p = comma + 1;
     }
     return false;
 }
 
 // 涉及了有限状态机的概念
-bool HttpRequest::parse(Buffer& buff) {
+// 请求头以空行结束，请求体的长度由Content-Length给出；请求不完整时不消费缓冲区，等待更多数据，
+// 完整时只取走这一个请求，之后的数据(流水线中的下一个请求)留在buff中
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
     const char CRLF[] = "\r\n";// http请求报文格式中每行都有 回车符和换行符
-    if(buff.ReadableBytes() <= 0) {
-        // 获取可读的字节数进行判断
-        return false;
+    const char BLANK[] = "\r\n\r\n"; // 请求头结束的空行
+    // 请求之间多余的空行忽略(例如有的客户端在POST请求体之后多发一个CRLF)
+    while(buff.ReadableBytes() >= 2 && buff.Peek()[0] == '\r' && buff.Peek()[1] == '\n') {
+        buff.Retrieve(2);
     }
-    // 默认state_是=requestline，解析请求首行
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 获取一行数据，根据\r\n为结束标志
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2); // lineEnd，当前行结束的位置
-        std::string line(buff.Peek(), lineEnd);
-        switch(state_)
-        {
-        case REQUEST_LINE:
-            // 判断，决定解析模式
-            if(!ParseRequestLine_(line)) {
-                return false;
-            }
-            ParsePath_(); // 解析路径的资源
-            break;    
-        case HEADERS:
-            // 判断，决定解析模式
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH; // 可读字节数<=2,已经结束了
-            }
-            break;
-        case BODY:
-            // 判断，决定解析模式
-            ParseBody_(line); // 解析请求体
-            break;
-        default:
+    const char* begin = buff.Peek();
+    const char* end = buff.BeginWriteConst();
+    const char* headEnd = search(begin, end, BLANK, BLANK + 4);
+    if(headEnd == end) {
+        // 请求头过长，不再等待
+        return buff.ReadableBytes() > MAX_HEAD ? BAD_REQUEST : NO_REQUEST;
+    }
+    // 解析请求首行
+    const char* lineEnd = search(begin, headEnd + 2, CRLF, CRLF + 2);
+    if(!ParseRequestLine_(begin, lineEnd)) {
+        return BAD_REQUEST;
+    }
+    // 逐行解析请求头，每行以\r\n结尾
+    for(const char* line = lineEnd + 2; line < headEnd + 2; line = lineEnd + 2) {
+        lineEnd = search(line, headEnd + 2, CRLF, CRLF + 2);
+        ParseHeader_(line, lineEnd);
+    }
+    state_ = BODY;
+    size_t bodyLen = 0;
+    if(!BodyLength_(&bodyLen)) {
+        return BAD_REQUEST;
+    }
+    size_t headLen = headEnd + 4 - begin;
+    if(buff.ReadableBytes() - headLen < bodyLen) {
+        return NO_REQUEST; // 请求体还没有收全
+    }
+    buff.Retrieve(headLen);
+    if(bodyLen > 0) {
+        ParseBody_(buff.Peek(), buff.Peek() + bodyLen); // 解析请求体
+        buff.Retrieve(bodyLen);
+    }
+    state_ = FINISH;
+    ParsePath_(); // 解析路径的资源
+    // 请求完整之后再改写，改写函数可以使用头部和表单；改写了路径时按新路径重新匹配，
+    // 别名之后的路由同样生效(例如POST /login -> /login.html之后的登录验证)，次数有限防止循环
+    for(int i = 0; i < MAX_REWRITES && route_ && route_->rewrite; i++) {
+        string path = path_;
+        route_->rewrite(*this);
+        if(path_ == path) {
             break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; } // 如果lineEnd是buff的头部的话，就说明解析完成，退出
-        buff.RetrieveUntil(lineEnd + 2); // 移动读指针的位置
+        ParsePath_();
     }
     LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
+    return GET_REQUEST;
 }
 
-void HttpRequest::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html"; 
+bool HttpRequest::BodyLength_(size_t* len) const {
+    // 不支持分块编码的请求体
+    if(FindHeader_("Transfer-Encoding")) {
+        LOG_ERROR("Transfer-Encoding unsupported");
+        return false;
     }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
+    const Field* field = FindHeader_("Content-Length");
+    if(!field) {
+        *len = 0;
+        return true;
+    }
+    if(field->valueLen == 0 || field->valueLen > 18
+       || strspn(field->value, "0123456789") != field->valueLen) {
+        LOG_ERROR("Content-Length Error");
+        return false;
+    }
+    *len = strtoull(field->value, nullptr, 10);
+    return true;
+}
+
+bool HttpRequest::ParseHead(const char* begin, size_t len) {
+    const char CRLF[] = "\r\n";
+    const char* end = begin + len;
+    while(begin < end && state_ != BODY) {
+        const char* lineEnd = search(begin, end, CRLF, CRLF + 2);
+        if(state_ == REQUEST_LINE) {
+            if(!ParseRequestLine_(begin, lineEnd)) {
+                return false;
             }
+        } else {
+            ParseHeader_(begin, lineEnd);
         }
+        if(lineEnd == end) { break; }
+        begin = lineEnd + 2;
     }
+    return state_ != REQUEST_LINE;
 }
 
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    // 正则表达式
-    // GET / HTTP/1.1
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;
-    // line-要匹配的字符串 subMatch-匹配数据保存在这里 patten-匹配模式
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
+void HttpRequest::ParsePath_() {
+    // 默认网页的别名、表单提交等都注册在路由表中，见WebServer::InitHandlers_
+    route_ = Router::Instance()->Match(method_, path_, &params_);
+}
+
+string HttpRequest::Param(const char* name) const {
+    for(int i = 0; i < params_.count; i++) {
+        const Router::Params::Item& item = params_.items[i];
+        if(strcmp(item.name, name) == 0 && item.begin + item.len <= path_.size()) {
+            return path_.substr(item.begin, item.len);
+        }
+    }
+    return "";
+}
+
+bool HttpRequest::ParseRequestLine_(const char* begin, const char* end) {
+    // GET / HTTP/1.1：以两个空格分成三段，第三段以HTTP/开头，各段中没有空格
+    const char* sp1 = find(begin, end, ' ');
+    const char* sp2 = sp1 == end ? end : find(sp1 + 1, end, ' ');
+    const char* ver = sp2 == end ? end : sp2 + 1;
+    if(sp2 != end && end - ver >= 5 && strncmp(ver, "HTTP/", 5) == 0 && find(ver, end, ' ') == end) {
+        method_.assign(begin, sp1);
+        path_.assign(sp1 + 1, sp2);
+        target_ = path_;
+        version_.assign(ver + 5, end);
         state_ = HEADERS;// 改变状态为请求头
         return true;
     }
@@ -100,11 +249,13 @@ bool HttpRequest::ParseRequestLine_(const string& line) {
     return false;
 }
 // 判断，决定解析模式
-void HttpRequest::ParseHeader_(const string& line) {
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+void HttpRequest::ParseHeader_(const char* begin, const char* end) {
+    // 名称: 值(冒号后至多一个空格)，没有冒号的行(空行)表示头部结束
+    const char* colon = find(begin, end, ':');
+    if(colon != end) {
+        const char* value = colon + 1;
+        if(value < end && *value == ' ') { value++; }
+        SetField_(header_, begin, colon - begin, value, end - value);
     }
     else {
         // 解析头结束，则模式变为解析体
@@ -112,11 +263,12 @@ void HttpRequest::ParseHeader_(const string& line) {
     }
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+void HttpRequest::ParseBody_(const char* begin, const char* end) {
+    bodyLen_ = end - begin;
+    body_ = arena_.Copy(begin, bodyLen_);
     ParsePost_();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%s, len:%d", body_, (int)bodyLen_);
 }
 
 int HttpRequest::ConverHex(char ch) {
@@ -126,40 +278,28 @@ int HttpRequest::ConverHex(char ch) {
 }
 
 void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
-        // 解析表单信息
+    const char* type = Header("Content-Type");
+    if(method_ == "POST" && type && strcmp(type, "application/x-www-form-urlencoded") == 0) {
+        // 解析表单信息，登录、注册由路由表中的改写函数处理
         ParseFromUrlencoded_();
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                // 如果插入成功，返回welcome
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                // 插入失败，返回error
-                else {
-                    path_ = "/error.html";
-                }
-            }
-        }
     }   
 }
 
 void HttpRequest::ParseFromUrlencoded_() {
-    if(body_.size() == 0) { return; }
+    if(bodyLen_ == 0) { return; }
 
-    string key, value;
+    const char* key = "";
+    size_t keyLen = 0;
     int num = 0;
-    int n = body_.size();
+    int n = bodyLen_;
     int i = 0, j = 0;
 
     for(; i < n; i++) {
         char ch = body_[i];
         switch (ch) {
         case '=':
-            key = body_.substr(j, i - j);
+            key = body_ + j;
+            keyLen = i - j;
             j = i + 1;
             break;
         case '+':
@@ -173,19 +313,18 @@ void HttpRequest::ParseFromUrlencoded_() {
             i += 2;
             break;
         case '&':
-            value = body_.substr(j, i - j);
+            // 键值直接引用body_中的位置，SetField_拷贝时补上结尾
+            SetField_(post_, key, keyLen, body_ + j, i - j);
+            LOG_DEBUG("%.*s = %.*s", (int)keyLen, key, i - j, body_ + j);
             j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
             break;
         default:
             break;
         }
     }
     assert(j <= i);
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+    if(!FindField_(post_, key, keyLen) && j < i) {
+        SetField_(post_, key, keyLen, body_ + j, i - j);
     }
 }
 
@@ -256,33 +395,34 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     return flag;
 }
 
-std::string HttpRequest::path() const{
+const std::string& HttpRequest::path() const{
     return path_;
 }
 
 std::string& HttpRequest::path(){
     return path_;
 }
-std::string HttpRequest::method() const {
+const std::string& HttpRequest::method() const {
     return method_;
 }
 
-std::string HttpRequest::version() const {
+const std::string& HttpRequest::version() const {
     return version_;
 }
 
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
+    return GetPost(key.c_str());
 }
 
 std::string HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
-}
\ No newline at end of file
+    const Field* field = FindField_(post_, key, strlen(key));
+    return field ? string(field->value, field->valueLen) : "";
+}
+
+std::string HttpRequest::GetHeader(const std::string& key) const {
+    assert(key != "");
+    const Field* field = FindHeader_(key.c_str());
+    return field ? string(field->value, field->valueLen) : "";
+}
@@ -9,14 +9,17 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>
+#include <vector>
 #include <errno.h>     
+#include <strings.h>   // strcasecmp
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/arena.h"
+#include "router.h"
 
 class HttpRequest {
 public:
@@ -28,7 +31,7 @@ public:
     };
 
     enum HTTP_CODE {
-        NO_REQUEST = 0, // 没有请求
+        NO_REQUEST = 0, // 请求不完整，等待更多数据
         GET_REQUEST, // 获得请求
         BAD_REQUEST, // 错误的请求
         NO_RESOURSE, // 没有资源
@@ -38,20 +41,45 @@ public:
         CLOSED_CONNECTION, // 连接关闭
     };
     
-    HttpRequest() { Init(); } // 构造函数，初始化
+    HttpRequest() : body_(nullptr), bodyLen_(0) { Init(); } // 构造函数，初始化
     ~HttpRequest() = default;
+    // 拷贝时字段重新复制到自己的arena_中(h2c升级时把请求交给流)
+    HttpRequest(const HttpRequest& other) : body_(nullptr), bodyLen_(0) { *this = other; }
+    HttpRequest& operator=(const HttpRequest& other);
 
     void Init();
-    bool parse(Buffer& buff);
+    // 解析buff中的一个完整请求：GET_REQUEST表示完整并已从buff中取走，NO_REQUEST表示还不完整(buff不动)，
+    // BAD_REQUEST表示格式错误
+    HTTP_CODE parse(Buffer& buff);
+    // 只解析[begin, begin + len)中完整的请求行和头部，不消费缓冲区、不匹配路由(反向代理的请求交给中间件检查)
+    bool ParseHead(const char* begin, size_t len);
 
-    std::string path() const;
+    const std::string& path() const;
     std::string& path();
-    std::string method() const;
-    std::string version() const;
+    const std::string& method() const;
+    const std::string& version() const;
+    const std::string& target() const { return target_; } // 请求行中的原始目标，路由改写path之前
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    std::string GetHeader(const std::string& key) const; // 获取请求头字段(名称大小写无关)，不存在返回空串
+    const char* Header(const char* key) const; // 不拷贝，不存在返回nullptr；下一个请求Init之前有效
 
     bool IsKeepAlive() const;
+    // 是否请求切换到protocol(例如websocket、h2c)：Connection中有upgrade，Upgrade中有该协议
+    bool IsUpgrade(const char* protocol) const;
+
+    // 请求行匹配到的路由，没有时为nullptr
+    const Router::Route* GetRoute() const { return route_; }
+    // 路由模式中捕获的参数，例如"/user/:id"中的id；不存在返回空串
+    std::string Param(const char* name) const;
+    const Router::Params& GetParams() const { return params_; }
+
+    // 处理函数记录数据库查询的耗时，写入访问日志(-1表示没有查询)
+    void AddDbTime(int64_t us) { dbUs_ = (dbUs_ < 0 ? 0 : dbUs_) + us; }
+    int64_t DbUs() const { return dbUs_; }
+
+    // 验证用户登录(isLogin为false时注册)
+    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
 
     /* 
     todo 
@@ -60,24 +88,43 @@ public:
     */
 
 private:
-    bool ParseRequestLine_(const std::string& line);// 解析请求首行
-    void ParseHeader_(const std::string& line); // 解析请求头
-    void ParseBody_(const std::string& line); // 解析请求体
+    // 请求头和表单字段，名称和值都拷贝在arena_中，以'\0'结尾
+    struct Field {
+        const char* name;
+        const char* value;
+        size_t valueLen;
+    };
 
-    void ParsePath_(); // 解析请求路径
+    bool ParseRequestLine_(const char* begin, const char* end);// 解析请求首行
+    void ParseHeader_(const char* begin, const char* end); // 解析请求头
+    void ParseBody_(const char* begin, const char* end); // 解析请求体
+    bool BodyLength_(size_t* len) const; // 由Content-Length得到请求体的长度
+
+    const Field* FindHeader_(const char* key) const; // 头部名称大小写无关
+    static const Field* FindField_(const std::vector<Field>& fields, const char* name, size_t len);
+    void SetField_(std::vector<Field>& fields, const char* name, size_t nameLen, const char* value, size_t valueLen);
+    bool HasToken_(const char* key, const char* token) const; // 头部的逗号分隔列表中是否有token
+
+    void ParsePath_(); // 按请求路径匹配路由
     void ParsePost_(); // 解析post请求
     void ParseFromUrlencoded_(); // 解析表单数据
-    // 验证用户登录
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
 
     PARSE_STATE state_; // 枚举(解析的状态)
-    std::string method_, path_, version_, body_; // 请求方法、请求路径、协议版本、请求体
-    std::unordered_map<std::string, std::string> header_; // 请求头
-    std::unordered_map<std::string, std::string> post_; // post请求表单数据
+    Arena arena_; // 请求作用域的内存，Init时整体重置，保持连接的请求之间复用
+    std::string method_, path_, version_; // 请求方法、请求路径、协议版本(Init时只清空，保留容量)
+    std::string target_; // 原始的请求目标，写入访问日志
+    char* body_; // 请求体，在arena_中
+    size_t bodyLen_;
+    std::vector<Field> header_; // 请求头(字段不多，顺序查找比哈希更快，容量在请求之间保留)
+    std::vector<Field> post_; // post请求表单数据
+    const Router::Route* route_; // 匹配到的路由
+    Router::Params params_; // 路由参数在path_中的位置
+    int64_t dbUs_; // 本请求数据库查询的耗时(微秒)
 
-    static const std::unordered_set<std::string> DEFAULT_HTML; // 默认的网页
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; // 
     static int ConverHex(char ch); // 转换成十六进制
+
+    static const size_t MAX_HEAD = 64 * 1024; // 请求头的长度上限
+    static const int MAX_REWRITES = 4; // 一个请求最多连续改写的次数
 };
 
 
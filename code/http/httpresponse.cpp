@@ -7,33 +7,18 @@
 
 using namespace std;
 
-const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
-    { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
-    { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
-    { ".mpeg",  "video/mpeg" },
-    { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
-    { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
-};
-
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
+    { 401, "Unauthorized" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 416, "Range Not Satisfiable" },
+    { 429, "Too Many Requests" },
+    { 500, "Internal Server Error" },
+    { 503, "Service Unavailable" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
@@ -42,11 +27,50 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 404, "/404.html" },
 };
 
+// multipart/byteranges的分隔符，不会出现在分段头中即可
+const char* HttpResponse::BOUNDARY = "WEBSERVER_BYTERANGES_7b3f9e";
+
+// 默认的缓存策略：页面每次都需要验证，静态资源允许缓存一段时间
+unordered_map<string, string> HttpResponse::CACHE_CONTROL = {
+    { ".html",  "no-cache" },
+    { ".css",   "public, max-age=86400" },
+    { ".js",    "public, max-age=86400" },
+    { ".png",   "public, max-age=604800" },
+    { ".gif",   "public, max-age=604800" },
+    { ".jpg",   "public, max-age=604800" },
+    { ".jpeg",  "public, max-age=604800" },
+    { ".ico",   "public, max-age=604800" },
+    { ".svg",   "public, max-age=604800" },
+    { ".woff",  "public, max-age=2592000" },
+    { ".woff2", "public, max-age=2592000" },
+    { ".ttf",   "public, max-age=2592000" },
+    { ".otf",   "public, max-age=2592000" },
+    { ".eot",   "public, max-age=2592000" },
+};
+
+int HttpResponse::keepAliveTimeout = 0;
+
+unordered_set<string> HttpResponse::IMMUTABLE;
+const char* HttpResponse::MANIFEST = "/asset-manifest.txt";
+const char* HttpResponse::IMMUTABLE_CACHE_CONTROL = "public, max-age=31536000, immutable";
+
 HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
+    request_ = nullptr;
     isKeepAlive_ = false;
+    keepAliveMax_ = -1;
     mmFile_ = nullptr; 
+    mmLen_ = 0;
+    vary_ = false;
+    variantSize_ = 0;
+    useBlock_ = false;
+    http2_ = false;
+    extra_ = nullptr;
+    extraLen_ = 0;
+    inArchive_ = false;
+    archBody_ = nullptr;
+    archLen_ = 0;
     mmFileStat_ = { 0 };
 };
 
@@ -55,25 +79,84 @@ HttpResponse::~HttpResponse() {
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
-    assert(srcDir != "");
+void HttpResponse::Init(const char* srcDir, string& path, bool isKeepAlive, int code,
+                        const HttpRequest* request){
+    assert(srcDir && *srcDir);
     if(mmFile_) { UnmapFile(); } // 判断mmFile_是否为空，为空则释放mmFile
     code_ = code;// 状态码
     isKeepAlive_ = isKeepAlive; // 是否保持连接
+    keepAliveMax_ = -1;
     path_ = path; // 请求报文解析后目标的路径
     srcDir_ = srcDir; // 请求报文解析后目标的目录
+    request_ = request; // 条件请求需要读取请求头
     mmFile_ = nullptr; // 赋为null
     mmFileStat_ = { 0 }; // 表示文件状态的信息
+    ranges_.clear();
+    bodyIov_.clear();
+    partHead_.clear();
+    encoding_.clear();
+    vary_ = false;
+    variantPath_.clear();
+    variantSize_ = 0;
+    variant_.reset();
+    entry_.reset();
+    useBlock_ = false;
+    http2_ = false;
+    inArchive_ = false;
+    archBody_ = nullptr;
+    archLen_ = 0;
+    extra_ = nullptr;
+    extraLen_ = 0;
+    stream_.Reset();
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
+    // 路由到处理函数的请求(包括带查询串的)由处理函数生成响应
+    const Router::Route* route = request_ ? request_->GetRoute() : nullptr;
+    if(route && route->handler && code_ == 200) {
+        AddStream_(buff, route->handler);
+        return;
+    }
+    // 被中间件拒绝的请求：有错误页时发送错误页，否则生成简短的错误提示
+    if(request_ && code_ >= 400) {
+        bool page = CODE_PATH.count(code_) == 1;
+        ErrorHtml_();
+        AddStateLine_(buff);
+        AddConnection_(buff);
+        AddExtraHeader_(buff);
+        if(page) {
+            AddEntityHeader_(buff);
+            AddContent_(buff);
+        } else {
+            buff.Append("Content-type: text/html\r\n");
+            ErrorContent(buff, CODE_STATUS.find(code_)->second);
+        }
+        return;
+    }
     /* 判断请求的资源文件 */
+    bool archived = ResArchive::Instance()->IsOpen();
+    // 先查内存缓存，命中时直接使用缓存的文件状态，不再访问文件系统
+    if(!archived && request_ && (request_->method() == "GET" || request_->method() == "HEAD")) {
+        entry_ = ContentCache::Instance()->Get(FilePath_());
+    }
+    // 使用资源包时所有文件都在映射区域中，不访问资源目录
+    if(archived) {
+        if(!FindArchive_()) {
+            code_ = 404;
+        } else if(code_ == -1) {
+            code_ = 200;
+        }
+    }
+    else if(entry_) {
+        mmFileStat_ = entry_->st;
+        if(code_ == -1) { code_ = 200; }
+    }
     // 以index.html为例
     // /home/late/temporal/webserver/WebServer-master/resources/index.html
     // stat保存上行信息，<0表示调用失败
     // S_ISDIR(mmFileStat_.st_mode)表示目录资源，不是文件资源
     // 以上都返回404
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    else if(stat(FilePath_().c_str(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -83,12 +166,82 @@ void HttpResponse::MakeResponse(Buffer& buff) {
     else if(code_ == -1) { 
         code_ = 200; 
     }
+    // 文本类资源按Accept-Encoding发送压缩版本(范围请求始终针对原文件)
+    if(code_ == 200) {
+        vary_ = IsCompressible_();
+        if(request_ && !request_->Header("Range")) {
+            SelectEncoding_();
+        }
+    }
+    // 资源未修改，返回不带响应体的304，浏览器直接使用本地缓存
+    if(code_ == 200 && IsNotModified_()) {
+        code_ = 304;
+    }
+    // 带Range的请求只发送需要的字节(206)，范围全部越界返回416
+    else if(code_ == 200) {
+        ParseRange_();
+    }
     ErrorHtml_();
+    // 完整的未压缩文件：使用(或加载)内存缓存块，实体头已经在块中
+    // HTTP/2同样放入缓存，但只发送块中的文件内容
+    if(code_ == 200 && encoding_.empty() && request_ && !archived) {
+        bool loaded = entry_ ? true : LoadEntry_();
+        useBlock_ = loaded && !http2_;
+    }
     AddStateLine_(buff); // 添加状态行，即响应报文的状态行(头部)，装在writeBuff_中
     AddHeader_(buff);
+    if(code_ == 304) {
+        buff.Append("\r\n");
+        return;
+    }
+    if(code_ == 416) {
+        ErrorContent(buff, "Requested range not satisfiable");
+        return;
+    }
     AddContent_(buff);
 }
 
+void HttpResponse::MakeReply(Buffer& buff, const string& type, const string& body) {
+    AddStateLine_(buff);
+    AddConnection_(buff);
+    AddExtraHeader_(buff);
+    buff.Append("Content-type: " + type + "\r\n");
+    buff.Append("Cache-Control: no-store\r\n");
+    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    if(!request_ || request_->method() != "HEAD") {
+        buff.Append(body);
+    }
+}
+
+bool HttpResponse::LoadEntry_() {
+    if((size_t)mmFileStat_.st_size > ContentCache::Instance()->MaxFileSize()) {
+        return false;
+    }
+    Buffer head(256);
+    AddEntityHeader_(head);
+    head.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    entry_ = ContentCache::Instance()->Load(FilePath_(), head.RetrieveAllToStr(), mmFileStat_);
+    return entry_ != nullptr;
+}
+
+void HttpResponse::AddStream_(Buffer& buff, const HttpStream::Handler& handler) {
+    string type = "text/html";
+    HttpStream::Producer producer = handler(*request_, type);
+    // HTTP/1.0没有分块编码，只能以关闭连接表示响应结束
+    bool chunked = request_->version() == "1.1";
+    if(!chunked) { isKeepAlive_ = false; }
+    AddStateLine_(buff);
+    AddConnection_(buff);
+    AddExtraHeader_(buff);
+    buff.Append("Content-type: " + type + "\r\n");
+    buff.Append("Cache-Control: no-store\r\n");
+    if(chunked) { buff.Append("Transfer-Encoding: chunked\r\n"); }
+    buff.Append("\r\n");
+    if(request_->method() != "HEAD") {
+        stream_.Start(producer, chunked);
+    }
+}
+
 char* HttpResponse::File() {
     return mmFile_;
 }
@@ -100,42 +253,156 @@ size_t HttpResponse::FileLen() const {
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1) {
         path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        if(ResArchive::Instance()->IsOpen()) {
+            FindArchive_();
+        } else {
+            stat(FilePath_().c_str(), &mmFileStat_);
+        }
+    }
+}
+
+bool HttpResponse::FindArchive_() {
+    inArchive_ = ResArchive::Instance()->Find(path_, &archFile_);
+    if(!inArchive_) {
+        return false;
     }
+    mmFileStat_ = { 0 };
+    mmFileStat_.st_mode = S_IFREG | 0444;
+    mmFileStat_.st_size = archFile_.len;
+    mmFileStat_.st_mtime = archFile_.mtime;
+    archBody_ = archFile_.data;
+    archLen_ = archFile_.len;
+    return true;
 }
 
 void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
+    const string* status;
     // 查询状态是否为-1，-1默认表示成功，即生成响应报文
     if(CODE_STATUS.count(code_) == 1) {
         // CODE_STATUS->second是状态码对应的状态描述
-        status = CODE_STATUS.find(code_)->second;
+        status = &CODE_STATUS.find(code_)->second;
     }
     else {
         // 没有找到
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+        status = &CODE_STATUS.find(400)->second;
     }
     // 这里还是生成响应报文头部的状态行，拼接，添加到buff,即writeBuff_
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    char line[64];
+    int n = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code_, status->c_str());
+    buff.Append(line, n);
 }
 
 void HttpResponse::AddHeader_(Buffer& buff) {
+    AddConnection_(buff);
+    AddExtraHeader_(buff);
+    if(!useBlock_) {
+        AddEntityHeader_(buff);
+    }
+}
+
+void HttpResponse::AddConnection_(Buffer& buff) {
     buff.Append("Connection: ");
     if(isKeepAlive_) {
         buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
-    } else{
+        // 告知客户端服务器实际执行的限制
+        string params;
+        if(keepAliveTimeout > 0) {
+            params = "timeout=" + to_string(keepAliveTimeout);
+        }
+        if(keepAliveMax_ >= 0) {
+            params += (params.empty() ? "max=" : ", max=") + to_string(keepAliveMax_);
+        }
+        if(!params.empty()) {
+            buff.Append("Keep-Alive: " + params + "\r\n");
+        }
+    } else {
         buff.Append("close\r\n");
     }
+}
+
+void HttpResponse::AddExtraHeader_(Buffer& buff) {
+    if(extraLen_ > 0) {
+        buff.Append(extra_, extraLen_);
+    }
+}
+
+void HttpResponse::AddEntityHeader_(Buffer& buff) {
     // GetFileType_()获取后缀，对应响应头部在传送数据时的不同传输数据的格式，以Content-type: 开始
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    if(code_ == 206 && ranges_.size() > 1) {
+        buff.Append("Content-type: multipart/byteranges; boundary=" + string(BOUNDARY) + "\r\n");
+    } else if(code_ == 416) {
+        buff.Append("Content-type: text/html\r\n"); // 416的响应体是错误提示页
+    } else {
+        buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    }
+    if(code_ == 200 || code_ == 206) {
+        buff.Append("Accept-Ranges: bytes\r\n");
+    }
+    if(!encoding_.empty()) {
+        buff.Append("Content-Encoding: " + encoding_ + "\r\n");
+    }
+    if(vary_) {
+        buff.Append("Vary: Accept-Encoding\r\n");
+    }
+    if(code_ == 206 && ranges_.size() == 1) {
+        buff.Append("Content-Range: " + ContentRange_(ranges_[0]) + "\r\n");
+    }
+    else if(code_ == 416) {
+        buff.Append("Content-Range: bytes */" + to_string(mmFileStat_.st_size) + "\r\n");
+    }
+    // 只有成功的静态资源才带验证器和缓存策略，错误页不缓存
+    if(code_ == 200 || code_ == 206 || code_ == 304) {
+        buff.Append("ETag: " + ETag_() + "\r\n");
+        buff.Append("Last-Modified: " + HttpDate_(mmFileStat_.st_mtime) + "\r\n");
+        auto it = CACHE_CONTROL.find(GetSuffix_());
+        if(IMMUTABLE.count(path_)) {
+            buff.Append("Cache-Control: " + string(IMMUTABLE_CACHE_CONTROL) + "\r\n");
+        } else if(it != CACHE_CONTROL.end() && !it->second.empty()) {
+            buff.Append("Cache-Control: " + it->second + "\r\n");
+        }
+    }
 }
 
 // 响应体
 void HttpResponse::AddContent_(Buffer& buff) {
+    // 内存缓存块：实体头+文件内容连续存放，接在状态行后面一起发送
+    if(useBlock_) {
+        bodyIov_.push_back({ entry_->block, entry_->blockLen });
+        return;
+    }
+    // 资源包中的文件：映射区域常驻，直接切片发送
+    if(ResArchive::Instance()->IsOpen()) {
+        if(!inArchive_) {
+            ErrorContent(buff, "File NotFound!");
+            return;
+        }
+        mmLen_ = archLen_;
+        AddBody_(buff, archBody_);
+        return;
+    }
+    // 缓存中的文件直接切片发送范围请求
+    if(entry_ && encoding_.empty()) {
+        mmLen_ = entry_->BodyLen();
+        AddBody_(buff, entry_->Body());
+        return;
+    }
+    // 压缩结果已经在内存中，直接发送
+    if(variant_) {
+        bodyIov_.push_back({ const_cast<char*>(variant_->data()), variant_->size() });
+        buff.Append("Content-length: " + to_string(variant_->size()) + "\r\n\r\n");
+        return;
+    }
+    // 预压缩文件和原文件一样映射发送，只是路径和长度不同
+    string file = srcDir_ + (variantPath_.empty() ? path_ : variantPath_);
+    mmLen_ = variantPath_.empty() ? mmFileStat_.st_size : variantSize_;
+    // 空文件不需要映射(mmap长度为0会失败)
+    if(mmLen_ == 0) {
+        buff.Append("Content-length: 0\r\n\r\n");
+        return;
+    }
     // open打开资源
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
+    int srcFd = open(file.data(), O_RDONLY);
     if(srcFd < 0) {
         // <0是没有成功打开文件 
         ErrorContent(buff, "File NotFound!");
@@ -144,41 +411,91 @@ void HttpResponse::AddContent_(Buffer& buff) {
 
     /* 将文件映射到内存提高文件的访问速度 
         MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
+    LOG_DEBUG("file path %s", file.data());
     // 使用mmap内存映射，得到地址，即int* mmRet
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
+    void* mmRet = mmap(0, mmLen_, PROT_READ, MAP_PRIVATE, srcFd, 0);
+    close(srcFd);
+    if(mmRet == MAP_FAILED) {
         ErrorContent(buff, "File NotFound!");
         return; 
     }
     // 上述mmap得到映射文件的指针，转为char*
     mmFile_ = (char*)mmRet;
-    close(srcFd);
-    // Content-length: 响应长度
-    // 
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    AddBody_(buff, mmFile_);
     // 至此，响应报文数据写入成功
 }
 
+// 响应体直接指向文件内容(映射区域或内存缓存)中的切片，写出时由writev从文件偏移处发送，不做拷贝
+void HttpResponse::AddBody_(Buffer& buff, const char* data) {
+    if(code_ != 206) {
+        bodyIov_.push_back({ const_cast<char*>(data), mmLen_ });
+        // Content-length: 响应长度
+        buff.Append("Content-length: " + to_string(mmLen_) + "\r\n\r\n");
+    }
+    else if(ranges_.size() == 1) {
+        const Range& r = ranges_[0];
+        bodyIov_.push_back({ const_cast<char*>(data) + r.first, (size_t)(r.second - r.first + 1) });
+        buff.Append("Content-length: " + to_string(r.second - r.first + 1) + "\r\n\r\n");
+    }
+    else {
+        AddMultipart_(buff, data);
+    }
+}
+
+// 多段范围：每一段前面是分隔符和该段的Content-Range，最后以结束分隔符收尾
+void HttpResponse::AddMultipart_(Buffer& buff, const char* data) {
+    string type = GetFileType_();
+    vector<size_t> headEnd;
+    for(const Range& r: ranges_) {
+        partHead_ += "\r\n--" + string(BOUNDARY) + "\r\n";
+        partHead_ += "Content-type: " + type + "\r\n";
+        partHead_ += "Content-Range: " + ContentRange_(r) + "\r\n\r\n";
+        headEnd.push_back(partHead_.size());
+    }
+    partHead_ += "\r\n--" + string(BOUNDARY) + "--\r\n";
+    // partHead_不再变化，此后取它的指针是安全的
+    size_t total = partHead_.size();
+    size_t begin = 0;
+    for(size_t i = 0; i < ranges_.size(); i++) {
+        const Range& r = ranges_[i];
+        size_t len = r.second - r.first + 1;
+        bodyIov_.push_back({ &partHead_[begin], headEnd[i] - begin });
+        bodyIov_.push_back({ const_cast<char*>(data) + r.first, len });
+        total += len;
+        begin = headEnd[i];
+    }
+    bodyIov_.push_back({ &partHead_[begin], partHead_.size() - begin });
+    buff.Append("Content-length: " + to_string(total) + "\r\n\r\n");
+}
+
 // 对响应报文中的响应正文是以内存映射的方式读取的，结束后需要释放
 void HttpResponse::UnmapFile() {
     if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
+        munmap(mmFile_, mmLen_);
         mmFile_ = nullptr;
     }
 }
 
-string HttpResponse::GetFileType_() {
-    /* 判断文件类型 */
-    string::size_type idx = path_.find_last_of('.');
-    if(idx == string::npos) {
-        return "text/plain";
+string HttpResponse::GetSuffix_() const {
+    return FileSuffix(path_);
+}
+
+const string& HttpResponse::FilePath_() {
+    // srcDir_以/结尾，path_以/开头，去掉重复的/与inotify给出的路径保持一致
+    // 拼接到成员中，保持连接的请求之间复用容量，不产生临时字符串
+    file_.assign(srcDir_);
+    if(!path_.empty()) {
+        file_.append(path_, 1, string::npos);
     }
-    string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    return file_;
+}
+
+string HttpResponse::GetFileType_() const {
+    /* 判断文件类型 */
+    if(inArchive_) {
+        return archFile_.mime;
     }
-    return "text/plain";
+    return MimeType(GetSuffix_());
 }
 
 void HttpResponse::ErrorContent(Buffer& buff, string message) 
@@ -199,3 +516,302 @@ void HttpResponse::ErrorContent(Buffer& buff, string message)
     buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
     buff.Append(body);
 }
+
+void HttpResponse::SetCacheControl(const string& suffix, const string& value) {
+    CACHE_CONTROL[suffix] = value;
+}
+
+size_t HttpResponse::LoadManifest(const string& srcDir) {
+    string content;
+    ResArchive::File file;
+    if(ResArchive::Instance()->IsOpen()) {
+        if(ResArchive::Instance()->Find(MANIFEST, &file)) {
+            content.assign(file.data, file.len);
+        }
+    } else {
+        int fd = open((srcDir + (MANIFEST + 1)).c_str(), O_RDONLY);
+        if(fd >= 0) {
+            char buf[4096];
+            ssize_t len;
+            while((len = read(fd, buf, sizeof(buf))) > 0) {
+                content.append(buf, len);
+            }
+            close(fd);
+        }
+    }
+    // 每行是"原路径 带哈希的路径"，只有后者需要永久缓存
+    size_t begin = 0;
+    while(begin < content.size()) {
+        size_t end = content.find('\n', begin);
+        if(end == string::npos) { end = content.size(); }
+        size_t space = content.find(' ', begin);
+        if(space < end && space + 1 < end) {
+            IMMUTABLE.insert(content.substr(space + 1, end - space - 1));
+        }
+        begin = end + 1;
+    }
+    return IMMUTABLE.size();
+}
+
+bool HttpResponse::IsNotModified_() const {
+    // 只有GET/HEAD才能使用条件请求，POST的结果页每次都要重新生成
+    if(!request_ || (request_->method() != "GET" && request_->method() != "HEAD")) {
+        return false;
+    }
+    // If-None-Match优先级高于If-Modified-Since
+    const char* inm = request_->Header("If-None-Match");
+    if(inm && *inm) {
+        return MatchETag_(inm, ETag_());
+    }
+    const char* ims = request_->Header("If-Modified-Since");
+    time_t since;
+    if(ims && *ims && ParseHttpDate_(ims, &since)) {
+        return mmFileStat_.st_mtime <= since;
+    }
+    return false;
+}
+
+string HttpResponse::ETag_() const {
+    // 资源包中的ETag由打包工具根据内容生成
+    if(inArchive_) {
+        if(encoding_.empty()) {
+            return archFile_.etag;
+        }
+        return archFile_.etag.substr(0, archFile_.etag.size() - 1) + "-" + encoding_ + "\"";
+    }
+    // 强ETag："inode-大小-修改时间(纳秒)"，文件被替换或修改后必然变化
+    // 压缩版本的内容不同，ETag带上编码名
+    char etag[96];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx%s%s\"",
+             (unsigned long)mmFileStat_.st_ino, (unsigned long)mmFileStat_.st_size,
+             (unsigned long)(mmFileStat_.st_mtim.tv_sec * 1000000000L + mmFileStat_.st_mtim.tv_nsec),
+             encoding_.empty() ? "" : "-", encoding_.c_str());
+    return etag;
+}
+
+// If-None-Match: "a", W/"b" 或 *，比较时忽略弱标记
+bool HttpResponse::MatchETag_(const string& list, const string& etag) {
+    size_t i = 0, n = list.size();
+    while(i < n) {
+        while(i < n && (list[i] == ' ' || list[i] == ',')) { i++; }
+        size_t j = list.find(',', i);
+        if(j == string::npos) { j = n; }
+        size_t end = j;
+        while(end > i && list[end - 1] == ' ') { end--; }
+        string tag = list.substr(i, end - i);
+        if(tag.compare(0, 2, "W/") == 0) { tag = tag.substr(2); }
+        if(tag == "*" || tag == etag) {
+            return true;
+        }
+        i = j + 1;
+    }
+    return false;
+}
+
+string HttpResponse::HttpDate_(time_t t) {
+    struct tm tm;
+    char date[64];
+    gmtime_r(&t, &tm);
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return date;
+}
+
+bool HttpResponse::ParseHttpDate_(const string& str, time_t* t) {
+    struct tm tm = { 0 };
+    // 只接受RFC 7231推荐的IMF-fixdate格式，其他格式按无条件请求处理
+    const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(end == nullptr) {
+        return false;
+    }
+    *t = timegm(&tm);
+    return true;
+}
+
+// Range: bytes=0-499,1000-,-200，语法错误或不支持的单位按普通请求处理
+void HttpResponse::ParseRange_() {
+    ranges_.clear();
+    if(!request_ || request_->method() != "GET") {
+        return;
+    }
+    string range = request_->GetHeader("Range");
+    if(range.compare(0, 6, "bytes=") != 0 || !IsIfRangeMatch_()) {
+        return;
+    }
+    off_t size = mmFileStat_.st_size;
+    vector<Range> ranges;
+    size_t i = 6, n = range.size();
+    while(i < n) {
+        size_t j = range.find(',', i);
+        if(j == string::npos) { j = n; }
+        string spec = range.substr(i, j - i);
+        i = j + 1;
+        spec.erase(0, spec.find_first_not_of(' '));
+        spec.erase(spec.find_last_not_of(' ') + 1);
+        size_t dash = spec.find('-');
+        if(dash == string::npos) { return; }
+        off_t first, last;
+        if(dash == 0) {
+            /* 后缀范围：最后N个字节 */
+            if(!ParseOffset_(spec.substr(1), &last)) { return; }
+            if(last == 0) { continue; }
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        } else {
+            if(!ParseOffset_(spec.substr(0, dash), &first)) { return; }
+            if(dash + 1 == spec.size()) {
+                last = size - 1;
+            } else if(!ParseOffset_(spec.substr(dash + 1), &last) || last < first) {
+                return;
+            }
+            if(last >= size) { last = size - 1; }
+        }
+        if(first >= size) { continue; } // 越界的范围不可满足，跳过
+        ranges.push_back({ first, last });
+    }
+    // 分段过多时直接返回整个文件，防止构造大量小分段消耗资源
+    if(ranges.size() > MAX_RANGES) {
+        return;
+    }
+    ranges_.swap(ranges);
+    code_ = ranges_.empty() ? 416 : 206;
+}
+
+// If-Range中的ETag或日期与当前资源一致时Range才生效，否则返回完整的新资源
+bool HttpResponse::IsIfRangeMatch_() const {
+    string ifRange = request_->GetHeader("If-Range");
+    if(ifRange.empty()) {
+        return true;
+    }
+    if(ifRange[0] == '"') {
+        return ifRange == ETag_();
+    }
+    time_t t;
+    return ParseHttpDate_(ifRange, &t) && t == mmFileStat_.st_mtime;
+}
+
+bool HttpResponse::ParseOffset_(const string& str, off_t* val) {
+    if(str.empty() || str.find_first_not_of("0123456789") != string::npos) {
+        return false;
+    }
+    errno = 0;
+    long long v = strtoll(str.c_str(), nullptr, 10);
+    if(errno == ERANGE) {
+        return false;
+    }
+    *val = v;
+    return true;
+}
+
+string HttpResponse::ContentRange_(const Range& r) const {
+    return "bytes " + to_string(r.first) + "-" + to_string(r.second) + "/" + to_string(mmFileStat_.st_size);
+}
+
+bool HttpResponse::IsCompressible_() const {
+    return IsCompressibleType(GetFileType_());
+}
+
+void HttpResponse::SelectEncoding_() {
+    if(!vary_) {
+        return;
+    }
+    vector<string> accepts = AcceptEncodings_(request_->GetHeader("Accept-Encoding"));
+    if(accepts.empty()) {
+        return;
+    }
+    // 资源包中已经带有打包时生成的压缩版本
+    if(inArchive_) {
+        for(const string& enc: accepts) {
+            if(enc == "br" && archFile_.br) {
+                archBody_ = archFile_.br;
+                archLen_ = archFile_.brLen;
+            } else if(enc == "gzip" && archFile_.gzip) {
+                archBody_ = archFile_.gzip;
+                archLen_ = archFile_.gzipLen;
+            } else {
+                continue;
+            }
+            encoding_ = enc;
+            return;
+        }
+        return;
+    }
+    const string& file = FilePath_();
+    string etag = ETag_(); // 此时encoding_为空，得到的是原文件的ETag
+    for(const string& enc: accepts) {
+        /* 1. 离线生成的预压缩文件，要求比原文件新 */
+        if(FindPrecompressed_(enc, &variantSize_)) {
+            encoding_ = enc;
+            variantPath_ = path_ + VariantCache::Suffix(enc);
+            return;
+        }
+        /* 2. 后台压缩好的缓存(空结果表示压缩后没有变小) */
+        VariantCache::Variant v = VariantCache::Instance()->Get(file, enc, etag);
+        if(v) {
+            if(!v->empty()) {
+                encoding_ = enc;
+                variant_ = v;
+            }
+            return;
+        }
+    }
+    /* 3. 都没有：提交后台压缩，本次先发送原文件 */
+    for(const string& enc: accepts) {
+        for(const string& supported: VariantCache::Encodings()) {
+            if(enc == supported) {
+                VariantCache::Instance()->Submit(file, enc, etag, mmFileStat_.st_size);
+                return;
+            }
+        }
+    }
+}
+
+bool HttpResponse::FindPrecompressed_(const string& encoding, off_t* size) const {
+    // 内存缓存命中时使用加载时记录的结果，不访问文件系统
+    if(entry_) {
+        const ContentCache::Sibling* sibling = entry_->FindSibling(encoding);
+        if(sibling) { *size = sibling->size; }
+        return sibling != nullptr;
+    }
+    struct stat st;
+    if(stat((srcDir_ + path_ + VariantCache::Suffix(encoding)).data(), &st) == 0 && S_ISREG(st.st_mode)
+        && st.st_mtime >= mmFileStat_.st_mtime) {
+        *size = st.st_size;
+        return true;
+    }
+    return false;
+}
+
+// 解析Accept-Encoding: gzip;q=0.8, br，按q值从高到低返回可接受的编码(q=0表示拒绝)
+// q值相同时按服务端偏好br > zstd > gzip
+vector<string> HttpResponse::AcceptEncodings_(const string& accept) {
+    static const char* PREFER[] = { "br", "zstd", "gzip" };
+    vector<pair<double, int>> items;
+    size_t i = 0, n = accept.size();
+    while(i < n) {
+        size_t j = accept.find(',', i);
+        if(j == string::npos) { j = n; }
+        string item = accept.substr(i, j - i);
+        i = j + 1;
+        double q = 1.0;
+        size_t semi = item.find(';');
+        if(semi != string::npos) {
+            size_t qpos = item.find("q=", semi);
+            if(qpos != string::npos) { q = atof(item.c_str() + qpos + 2); }
+            item.erase(semi);
+        }
+        item.erase(0, item.find_first_not_of(' '));
+        item.erase(item.find_last_not_of(' ') + 1);
+        if(q <= 0) { continue; }
+        for(int k = 0; k < 3; k++) {
+            if(item == PREFER[k]) {
+                items.push_back({ -q, k });
+            }
+        }
+    }
+    sort(items.begin(), items.end());
+    vector<string> res;
+    for(auto& item: items) {
+        res.push_back(PREFER[item.second]);
+    }
+    return res;
+}
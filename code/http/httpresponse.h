@@ -7,47 +7,144 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>     // sort
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
 #include <sys/mman.h>    // mmap, munmap
+#include <sys/uio.h>     // iovec
+#include <time.h>        // gmtime_r, timegm
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../cache/variantcache.h"
+#include "../cache/contentcache.h"
+#include "../cache/resarchive.h"
+#include "httprequest.h"
+#include "httpstream.h"
+#include "mimetype.h"
 
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    void Init(const char* srcDir, std::string& path, bool isKeepAlive = false, int code = -1,
+              const HttpRequest* request = nullptr);
     void MakeResponse(Buffer& buff);
+    // 已经生成好的响应体(如异步处理函数的结果)，和响应头一起放入buff
+    void MakeReply(Buffer& buff, const std::string& type, const std::string& body);
     void UnmapFile();
     char* File();
     size_t FileLen() const;
+    // 响应体的分段(文件切片以及multipart分隔头)，由HttpConn接在响应头之后writev
+    const std::vector<struct iovec>& BodyIov() const { return bodyIov_; }
+    size_t BodyBytes() const {
+        size_t bytes = 0;
+        for(const struct iovec& iov: bodyIov_) { bytes += iov.iov_len; }
+        return bytes;
+    }
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; } // 响应可能取消保持连接(如HTTP/1.0的流式响应)
+    // 本连接还能处理的请求数(-1表示不限)，写在Keep-Alive头部中
+    void SetKeepAliveMax(int left) { keepAliveMax_ = left; }
+    static int keepAliveTimeout; // 空闲连接的超时时间(秒)，写在Keep-Alive头部中
+    // 动态处理函数的流式响应体，响应头之后由HttpConn逐段取出发送
+    HttpStream& Stream() { return stream_; }
+    // HTTP/2的响应头由HPACK单独编码，不能使用实体头和文件内容连在一起的缓存块(在Init之后调用)
+    void SetHttp2() { http2_ = true; }
+    // 中间件追加的头部(格式化好的"Name: value\r\n")，在MakeResponse之前调用，之后不再引用
+    void SetExtraHeaders(const char* data, size_t len) { extra_ = data; extraLen_ = len; }
+
+    // 按后缀配置Cache-Control策略，value为空表示不发送该头部(仅在启动时调用)
+    static void SetCacheControl(const std::string& suffix, const std::string& value);
+    // 读取assetpipe生成的清单，清单中带内容哈希的文件永久缓存(仅在启动时调用)
+    // 资源包打开时从包中读取，否则从srcDir读取；没有清单返回0
+    static size_t LoadManifest(const std::string& srcDir);
 
 private:
     void AddStateLine_(Buffer &buff);
     void AddHeader_(Buffer &buff);
+    void AddConnection_(Buffer &buff); // Connection和Keep-Alive头部
+    void AddExtraHeader_(Buffer &buff); // 中间件追加的头部
+    void AddEntityHeader_(Buffer &buff); // Content-type到Cache-Control这些只与资源有关的头部
+    void AddStream_(Buffer &buff, const HttpStream::Handler& handler); // 动态处理函数的分块响应
     void AddContent_(Buffer &buff);
+    void AddBody_(Buffer &buff, const char* data);
+    void AddMultipart_(Buffer &buff, const char* data);
 
     void ErrorHtml_();
-    std::string GetFileType_();
+    std::string GetFileType_() const;
+    std::string GetSuffix_() const;
+    const std::string& FilePath_(); // 资源的完整路径(内存缓存的key)，在file_中
+    bool LoadEntry_(); // 把当前文件连同实体头放入内存缓存
+    bool FindArchive_(); // 在资源包中查找path_，找到后填充文件状态
+
+    /* 条件请求 */
+    bool IsNotModified_() const; // 根据If-None-Match/If-Modified-Since判断是否返回304
+    std::string ETag_() const; // 由inode、大小、修改时间生成的强ETag
+    static bool MatchETag_(const std::string& list, const std::string& etag);
+    static std::string HttpDate_(time_t t);
+
+    /* 内容编码协商 */
+    void SelectEncoding_(); // 选择预压缩文件或缓存中的压缩结果
+    bool IsCompressible_() const;
+    bool FindPrecompressed_(const std::string& encoding, off_t* size) const; // 比原文件新的预压缩文件
+    static std::vector<std::string> AcceptEncodings_(const std::string& accept);
+    static bool ParseHttpDate_(const std::string& str, time_t* t);
+
+    /* 范围请求 */
+    typedef std::pair<off_t, off_t> Range; // [first, last]闭区间
+    void ParseRange_();
+    bool IsIfRangeMatch_() const;
+    static bool ParseOffset_(const std::string& str, off_t* val);
+    std::string ContentRange_(const Range& r) const;
 
     int code_; // 响应状态码(10X 20X 30X 40X 50X)
     bool isKeepAlive_; // 是否保持连接
+    int keepAliveMax_;
 
     std::string path_; // 资源的路径(例如resource/index.html)
     std::string srcDir_; // 资源的目录
+    std::string file_; // 资源的完整路径，见FilePath_，容量在请求之间保留
+    const HttpRequest* request_; // 对应的请求(用于条件请求等)，可能为空
     
     char* mmFile_; // 文件内存映射的指针
+    size_t mmLen_; // 映射的长度(发送预压缩文件时与原文件大小不同)
     struct stat mmFileStat_; // 文件的状态信息
 
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE; // 后缀-类型
+    std::string encoding_; // 选中的Content-Encoding，空表示原文件
+    bool vary_; // 响应内容随Accept-Encoding变化
+    std::string variantPath_; // 预压缩的同名文件(例如style.css.gz)
+    off_t variantSize_;
+    VariantCache::Variant variant_; // 内存中的压缩结果
+    ContentCache::EntryPtr entry_; // 内存缓存中的文件
+    bool useBlock_; // 直接发送缓存块(实体头+文件内容)
+    bool http2_;
+    const char* extra_; // 中间件追加的头部
+    size_t extraLen_;
+
+    bool inArchive_; // path_在资源包中
+    ResArchive::File archFile_;
+    const char* archBody_; // 选中的资源包切片(原文件或压缩版本)
+    size_t archLen_;
+
+    std::vector<Range> ranges_; // 请求的字节范围
+    std::vector<struct iovec> bodyIov_; // 响应体分段
+    std::string partHead_; // multipart各段的分隔头
+    HttpStream stream_;
+
     static const std::unordered_map<int, std::string> CODE_STATUS; // 状态码-描述
     static const std::unordered_map<int, std::string> CODE_PATH; // 状态码-路径
+    static std::unordered_map<std::string, std::string> CACHE_CONTROL; // 后缀-缓存策略
+    static std::unordered_set<std::string> IMMUTABLE; // 带内容哈希的路径，内容变化时路径也会变
+    static const char* MANIFEST;
+    static const char* IMMUTABLE_CACHE_CONTROL;
+    static const size_t MAX_RANGES = 16; // 单个请求允许的最大分段数
+    static const char* BOUNDARY;
 };
 
 
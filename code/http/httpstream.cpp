@@ -0,0 +1,52 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-09
+ * @copyleft Apache 2.0
+ */
+#include "httpstream.h"
+
+using namespace std;
+
+HttpStream::HttpStream() {
+    active_ = false;
+    chunked_ = true;
+}
+
+void HttpStream::Start(const Producer& producer, bool chunked) {
+    producer_ = producer;
+    chunked_ = chunked;
+    active_ = (bool)producer_;
+}
+
+void HttpStream::Reset() {
+    producer_ = nullptr; // 释放生产者持有的资源
+    active_ = false;
+}
+
+bool HttpStream::Next(Buffer& buff) {
+    if(!active_) {
+        return false;
+    }
+    chunk_.clear();
+    bool more = producer_(chunk_);
+    bool appended = false;
+    // 空的一段不能发送，"0\r\n\r\n"是结束块
+    if(!chunk_.empty()) {
+        if(chunked_) {
+            char size[32];
+            int len = snprintf(size, sizeof(size), "%zx\r\n", chunk_.size());
+            buff.Append(size, len);
+        }
+        buff.Append(chunk_);
+        if(chunked_) { buff.Append("\r\n", 2); }
+        appended = true;
+    }
+    if(!more) {
+        if(chunked_) {
+            buff.Append("0\r\n\r\n", 5);
+            appended = true;
+        }
+        Reset();
+    }
+    return appended;
+}
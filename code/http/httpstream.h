@@ -0,0 +1,45 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-09
+ * @copyleft Apache 2.0
+ */
+#ifndef HTTP_STREAM_H
+#define HTTP_STREAM_H
+
+#include <string>
+#include <functional>
+
+#include "../buffer/buffer.h"
+#include "httprequest.h"
+#include "router.h"
+
+// 流式响应：动态处理函数逐段生成响应体，以Transfer-Encoding: chunked发送
+// 连接把上一段写完后才向生产者要下一段，socket写满(EAGAIN)时等待EPOLLOUT，生产者随之暂停，
+// 每个响应只占用一段的内存，与总长度无关；第一段生成后即可发出，不必等整个页面生成完
+class HttpStream {
+public:
+    // 生产者：向chunk追加下一段数据(建议不超过CHUNK_SIZE)，返回false表示没有更多数据
+    typedef Router::Producer Producer;
+    // 处理函数：根据请求设置Content-type(默认text/html)，返回生产者；用Router::Add注册
+    typedef Router::Handler Handler;
+
+    HttpStream();
+
+    // chunked为false时(HTTP/1.0)直接发送原始数据，由关闭连接表示结束
+    void Start(const Producer& producer, bool chunked);
+    void Reset();
+    bool IsActive() const { return active_; }
+
+    // 向生产者要下一段并追加到buff，生产者结束时追加结束块；没有追加任何数据返回false
+    bool Next(Buffer& buff);
+
+    static const size_t CHUNK_SIZE = 16 * 1024;
+
+private:
+    Producer producer_;
+    bool active_;
+    bool chunked_;
+    std::string chunk_; // 复用的分段缓冲，容量不超过生产者给出的最大一段
+};
+
+#endif //HTTP_STREAM_H
@@ -0,0 +1,158 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-17
+ * @copyleft Apache 2.0
+ */
+#include "middleware.h"
+#include "base64.h"
+#include "../log/accesslog.h"
+
+#include <chrono>
+#include <string.h>      // memcpy()
+using namespace std;
+
+static int64_t NowUs() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RequestContext::RequestContext() : request_(nullptr), peer_({ 0 }), tls_(false),
+    startUs_(0), code_(0), bytes_(0), depth_(0), headersLen_(0) {}
+
+void RequestContext::Reset(const HttpRequest* request, const sockaddr_in& peer, bool tls) {
+    request_ = request;
+    peer_ = peer;
+    tls_ = tls;
+    startUs_ = NowUs();
+    code_ = 0;
+    bytes_ = 0;
+    depth_ = 0;
+    headersLen_ = 0; // 只重置长度，不清零
+}
+
+bool RequestContext::AddHeader(const char* name, const char* value) {
+    size_t nameLen = strlen(name), valueLen = strlen(value);
+    size_t len = nameLen + 2 + valueLen + 2;
+    if(headersLen_ + len > HEADER_BYTES) {
+        return false;
+    }
+    char* p = headers_ + headersLen_;
+    memcpy(p, name, nameLen);
+    memcpy(p + nameLen, ": ", 2);
+    memcpy(p + nameLen + 2, value, valueLen);
+    memcpy(p + nameLen + 2 + valueLen, "\r\n", 2);
+    headersLen_ += len;
+    return true;
+}
+
+bool RequestContext::AppendHeaders(const char* lines, size_t len) {
+    if(headersLen_ + len > HEADER_BYTES) {
+        return false;
+    }
+    memcpy(headers_ + headersLen_, lines, len);
+    headersLen_ += len;
+    return true;
+}
+
+void AccessLog::After(RequestContext& ctx) {
+    if(!enabled_) { return; }
+    const HttpRequest& request = ctx.Request();
+    AccessLogWriter* writer = AccessLogWriter::Instance();
+    if(writer->IsOpen()) {
+        AccessLogWriter::Entry entry;
+        entry.peer = &ctx.Peer();
+        entry.method = request.method().c_str();
+        entry.target = request.target().c_str();
+        entry.version = request.version().c_str();
+        entry.status = ctx.Code();
+        entry.bytes = ctx.Bytes();
+        entry.durationUs = NowUs() - ctx.StartUs();
+        entry.dbUs = request.DbUs();
+        entry.referer = request.Header("Referer");
+        entry.userAgent = request.Header("User-Agent");
+        writer->Write(entry);
+        return;
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &ctx.Peer().sin_addr, ip, sizeof(ip));
+    LOG_INFO("%s \"%s %s HTTP/%s\" %d %lldus", ip, request.method().c_str(), request.path().c_str(),
+             request.version().c_str(), ctx.Code(), (long long)(NowUs() - ctx.StartUs()));
+}
+
+atomic<uint64_t> RateLimit::rejectCount;
+
+RateLimit::RateLimit() : intervalUs_(0), burstUs_(0) {
+    for(auto& tat: tat_) { tat = 0; }
+}
+
+void RateLimit::Configure(int rate, int burst) {
+    intervalUs_ = rate > 0 ? 1000000 / rate : 0;
+    burstUs_ = intervalUs_ * max(burst, 0);
+}
+
+bool RateLimit::Before(RequestContext& ctx) {
+    if(intervalUs_ == 0) { return true; }
+    // Fibonacci散列，取高位作为槽位
+    uint32_t ip = ctx.Peer().sin_addr.s_addr;
+    atomic<int64_t>& slot = tat_[(ip * 2654435769u) >> 20];
+    int64_t now = ctx.StartUs();
+    int64_t tat = slot.load(memory_order_relaxed);
+    int64_t next;
+    do {
+        next = max(tat, now) + intervalUs_;
+        if(next - now > burstUs_ + intervalUs_) {
+            // 额度用完，告知客户端还要等多久(向上取整到秒)
+            char wait[16];
+            snprintf(wait, sizeof(wait), "%lld", (long long)((next - now - burstUs_ - intervalUs_) / 1000000 + 1));
+            ctx.AddHeader("Retry-After", wait);
+            ctx.Reject(429);
+            rejectCount++;
+            return false;
+        }
+    } while(!slot.compare_exchange_weak(tat, next, memory_order_relaxed));
+    return true;
+}
+
+atomic<uint64_t> BasicAuth::rejectCount;
+
+void BasicAuth::Protect(const string& prefix, const string& realm, const string& credential) {
+    Rule rule;
+    rule.prefix = prefix;
+    rule.authorization = "Basic " + Base64(credential);
+    rule.challenge = "WWW-Authenticate: Basic realm=\"" + realm + "\"\r\n";
+    rules_.push_back(move(rule));
+}
+
+bool BasicAuth::Before(RequestContext& ctx) {
+    const HttpRequest& request = ctx.Request();
+    for(const Rule& rule: rules_) {
+        if(request.path().compare(0, rule.prefix.size(), rule.prefix) != 0) {
+            continue;
+        }
+        const char* authorization = request.Header("Authorization");
+        if(authorization && rule.authorization == authorization) {
+            return true;
+        }
+        ctx.AppendHeaders(rule.challenge.data(), rule.challenge.size());
+        ctx.Reject(401);
+        rejectCount++;
+        return false;
+    }
+    return true;
+}
+
+void ResponseHeaders::Add(const string& name, const string& value) {
+    lines_ += name + ": " + value + "\r\n";
+}
+
+bool ResponseHeaders::Before(RequestContext& ctx) {
+    if(!lines_.empty()) {
+        ctx.AppendHeaders(lines_.data(), lines_.size());
+    }
+    return true;
+}
+
+ServerPipeline* ServerPipeline::Instance() {
+    static ServerPipeline inst;
+    return &inst;
+}
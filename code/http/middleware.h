@@ -0,0 +1,179 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-17
+ * @copyleft Apache 2.0
+ */
+#ifndef MIDDLEWARE_H
+#define MIDDLEWARE_H
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <atomic>
+#include <type_traits>
+#include <stdint.h>
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "httprequest.h"
+
+// 中间件：在路由和静态资源之前检查请求(认证、限流)，在响应生成之后记录结果(日志)
+// 中间件链的类型在编译时确定，Before/After按模板展开成直接调用，没有虚函数；
+// 每个请求使用的RequestContext嵌在连接(或HTTP/2的流)中，头部写入定长空间，保持连接的后续请求复用，
+// 中间件再多，每个请求也不会因此分配内存
+
+// 一个请求的上下文：中间件拒绝请求、追加响应头部都通过它完成
+class RequestContext {
+public:
+    RequestContext();
+
+    // 每个请求开始时调用，清空上一个请求添加的头部和状态
+    void Reset(const HttpRequest* request, const sockaddr_in& peer, bool tls);
+
+    const HttpRequest& Request() const { return *request_; }
+    const sockaddr_in& Peer() const { return peer_; }
+    bool IsTls() const { return tls_; }
+    int64_t StartUs() const { return startUs_; } // 请求开始处理的时间(单调时钟，微秒)
+
+    // 拒绝请求：后面的中间件和处理函数不再调用，以code回复错误页
+    void Reject(int code) { code_ = code; }
+    // Before阶段是拒绝的状态码(0表示没有拒绝)，After阶段是响应的状态码
+    int Code() const { return code_; }
+    void SetCode(int code) { code_ = code; }
+    // After阶段是响应的字节数(含头部，流式响应只含响应头)
+    uint64_t Bytes() const { return bytes_; }
+    void SetBytes(uint64_t bytes) { bytes_ = bytes; }
+
+    // 追加一个响应头部，空间不足时返回false
+    bool AddHeader(const char* name, const char* value);
+    // 追加已经格式化好的头部("Name: value\r\n")
+    bool AppendHeaders(const char* lines, size_t len);
+    const char* Headers() const { return headers_; }
+    size_t HeadersLen() const { return headersLen_; }
+
+    static const size_t HEADER_BYTES = 512;
+
+private:
+    template<typename... Ms> friend class Pipeline;
+
+    const HttpRequest* request_;
+    sockaddr_in peer_;
+    bool tls_;
+    int64_t startUs_;
+    int code_;
+    uint64_t bytes_;
+    int depth_; // 调用过Before的中间件个数，After只调用这些中间件
+    size_t headersLen_;
+    char headers_[HEADER_BYTES];
+};
+
+// 中间件的默认实现，派生类只需要隐藏(不是重写)需要的那个函数
+struct Middleware {
+    bool Before(RequestContext&) { return true; } // 返回false表示拒绝请求
+    void After(RequestContext&) {}
+};
+
+// 中间件链：Before按顺序调用，某一个返回false时停止；After按相反的顺序调用已经调用过Before的中间件
+// 所以排在前面的中间件(如访问日志)也能看到被后面拒绝的请求
+template<typename... Ms>
+class Pipeline {
+public:
+    bool Before(RequestContext& ctx) {
+        ctx.depth_ = 0;
+        return Before_<0>(ctx);
+    }
+    void After(RequestContext& ctx) { After_<sizeof...(Ms)>(ctx); }
+
+    // 取得链中的中间件进行配置(仅在启动时调用)
+    template<typename M>
+    M& Get() { return std::get<M>(middlewares_); }
+
+private:
+    template<size_t I>
+    typename std::enable_if<I == sizeof...(Ms), bool>::type Before_(RequestContext&) { return true; }
+
+    template<size_t I>
+    typename std::enable_if<(I < sizeof...(Ms)), bool>::type Before_(RequestContext& ctx) {
+        ctx.depth_ = I + 1;
+        return std::get<I>(middlewares_).Before(ctx) && Before_<I + 1>(ctx);
+    }
+
+    template<size_t I>
+    typename std::enable_if<I == 0>::type After_(RequestContext&) {}
+
+    template<size_t I>
+    typename std::enable_if<(I > 0)>::type After_(RequestContext& ctx) {
+        if((int)I <= ctx.depth_) {
+            std::get<I - 1>(middlewares_).After(ctx);
+        }
+        After_<I - 1>(ctx);
+    }
+
+    std::tuple<Ms...> middlewares_;
+};
+
+/* 内置的中间件，默认都不起作用，配置之后生效 */
+
+// 访问日志：每个请求一行，包括被拒绝的请求；打开了AccessLogWriter时写入访问日志文件，否则写入运行日志
+class AccessLog : public Middleware {
+public:
+    AccessLog() : enabled_(false) {}
+    void Enable(bool enabled) { enabled_ = enabled; }
+    void After(RequestContext& ctx);
+
+private:
+    bool enabled_;
+};
+
+// 按客户端IPv4地址限流(GCRA)：平均每秒rate个请求，另外允许突发burst个，超出回复429
+// 地址散列到定长的槽位表，冲突的地址共享额度；每个请求只有一次CAS，不加锁
+class RateLimit : public Middleware {
+public:
+    RateLimit();
+    void Configure(int rate, int burst); // rate为0表示不限流
+    bool Before(RequestContext& ctx);
+
+    static std::atomic<uint64_t> rejectCount;
+
+private:
+    static const size_t SLOTS = 4096;
+
+    int64_t intervalUs_; // 每个请求占用的时间
+    int64_t burstUs_; // 允许提前的时间
+    std::atomic<int64_t> tat_[SLOTS]; // 各槽位的理论到达时间
+};
+
+// HTTP基本认证：路径以prefix开头的请求需要匹配的Authorization头部，否则回复401
+class BasicAuth : public Middleware {
+public:
+    // credential为"用户名:密码"
+    void Protect(const std::string& prefix, const std::string& realm, const std::string& credential);
+    bool Before(RequestContext& ctx);
+
+    static std::atomic<uint64_t> rejectCount;
+
+private:
+    struct Rule {
+        std::string prefix;
+        std::string authorization; // "Basic base64(credential)"
+        std::string challenge; // WWW-Authenticate头部
+    };
+    std::vector<Rule> rules_;
+};
+
+// 为每个响应追加固定的头部(如安全相关的头部)
+class ResponseHeaders : public Middleware {
+public:
+    void Add(const std::string& name, const std::string& value);
+    bool Before(RequestContext& ctx);
+
+private:
+    std::string lines_; // 格式化好的头部
+};
+
+// 服务器使用的中间件链，顺序即调用Before的顺序
+class ServerPipeline : public Pipeline<AccessLog, RateLimit, BasicAuth, ResponseHeaders> {
+public:
+    static ServerPipeline* Instance();
+};
+
+#endif //MIDDLEWARE_H
@@ -0,0 +1,69 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-06
+ * @copyleft Apache 2.0
+ */
+#ifndef MIME_TYPE_H
+#define MIME_TYPE_H
+
+#include <string>
+#include <unordered_map>
+
+// 后缀-类型表，HttpResponse和资源打包工具共用，只依赖标准库
+
+// 按文件后缀(含.)查询Content-type，未知类型返回text/plain
+inline std::string MimeType(const std::string& suffix) {
+    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE = {
+        { ".html",  "text/html" },
+        { ".xml",   "text/xml" },
+        { ".xhtml", "application/xhtml+xml" },
+        { ".txt",   "text/plain" },
+        { ".rtf",   "application/rtf" },
+        { ".pdf",   "application/pdf" },
+        { ".word",  "application/nsword" },
+        { ".png",   "image/png" },
+        { ".gif",   "image/gif" },
+        { ".jpg",   "image/jpeg" },
+        { ".jpeg",  "image/jpeg" },
+        { ".au",    "audio/basic" },
+        { ".mpeg",  "video/mpeg" },
+        { ".mpg",   "video/mpeg" },
+        { ".avi",   "video/x-msvideo" },
+        { ".gz",    "application/x-gzip" },
+        { ".tar",   "application/x-tar" },
+        { ".css",   "text/css" },
+        { ".js",    "text/javascript" },
+        { ".svg",   "image/svg+xml" },
+        { ".ico",   "image/x-icon" },
+        { ".mp4",   "video/mp4" },
+        { ".webm",  "video/webm" },
+        { ".woff",  "font/woff" },
+        { ".woff2", "font/woff2" },
+        { ".ttf",   "font/ttf" },
+        { ".otf",   "font/otf" },
+        { ".eot",   "application/vnd.ms-fontobject" },
+    };
+    auto it = SUFFIX_TYPE.find(suffix);
+    if(it != SUFFIX_TYPE.end()) {
+        return it->second;
+    }
+    return "text/plain";
+}
+
+// 文件后缀，没有后缀返回空串
+inline std::string FileSuffix(const std::string& path) {
+    std::string::size_type idx = path.find_last_of('.');
+    if(idx == std::string::npos || path.find('/', idx) != std::string::npos) {
+        return "";
+    }
+    return path.substr(idx);
+}
+
+// 值得压缩的类型(文本类)，图片、woff等已经压缩过的格式不再压缩
+inline bool IsCompressibleType(const std::string& type) {
+    return type.compare(0, 5, "text/") == 0 || type == "image/svg+xml"
+        || type == "application/xhtml+xml" || type == "application/rtf"
+        || type == "font/ttf" || type == "font/otf" || type == "application/vnd.ms-fontobject";
+}
+
+#endif //MIME_TYPE_H
@@ -0,0 +1,669 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#include "proxyconn.h"
+#include "../log/accesslog.h"
+
+#include <fcntl.h>       // splice()
+#include <unistd.h>      // close()
+#include <string.h>      // memmem()
+#include <strings.h>     // strncasecmp()
+#include <ctype.h>       // isxdigit()
+#include <errno.h>
+#include <sys/socket.h>
+#include <chrono>
+using namespace std;
+
+std::atomic<uint64_t> ProxyConn::requestCount;
+std::atomic<uint64_t> ProxyConn::errorCount;
+std::atomic<uint64_t> ProxyConn::retryCount;
+std::atomic<uint64_t> ProxyConn::spliceBytes;
+const size_t ProxyConn::READ_CHUNK; // std::min()按引用取参数，需要类外的定义
+
+size_t ProxyConn::ChunkScanner::Scan(const char* data, size_t len) {
+    size_t i = 0;
+    while(i < len && state != DONE && state != ERROR) {
+        char c = data[i];
+        switch(state) {
+        case SIZE:
+            if(isxdigit(static_cast<unsigned char>(c))) {
+                if(left >> 60) { state = ERROR; break; } // 长度溢出
+                left = left * 16 + (isdigit(static_cast<unsigned char>(c)) ? c - '0' : (tolower(c) - 'a' + 10));
+            } else if(c == ';' || c == ' ' || c == '\t') {
+                state = EXT;
+            } else if(c == '\r') {
+                state = SIZE_LF;
+            } else {
+                state = ERROR;
+            }
+            i++;
+            break;
+        case EXT:
+            if(c == '\r') { state = SIZE_LF; }
+            i++;
+            break;
+        case SIZE_LF:
+            state = c != '\n' ? ERROR : (left == 0 ? LINE_START : DATA);
+            i++;
+            break;
+        case DATA: {
+            // 块数据整段跳过
+            size_t n = std::min(left, len - i);
+            left -= n;
+            i += n;
+            if(left == 0) { state = DATA_CR; }
+            break;
+        }
+        case DATA_CR:
+            state = c == '\r' ? DATA_LF : ERROR;
+            i++;
+            break;
+        case DATA_LF:
+            state = c == '\n' ? SIZE : ERROR;
+            i++;
+            break;
+        case LINE_START:
+            state = c == '\r' ? END_LF : TRAILER;
+            i++;
+            break;
+        case TRAILER:
+            if(c == '\n') { state = LINE_START; }
+            i++;
+            break;
+        case END_LF:
+            state = c == '\n' ? DONE : ERROR;
+            i++;
+            break;
+        default:
+            break;
+        }
+    }
+    return i;
+}
+
+ProxyConn::ProxyConn(bool splice) {
+    splice_ = splice;
+    pipe_[0] = pipe_[1] = -1;
+    pipeBytes_ = 0;
+    route_ = nullptr;
+    upstream_ = nullptr;
+    fd_ = -1;
+    connecting_ = reused_ = reusable_ = false;
+    retries_ = 0;
+    state_ = FINISHED;
+    want_ = DONE;
+    keepAlive_ = false;
+    isHead_ = idempotent_ = continue_ = false;
+    reqSent_ = 0;
+    bodyChunked_ = bodySent_ = false;
+    bodyLeft_ = 0;
+    respBytes_ = 0;
+    headSent_ = false;
+    framing_ = NONE;
+    left_ = 0;
+    client_ = { 0 };
+    hasReferer_ = hasUserAgent_ = false;
+    status_ = 0;
+    errorBytes_ = 0;
+    startUs_ = upstreamStartUs_ = 0;
+    logged_ = true;
+}
+
+ProxyConn::~ProxyConn() {
+    ReleaseUpstream_(false);
+    if(pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+}
+
+ProxyRoute* ProxyConn::Peek(const Buffer& in, size_t* headLen) {
+    *headLen = 0;
+    const char* begin = in.Peek();
+    size_t len = in.ReadableBytes();
+    // 请求行：方法 目标 版本
+    const char* eol = static_cast<const char*>(memmem(begin, len, "\r\n", 2));
+    if(!eol) {
+        return nullptr;
+    }
+    const char* target = static_cast<const char*>(memchr(begin, ' ', eol - begin));
+    if(!target) {
+        return nullptr;
+    }
+    target++;
+    const char* end = static_cast<const char*>(memchr(target, ' ', eol - target));
+    if(!end) {
+        return nullptr;
+    }
+    ProxyRoute* route = ProxyRoute::Match(target, end - target);
+    if(route) {
+        const char* head = static_cast<const char*>(memmem(begin, len, "\r\n\r\n", 4));
+        if(head) { *headLen = head + 4 - begin; }
+    }
+    return route;
+}
+
+bool ProxyConn::HasToken_(const string& value, const char* token) {
+    size_t tokenLen = strlen(token);
+    size_t i = 0;
+    while(i < value.size()) {
+        while(i < value.size() && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) { i++; }
+        size_t j = i;
+        while(j < value.size() && value[j] != ',' && value[j] != ' ' && value[j] != '\t') { j++; }
+        if(j - i == tokenLen && strncasecmp(value.data() + i, token, tokenLen) == 0) {
+            return true;
+        }
+        i = j;
+    }
+    return false;
+}
+
+bool ProxyConn::IsHopHeader_(const string& name, const string& connection) {
+    // 逐跳头部只对一个连接有效，不转发；Connection中列出的头部同样是逐跳的
+    static const char* HOP[] = { "Connection", "Keep-Alive", "Proxy-Connection", "TE",
+                                 "Upgrade", "Expect", "Proxy-Authorization" };
+    for(const char* hop: HOP) {
+        if(strcasecmp(name.c_str(), hop) == 0) { return true; }
+    }
+    return HasToken_(connection, name.c_str());
+}
+
+// 按行拆分头部，回调的参数为名称和去掉前后空白的值
+template<typename F>
+static void EachHeader(const char* begin, const char* end, F f) {
+    const char* line = begin;
+    while(line < end) {
+        const char* eol = static_cast<const char*>(memmem(line, end - line, "\r\n", 2));
+        if(!eol) { eol = end; }
+        const char* colon = static_cast<const char*>(memchr(line, ':', eol - line));
+        if(colon) {
+            const char* v = colon + 1;
+            const char* ve = eol;
+            while(v < ve && (*v == ' ' || *v == '\t')) { v++; }
+            while(ve > v && (ve[-1] == ' ' || ve[-1] == '\t')) { ve--; }
+            f(string(line, colon), string(v, ve), line, eol);
+        }
+        line = eol + 2;
+    }
+}
+
+void ProxyConn::Start(ProxyRoute* route, Buffer& in, size_t headLen,
+                      const sockaddr_in& client, bool tls, bool keepAlive) {
+    assert(state_ == FINISHED && fd_ < 0 && pipeBytes_ == 0);
+    requestCount++;
+    route_ = route;
+    retries_ = 0;
+    reqSent_ = 0;
+    bodyChunked_ = bodySent_ = false;
+    bodyLeft_ = 0;
+    reqChunks_.Reset();
+    resp_.RetrieveAll();
+    respBytes_ = 0;
+    headSent_ = false;
+    client_ = client;
+    status_ = 0;
+    errorBytes_ = 0;
+    startUs_ = NowUs_();
+    upstreamStartUs_ = 0;
+    logged_ = false;
+
+    const char* begin = in.Peek();
+    const char* lineEnd = static_cast<const char*>(memmem(begin, headLen, "\r\n", 2));
+    const char* headEnd = begin + headLen - 2; // 最后一个头部行的"\r\n"之后
+    string line(begin, lineEnd);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.rfind(' ');
+    string method = line.substr(0, sp1);
+    string version = line.substr(sp2 + 1);
+    method_ = method;
+    target_.assign(line, sp1 + 1, sp2 - sp1 - 1);
+    version_.assign(version, version.size() > 5 ? 5 : version.size(), string::npos);
+    hasReferer_ = hasUserAgent_ = false;
+    isHead_ = method == "HEAD";
+    idempotent_ = method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+                  method == "PUT" || method == "DELETE";
+
+    // 先找Connection，它列出的头部也不转发
+    string connection, forwarded;
+    EachHeader(lineEnd + 2, headEnd, [&](const string& name, const string& value, const char*, const char*) {
+        if(strcasecmp(name.c_str(), "Connection") == 0) {
+            connection += (connection.empty() ? "" : ",") + value;
+        } else if(strcasecmp(name.c_str(), "Referer") == 0) {
+            referer_ = value;
+            hasReferer_ = true;
+        } else if(strcasecmp(name.c_str(), "User-Agent") == 0) {
+            userAgent_ = value;
+            hasUserAgent_ = true;
+        }
+    });
+    bool http11 = version == "HTTP/1.1";
+    keepAlive_ = keepAlive && (http11 ? !HasToken_(connection, "close") : HasToken_(connection, "keep-alive"));
+    continue_ = false;
+
+    // 上游连接总是HTTP/1.1的保持连接
+    reqHead_.clear();
+    reqHead_.reserve(headLen + 128);
+    reqHead_.append(line, 0, sp2 + 1);
+    reqHead_ += "HTTP/1.1\r\n";
+    EachHeader(lineEnd + 2, headEnd, [&](const string& name, const string& value, const char* l, const char* e) {
+        if(strcasecmp(name.c_str(), "Expect") == 0) {
+            continue_ = strcasecmp(value.c_str(), "100-continue") == 0; // 由代理直接回复
+            return;
+        }
+        if(strcasecmp(name.c_str(), "X-Forwarded-For") == 0) {
+            forwarded += (forwarded.empty() ? "" : ", ") + value;
+            return;
+        }
+        if(IsHopHeader_(name, connection)) {
+            return;
+        }
+        if(strcasecmp(name.c_str(), "Content-Length") == 0) {
+            bodyLeft_ = strtoull(value.c_str(), nullptr, 10);
+        } else if(strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+            bodyChunked_ = HasToken_(value, "chunked");
+        }
+        reqHead_.append(l, e - l);
+        reqHead_ += "\r\n";
+    });
+    char ip[INET_ADDRSTRLEN] = { 0 };
+    inet_ntop(AF_INET, &client.sin_addr, ip, sizeof(ip));
+    forwarded += (forwarded.empty() ? "" : ", ") + string(ip);
+    reqHead_ += "X-Forwarded-For: " + forwarded + "\r\n";
+    reqHead_ += tls ? "X-Forwarded-Proto: https\r\n" : "X-Forwarded-Proto: http\r\n";
+    reqHead_ += "Connection: keep-alive\r\n\r\n";
+    if(bodyChunked_) {
+        bodyLeft_ = 0; // 同时出现时以分块为准
+    }
+    if(!bodyChunked_ && bodyLeft_ == 0) {
+        continue_ = false;
+    }
+    in.Retrieve(headLen);
+
+    state_ = SEND;
+    want_ = UPSTREAM_WRITE;
+}
+
+int ProxyConn::Connect_() {
+    upstream_ = route_->Pick();
+    if(!upstream_) {
+        return 503;
+    }
+    fd_ = upstream_->Acquire(&reused_, &connecting_);
+    if(fd_ < 0) {
+        upstream_ = nullptr;
+        return 502;
+    }
+    reusable_ = true;
+    if(upstreamStartUs_ == 0) {
+        upstreamStartUs_ = NowUs_(); // 重试时仍从第一次连接算起
+    }
+    return 0;
+}
+
+void ProxyConn::ReleaseUpstream_(bool reusable) {
+    if(fd_ >= 0) {
+        upstream_->Release(fd_, reusable);
+        fd_ = -1;
+        upstream_ = nullptr;
+    }
+}
+
+ProxyConn::Want ProxyConn::Advance(Buffer& in, Buffer& out) {
+    assert(out.ReadableBytes() == 0 && pipeBytes_ == 0);
+    switch(state_) {
+    case SEND:
+        want_ = Send_(in, out);
+        break;
+    case HEAD:
+        want_ = ReadHead_(out);
+        break;
+    case BODY:
+        want_ = ReadBody_(out);
+        break;
+    default:
+        want_ = DONE;
+        break;
+    }
+    if(want_ == DONE && !logged_) {
+        LogAccess_();
+    }
+    return want_;
+}
+
+int64_t ProxyConn::NowUs_() {
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ProxyConn::LogAccess_() {
+    logged_ = true;
+    AccessLogWriter* writer = AccessLogWriter::Instance();
+    if(!writer->IsOpen()) {
+        return;
+    }
+    int64_t now = NowUs_();
+    AccessLogWriter::Entry entry;
+    entry.peer = &client_;
+    entry.method = method_.c_str();
+    entry.target = target_.c_str();
+    entry.version = version_.c_str();
+    entry.status = status_;
+    entry.bytes = respBytes_ + errorBytes_;
+    entry.durationUs = now - startUs_;
+    entry.upstreamUs = upstreamStartUs_ > 0 ? now - upstreamStartUs_ : -1;
+    entry.referer = hasReferer_ ? referer_.c_str() : nullptr;
+    entry.userAgent = hasUserAgent_ ? userAgent_.c_str() : nullptr;
+    writer->Write(entry);
+}
+
+ProxyConn::Want ProxyConn::Send_(Buffer& in, Buffer& out) {
+    if(fd_ < 0) {
+        int code = Connect_();
+        if(code != 0) {
+            errorCount++;
+            Error_(code, out);
+            return DONE;
+        }
+        if(connecting_) { return UPSTREAM_WRITE; }
+    } else if(connecting_) {
+        // 可写之后检查非阻塞connect的结果
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if(getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0) { err = errno; }
+        if(err != 0) {
+            errno = err;
+            return Fail_(out, "connect", true);
+        }
+        connecting_ = false;
+    }
+    while(true) {
+        // 请求头和已收到的请求体一起发送
+        struct iovec iov[2];
+        int cnt = 0;
+        if(reqSent_ < reqHead_.size()) {
+            iov[cnt++] = { const_cast<char*>(reqHead_.data()) + reqSent_, reqHead_.size() - reqSent_ };
+        }
+        size_t body = 0;
+        if(bodyChunked_ && reqChunks_.state != ChunkScanner::DONE) {
+            // 扫描的是还没有发送的部分，发送不完时剩余部分下次重新扫描
+            ChunkScanner scanner = reqChunks_;
+            body = scanner.Scan(in.Peek(), in.ReadableBytes());
+            if(scanner.state == ChunkScanner::ERROR) {
+                keepAlive_ = false;
+                return Fail_(out, "request chunk", false);
+            }
+        } else if(!bodyChunked_) {
+            body = std::min(bodyLeft_, in.ReadableBytes());
+        }
+        if(body > 0) {
+            iov[cnt++] = { const_cast<char*>(in.Peek()), body };
+        }
+        bool bodyDone = bodyChunked_ ? reqChunks_.state == ChunkScanner::DONE : bodyLeft_ == 0;
+        if(cnt == 0) {
+            if(bodyDone) { break; }
+            // 等待客户端的请求体；先回复100 Continue
+            if(continue_) {
+                continue_ = false;
+                out.Append("HTTP/1.1 100 Continue\r\n\r\n");
+                return CLIENT_WRITE;
+            }
+            return CLIENT_READ;
+        }
+        struct msghdr msg = { 0 };
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t len = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if(len < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) { return UPSTREAM_WRITE; }
+            return Fail_(out, "send", true);
+        }
+        size_t n = len;
+        size_t head = std::min(n, reqHead_.size() - reqSent_);
+        reqSent_ += head;
+        n -= head;
+        if(n > 0) {
+            // 取走的请求体不能再重发
+            bodySent_ = true;
+            if(bodyChunked_) {
+                reqChunks_.Scan(in.Peek(), n);
+            } else {
+                bodyLeft_ -= n;
+            }
+            in.Retrieve(n);
+            continue_ = false;
+        }
+    }
+    state_ = HEAD;
+    return ReadHead_(out);
+}
+
+ProxyConn::Want ProxyConn::Recv_(Buffer& out) {
+    resp_.EnsureWriteable(READ_CHUNK);
+    ssize_t len = recv(fd_, resp_.BeginWrite(), READ_CHUNK, 0);
+    if(len > 0) {
+        resp_.HasWritten(len);
+        respBytes_ += len;
+        return CLIENT_WRITE;
+    }
+    if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return UPSTREAM_READ;
+    }
+    if(len == 0 && state_ == BODY && framing_ == UNTIL_CLOSE) {
+        return Finish_();
+    }
+    // 连接池中的连接可能刚好被上游关闭，还没有收到响应时可以换一个连接重试
+    return Fail_(out, len == 0 ? "closed" : "recv", respBytes_ == 0);
+}
+
+ProxyConn::Want ProxyConn::ReadHead_(Buffer& out) {
+    while(true) {
+        const char* end = static_cast<const char*>(memmem(resp_.Peek(), resp_.ReadableBytes(), "\r\n\r\n", 4));
+        if(end) {
+            size_t len = end + 4 - resp_.Peek();
+            if(!ParseHead_(len, out)) {
+                return Fail_(out, "response head", false);
+            }
+            if(state_ == HEAD) {
+                continue; // 1xx临时响应，接着读最终响应
+            }
+            return ReadBody_(out);
+        }
+        if(resp_.ReadableBytes() > MAX_HEAD) {
+            return Fail_(out, "response head too large", false);
+        }
+        Want want = Recv_(out);
+        if(want != CLIENT_WRITE) {
+            return want;
+        }
+    }
+}
+
+bool ProxyConn::ParseHead_(size_t len, Buffer& out) {
+    const char* begin = resp_.Peek();
+    const char* lineEnd = static_cast<const char*>(memmem(begin, len, "\r\n", 2));
+    // 状态行："HTTP/1.x NNN 描述"
+    if(lineEnd - begin < 12 || memcmp(begin, "HTTP/1.", 7) != 0 || begin[8] != ' ') {
+        return false;
+    }
+    int code = atoi(begin + 9);
+    bool http11 = begin[7] == '1';
+    if(code >= 100 && code < 200) {
+        resp_.Retrieve(len); // 不转发临时响应
+        return true;
+    }
+    status_ = code;
+    const char* headEnd = begin + len - 2;
+    string connection;
+    bool chunked = false, hasLength = false;
+    size_t length = 0;
+    EachHeader(lineEnd + 2, headEnd, [&](const string& name, const string& value, const char*, const char*) {
+        if(strcasecmp(name.c_str(), "Connection") == 0) {
+            connection += (connection.empty() ? "" : ",") + value;
+        } else if(strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+            chunked = HasToken_(value, "chunked");
+        } else if(strcasecmp(name.c_str(), "Content-Length") == 0) {
+            hasLength = true;
+            length = strtoull(value.c_str(), nullptr, 10);
+        }
+    });
+    reusable_ = http11 ? !HasToken_(connection, "close") : HasToken_(connection, "keep-alive");
+    if(isHead_ || code == 204 || code == 304) {
+        framing_ = NONE;
+    } else if(chunked) {
+        framing_ = CHUNKED;
+        respChunks_.Reset();
+    } else if(hasLength) {
+        framing_ = LENGTH;
+        left_ = length;
+    } else {
+        framing_ = UNTIL_CLOSE; // 只能用关闭连接表示结束
+        reusable_ = false;
+        keepAlive_ = false;
+    }
+
+    out.Append("HTTP/1.1");
+    out.Append(begin + 8, lineEnd + 2 - (begin + 8));
+    EachHeader(lineEnd + 2, headEnd, [&](const string& name, const string&, const char* l, const char* e) {
+        if(!IsHopHeader_(name, connection)) {
+            out.Append(l, e + 2 - l);
+        }
+    });
+    out.Append(keepAlive_ ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    resp_.Retrieve(len);
+    headSent_ = true;
+    state_ = BODY;
+    return true;
+}
+
+bool ProxyConn::Forward_(Buffer& out) {
+    size_t n = resp_.ReadableBytes();
+    if(framing_ == LENGTH) {
+        n = std::min(n, left_);
+        left_ -= n;
+    } else if(framing_ == CHUNKED) {
+        n = respChunks_.Scan(resp_.Peek(), n);
+        if(respChunks_.state == ChunkScanner::ERROR) {
+            return false;
+        }
+    } else if(framing_ == NONE) {
+        n = 0;
+    }
+    out.Append(resp_.Peek(), n);
+    resp_.Retrieve(n);
+    return true;
+}
+
+ProxyConn::Want ProxyConn::ReadBody_(Buffer& out) {
+    while(true) {
+        if(!Forward_(out)) {
+            return Fail_(out, "response chunk", false);
+        }
+        bool done = framing_ == NONE || (framing_ == LENGTH && left_ == 0) ||
+                    (framing_ == CHUNKED && respChunks_.state == ChunkScanner::DONE);
+        if(done) {
+            if(resp_.ReadableBytes() > 0) {
+                reusable_ = false; // 上游在响应之后多发了数据
+            }
+            return Finish_();
+        }
+        if(out.ReadableBytes() > 0) {
+            return CLIENT_WRITE;
+        }
+        if(splice_ && (framing_ == LENGTH || framing_ == UNTIL_CLOSE)) {
+            // 上游socket -> 管道，发送时管道 -> 客户端socket
+            if(pipe_[0] < 0 && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+                pipe_[0] = pipe_[1] = -1;
+                splice_ = false;
+                continue;
+            }
+            size_t want = framing_ == LENGTH ? std::min(left_, READ_CHUNK) : READ_CHUNK;
+            ssize_t len = splice(fd_, nullptr, pipe_[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(len > 0) {
+                pipeBytes_ += len;
+                respBytes_ += len;
+                if(framing_ == LENGTH) {
+                    left_ -= len;
+                    if(left_ == 0) { return Finish_(); }
+                }
+                return CLIENT_WRITE;
+            }
+            if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return UPSTREAM_READ;
+            }
+            if(len == 0 && framing_ == UNTIL_CLOSE) {
+                return Finish_();
+            }
+            return Fail_(out, len == 0 ? "closed" : "splice", false);
+        }
+        Want want = Recv_(out);
+        if(want != CLIENT_WRITE) {
+            return want;
+        }
+    }
+}
+
+ssize_t ProxyConn::SpliceTo(int fd, size_t limit, int* saveErrno) {
+    ssize_t len = splice(pipe_[0], nullptr, fd, nullptr, std::min(pipeBytes_, limit),
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    pipeBytes_ -= len;
+    spliceBytes += len;
+    return len;
+}
+
+ProxyConn::Want ProxyConn::Finish_() {
+    ReleaseUpstream_(reusable_ && framing_ != UNTIL_CLOSE);
+    state_ = FINISHED;
+    return DONE;
+}
+
+ProxyConn::Want ProxyConn::Fail_(Buffer& out, const char* reason, bool retryable) {
+    errorCount++;
+    LOG_WARN("Proxy %s upstream %s: %s error %d", route_->Prefix().c_str(),
+             upstream_ ? upstream_->Name().c_str() : "-", reason, errno);
+    bool sent = reqSent_ > 0;
+    ReleaseUpstream_(false);
+    // 还没有发出请求(连接失败)，或者复用的连接上没有请求体的幂等请求还没有收到响应，可以重试一次
+    if(retryable && retries_ == 0 && !bodySent_ && !headSent_ && (!sent || (reused_ && idempotent_))) {
+        retryCount++;
+        retries_++;
+        // 从头重新发送请求头，丢弃旧连接上收到的部分响应
+        state_ = SEND;
+        reqSent_ = 0;
+        resp_.RetrieveAll();
+        respBytes_ = 0;
+        respChunks_.Reset();
+        status_ = 0;
+        int code = Connect_();
+        if(code == 0) {
+            // 新连接或复用的连接可写之后重新发送请求头
+            return UPSTREAM_WRITE;
+        }
+        Error_(code, out);
+        return DONE;
+    }
+    state_ = FINISHED;
+    keepAlive_ = false;
+    if(!headSent_) {
+        Error_(502, out);
+    }
+    return DONE;
+}
+
+void ProxyConn::Error_(int code, Buffer& out) {
+    string status = code == 503 ? "503 Service Unavailable" : "502 Bad Gateway";
+    string body = status + "\n";
+    size_t before = out.ReadableBytes();
+    out.Append("HTTP/1.1 " + status + "\r\nContent-Type: text/plain\r\nContent-Length: " +
+               to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+    status_ = code;
+    errorBytes_ = out.ReadableBytes() - before;
+    state_ = FINISHED;
+    keepAlive_ = false;
+    headSent_ = true;
+}
@@ -0,0 +1,146 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#ifndef PROXY_CONN_H
+#define PROXY_CONN_H
+
+#include <atomic>
+#include <string>
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "upstream.h"
+
+// 一个客户端连接上的反向代理：把请求转发给上游，再把响应转发回客户端
+// 不阻塞任何线程：每一步做到需要等待某个fd为止，返回要等待的事件，由WebServer在同一个epoll中登记
+// 客户端fd和上游fd任何时候只有一个处于登记状态，所以同一时间只有一个工作线程在处理这个连接
+// 响应体有长度或持续到关闭时，在客户端不需要用户态加密的情况下经由管道splice，数据不进入用户态
+class ProxyConn {
+public:
+    enum Want {
+        UPSTREAM_WRITE, // 等待上游可写(连接中或发送缓冲满)
+        UPSTREAM_READ, // 等待上游的响应
+        CLIENT_READ, // 等待客户端的请求体
+        CLIENT_WRITE, // 有数据要发给客户端，发完后再调用Advance
+        DONE, // 本次交换结束，发完输出后可以处理下一个请求
+    };
+
+    // splice为false时(用户态TLS)响应体都经过out
+    explicit ProxyConn(bool splice);
+    ~ProxyConn(); // 未完成的上游连接直接关闭
+
+    // 请求目标匹配代理路由时返回路由，并在请求头完整时给出请求头的长度(否则为0)
+    static ProxyRoute* Peek(const Buffer& in, size_t* headLen);
+
+    // 开始转发in开头的长度为headLen的请求头；请求头从in中取走，请求体随后按需取走
+    // keepAlive为false时响应后关闭客户端连接(如达到单个连接的请求数上限)
+    void Start(ProxyRoute* route, Buffer& in, size_t headLen,
+               const sockaddr_in& client, bool tls, bool keepAlive);
+
+    // 推进转发：从in取请求体，把要发给客户端的数据追加到out或放入管道(out必须为空)
+    Want Advance(Buffer& in, Buffer& out);
+    Want GetWant() const { return want_; }
+    bool KeepAlive() const { return keepAlive_; } // DONE之后客户端连接是否保持
+
+    int UpstreamFd() const { return fd_; }
+    size_t PipeBytes() const { return pipeBytes_; }
+    // 把管道中至多limit字节发给客户端
+    ssize_t SpliceTo(int fd, size_t limit, int* saveErrno);
+
+    /* 统计 */
+    static std::atomic<uint64_t> requestCount; // 转发的请求数
+    static std::atomic<uint64_t> errorCount; // 上游出错的次数
+    static std::atomic<uint64_t> retryCount; // 换一个连接重试的次数
+    static std::atomic<uint64_t> spliceBytes; // 经管道转发的响应体字节数
+
+    static const size_t MAX_HEAD = 64 * 1024; // 请求头和响应头的长度上限
+    static const size_t READ_CHUNK = 64 * 1024; // 每次从上游读取/splice的最大长度
+
+private:
+    enum State {
+        SEND, // 发送请求头和请求体
+        HEAD, // 读取响应头
+        BODY, // 转发响应体
+        FINISHED,
+    };
+
+    enum Framing {
+        NONE, // 没有响应体(HEAD请求、204、304)
+        LENGTH, // Content-Length
+        CHUNKED, // 原样转发分块，扫描到结束块为止
+        UNTIL_CLOSE, // 上游关闭连接时结束
+    };
+
+    // 增量扫描分块编码，只判断边界，不改变数据
+    struct ChunkScanner {
+        enum { SIZE, EXT, SIZE_LF, DATA, DATA_CR, DATA_LF, LINE_START, TRAILER, END_LF, DONE, ERROR } state;
+        size_t left; // 当前块剩余的数据长度
+        void Reset() { state = SIZE; left = 0; }
+        size_t Scan(const char* data, size_t len); // 返回属于分块编码的字节数，到结束块为止
+    };
+
+    int Connect_(); // 选择上游并取得连接，失败时返回要回复的状态码
+    Want Send_(Buffer& in, Buffer& out);
+    Want ReadHead_(Buffer& out);
+    Want ReadBody_(Buffer& out);
+    bool ParseHead_(size_t len, Buffer& out); // 解析并改写resp_开头长度为len的响应头
+    bool Forward_(Buffer& out); // 把resp_中属于响应体的数据移到out，上游多发数据时返回false
+    Want Recv_(Buffer& out); // 读上游到resp_，有数据时返回CLIENT_WRITE，否则返回要等待的事件或DONE
+    Want Fail_(Buffer& out, const char* reason, bool retryable); // 可以重试时换一个连接，否则回复502或中断响应
+    Want Finish_();
+    void ReleaseUpstream_(bool reusable);
+    void Error_(int code, Buffer& out); // 还没有输出响应头时回复错误并关闭连接
+    void LogAccess_(); // 本次交换结束时写一行访问日志(打开了AccessLogWriter时)
+
+    static bool HasToken_(const std::string& value, const char* token); // 逗号分隔的列表中是否有token
+    static int64_t NowUs_(); // 单调时钟，微秒
+    static bool IsHopHeader_(const std::string& name, const std::string& connection);
+
+    bool splice_;
+    int pipe_[2]; // 第一次splice时创建，之后在这个客户端连接的各个请求之间复用
+    size_t pipeBytes_; // 管道中还没有发给客户端的字节数
+
+    ProxyRoute* route_;
+    Upstream* upstream_;
+    int fd_; // 上游连接，-1表示没有
+    bool connecting_; // 非阻塞connect还没有完成
+    bool reused_; // 连接来自连接池
+    bool reusable_; // 响应结束后上游连接可以放回连接池
+    int retries_;
+
+    State state_;
+    Want want_;
+    bool keepAlive_;
+    bool isHead_; // HEAD请求的响应没有响应体
+    bool idempotent_; // 请求可以在另一个连接上重发
+    bool continue_; // 客户端在等待100 Continue
+
+    std::string reqHead_; // 改写后的请求头，重试时重新发送
+    size_t reqSent_;
+    bool bodyChunked_;
+    size_t bodyLeft_; // 剩余的请求体长度
+    bool bodySent_; // 已经从客户端取走了请求体，不能再重试
+    ChunkScanner reqChunks_;
+
+    Buffer resp_; // 从上游读到、还没有转发的数据
+    size_t respBytes_; // 本次交换从上游收到的字节数
+    bool headSent_; // 已经向客户端输出了响应头
+    Framing framing_;
+    size_t left_; // LENGTH时剩余的响应体长度
+    ChunkScanner respChunks_;
+
+    /* 访问日志 */
+    sockaddr_in client_;
+    std::string method_, target_, version_, referer_, userAgent_;
+    bool hasReferer_, hasUserAgent_;
+    int status_; // 转发的状态码或代理回复的错误码
+    size_t errorBytes_; // 代理自己回复的错误页的字节数
+    int64_t startUs_;
+    int64_t upstreamStartUs_; // 第一次取得上游连接的时间，0表示没有
+    bool logged_;
+};
+
+#endif //PROXY_CONN_H
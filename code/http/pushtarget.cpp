@@ -0,0 +1,97 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-14
+ * @copyleft Apache 2.0
+ */
+#include "pushtarget.h"
+using namespace std;
+
+std::function<void()> PushTarget::notifier_;
+std::mutex PushTarget::wakeMtx_;
+std::vector<PushTarget::Ptr> PushTarget::wakeups_;
+
+PushTarget::PushTarget(int fd) {
+    fd_ = fd;
+    detached_ = false;
+    armed_ = false;
+    wakePending_ = false;
+}
+
+void PushTarget::SetNotifier(const function<void()>& notifier) {
+    notifier_ = notifier;
+}
+
+vector<PushTarget::Ptr> PushTarget::TakeWakeups() {
+    vector<Ptr> list;
+    lock_guard<mutex> locker(wakeMtx_);
+    list.swap(wakeups_);
+    return list;
+}
+
+void PushTarget::Arm(const function<void(bool pending)>& mod) {
+    lock_guard<mutex> locker(mtx_);
+    armed_ = true;
+    mod(Pending_());
+}
+
+void PushTarget::Disarm() {
+    lock_guard<mutex> locker(mtx_);
+    armed_ = false;
+}
+
+void PushTarget::Wake(const function<void(int fd)>& mod) {
+    lock_guard<mutex> locker(mtx_);
+    wakePending_ = false;
+    if(armed_ && !detached_ && Pending_()) {
+        mod(fd_);
+    }
+}
+
+void PushTarget::Detach() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(detached_) {
+            return;
+        }
+        detached_ = true;
+        armed_ = false;
+    }
+    OnDetach_();
+}
+
+bool PushTarget::Schedule_() {
+    if(armed_ && !wakePending_) {
+        wakePending_ = true;
+        return true;
+    }
+    return false;
+}
+
+void PushTarget::Notify_() {
+    bool first;
+    {
+        lock_guard<mutex> locker(wakeMtx_);
+        first = wakeups_.empty();
+        wakeups_.push_back(shared_from_this());
+    }
+    // 主线程先读eventfd再取列表，列表非空时eventfd一定已经写过
+    if(first && notifier_) { notifier_(); }
+}
+
+void PushTarget::Notify_(vector<Ptr>& targets) {
+    if(targets.empty()) {
+        return;
+    }
+    bool first;
+    {
+        lock_guard<mutex> locker(wakeMtx_);
+        first = wakeups_.empty();
+        if(first) {
+            wakeups_.swap(targets);
+        } else {
+            wakeups_.insert(wakeups_.end(), targets.begin(), targets.end());
+        }
+    }
+    targets.clear();
+    if(first && notifier_) { notifier_(); }
+}
@@ -0,0 +1,68 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-14
+ * @copyleft Apache 2.0
+ */
+#ifndef PUSH_TARGET_H
+#define PUSH_TARGET_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <functional>
+
+// 可以由其他线程推送数据的长连接(WebSocket、SSE)
+// 连接用EPOLLONESHOT登记，推送线程不能直接修改事件：空闲(已登记，没有工作线程在处理)的连接
+// 加入唤醒列表并写reactor的eventfd，由主线程登记写事件；正在处理的连接在重新登记时看到待发送的数据
+class PushTarget : public std::enable_shared_from_this<PushTarget> {
+public:
+    typedef std::shared_ptr<PushTarget> Ptr;
+
+    explicit PushTarget(int fd);
+    virtual ~PushTarget() = default;
+
+    /* reactor：登记事件与唤醒检查在同一把锁内完成，推送不会丢失唤醒 */
+    // 工作线程处理完，重新登记事件；mod的参数表示是否有待发送的数据
+    void Arm(const std::function<void(bool pending)>& mod);
+    // 主线程把事件分发给工作线程之前调用
+    void Disarm();
+    // 主线程：唤醒登记过事件的连接(mod中登记EPOLLOUT)
+    void Wake(const std::function<void(int fd)>& mod);
+    // 连接关闭，之后的推送都失败
+    void Detach();
+
+    // 主线程的定时器：连接空闲时发送心跳，对端失去响应返回false
+    virtual bool Heartbeat() = 0;
+
+    int Fd() const { return fd_; }
+
+    // 有连接需要唤醒时调用(写reactor的eventfd)，由WebServer设置
+    static void SetNotifier(const std::function<void()>& notifier);
+    static std::vector<Ptr> TakeWakeups();
+
+protected:
+    virtual bool Pending_() const = 0; // 持有mtx_时调用：是否有待发送的数据
+    virtual void OnDetach_() {} // Detach之后调用一次，不持有mtx_
+
+    // 持有mtx_时调用：连接处于登记状态并且还不在唤醒列表中时返回true，解锁后调用Notify_
+    bool Schedule_();
+    void Notify_();
+    // 批量加入唤醒列表(一次广播唤醒很多连接)，只在列表由空变为非空时写一次eventfd
+    static void Notify_(std::vector<Ptr>& targets);
+    // 只写eventfd，让主线程处理唤醒列表之外的请求(如登记定时器)
+    static void NotifyReactor_() { if(notifier_) { notifier_(); } }
+
+    std::mutex mtx_; // 保护子类的发送队列和以下成员
+    bool detached_;
+
+private:
+    int fd_;
+    bool armed_; // 已登记事件，没有工作线程在处理
+    bool wakePending_; // 已经在唤醒列表中
+
+    static std::function<void()> notifier_;
+    static std::mutex wakeMtx_;
+    static std::vector<Ptr> wakeups_;
+};
+
+#endif //PUSH_TARGET_H
@@ -0,0 +1,220 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-16
+ * @copyleft Apache 2.0
+ */
+#include "router.h"
+#include "httprequest.h"
+
+#include <string.h>      // memcmp()
+using namespace std;
+
+Router::Node::Node() : param(-1), wildcard(-1) {
+    for(int& route: routes) { route = -1; }
+}
+
+Router::Router() {
+    nodes_.emplace_back(); // 根，前缀为空
+}
+
+Router* Router::Instance() {
+    static Router inst;
+    return &inst;
+}
+
+int Router::MethodIndex_(const char* method, size_t len) {
+    static const char* NAMES[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS", "*" };
+    for(int i = 0; i < METHOD_COUNT; i++) {
+        if(strlen(NAMES[i]) == len && memcmp(NAMES[i], method, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool Router::Add(const char* method, const string& pattern, const Handler& handler) {
+    Route route;
+    route.handler = handler;
+    return Add_(method, pattern, move(route));
+}
+
+bool Router::Rewrite(const char* method, const string& pattern, const Rewriter& rewrite) {
+    Route route;
+    route.rewrite = rewrite;
+    return Add_(method, pattern, move(route));
+}
+
+#ifdef USE_CORO
+bool Router::AddAsync(const char* method, const string& pattern, const AsyncHandler& handler) {
+    Route route;
+    route.async = handler;
+    return Add_(method, pattern, move(route));
+}
+#endif
+
+bool Router::Alias(const string& path, const string& target) {
+    return Rewrite("*", path, [target](HttpRequest& request) {
+        request.path() = target;
+    });
+}
+
+bool Router::Add_(const char* method, const string& pattern, Route route) {
+    int index = MethodIndex_(method, strlen(method));
+    if(index < 0 || pattern.empty() || pattern[0] != '/') {
+        LOG_ERROR("Route %s %s: bad method or pattern", method, pattern.c_str());
+        return false;
+    }
+    int node = Insert_(pattern);
+    if(node < 0) {
+        LOG_ERROR("Route %s %s conflicts with an existing pattern", method, pattern.c_str());
+        return false;
+    }
+    route.pattern = pattern;
+    int& slot = nodes_[node].routes[index];
+    if(slot >= 0) {
+        routes_[slot] = move(route); // 重复注册时覆盖
+    } else {
+        slot = routes_.size();
+        routes_.push_back(move(route));
+    }
+    return true;
+}
+
+int Router::Insert_(const string& pattern) {
+    int node = 0;
+    int params = 0;
+    size_t i = 0;
+    while(i < pattern.size()) {
+        char c = pattern[i];
+        if(c == ':' || c == '*') {
+            // 参数名到下一个'/'为止；通配段必须是最后一段
+            size_t end = c == ':' ? pattern.find('/', i) : pattern.size();
+            if(end == string::npos) { end = pattern.size(); }
+            string name = pattern.substr(i + 1, end - i - 1);
+            if(name.empty() || ++params > Params::MAX || (i > 0 && pattern[i - 1] != '/')) {
+                return -1;
+            }
+            int& slot = c == ':' ? nodes_[node].param : nodes_[node].wildcard;
+            if(slot < 0) {
+                Node child;
+                child.name = name;
+                nodes_.push_back(move(child));
+                // push_back之后重新取引用
+                (c == ':' ? nodes_[node].param : nodes_[node].wildcard) = nodes_.size() - 1;
+            } else if(nodes_[slot].name != name) {
+                return -1;
+            }
+            node = c == ':' ? nodes_[node].param : nodes_[node].wildcard;
+            i = end;
+            continue;
+        }
+        size_t end = pattern.find_first_of(":*", i);
+        if(end == string::npos) { end = pattern.size(); }
+        node = InsertStatic_(node, pattern.substr(i, end - i));
+        i = end;
+    }
+    return node;
+}
+
+int Router::InsertStatic_(int node, const string& segment) {
+    size_t i = 0;
+    while(i < segment.size()) {
+        size_t pos = nodes_[node].indices.find(segment[i]);
+        if(pos == string::npos) {
+            Node child;
+            child.prefix = segment.substr(i);
+            nodes_.push_back(move(child));
+            nodes_[node].indices += segment[i];
+            nodes_[node].children.push_back(nodes_.size() - 1);
+            return nodes_.size() - 1;
+        }
+        int child = nodes_[node].children[pos];
+        const string& prefix = nodes_[child].prefix;
+        size_t common = 0;
+        while(common < prefix.size() && i + common < segment.size() && prefix[common] == segment[i + common]) {
+            common++;
+        }
+        if(common < prefix.size()) {
+            // 分裂：公共部分成为新的中间节点，原节点保留剩余部分
+            Node mid;
+            mid.prefix = prefix.substr(0, common);
+            mid.indices = prefix[common];
+            mid.children.push_back(child);
+            nodes_[child].prefix.erase(0, common);
+            nodes_.push_back(move(mid));
+            child = nodes_.size() - 1;
+            nodes_[node].children[pos] = child;
+        }
+        node = child;
+        i += common;
+    }
+    return node;
+}
+
+int Router::RouteOf_(int node, int method) const {
+    const int* routes = nodes_[node].routes;
+    if(routes[method] >= 0) { return routes[method]; }
+    if(method == HEAD && routes[GET] >= 0) { return routes[GET]; }
+    return routes[ANY];
+}
+
+bool Router::Match_(int node, int method, const char* path, size_t i, size_t len,
+                    Params* params, int* found) const {
+    const Node& n = nodes_[node];
+    if(i == len) {
+        *found = RouteOf_(node, method);
+        if(*found >= 0) { return true; }
+    }
+    // 静态子节点：第一个字节唯一确定
+    if(i < len) {
+        const char* pos = static_cast<const char*>(memchr(n.indices.data(), path[i], n.indices.size()));
+        if(pos) {
+            int child = n.children[pos - n.indices.data()];
+            const string& prefix = nodes_[child].prefix;
+            if(len - i >= prefix.size() && memcmp(path + i, prefix.data(), prefix.size()) == 0 &&
+               Match_(child, method, path, i + prefix.size(), len, params, found)) {
+                return true;
+            }
+        }
+    }
+    // 参数段：至少一个字节，到下一个'/'为止
+    if(n.param >= 0 && i < len && path[i] != '/') {
+        const char* slash = static_cast<const char*>(memchr(path + i, '/', len - i));
+        size_t end = slash ? slash - path : len;
+        int count = params->count;
+        params->items[count] = { nodes_[n.param].name.c_str(), (uint32_t)i, (uint32_t)(end - i) };
+        params->count++;
+        if(Match_(n.param, method, path, end, len, params, found)) {
+            return true;
+        }
+        params->count = count;
+    }
+    // 通配段：剩余的全部路径(可以为空)
+    if(n.wildcard >= 0) {
+        *found = RouteOf_(n.wildcard, method);
+        if(*found >= 0) {
+            params->items[params->count++] = { nodes_[n.wildcard].name.c_str(), (uint32_t)i, (uint32_t)(len - i) };
+            return true;
+        }
+    }
+    return false;
+}
+
+const Router::Route* Router::Match(const string& method, const string& path, Params* params) const {
+    params->count = 0;
+    if(routes_.empty()) {
+        return nullptr;
+    }
+    int index = MethodIndex_(method.data(), method.size());
+    if(index < 0) {
+        index = ANY; // 其他方法只匹配"*"的路由
+    }
+    size_t len = path.find('?');
+    if(len == string::npos) { len = path.size(); }
+    int found = -1;
+    if(!Match_(0, index, path.data(), 0, len, params, &found)) {
+        params->count = 0;
+        return nullptr;
+    }
+    return &routes_[found];
+}
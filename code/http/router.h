@@ -0,0 +1,100 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-16
+ * @copyleft Apache 2.0
+ */
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+#include "asynctask.h"
+
+class HttpRequest;
+
+// 路由表：按方法和路径模式注册处理函数，启动时建成基数树(radix trie)
+// 模式中":name"匹配一个路径段，"*name"匹配剩余的全部路径(只能在末尾)，其余部分按字节匹配
+// 分发时沿树逐字节前进，耗时只与路径长度有关，与注册的路由数量无关；
+// 静态前缀优先于参数段，参数段优先于通配段，前者后续匹配失败时才回退
+// 捕获的参数只记录在路径中的位置，不分配内存
+class Router {
+public:
+    // 流式响应的生产者和处理函数，见HttpStream
+    typedef std::function<bool(std::string& chunk)> Producer;
+    typedef std::function<Producer(const HttpRequest& request, std::string& contentType)> Handler;
+    // 改写请求(通常是路径)，之后仍按静态资源响应；在请求解析完之后调用
+    typedef std::function<void(HttpRequest& request)> Rewriter;
+#ifdef USE_CORO
+    // 协程处理函数：可以co_await Async中的等待对象，挂起期间不占用工作线程
+    typedef std::function<Task<Reply>(const HttpRequest& request)> AsyncHandler;
+#endif
+
+    struct Route {
+        std::string pattern;
+        Handler handler; // 非空时由处理函数生成响应
+        Rewriter rewrite; // 非空时先改写请求
+#ifdef USE_CORO
+        AsyncHandler async; // 非空时由协程生成响应
+#endif
+    };
+
+    // 匹配时捕获的参数：名称指向路由表，值是路径中的[begin, begin+len)
+    struct Params {
+        static const int MAX = 8;
+        struct Item {
+            const char* name;
+            uint32_t begin;
+            uint32_t len;
+        };
+        int count;
+        Item items[MAX];
+    };
+
+    static Router* Instance();
+
+    /* 仅在启动时调用；method为"*"时匹配任意方法，GET的路由同样匹配HEAD */
+    // 模式冲突(同一位置的参数名不同、通配段不在末尾)时返回false
+    bool Add(const char* method, const std::string& pattern, const Handler& handler);
+    bool Rewrite(const char* method, const std::string& pattern, const Rewriter& rewrite);
+#ifdef USE_CORO
+    bool AddAsync(const char* method, const std::string& pattern, const AsyncHandler& handler);
+#endif
+    // 精确路径的别名，如"/login" -> "/login.html"
+    bool Alias(const std::string& path, const std::string& target);
+
+    // path可以带查询串，'?'之后不参与匹配；没有匹配的路由返回nullptr
+    const Route* Match(const std::string& method, const std::string& path, Params* params) const;
+
+    size_t RouteCount() const { return routes_.size(); }
+
+private:
+    enum Method { GET, HEAD, POST, PUT, DELETE, PATCH, OPTIONS, ANY, METHOD_COUNT };
+
+    struct Node {
+        std::string prefix; // 静态边上的字节；参数和通配节点为空
+        std::string name; // 参数和通配节点的参数名
+        std::string indices; // 各个静态子节点前缀的第一个字节，与children一一对应
+        std::vector<int> children;
+        int param; // ":name"子节点，-1表示没有
+        int wildcard; // "*name"子节点
+        int routes[METHOD_COUNT]; // 各方法的路由下标，-1表示没有
+        Node();
+    };
+
+    Router();
+
+    bool Add_(const char* method, const std::string& pattern, Route route);
+    int Insert_(const std::string& pattern); // 插入模式，返回模式末尾的节点，冲突时返回-1
+    int InsertStatic_(int node, const std::string& segment);
+    bool Match_(int node, int method, const char* path, size_t i, size_t len, Params* params, int* found) const;
+    int RouteOf_(int node, int method) const; // 取节点上该方法的路由，HEAD回退到GET，最后是"*"
+    static int MethodIndex_(const char* method, size_t len);
+
+    std::vector<Node> nodes_; // nodes_[0]是根
+    std::vector<Route> routes_;
+};
+
+#endif //ROUTER_H
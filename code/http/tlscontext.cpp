@@ -0,0 +1,121 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-11
+ * @copyleft Apache 2.0
+ */
+#ifdef USE_TLS
+
+#include "tlscontext.h"
+#include "../log/log.h"
+#include "../log/stats.h"
+
+using namespace std;
+
+TlsContext::TlsContext() {
+    ctx_ = nullptr;
+    handshakes_ = resumed_ = ktlsSend_ = ktlsRecv_ = 0;
+}
+
+TlsContext::~TlsContext() {
+    if(ctx_) {
+        SSL_CTX_free(ctx_);
+    }
+}
+
+TlsContext* TlsContext::Instance() {
+    static TlsContext inst;
+    return &inst;
+}
+
+string TlsContext::LastError() {
+    char buf[256] = { 0 };
+    ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+    return buf;
+}
+
+bool TlsContext::Init(const char* certFile, const char* keyFile) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if(!ctx) {
+        LOG_ERROR("SSL_CTX_new: %s", LastError().c_str());
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    if(SSL_CTX_use_certificate_chain_file(ctx, certFile) != 1
+        || SSL_CTX_use_PrivateKey_file(ctx, keyFile, SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ctx) != 1) {
+        LOG_ERROR("Load cert %s / key %s: %s", certFile, keyFile, LastError().c_str());
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    // 写缓冲在重试时可以移动，允许部分写，与HttpConn按iovec逐段发送的方式配合
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                          | SSL_MODE_RELEASE_BUFFERS);
+    // 握手后由内核加解密(内核不支持时OpenSSL自动退回用户态)
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    /* 会话复用：TLS1.2的会话ID缓存，以及无状态的会话票据(TLS1.3也使用票据) */
+    static const unsigned char SID_CTX[] = "webserver";
+    SSL_CTX_set_session_id_context(ctx, SID_CTX, sizeof(SID_CTX) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT);
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets(ctx, 2);
+
+    // ALPN：客户端支持时优先选择h2，否则回退到http/1.1
+    SSL_CTX_set_alpn_select_cb(ctx, SelectAlpn_, nullptr);
+
+    ctx_ = ctx;
+    Stats::Instance()->Register("tls", [this](string& out) {
+        Stats::Line(out, "tls_handshakes", handshakes_);
+        Stats::Line(out, "tls_resumed", resumed_);
+        Stats::Line(out, "tls_ktls_send", ktlsSend_);
+        Stats::Line(out, "tls_ktls_recv", ktlsRecv_);
+        Stats::Line(out, "tls_session_cache", SSL_CTX_sess_number(ctx_));
+    });
+    LOG_INFO("TLS cert: %s", certFile);
+    return true;
+}
+
+int TlsContext::SelectAlpn_(SSL*, const unsigned char** out, unsigned char* outLen,
+                            const unsigned char* in, unsigned int inLen, void*) {
+    static const unsigned char PROTOS[] = "\x02h2\x08http/1.1";
+    unsigned char* selected = nullptr;
+    if(SSL_select_next_proto(&selected, outLen, PROTOS, sizeof(PROTOS) - 1, in, inLen)
+        != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK; // 没有共同的协议，不带ALPN继续握手(按HTTP/1.1处理)
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+SSL* TlsContext::NewSsl(int fd) {
+    if(!ctx_) {
+        return nullptr;
+    }
+    SSL* ssl = SSL_new(ctx_);
+    if(!ssl) {
+        return nullptr;
+    }
+    if(SSL_set_fd(ssl, fd) != 1) {
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool TlsContext::OnHandshake(SSL* ssl) {
+    handshakes_++;
+    if(SSL_session_reused(ssl)) {
+        resumed_++;
+    }
+    bool send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    if(send) { ktlsSend_++; }
+    if(BIO_get_ktls_recv(SSL_get_rbio(ssl))) { ktlsRecv_++; }
+    LOG_DEBUG("TLS handshake %s %s%s%s", SSL_get_version(ssl), SSL_get_cipher_name(ssl),
+              SSL_session_reused(ssl) ? ", resumed" : "", send ? ", ktls" : "");
+    return send;
+}
+
+#endif //USE_TLS
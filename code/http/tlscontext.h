@@ -0,0 +1,54 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-11
+ * @copyleft Apache 2.0
+ */
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#ifdef USE_TLS
+
+#include <atomic>
+#include <string>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+// TLS上下文：加载证书，配置会话复用(会话缓存+会话票据)，为每个连接创建SSL对象
+// 握手完成后如果内核支持kTLS，由内核负责加解密，发送路径仍然是sendmsg直接写socket
+// ALPN协商h2或http/1.1
+class TlsContext {
+public:
+    static TlsContext* Instance();
+
+    bool Init(const char* certFile, const char* keyFile);
+    bool IsOpen() const { return ctx_ != nullptr; }
+
+    // 为非阻塞socket创建服务端SSL对象，失败返回nullptr
+    SSL* NewSsl(int fd);
+
+    // 握手完成时调用，记录复用和kTLS统计；返回发送方向是否已由内核加密
+    bool OnHandshake(SSL* ssl);
+
+    static std::string LastError(); // OpenSSL错误队列中的最近一条错误
+
+private:
+    TlsContext();
+    ~TlsContext();
+
+    static int SelectAlpn_(SSL* ssl, const unsigned char** out, unsigned char* outLen,
+                           const unsigned char* in, unsigned int inLen, void* arg);
+
+    SSL_CTX* ctx_;
+
+    std::atomic<uint64_t> handshakes_;
+    std::atomic<uint64_t> resumed_; // 通过会话缓存或票据复用的握手
+    std::atomic<uint64_t> ktlsSend_; // 发送方向启用了kTLS的连接
+    std::atomic<uint64_t> ktlsRecv_;
+
+    static const int SESSION_CACHE_SIZE = 20480;
+    static const long SESSION_TIMEOUT = 3600; // 会话与票据的有效期(秒)
+};
+
+#endif //USE_TLS
+
+#endif //TLS_CONTEXT_H
@@ -0,0 +1,290 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#include "upstream.h"
+#include "../log/stats.h"
+
+#include <chrono>
+#include <fcntl.h>       // fcntl()
+#include <netdb.h>       // getaddrinfo()
+#include <poll.h>        // poll()
+#include <unistd.h>      // close()
+#include <string.h>      // memcpy()
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+using namespace std;
+
+std::vector<std::unique_ptr<ProxyRoute>> ProxyRoute::ROUTES;
+std::thread ProxyRoute::checker_;
+std::mutex ProxyRoute::checkMtx_;
+std::condition_variable ProxyRoute::checkCond_;
+bool ProxyRoute::stop_ = false;
+
+Upstream::Upstream(const string& name, const sockaddr_in& addr)
+    : requestCount(0), connectCount(0), reuseCount(0), name_(name), addr_(addr),
+      active_(0), healthy_(true), passes_(0), fails_(0) {
+}
+
+Upstream::~Upstream() {
+    for(const Idle& idle: idle_) {
+        close(idle.fd);
+    }
+}
+
+int64_t Upstream::NowMs_() {
+    return chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t Upstream::IdleCount() {
+    lock_guard<mutex> locker(mtx_);
+    return idle_.size();
+}
+
+int Upstream::Acquire(bool* reused, bool* connecting) {
+    requestCount++;
+    int64_t now = NowMs_();
+    while(true) {
+        Idle idle;
+        {
+            lock_guard<mutex> locker(mtx_);
+            if(idle_.empty()) { break; }
+            idle = idle_.back();
+            idle_.pop_back();
+        }
+        // 空闲太久的连接很可能已经被上游的超时关闭
+        if(now - idle.sinceMs > IDLE_TIMEOUT_MS) {
+            close(idle.fd);
+            continue;
+        }
+        // 空闲连接上不应该有数据：可读说明对端已经关闭(0)或出错
+        char c;
+        ssize_t len = recv(idle.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            reuseCount++;
+            active_++;
+            *reused = true;
+            *connecting = false;
+            return idle.fd;
+        }
+        close(idle.fd);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        LOG_ERROR("Upstream %s socket error: %d", name_.c_str(), errno);
+        return -1;
+    }
+    int optval = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    if(connect(fd, (struct sockaddr*)&addr_, sizeof(addr_)) < 0 && errno != EINPROGRESS) {
+        LOG_WARN("Upstream %s connect error: %d", name_.c_str(), errno);
+        close(fd);
+        return -1;
+    }
+    connectCount++;
+    active_++;
+    *reused = false;
+    *connecting = true;
+    return fd;
+}
+
+void Upstream::Release(int fd, bool reusable) {
+    assert(fd >= 0);
+    active_--;
+    if(reusable) {
+        lock_guard<mutex> locker(mtx_);
+        if(idle_.size() < MAX_IDLE) {
+            idle_.push_back({ fd, NowMs_() });
+            return;
+        }
+    }
+    close(fd);
+}
+
+bool Upstream::Probe_(const string& path, int timeoutMs) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) { return false; }
+    bool ok = false;
+    do {
+        if(connect(fd, (struct sockaddr*)&addr_, sizeof(addr_)) < 0) {
+            if(errno != EINPROGRESS) { break; }
+            pollfd pfd = { fd, POLLOUT, 0 };
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if(poll(&pfd, 1, timeoutMs) <= 0 ||
+               getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                break;
+            }
+        }
+        string req = "GET " + path + " HTTP/1.1\r\nHost: " + name_ + "\r\nConnection: close\r\n\r\n";
+        if(send(fd, req.data(), req.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(req.size())) { break; }
+        // 只需要状态行："HTTP/1.x NNN"
+        char buff[16];
+        size_t got = 0;
+        while(got < 12) {
+            pollfd pfd = { fd, POLLIN, 0 };
+            if(poll(&pfd, 1, timeoutMs) <= 0) { break; }
+            ssize_t len = recv(fd, buff + got, sizeof(buff) - got, 0);
+            if(len <= 0) { break; }
+            got += len;
+        }
+        ok = got >= 12 && memcmp(buff, "HTTP/1.", 7) == 0 && (buff[9] == '2' || buff[9] == '3');
+    } while(false);
+    close(fd);
+    return ok;
+}
+
+void Upstream::Check(const string& path, int timeoutMs) {
+    if(Probe_(path, timeoutMs)) {
+        fails_ = 0;
+        if(!healthy_ && ++passes_ >= RISE) {
+            healthy_ = true;
+            LOG_INFO("Upstream %s is up", name_.c_str());
+        }
+    } else {
+        passes_ = 0;
+        if(healthy_ && ++fails_ >= FALL) {
+            healthy_ = false;
+            LOG_WARN("Upstream %s is down", name_.c_str());
+            // 池中的连接多半也已经失效
+            lock_guard<mutex> locker(mtx_);
+            for(const Idle& idle: idle_) {
+                close(idle.fd);
+            }
+            idle_.clear();
+        }
+    }
+}
+
+ProxyRoute::ProxyRoute(const string& prefix, Balance balance)
+    : prefix_(prefix), balance_(balance), next_(0) {
+}
+
+bool ProxyRoute::Add(const string& prefix, const vector<string>& backends, Balance balance) {
+    assert(!prefix.empty() && prefix[0] == '/');
+    unique_ptr<ProxyRoute> route(new ProxyRoute(prefix, balance));
+    // 末尾的'/'不参与匹配，"/api/"和"/api"等价
+    while(route->prefix_.size() > 1 && route->prefix_.back() == '/') {
+        route->prefix_.pop_back();
+    }
+    for(const string& backend: backends) {
+        size_t colon = backend.rfind(':');
+        if(colon == string::npos) {
+            LOG_ERROR("Proxy backend %s needs host:port", backend.c_str());
+            return false;
+        }
+        string host = backend.substr(0, colon);
+        string port = backend.substr(colon + 1);
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+            LOG_ERROR("Proxy backend %s resolve error", backend.c_str());
+            return false;
+        }
+        sockaddr_in addr;
+        memcpy(&addr, res->ai_addr, sizeof(addr));
+        freeaddrinfo(res);
+        route->upstreams_.emplace_back(new Upstream(backend, addr));
+    }
+    if(route->upstreams_.empty()) {
+        return false;
+    }
+    LOG_INFO("Proxy %s -> %zu upstream(s), %s", route->prefix_.c_str(), route->upstreams_.size(),
+             balance == LEAST_CONN ? "least_conn" : "round_robin");
+    ROUTES.push_back(move(route));
+    return true;
+}
+
+ProxyRoute* ProxyRoute::Match(const char* target, size_t len) {
+    ProxyRoute* best = nullptr;
+    for(const auto& route: ROUTES) {
+        const string& prefix = route->prefix_;
+        if(len < prefix.size() || (best && prefix.size() <= best->prefix_.size())) {
+            continue;
+        }
+        if(memcmp(target, prefix.data(), prefix.size()) != 0) {
+            continue;
+        }
+        // "/api"匹配"/api"、"/api/x"、"/api?x"，不匹配"/apix"
+        if(prefix.size() == 1 || len == prefix.size() ||
+           target[prefix.size()] == '/' || target[prefix.size()] == '?') {
+            best = route.get();
+        }
+    }
+    return best;
+}
+
+Upstream* ProxyRoute::Pick() {
+    size_t n = upstreams_.size();
+    if(balance_ == LEAST_CONN) {
+        // 活跃数相同时从轮转位置开始找，避免总是压在第一个上
+        size_t start = next_++;
+        Upstream* best = nullptr;
+        for(size_t i = 0; i < n; i++) {
+            Upstream* up = upstreams_[(start + i) % n].get();
+            if(up->IsHealthy() && (!best || up->Active() < best->Active())) {
+                best = up;
+            }
+        }
+        return best;
+    }
+    for(size_t i = 0; i < n; i++) {
+        Upstream* up = upstreams_[next_++ % n].get();
+        if(up->IsHealthy()) {
+            return up;
+        }
+    }
+    return nullptr;
+}
+
+void ProxyRoute::StartHealthCheck(const string& path, int intervalMs) {
+    if(ROUTES.empty() || intervalMs <= 0 || checker_.joinable()) {
+        return;
+    }
+    stop_ = false;
+    checker_ = thread([path, intervalMs] {
+        unique_lock<mutex> locker(checkMtx_);
+        while(!stop_) {
+            locker.unlock();
+            for(const auto& route: ROUTES) {
+                for(const auto& up: route->upstreams_) {
+                    up->Check(path, intervalMs);
+                }
+            }
+            locker.lock();
+            checkCond_.wait_for(locker, chrono::milliseconds(intervalMs), [] { return stop_; });
+        }
+    });
+}
+
+void ProxyRoute::StopHealthCheck() {
+    if(!checker_.joinable()) {
+        return;
+    }
+    {
+        lock_guard<mutex> locker(checkMtx_);
+        stop_ = true;
+    }
+    checkCond_.notify_one();
+    checker_.join();
+}
+
+void ProxyRoute::Dump(string& out) {
+    for(const auto& route: ROUTES) {
+        for(const auto& up: route->upstreams_) {
+            string name = "proxy_upstream_" + up->Name() + "_";
+            Stats::Line(out, (name + "healthy").c_str(), up->IsHealthy());
+            Stats::Line(out, (name + "active").c_str(), up->Active());
+            Stats::Line(out, (name + "idle").c_str(), up->IdleCount());
+            Stats::Line(out, (name + "requests").c_str(), up->requestCount);
+            Stats::Line(out, (name + "connects").c_str(), up->connectCount);
+            Stats::Line(out, (name + "reuses").c_str(), up->reuseCount);
+        }
+    }
+}
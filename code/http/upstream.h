@@ -0,0 +1,112 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-15
+ * @copyleft Apache 2.0
+ */
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <condition_variable>
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "../log/log.h"
+
+// 反向代理的上游服务器：地址、空闲的保持连接池、活跃连接数和健康状态
+class Upstream {
+public:
+    Upstream(const std::string& name, const sockaddr_in& addr);
+    ~Upstream(); // 关闭空闲连接
+
+    // 取一个连接：优先复用池中的空闲连接，没有时发起非阻塞connect(connecting为true)
+    // reused表示来自连接池(对端可能刚好关闭，没有收到响应时可以重试一次)；失败返回-1
+    int Acquire(bool* reused, bool* connecting);
+    // 交换结束：reusable为true时放回空闲池，否则关闭
+    void Release(int fd, bool reusable);
+
+    // 主动健康检查(阻塞，在检查线程中调用)：请求path，2xx/3xx为成功
+    // 连续FALL次失败标记为不可用，不再分配请求；连续RISE次成功后恢复
+    void Check(const std::string& path, int timeoutMs);
+
+    bool IsHealthy() const { return healthy_; }
+    int Active() const { return active_; }
+    const std::string& Name() const { return name_; }
+    size_t IdleCount();
+
+    /* 统计 */
+    std::atomic<uint64_t> requestCount; // 分配到的请求数
+    std::atomic<uint64_t> connectCount; // 新建的连接数
+    std::atomic<uint64_t> reuseCount; // 复用池中连接的次数
+
+    static const size_t MAX_IDLE = 32; // 每个上游最多保留的空闲连接
+    static const int64_t IDLE_TIMEOUT_MS = 30000; // 空闲超过该时间的连接不再复用
+    static const int RISE = 2;
+    static const int FALL = 3;
+
+private:
+    struct Idle {
+        int fd;
+        int64_t sinceMs;
+    };
+
+    bool Probe_(const std::string& path, int timeoutMs); // 一次健康检查请求
+    static int64_t NowMs_();
+
+    std::string name_; // host:port
+    sockaddr_in addr_;
+
+    std::mutex mtx_;
+    std::vector<Idle> idle_; // 最近放回的在末尾，优先复用
+
+    std::atomic<int> active_; // 正在进行的交换数(最少连接策略)
+    std::atomic<bool> healthy_;
+    int passes_; // 连续成功次数，只在检查线程中访问
+    int fails_; // 连续失败次数
+};
+
+// 代理路由：路径以prefix开头的请求转发给一组上游中的一个
+class ProxyRoute {
+public:
+    enum Balance {
+        ROUND_ROBIN, // 轮转
+        LEAST_CONN, // 活跃交换最少的优先
+    };
+
+    // 注册路由(仅在启动时调用)，backends为"host:port"，地址解析失败返回false
+    static bool Add(const std::string& prefix, const std::vector<std::string>& backends, Balance balance);
+    // 按请求目标(路径和查询串)做最长前缀匹配，prefix之后必须是路径分隔符、'?'或结尾
+    static ProxyRoute* Match(const char* target, size_t len);
+    static bool Empty() { return ROUTES.empty(); }
+
+    // 启动后台检查线程，每intervalMs毫秒对所有上游请求一次path；StopHealthCheck等待线程退出
+    static void StartHealthCheck(const std::string& path, int intervalMs);
+    static void StopHealthCheck();
+
+    // 每个上游一组统计行：proxy_upstream_<host:port>_<名称>
+    static void Dump(std::string& out);
+
+    // 按策略选择一个健康的上游，都不可用时返回nullptr
+    Upstream* Pick();
+    const std::string& Prefix() const { return prefix_; }
+
+private:
+    ProxyRoute(const std::string& prefix, Balance balance);
+
+    std::string prefix_;
+    Balance balance_;
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+    std::atomic<size_t> next_; // 轮转的下一个位置
+
+    static std::vector<std::unique_ptr<ProxyRoute>> ROUTES;
+    static std::thread checker_;
+    static std::mutex checkMtx_;
+    static std::condition_variable checkCond_;
+    static bool stop_;
+};
+
+#endif //UPSTREAM_H
@@ -0,0 +1,390 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-13
+ * @copyleft Apache 2.0
+ */
+#include "websocket.h"
+#include "base64.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+std::unordered_map<std::string, WebSocket::Handler> WebSocket::HANDLERS;
+const char* WebSocket::GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+std::atomic<uint64_t> WebSocket::openCount;
+std::atomic<int> WebSocket::activeCount;
+std::atomic<uint64_t> WebSocket::messageInCount;
+std::atomic<uint64_t> WebSocket::messageOutCount;
+std::atomic<uint64_t> WebSocket::pingCount;
+
+// 握手只需要对很短的key做一次SHA1，不依赖OpenSSL(未开启TLS时也能用)
+static void Sha1(const string& msg, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    string data = msg;
+    uint64_t bits = (uint64_t)msg.size() * 8;
+    data.push_back((char)0x80);
+    while(data.size() % 64 != 56) { data.push_back(0); }
+    for(int i = 7; i >= 0; i--) { data.push_back((char)(bits >> (i * 8))); }
+    auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    for(size_t off = 0; off < data.size(); off += 64) {
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++) {
+            const uint8_t* p = (const uint8_t*)data.data() + off + i * 4;
+            w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+        for(int i = 16; i < 80; i++) { w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1); }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if(i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if(i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for(int i = 0; i < 20; i++) { digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8)); }
+}
+
+void WebSocket::Register(const string& path, const Handler& handler) {
+    HANDLERS[path] = handler;
+}
+
+const WebSocket::Handler* WebSocket::Find(const string& path) {
+    auto it = HANDLERS.find(path);
+    return it == HANDLERS.end() ? nullptr : &it->second;
+}
+
+string WebSocket::AcceptKey(const string& key) {
+    uint8_t digest[20];
+    Sha1(key + GUID, digest);
+    return Base64(digest, sizeof(digest));
+}
+
+WebSocket::WebSocket(const Handler* handler, int fd, uint64_t serial): PushTarget(fd) {
+    assert(handler);
+    handler_ = handler;
+    fd_ = fd;
+    serial_ = serial;
+    messageOpcode_ = TEXT;
+    pingPending_ = false;
+    closeSent_ = false;
+    closeNotified_ = false;
+    openCount++;
+    activeCount++;
+}
+
+WebSocket::~WebSocket() {
+    MemoryBudget::Instance()->Charge(MemoryBudget::PUSH_QUEUE, -(int64_t)out_.ReadableBytes());
+    BufferPool::Instance()->Release(move(message_));
+    activeCount--;
+}
+
+void WebSocket::Open() {
+    if(handler_->onOpen) {
+        handler_->onOpen(Self_());
+    }
+}
+
+void WebSocket::Feed(Buffer& in) {
+    while(!closeSent_ && in.ReadableBytes() >= 2) {
+        const uint8_t* p = (const uint8_t*)in.Peek();
+        size_t avail = in.ReadableBytes();
+        bool fin = p[0] & 0x80;
+        uint8_t opcode = p[0] & 0x0f;
+        // 没有协商扩展，RSV位必须为0；客户端发来的帧必须加掩码
+        if((p[0] & 0x70) || !(p[1] & 0x80)) {
+            Fail_(CLOSE_PROTOCOL);
+            break;
+        }
+        uint64_t len = p[1] & 0x7f;
+        size_t head = 2;
+        if(len == 126) {
+            if(avail < 4) { break; }
+            len = (p[2] << 8) | p[3];
+            head = 4;
+        } else if(len == 127) {
+            if(avail < 10) { break; }
+            len = 0;
+            for(int i = 0; i < 8; i++) { len = (len << 8) | p[2 + i]; }
+            head = 10;
+        }
+        // 在收完之前就拒绝过大的帧，不为它缓存数据
+        if(len > MAX_MESSAGE) {
+            Fail_(CLOSE_TOO_BIG);
+            break;
+        }
+        head += 4;
+        if(avail < head + len) {
+            break; // 等待帧的剩余部分
+        }
+        uint8_t key[4];
+        memcpy(key, p + head - 4, 4);
+        // 在读缓冲中原地去掉掩码，未分片的消息直接交给回调，不再拷贝
+        char* payload = const_cast<char*>(in.Peek()) + head;
+        Unmask(payload, len, key);
+        bool ok = OnFrame_(opcode, fin, payload, len);
+        in.Retrieve(head + len);
+        if(!ok) { break; }
+    }
+    if(closeSent_) {
+        in.RetrieveAll(); // 关闭帧之后的数据不再处理
+    }
+}
+
+bool WebSocket::OnFrame_(uint8_t opcode, bool fin, char* payload, size_t len) {
+    /* 控制帧可以插在分片之间，不能分片，长度不超过125 */
+    if(opcode & 0x8) {
+        if(!fin || len > 125) {
+            Fail_(CLOSE_PROTOCOL);
+            return false;
+        }
+        switch(opcode) {
+        case CLOSE:
+            return OnClose_(payload, len);
+        case PING:
+            Queue_(PONG, payload, len, true);
+            return true;
+        case PONG: {
+            lock_guard<mutex> locker(mtx_);
+            pingPending_ = false;
+            return true;
+        }
+        default:
+            Fail_(CLOSE_PROTOCOL);
+            return false;
+        }
+    }
+    /* 数据帧：第一个分片带TEXT/BINARY，后续分片是CONTINUATION */
+    if(opcode == CONTINUATION) {
+        if(!message_) {
+            Fail_(CLOSE_PROTOCOL);
+            return false;
+        }
+        if(message_->size() + len > MAX_MESSAGE) {
+            Fail_(CLOSE_TOO_BIG);
+            return false;
+        }
+        message_->append(payload, len);
+        if(fin) {
+            Deliver_(message_->data(), message_->size(), messageOpcode_ == BINARY);
+            BufferPool::Instance()->Release(move(message_));
+        }
+        return !closeSent_;
+    }
+    if((opcode != TEXT && opcode != BINARY) || message_) {
+        Fail_(CLOSE_PROTOCOL);
+        return false;
+    }
+    if(fin) {
+        Deliver_(payload, len, opcode == BINARY);
+        return !closeSent_;
+    }
+    // 分片消息重组到池化的缓冲中，缓冲的容量在消息之间复用
+    message_ = BufferPool::Instance()->Acquire();
+    messageOpcode_ = opcode;
+    message_->append(payload, len);
+    return true;
+}
+
+bool WebSocket::OnClose_(const char* payload, size_t len) {
+    uint16_t code = 1005; // 对端没有给出状态码
+    if(len == 1) {
+        Fail_(CLOSE_PROTOCOL);
+        return false;
+    }
+    if(len >= 2) {
+        code = ((uint8_t)payload[0] << 8) | (uint8_t)payload[1];
+        if(!IsValidCloseCode_(code) || !IsValidUtf8(payload + 2, len - 2)) {
+            Fail_(CLOSE_PROTOCOL);
+            return false;
+        }
+    }
+    NotifyClose_(code);
+    // 回复关闭帧(带同样的状态码)，写完后关闭连接
+    Queue_(CLOSE, payload, min<size_t>(len, 2), true);
+    return false;
+}
+
+void WebSocket::Deliver_(const char* data, size_t len, bool binary) {
+    if(!binary && !IsValidUtf8(data, len)) {
+        Fail_(CLOSE_INVALID_DATA);
+        return;
+    }
+    messageInCount++;
+    if(handler_->onMessage) {
+        handler_->onMessage(Self_(), data, len, binary);
+    }
+}
+
+void WebSocket::Fail_(uint16_t code) {
+    LOG_WARN("WebSocket[%d] close with %d", fd_, code);
+    char payload[2] = { (char)(code >> 8), (char)code };
+    Queue_(CLOSE, payload, sizeof(payload), true);
+    NotifyClose_(code);
+}
+
+void WebSocket::NotifyClose_(uint16_t code) {
+    if(!closeNotified_.exchange(true) && handler_->onClose) {
+        handler_->onClose(Self_(), code);
+    }
+}
+
+bool WebSocket::Send(const char* data, size_t len, bool binary) {
+    if(!Queue_(binary ? BINARY : TEXT, data, len, false)) {
+        return false;
+    }
+    messageOutCount++;
+    return true;
+}
+
+void WebSocket::Close(uint16_t code) {
+    char payload[2] = { (char)(code >> 8), (char)code };
+    Queue_(CLOSE, payload, sizeof(payload), true);
+    NotifyClose_(code);
+}
+
+bool WebSocket::Ping() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(pingPending_) {
+            return false;
+        }
+        pingPending_ = true;
+    }
+    pingCount++;
+    Queue_(PING, nullptr, 0, true);
+    return true;
+}
+
+bool WebSocket::Queue_(uint8_t opcode, const char* data, size_t len, bool force) {
+    bool notify = false;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(detached_ || closeSent_) {
+            return false;
+        }
+        // 对端读得太慢时丢弃新的消息，控制帧不受限制
+        if(!force && out_.ReadableBytes() + len > MAX_BACKLOG) {
+            return false;
+        }
+        // 进程内存超过预算时新的消息最先被丢弃
+        if(!force && MemoryBudget::Instance()->GetLevel() == MemoryBudget::CRITICAL) {
+            MemoryBudget::dropCount++;
+            return false;
+        }
+        // 服务端发出的帧不加掩码
+        uint8_t head[10];
+        size_t n = 2;
+        head[0] = 0x80 | opcode;
+        if(len < 126) {
+            head[1] = (uint8_t)len;
+        } else if(len <= 0xffff) {
+            head[1] = 126;
+            head[2] = (uint8_t)(len >> 8);
+            head[3] = (uint8_t)len;
+            n = 4;
+        } else {
+            head[1] = 127;
+            for(int i = 0; i < 8; i++) { head[2 + i] = (uint8_t)((uint64_t)len >> (56 - i * 8)); }
+            n = 10;
+        }
+        out_.Append(head, n);
+        if(len > 0) { out_.Append(data, len); }
+        MemoryBudget::Instance()->Charge(MemoryBudget::PUSH_QUEUE, n + len);
+        if(opcode == CLOSE) { closeSent_ = true; }
+        notify = Schedule_();
+    }
+    if(notify) {
+        Notify_();
+    }
+    return true;
+}
+
+bool WebSocket::Fill(Buffer& out) {
+    lock_guard<mutex> locker(mtx_);
+    if(out_.ReadableBytes() == 0) {
+        return false;
+    }
+    MemoryBudget::Instance()->Charge(MemoryBudget::PUSH_QUEUE, -(int64_t)out_.ReadableBytes());
+    while(out_.ReadableBytes() > 0) {
+        size_t n = out_.PeekBytes();
+        out.Append(out_.Peek(), n);
+        out_.Retrieve(n);
+    }
+    return true;
+}
+
+bool WebSocket::IsValidCloseCode_(uint16_t code) {
+    return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+}
+
+void WebSocket::Unmask(char* data, size_t len, const uint8_t key[4]) {
+    size_t i = 0;
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+#if defined(__SSE2__)
+    // 每次16字节；16是4的倍数，掩码的相位保持不变
+    __m128i mask = _mm_set1_epi32((int)key32);
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, mask));
+    }
+#endif
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= key64;
+        memcpy(data + i, &v, 8);
+    }
+    for(; i < len; i++) {
+        data[i] ^= key[i & 3];
+    }
+}
+
+bool WebSocket::IsValidUtf8(const char* data, size_t len) {
+    const uint8_t* s = (const uint8_t*)data;
+    size_t i = 0;
+    while(i < len) {
+        // ASCII一次检查8字节
+        if(i + 8 <= len) {
+            uint64_t v;
+            memcpy(&v, s + i, 8);
+            if((v & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        uint8_t c = s[i];
+        if(c < 0x80) {
+            i++;
+            continue;
+        }
+        size_t n;
+        uint32_t cp;
+        if(c >= 0xC2 && c <= 0xDF) { n = 1; cp = c & 0x1F; }
+        else if((c & 0xF0) == 0xE0) { n = 2; cp = c & 0x0F; }
+        else if(c >= 0xF0 && c <= 0xF4) { n = 3; cp = c & 0x07; }
+        else { return false; }
+        if(i + n >= len) {
+            return false;
+        }
+        for(size_t k = 1; k <= n; k++) {
+            if((s[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+            cp = (cp << 6) | (s[i + k] & 0x3F);
+        }
+        // 过长编码、代理对、超出范围
+        if((n == 2 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) ||
+           (n == 3 && (cp < 0x10000 || cp > 0x10FFFF))) {
+            return false;
+        }
+        i += n + 1;
+    }
+    return true;
+}
@@ -0,0 +1,117 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-13
+ * @copyleft Apache 2.0
+ */
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <functional>
+#include <unordered_map>
+
+#include "../buffer/buffer.h"
+#include "../buffer/chainbuffer.h"
+#include "../log/log.h"
+#include "../pool/bufferpool.h"
+#include "../pool/memorybudget.h"
+#include "pushtarget.h"
+
+// WebSocket连接(RFC 6455)：HttpConn收到升级请求后回复101，此后读到的数据交给Feed解析成帧
+// 连接仍由同一个Epoller和定时器管理：空闲时只占一个socket，定时发送ping检测对端是否还在
+// Send可以在任意线程调用(服务端推送)，消息排队后唤醒reactor登记写事件(见PushTarget)
+class WebSocket : public PushTarget {
+public:
+    typedef std::shared_ptr<WebSocket> Ptr;
+
+    // 回调在处理该连接的工作线程中执行，同一个连接的回调不会并发
+    struct Handler {
+        std::function<void(const Ptr& ws)> onOpen;
+        // 完整的消息(分片已经重组)，data只在回调期间有效
+        std::function<void(const Ptr& ws, const char* data, size_t len, bool binary)> onMessage;
+        // 收到关闭帧或者连接断开(1006)，只调用一次
+        std::function<void(const Ptr& ws, uint16_t code)> onClose;
+    };
+
+    // 为path注册处理函数(仅在启动时调用)
+    static void Register(const std::string& path, const Handler& handler);
+    static const Handler* Find(const std::string& path);
+
+    // Sec-WebSocket-Accept = base64(SHA1(key + GUID))
+    static std::string AcceptKey(const std::string& key);
+
+    WebSocket(const Handler* handler, int fd, uint64_t serial);
+    ~WebSocket() override;
+
+    /* 任意线程调用 */
+    bool Send(const char* data, size_t len, bool binary = false); // 连接已关闭或积压过多返回false
+    bool Send(const std::string& text) { return Send(text.data(), text.size(), false); }
+    void Close(uint16_t code = CLOSE_NORMAL); // 发送关闭帧，发送完后关闭连接
+    // 发送ping；上一个ping还没有收到pong返回false，说明对端已经失去响应
+    bool Ping();
+    bool Heartbeat() override { return Ping(); }
+
+    /* 处理该连接的工作线程调用 */
+    void Open(); // 101已经排队，调用onOpen
+    void Feed(Buffer& in); // 解析in中所有完整的帧，不完整的帧留在in中
+    bool Fill(Buffer& out); // 取出排队的帧，没有返回false
+    bool IsClosing() const { return closeSent_; }
+
+    uint64_t Serial() const { return serial_; }
+
+    static void Unmask(char* data, size_t len, const uint8_t key[4]);
+    static bool IsValidUtf8(const char* data, size_t len);
+
+    /* 统计 */
+    static std::atomic<uint64_t> openCount; // 建立的WebSocket连接数
+    static std::atomic<int> activeCount;
+    static std::atomic<uint64_t> messageInCount;
+    static std::atomic<uint64_t> messageOutCount;
+    static std::atomic<uint64_t> pingCount;
+
+    enum CloseCode {
+        CLOSE_NORMAL = 1000, CLOSE_GOING_AWAY = 1001, CLOSE_PROTOCOL = 1002, CLOSE_UNSUPPORTED = 1003,
+        CLOSE_ABNORMAL = 1006, CLOSE_INVALID_DATA = 1007, CLOSE_TOO_BIG = 1009,
+    };
+
+    static const size_t MAX_MESSAGE = 1024 * 1024; // 重组后的消息上限
+    static const size_t MAX_BACKLOG = 4 * 1024 * 1024; // 待发送数据的上限，超过时Send失败
+
+private:
+    enum Opcode {
+        CONTINUATION = 0x0, TEXT = 0x1, BINARY = 0x2, CLOSE = 0x8, PING = 0x9, PONG = 0xA,
+    };
+
+    bool Pending_() const override { return out_.ReadableBytes() > 0; }
+    void OnDetach_() override { NotifyClose_(CLOSE_ABNORMAL); }
+    Ptr Self_() { return std::static_pointer_cast<WebSocket>(shared_from_this()); }
+
+    bool OnFrame_(uint8_t opcode, bool fin, char* payload, size_t len);
+    bool OnClose_(const char* payload, size_t len);
+    void Deliver_(const char* data, size_t len, bool binary);
+    void Fail_(uint16_t code); // 协议错误：发送关闭帧，不再处理后续的帧
+    void NotifyClose_(uint16_t code);
+    bool Queue_(uint8_t opcode, const char* data, size_t len, bool force); // 加锁后组帧
+    static bool IsValidCloseCode_(uint16_t code);
+
+    const Handler* handler_;
+    int fd_; // 只用于日志
+    uint64_t serial_;
+
+    // 正在重组的分片消息
+    BufferPool::BufferPtr message_;
+    uint8_t messageOpcode_;
+
+    // 以下两个成员由mtx_保护
+    ChainBuffer out_; // 已经组好的待发送帧，积压时追加新块而不是整体扩容拷贝，发完后块还给池
+    bool pingPending_;
+    std::atomic<bool> closeSent_;
+    std::atomic<bool> closeNotified_;
+
+    static std::unordered_map<std::string, Handler> HANDLERS; // 路径-处理函数
+    static const char* GUID;
+};
+
+#endif //WEBSOCKET_H
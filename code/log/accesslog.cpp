@@ -0,0 +1,553 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "accesslog.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/uio.h>        // writev
+#include <sys/stat.h>       // mkdir
+#include <sys/time.h>
+#include <sys/resource.h>   // setpriority
+#include <sys/syscall.h>
+#include <algorithm>
+#include <deque>
+#include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "log.h"
+#include "stats.h"
+
+using namespace std;
+
+AccessLogWriter::Entry::Entry() : peer(nullptr), method(nullptr), target(nullptr), version(nullptr),
+    status(0), bytes(0), durationUs(0), upstreamUs(-1), dbUs(-1), referer(nullptr), userAgent(nullptr) {}
+
+AccessLogWriter::AccessLogWriter() : format_(COMBINED), maxBytes_(0), maxSeconds_(0), compress_(NONE),
+    isOpen_(false), fd_(-1), fileBytes_(0), openedAt_(0), flusher_(RING_SIZE), compressStop_(false),
+    compressPending_(0), bytesCount_(0), batchCount_(0), rotateCount_(0),
+    compressCount_(0), compressFailCount_(0), compressInBytes_(0), compressOutBytes_(0) {
+    // 按间隔攒批，环积压到一半时提前写
+    flusher_.SetPolicy(FLUSH_INTERVAL_MS, RING_SIZE / 2);
+}
+
+AccessLogWriter::~AccessLogWriter() {
+    Close();
+}
+
+AccessLogWriter* AccessLogWriter::Instance() {
+    static AccessLogWriter inst;
+    return &inst;
+}
+
+bool AccessLogWriter::Open(const string& path, Format format, size_t maxBytes, int maxSeconds, Compress compress) {
+    if(isOpen_ || flusher_.IsRunning()) {
+        return false;
+    }
+    path_ = path;
+    format_ = format;
+    maxBytes_ = maxBytes;
+    maxSeconds_ = maxSeconds > 0 ? maxSeconds : 0;
+#ifndef USE_ZSTD
+    if(compress == ZSTD) {
+        LOG_WARN("Access log: zstd not compiled in, using gzip");
+        compress = GZIP;
+    }
+#endif
+    compress_ = compress;
+    if(!OpenFile_()) {
+        LOG_ERROR("Access log: open %s error %d", path_.c_str(), errno);
+        return false;
+    }
+    // 上次Close时关闭的压缩队列不能再用，重新创建
+    compressQueue_.reset(new BlockDeque<string>(MAX_PENDING_FILES));
+    compressStop_ = false;
+    compressPending_ = 0;
+    flusher_.Start([this](vector<Ring*>& rings) { return Drain_(rings); });
+    if(compress_ != NONE) {
+        compressThread_.reset(new thread(&AccessLogWriter::CompressLoop_, this));
+    }
+    isOpen_ = true;
+    return true;
+}
+
+void AccessLogWriter::Close() {
+    isOpen_ = false;
+    flusher_.Stop(); // 写线程写完所有环之后才退出
+    if(compressThread_) {
+        // 正在压缩的文件放弃，原文件保留
+        {
+            lock_guard<mutex> locker(compressMtx_);
+            compressStop_ = true;
+        }
+        compressCond_.notify_all();
+        compressQueue_->Close();
+        compressThread_->join();
+        compressThread_.reset();
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool AccessLogWriter::OpenFile_() {
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0 && errno == ENOENT) {
+        size_t slash = path_.rfind('/');
+        if(slash != string::npos && slash > 0) {
+            mkdir(path_.substr(0, slash).c_str(), 0777);
+            fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        }
+    }
+    if(fd_ < 0) {
+        return false;
+    }
+    struct stat st;
+    fileBytes_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    openedAt_ = time(nullptr);
+    return true;
+}
+
+/* 格式化：每个字段的输出长度有上限，整行不会超过LINE_SIZE */
+
+// 追加字符串s，转义后不超过max字节；json为false时按Common格式转义(\"、\\、\xHH)
+static char* AppendEscaped(char* p, const char* s, size_t max, bool json) {
+    static const char HEX[] = "0123456789abcdef";
+    char* end = p + max;
+    for(; *s; s++) {
+        unsigned char c = *s;
+        if(c == '"' || c == '\\') {
+            if(end - p < 2) { break; }
+            *p++ = '\\';
+            *p++ = c;
+        } else if(c < 0x20 || c == 0x7f || (!json && c >= 0x80)) {
+            if(json) {
+                if(end - p < 6) { break; }
+                memcpy(p, "\\u00", 4);
+                p[4] = HEX[c >> 4];
+                p[5] = HEX[c & 15];
+                p += 6;
+            } else {
+                if(end - p < 4) { break; }
+                p[0] = '\\';
+                p[1] = 'x';
+                p[2] = HEX[c >> 4];
+                p[3] = HEX[c & 15];
+                p += 4;
+            }
+        } else {
+            if(p == end) { break; }
+            *p++ = c;
+        }
+    }
+    return p;
+}
+
+static char* AppendLiteral(char* p, const char* s) {
+    size_t len = strlen(s);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static char* AppendNumber(char* p, int64_t v) {
+    if(v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    char buf[24];
+    int n = 0;
+    do {
+        buf[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v > 0);
+    while(n > 0) {
+        *p++ = buf[--n];
+    }
+    return p;
+}
+
+// 没有的值：Common格式输出"-"，JSON输出null
+static char* AppendOptional(char* p, int64_t v, bool json) {
+    if(v < 0) {
+        return AppendLiteral(p, json ? "null" : "-");
+    }
+    return AppendNumber(p, v);
+}
+
+static char* AppendQuoted(char* p, const char* s, size_t max, bool json) {
+    if(!s) {
+        return AppendLiteral(p, json ? "null" : "\"-\"");
+    }
+    *p++ = '"';
+    p = AppendEscaped(p, s, max, json);
+    *p++ = '"';
+    return p;
+}
+
+size_t AccessLogWriter::Format_(const Entry& e, char* line, TimeText& t) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if(now.tv_sec != t.sec) {
+        // 同一秒内的记录复用格式化好的时间
+        static const char* MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+        struct tm tm;
+        localtime_r(&now.tv_sec, &tm);
+        long off = tm.tm_gmtoff / 60;
+        char sign = off < 0 ? '-' : '+';
+        off = off < 0 ? -off : off;
+        t.sec = now.tv_sec;
+        t.commonLen = snprintf(t.common, sizeof(t.common), "[%02d/%s/%d:%02d:%02d:%02d %c%02ld%02ld]",
+                               tm.tm_mday, MONTHS[tm.tm_mon], tm.tm_year + 1900,
+                               tm.tm_hour, tm.tm_min, tm.tm_sec, sign, off / 60, off % 60);
+        t.isoLen = snprintf(t.iso, sizeof(t.iso), "%d-%02d-%02dT%02d:%02d:%02d%c%02ld:%02ld",
+                            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                            tm.tm_hour, tm.tm_min, tm.tm_sec, sign, off / 60, off % 60);
+    }
+    char ip[INET_ADDRSTRLEN] = "-";
+    if(e.peer) {
+        inet_ntop(AF_INET, &e.peer->sin_addr, ip, sizeof(ip));
+    }
+    const char* method = e.method ? e.method : "-";
+    const char* version = e.version ? e.version : "1.1";
+
+    // 固定部分不超过约300字节，可变字段按下面的上限截断
+    char* p = line;
+    if(format_ == JSON) {
+        p = AppendLiteral(p, "{\"time\":\"");
+        memcpy(p, t.iso, t.isoLen);
+        p += t.isoLen;
+        p = AppendLiteral(p, "\",\"remote_addr\":\"");
+        p = AppendLiteral(p, ip);
+        p = AppendLiteral(p, "\",\"method\":");
+        p = AppendQuoted(p, method, 32, true);
+        p = AppendLiteral(p, ",\"uri\":");
+        p = AppendQuoted(p, e.target, 2048, true);
+        p = AppendLiteral(p, ",\"protocol\":\"HTTP/");
+        p = AppendEscaped(p, version, 8, true);
+        p = AppendLiteral(p, "\",\"status\":");
+        p = AppendNumber(p, e.status);
+        p = AppendLiteral(p, ",\"bytes\":");
+        p = AppendNumber(p, (int64_t)e.bytes);
+        p = AppendLiteral(p, ",\"duration_us\":");
+        p = AppendNumber(p, max<int64_t>(e.durationUs, 0));
+        p = AppendLiteral(p, ",\"upstream_us\":");
+        p = AppendOptional(p, e.upstreamUs, true);
+        p = AppendLiteral(p, ",\"db_us\":");
+        p = AppendOptional(p, e.dbUs, true);
+        p = AppendLiteral(p, ",\"referer\":");
+        p = AppendQuoted(p, e.referer, 512, true);
+        p = AppendLiteral(p, ",\"user_agent\":");
+        p = AppendQuoted(p, e.userAgent, 512, true);
+        *p++ = '}';
+    } else {
+        // 127.0.0.1 - - [19/Jul/2020:10:00:00 +0800] "GET /index.html HTTP/1.1" 200 3456
+        p = AppendLiteral(p, ip);
+        p = AppendLiteral(p, " - - ");
+        memcpy(p, t.common, t.commonLen);
+        p += t.commonLen;
+        p = AppendLiteral(p, " \"");
+        p = AppendEscaped(p, method, 32, false);
+        *p++ = ' ';
+        p = AppendEscaped(p, e.target ? e.target : "-", 2048, false);
+        p = AppendLiteral(p, " HTTP/");
+        p = AppendEscaped(p, version, 8, false);
+        p = AppendLiteral(p, "\" ");
+        p = AppendNumber(p, e.status);
+        *p++ = ' ';
+        p = AppendNumber(p, (int64_t)e.bytes);
+        if(format_ == COMBINED) {
+            *p++ = ' ';
+            p = AppendQuoted(p, e.referer, 512, false);
+            *p++ = ' ';
+            p = AppendQuoted(p, e.userAgent, 512, false);
+        }
+        *p++ = ' ';
+        p = AppendNumber(p, max<int64_t>(e.durationUs, 0));
+        *p++ = ' ';
+        p = AppendOptional(p, e.upstreamUs, false);
+        *p++ = ' ';
+        p = AppendOptional(p, e.dbUs, false);
+    }
+    *p++ = '\n';
+    assert((size_t)(p - line) <= LINE_SIZE);
+    return p - line;
+}
+
+void AccessLogWriter::Write(const Entry& entry) {
+    if(!IsOpen()) {
+        return;
+    }
+    static thread_local char line[LINE_SIZE];
+    static thread_local TimeText time;
+    size_t len = Format_(entry, line, time);
+    flusher_.Push(LocalRing_(), line, len);
+}
+
+AccessLogWriter::Ring* AccessLogWriter::LocalRing_() {
+    static thread_local RingFlusher::Holder holder;
+    return flusher_.Local(holder);
+}
+
+void AccessLogWriter::flush() {
+    flusher_.flush();
+}
+
+void AccessLogWriter::WaitCompressed() {
+    flush(); // 写线程写出时才检查切换，先让之前的记录都写完
+    unique_lock<mutex> locker(compressMtx_);
+    compressCond_.wait(locker, [this] { return compressPending_ == 0 || compressStop_; });
+}
+
+size_t AccessLogWriter::Drain_(vector<Ring*>& rings) {
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    size_t total = 0;
+    size_t done = 0; // rings中已经推进了tail的环数
+    for(size_t i = 0; i < rings.size(); i++) {
+        Ring* ring = rings[i];
+        size_t tail = ring->tail.load(memory_order_relaxed);
+        size_t head = ring->head.load(memory_order_acquire);
+        ring->drainHead = head;
+        if(head == tail) {
+            continue;
+        }
+        if(cnt + 2 > MAX_IOV) {
+            // iov用完：先写出这一批
+            WriteFile_(iov, cnt);
+            for(; done < i; done++) {
+                rings[done]->tail.store(rings[done]->drainHead, memory_order_release);
+            }
+            cnt = 0;
+        }
+        // 环中的数据不复制，直接交给writev
+        size_t pos = tail & (ring->capacity - 1);
+        size_t len = head - tail;
+        size_t first = min(len, ring->capacity - pos);
+        iov[cnt++] = { ring->data + pos, first };
+        if(first < len) {
+            iov[cnt++] = { ring->data, len - first };
+        }
+        total += len;
+    }
+    if(cnt > 0) {
+        WriteFile_(iov, cnt);
+    }
+    for(; done < rings.size(); done++) {
+        rings[done]->tail.store(rings[done]->drainHead, memory_order_release);
+    }
+    Rotate_(time(nullptr));
+    return total;
+}
+
+bool AccessLogWriter::WriteFile_(struct iovec* iov, int cnt) {
+    batchCount_++;
+    while(cnt > 0) {
+        ssize_t n = writev(fd_, iov, cnt);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            return false; // 磁盘满等错误：丢弃这一批，不阻塞请求线程
+        }
+        bytesCount_ += n;
+        fileBytes_ += n;
+        // 部分写：跳过已经写出的iov
+        while(cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+void AccessLogWriter::Rotate_(time_t now) {
+    if(fileBytes_ == 0) {
+        return; // 空文件不切换
+    }
+    bool bySize = maxBytes_ > 0 && fileBytes_ >= maxBytes_;
+    bool byTime = maxSeconds_ > 0 && now - openedAt_ >= maxSeconds_;
+    if(!bySize && !byTime) {
+        return;
+    }
+    // access.log -> access.log.20200719-100000，同一秒内再次切换时加上-N
+    struct tm t;
+    localtime_r(&now, &t);
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), ".%04d%02d%02d-%02d%02d%02d", t.tm_year + 1900, t.tm_mon + 1,
+             t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+    string rotated = path_ + stamp;
+    for(int i = 1; access(rotated.c_str(), F_OK) == 0 || access((rotated + ".gz").c_str(), F_OK) == 0 ||
+                   access((rotated + ".zst").c_str(), F_OK) == 0; i++) {
+        rotated = path_ + stamp + "-" + to_string(i);
+    }
+    if(rename(path_.c_str(), rotated.c_str()) < 0) {
+        LOG_WARN("Access log: rename %s error %d", path_.c_str(), errno);
+        openedAt_ = now; // 下一个周期再试
+        return;
+    }
+    close(fd_);
+    if(!OpenFile_()) {
+        LOG_ERROR("Access log: reopen %s error %d", path_.c_str(), errno);
+        isOpen_ = false;
+        fileBytes_ = 0;
+        return;
+    }
+    rotateCount_++;
+    if(compress_ == NONE) {
+        return;
+    }
+    // 写线程只登记文件名，压缩在低优先级的线程中进行；积压太多时不再压缩，保持原文件
+    if(compressQueue_->full()) {
+        compressFailCount_++;
+        LOG_WARN("Access log: compression backlog full, %s left uncompressed", rotated.c_str());
+        return;
+    }
+    {
+        lock_guard<mutex> locker(compressMtx_);
+        compressPending_++;
+    }
+    compressQueue_->push_back(move(rotated));
+}
+
+void AccessLogWriter::CompressLoop_() {
+    // 最低的CPU和IO优先级：在Linux上对线程id生效，只影响本线程
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+    deque<string> files;
+    while(compressQueue_->pop_all(files)) {
+        for(const string& file : files) {
+            if(compressStop_) {
+                return;
+            }
+            if(CompressFile_(file)) {
+                compressCount_++;
+            } else {
+                compressFailCount_++;
+            }
+            lock_guard<mutex> locker(compressMtx_);
+            compressPending_--;
+            compressCond_.notify_all();
+        }
+    }
+}
+
+bool AccessLogWriter::CompressFile_(const string& file) {
+    int in = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in < 0) {
+        LOG_WARN("Access log: open %s error %d", file.c_str(), errno);
+        return false;
+    }
+    string out = file + (compress_ == ZSTD ? ".zst" : ".gz");
+    string tmp = out + ".tmp"; // 写完后再改名，中途退出不会留下不完整的压缩文件
+    vector<char> buf(COMPRESS_CHUNK);
+    uint64_t inBytes = 0, outBytes = 0;
+    bool ok = true;
+    if(compress_ == GZIP) {
+        gzFile gz = gzopen(tmp.c_str(), "wb6");
+        ok = gz != nullptr;
+        while(ok && !compressStop_) {
+            ssize_t n = read(in, buf.data(), buf.size());
+            if(n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            inBytes += n;
+            ok = gzwrite(gz, buf.data(), (unsigned)n) == n;
+        }
+        if(gz && gzclose(gz) != Z_OK) {
+            ok = false;
+        }
+    }
+#ifdef USE_ZSTD
+    if(compress_ == ZSTD) {
+        FILE* fp = fopen(tmp.c_str(), "wb");
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        ok = fp && cctx;
+        if(ok) {
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 3);
+        }
+        vector<char> zbuf(ZSTD_CStreamOutSize());
+        while(ok && !compressStop_) {
+            ssize_t n = read(in, buf.data(), buf.size());
+            if(n < 0) {
+                ok = false;
+                break;
+            }
+            inBytes += n;
+            bool last = n == 0;
+            ZSTD_inBuffer input = { buf.data(), (size_t)n, 0 };
+            bool finished;
+            do {
+                ZSTD_outBuffer output = { zbuf.data(), zbuf.size(), 0 };
+                size_t left = ZSTD_compressStream2(cctx, &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+                if(ZSTD_isError(left) || fwrite(zbuf.data(), 1, output.pos, fp) != output.pos) {
+                    ok = false;
+                    break;
+                }
+                finished = last ? left == 0 : input.pos == input.size;
+            } while(!finished);
+            if(last) {
+                break;
+            }
+        }
+        if(cctx) {
+            ZSTD_freeCCtx(cctx);
+        }
+        if(fp && fclose(fp) != 0) {
+            ok = false;
+        }
+    }
+#endif
+    close(in);
+    struct stat st;
+    if(ok && !compressStop_ && stat(tmp.c_str(), &st) == 0) {
+        outBytes = st.st_size;
+    } else {
+        ok = false;
+    }
+    if(!ok || rename(tmp.c_str(), out.c_str()) < 0) {
+        unlink(tmp.c_str());
+        if(!compressStop_) {
+            LOG_WARN("Access log: compress %s failed", file.c_str());
+        }
+        return false;
+    }
+    unlink(file.c_str());
+    compressInBytes_ += inBytes;
+    compressOutBytes_ += outBytes;
+    return true;
+}
+
+void AccessLogWriter::DumpStats(string& out) {
+    size_t rings = 0;
+    uint64_t lines = 0, waits = 0;
+    flusher_.Counts(&rings, &lines, &waits);
+    Stats::Line(out, "access_log_open", IsOpen());
+    Stats::Line(out, "access_log_format", format_);
+    Stats::Line(out, "access_log_rings", rings);
+    Stats::Line(out, "access_log_lines", lines);
+    Stats::Line(out, "access_log_bytes", bytesCount_);
+    Stats::Line(out, "access_log_batches", batchCount_);
+    Stats::Line(out, "access_log_ring_waits", waits);
+    Stats::Line(out, "access_log_rotations", rotateCount_);
+    Stats::Line(out, "access_log_compressed", compressCount_);
+    Stats::Line(out, "access_log_compress_failed", compressFailCount_);
+    Stats::Line(out, "access_log_compress_in_bytes", compressInBytes_);
+    Stats::Line(out, "access_log_compress_out_bytes", compressOutBytes_);
+}
@@ -0,0 +1,133 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include <arpa/inet.h>   // sockaddr_in
+
+#include "blockqueue.h"
+#include "ringflusher.h"
+
+// 访问日志：每个请求一行，写入单独的文件，与运行日志分开
+// 处理请求的线程在自己的环(RingFlusher，与Log相同)中放入格式化好的行，写线程按间隔把所有环用一次writev写出；
+// 文件超过大小或时间后改名切换，改名后的文件交给低优先级的压缩线程，写线程不等待压缩
+class AccessLogWriter {
+public:
+    enum Format {
+        COMMON, // 地址 - - [时间] "请求行" 状态码 字节数 耗时 上游耗时 数据库耗时(微秒，没有时为"-")
+        COMBINED, // 在COMMON的字节数之后加上"Referer" "User-Agent"
+        JSON, // 每行一个JSON对象
+    };
+    enum Compress {
+        NONE,
+        GZIP,
+        ZSTD, // 需要 make ZSTD=1，否则使用GZIP
+    };
+
+    // 一个请求的记录；字符串为nullptr时输出"-"(JSON中为null)
+    struct Entry {
+        Entry();
+        const sockaddr_in* peer;
+        const char* method;
+        const char* target;
+        const char* version; // "1.1"、"2.0"
+        int status;
+        uint64_t bytes; // 响应的字节数(含头部)
+        int64_t durationUs; // 从开始处理请求到生成响应
+        int64_t upstreamUs; // 反向代理等待上游的时间，-1表示没有
+        int64_t dbUs; // 数据库查询的时间，-1表示没有
+        const char* referer;
+        const char* userAgent;
+    };
+
+    static AccessLogWriter* Instance();
+
+    // 打开(追加)日志文件，目录不存在时创建；maxBytes、maxSeconds为0表示不按大小、时间切换；
+    // 已经打开时返回false，Close之后可以重新打开
+    bool Open(const std::string& path, Format format, size_t maxBytes, int maxSeconds, Compress compress);
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+    // 在调用线程中格式化，放入当前线程的环；环满时等待写线程腾出空间
+    void Write(const Entry& entry);
+    // 等待调用之前提交的记录写入文件
+    void flush();
+    // flush之后再等待已经切换下来的文件压缩完成(Close会放弃还没有压缩的文件)
+    void WaitCompressed();
+    // 写完所有环，停止写线程和压缩线程(还没有压缩的文件留在原处)
+    void Close();
+
+    void DumpStats(std::string& out);
+
+private:
+    typedef RingFlusher::Ring Ring;
+    // 每个线程按秒缓存已经格式化好的时间
+    struct TimeText {
+        time_t sec = -1;
+        char common[32]; // [19/Jul/2020:10:00:00 +0800]
+        size_t commonLen = 0;
+        char iso[32]; // 2020-07-19T10:00:00+08:00
+        size_t isoLen = 0;
+    };
+
+    AccessLogWriter();
+    ~AccessLogWriter();
+
+    size_t Format_(const Entry& entry, char* line, TimeText& time);
+    Ring* LocalRing_();
+    size_t Drain_(std::vector<Ring*>& rings); // 写线程中把各环中已提交的数据写入文件并检查切换，返回写入的字节数
+    bool WriteFile_(struct iovec* iov, int cnt); // 处理部分写
+    bool OpenFile_();
+    void Rotate_(time_t now); // 写线程中检查大小和时间，需要时切换文件
+    void CompressLoop_(); // 压缩线程
+    bool CompressFile_(const std::string& file);
+
+    static const size_t RING_SIZE = 64 * 1024; // 每个线程的环的容量
+    static const size_t LINE_SIZE = 4096; // 一行的上限，请求目标、Referer、User-Agent超长时截断
+    static const int FLUSH_INTERVAL_MS = 200; // 写线程的攒批间隔，环积压到一半时提前写
+    static const int MAX_IOV = 1024;
+    static const size_t MAX_PENDING_FILES = 64; // 等待压缩的文件数上限，超过时不再压缩
+    static const size_t COMPRESS_CHUNK = 64 * 1024;
+
+    std::string path_;
+    Format format_;
+    size_t maxBytes_;
+    int maxSeconds_;
+    Compress compress_;
+
+    std::atomic<bool> isOpen_;
+    int fd_; // 只由写线程使用(Open和Close时写线程不在运行)
+    size_t fileBytes_; // 当前文件的字节数
+    time_t openedAt_; // 当前文件开始写入的时间
+
+    RingFlusher flusher_; // 各线程的环和写线程
+
+    std::unique_ptr<BlockDeque<std::string>> compressQueue_; // 已经切换下来、等待压缩的文件，每次Open时新建
+    std::atomic<bool> compressStop_;
+    std::mutex compressMtx_;
+    std::condition_variable compressCond_; // 一个文件处理完或压缩线程停止，WaitCompressed在这上面等待
+    size_t compressPending_; // 已经放进队列、还没有处理完的文件数，在compressMtx_内读写
+    std::unique_ptr<std::thread> compressThread_;
+
+    /* 统计 */
+    std::atomic<uint64_t> bytesCount_;
+    std::atomic<uint64_t> batchCount_; // writev的次数
+    std::atomic<uint64_t> rotateCount_;
+    std::atomic<uint64_t> compressCount_; // 压缩完成的文件数
+    std::atomic<uint64_t> compressFailCount_; // 压缩失败或因积压跳过的文件数
+    std::atomic<uint64_t> compressInBytes_;
+    std::atomic<uint64_t> compressOutBytes_;
+};
+
+#endif //ACCESS_LOG_H
@@ -4,6 +4,8 @@
  * @copyleft Apache 2.0
  */ 
 // 阻塞队列
+// 生产者追加到前台队列；消费者可以用pop_all一次换走整个前台队列(双缓冲)，
+// 整批处理期间生产者不受影响。只在对方确实在等待时才通知，连续的push不会每次都唤醒消费者
 #ifndef BLOCKQUEUE_H
 #define BLOCKQUEUE_H
 
@@ -37,15 +39,26 @@ public:
 
     void push_back(const T &item);
 
+    void push_back(T &&item);
+
     void push_front(const T &item);
 
     bool pop(T &item);
 
     bool pop(T &item, int timeout);
 
+    // 等待直到队列非空，把整个队列与out交换(out原有的内容丢弃)；关闭时返回false
+    bool pop_all(std::deque<T> &out);
+
+    // timeout毫秒内仍然为空时返回false
+    bool pop_all(std::deque<T> &out, int timeoutMs);
+
     void flush();
 
 private:
+    void NotifyConsumer_(); // 在锁内调用
+    void NotifyProducer_(); // 在锁内调用
+
     std::deque<T> deq_; //T模板
 
     size_t capacity_;
@@ -57,6 +70,9 @@ private:
     std::condition_variable condConsumer_; // 消费者
 
     std::condition_variable condProducer_; // 生产者
+
+    int consumerWaiting_; // 正在等待的消费者数，为0时push不需要通知
+    int producerWaiting_; // 因队列满而等待的生产者数
 };
 
 
@@ -64,6 +80,8 @@ template<class T>
 BlockDeque<T>::BlockDeque(size_t MaxCapacity) :capacity_(MaxCapacity) {
     assert(MaxCapacity > 0);
     isClose_ = false;
+    consumerWaiting_ = 0;
+    producerWaiting_ = 0;
 }
 
 template<class T>
@@ -118,14 +136,42 @@ size_t BlockDeque<T>::capacity() {
     return capacity_;
 }
 
+template<class T>
+void BlockDeque<T>::NotifyConsumer_() {
+    if(consumerWaiting_ > 0) {
+        condConsumer_.notify_one();
+    }
+}
+
+template<class T>
+void BlockDeque<T>::NotifyProducer_() {
+    if(producerWaiting_ > 0) {
+        condProducer_.notify_all();
+    }
+}
+
 template<class T>
 void BlockDeque<T>::push_back(const T &item) {
     std::unique_lock<std::mutex> locker(mtx_);
-    while(deq_.size() >= capacity_) {
+    while(deq_.size() >= capacity_ && !isClose_) {
+        producerWaiting_++;
         condProducer_.wait(locker);
+        producerWaiting_--;
     }
     deq_.push_back(item);
-    condConsumer_.notify_one();
+    NotifyConsumer_();
+}
+
+template<class T>
+void BlockDeque<T>::push_back(T &&item) {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(deq_.size() >= capacity_ && !isClose_) {
+        producerWaiting_++;
+        condProducer_.wait(locker);
+        producerWaiting_--;
+    }
+    deq_.push_back(std::move(item));
+    NotifyConsumer_();
 }
 
 // 往前添加
@@ -133,13 +179,15 @@ template<class T>
 void BlockDeque<T>::push_front(const T &item) {
     std::unique_lock<std::mutex> locker(mtx_);
     // 大小超出了容量
-    while(deq_.size() >= capacity_) {
+    while(deq_.size() >= capacity_ && !isClose_) {
         // 生产者等待
+        producerWaiting_++;
         condProducer_.wait(locker);
+        producerWaiting_--;
     }
     deq_.push_front(item);
-    // 通知消费者消费
-    condConsumer_.notify_one();
+    // 有消费者在等待时通知
+    NotifyConsumer_();
 }
 
 template<class T>
@@ -158,14 +206,16 @@ template<class T>
 bool BlockDeque<T>::pop(T &item) {
     std::unique_lock<std::mutex> locker(mtx_);
     while(deq_.empty()){
+        consumerWaiting_++;
         condConsumer_.wait(locker);
+        consumerWaiting_--;
         if(isClose_){
             return false;
         }
     }
     item = deq_.front();
     deq_.pop_front();
-    condProducer_.notify_one();
+    NotifyProducer_();
     return true;
 }
 
@@ -173,8 +223,10 @@ template<class T>
 bool BlockDeque<T>::pop(T &item, int timeout) {
     std::unique_lock<std::mutex> locker(mtx_);
     while(deq_.empty()){
-        if(condConsumer_.wait_for(locker, std::chrono::seconds(timeout)) 
-                == std::cv_status::timeout){
+        consumerWaiting_++;
+        std::cv_status status = condConsumer_.wait_for(locker, std::chrono::seconds(timeout));
+        consumerWaiting_--;
+        if(status == std::cv_status::timeout){
             return false;
         }
         if(isClose_){
@@ -183,7 +235,45 @@ bool BlockDeque<T>::pop(T &item, int timeout) {
     }
     item = deq_.front();
     deq_.pop_front();
-    condProducer_.notify_one();
+    NotifyProducer_();
+    return true;
+}
+
+template<class T>
+bool BlockDeque<T>::pop_all(std::deque<T> &out) {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(deq_.empty()){
+        if(isClose_){
+            return false;
+        }
+        consumerWaiting_++;
+        condConsumer_.wait(locker);
+        consumerWaiting_--;
+    }
+    out.clear();
+    deq_.swap(out);
+    NotifyProducer_();
+    return true;
+}
+
+template<class T>
+bool BlockDeque<T>::pop_all(std::deque<T> &out, int timeoutMs) {
+    std::unique_lock<std::mutex> locker(mtx_);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while(deq_.empty()){
+        if(isClose_){
+            return false;
+        }
+        consumerWaiting_++;
+        std::cv_status status = condConsumer_.wait_until(locker, deadline);
+        consumerWaiting_--;
+        if(status == std::cv_status::timeout && deq_.empty()){
+            return false;
+        }
+    }
+    out.clear();
+    deq_.swap(out);
+    NotifyProducer_();
     return true;
 }
 
@@ -2,202 +2,495 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #include "log.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>    // writev
+#include <algorithm>
+#include "stats.h"
+
 using namespace std;
 
-Log::Log() {
+const char* Log::BINARY_SUFFIX = ".bin";
+atomic<Log::FormatInfo*> Log::formats_[Log::MAX_FORMATS];
+atomic<uint32_t> Log::formatCount_;
+
+Log::Log() : flusher_(RING_SIZE) {
     lineCount_ = 0;
+    fileLines_ = 0;
+    isOpen_ = false;
+    level_ = 1;
     isAsync_ = false;
-    writeThread_ = nullptr;
-    deque_ = nullptr;
+    mode_ = TEXT;
+    deferred_ = false;
+    fileBinary_ = false;
     toDay_ = 0;
-    fp_ = nullptr;
+    fd_ = -1;
+    flusher_.SetPolicy(FLUSH_INTERVAL_MS, FLUSH_BYTES);
+    linesCount_ = 0;
+    batchCount_ = 0;
+    bytesCount_ = 0;
+    directCount_ = 0;
+    recordCount_ = 0;
 }
 
 Log::~Log() {
-    if(writeThread_ && writeThread_->joinable()) {
-        while(!deque_->empty()) {
-            deque_->flush();
-        };
-        deque_->Close();
-        writeThread_->join();
-    }
-    if(fp_) {
+    isOpen_ = false;
+    flusher_.Stop(); // 刷写线程写完所有环之后才退出
+    if(fd_ >= 0) {
         lock_guard<mutex> locker(mtx_);
-        flush();
-        fclose(fp_);
+        close(fd_);
     }
 }
 
-int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
-}
-
-void Log::SetLevel(int level) {
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
-}
-
 void Log::init(int level = 1, const char* path, const char* suffix,
     int maxQueueSize) {
-    isOpen_ = true;
     level_ = level;
     if(maxQueueSize > 0) {
-        // 异步
+        // 异步：maxQueueSize只表示开启，每个线程的环是固定大小的
+        flusher_.Start([this](vector<Ring*>& rings) { return Drain_(rings); });
         isAsync_ = true;
-        if(!deque_) {
-            unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = move(newDeque);
-            // 创建新线程
-            // new thread(FlushLogThread)做FlushLogThread
-            std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
-            writeThread_ = move(NewThread);
-        }
     } else {
-        // 同步
+        // 同步：之前已经放进环的日志先写到原来的文件
         isAsync_ = false;
+        flush();
+    }
+    deferred_ = mode_ != TEXT && isAsync_;
+    if(isOpen_) {
+        // 将之前的没有写的日志信息写到原来的文件；要在改path_之前，写满时切换出的文件仍在原来的目录
+        flush();
     }
-    // 记录写到第几行
-    lineCount_ = 0;
     // 获取时间
     time_t timer = time(nullptr);
-    struct tm *sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-    path_ = path; // 
-    suffix_ = suffix; // 
+    struct tm t;
+    localtime_r(&timer, &t);
+    path_ = path; //
+    suffix_ = suffix; //
     char fileName[LOG_NAME_LEN] = {0}; // 文件名
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
+    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
             path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);// 生成的文件的名字
-    toDay_ = t.tm_mday; // 当前的日期
 
     {
         lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        if(fp_) { 
-            flush(); // 将之前的没有写的日志信息刷新
-            fclose(fp_); 
-        }
+        // 记录写到第几行
+        lineCount_ = 0;
+        fileLines_ = 0;
+        toDay_ = t.tm_mday; // 当前的日期
+        OpenFile_(fileName);
+    }
+    isOpen_ = true;
+}
 
-        fp_ = fopen(fileName, "a");
-        // 判断文件指针
-        if(fp_ == nullptr) {
-            mkdir(path_, 0777);
-            fp_ = fopen(fileName, "a");
-        } 
-        assert(fp_ != nullptr);
+void Log::SetMode(Mode mode) {
+    mode_ = mode;
+    deferred_ = mode != TEXT && isAsync_;
+    if(!isOpen_) {
+        return; // init时按模式打开文件
+    }
+    // 环中已有的文本和记录不用先写出：刷写线程按写入时的文件格式转换
+    lock_guard<mutex> locker(mtx_);
+    if((mode == BINARY && isAsync_) != fileBinary_) {
+        string fileName = fileName_;
+        OpenFile_(fileName.c_str());
     }
 }
 
-void Log::write(int level, const char *format, ...) {
+void Log::SetFlushPolicy(int intervalMs, size_t bytes) {
+    flusher_.SetPolicy(intervalMs, bytes);
+}
+
+uint32_t Log::Register(const char* format, const char* file, int line) {
+    static mutex registerMtx;
+    lock_guard<mutex> locker(registerMtx);
+    uint32_t id = formatCount_ + 1;
+    if(id >= MAX_FORMATS) {
+        return 0;
+    }
+    FormatInfo* info = new FormatInfo{ format, file, line };
+    LogRecord::BoundedStrings(format, &info->bounds);
+    formats_[id].store(info, memory_order_release);
+    formatCount_ = id;
+    return id;
+}
+
+void Log::OpenFile_(const char* fileName) {
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+    fileName_ = fileName;
+    fileBinary_ = mode_ == BINARY && isAsync_;
+    string name = fileBinary_ ? fileName_ + BINARY_SUFFIX : fileName_;
+    fd_ = open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if(fd_ < 0) {
+        mkdir(path_, 0777);
+        fd_ = open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    }
+    assert(fd_ >= 0);
+    // 新文件中格式串定义要重新写出
+    defined_.assign(MAX_FORMATS, false);
+    if(fileBinary_ && lseek(fd_, 0, SEEK_END) == 0) {
+        struct iovec iov = { (void*)LogRecord::FILE_MAGIC, sizeof(LogRecord::FILE_MAGIC) };
+        WriteFile_(&iov, 1);
+    }
+}
+
+uint64_t Log::NowUs_() {
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);
-    time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+char* Log::RecordBuffer_() {
+    static thread_local char buf[LogRecord::MAX_SIZE];
+    return buf;
+}
+
+size_t Log::FormatPrefix_(char* buf, int level, struct tm* t) {
+    static thread_local LogRecord::TimeCache cache;
+    size_t n = LogRecord::Prefix(buf, NowUs_(), level, cache);
+    *t = cache.t;
+    return n;
+}
+
+void Log::write(int level, const char *format, ...) {
+    // 行前面留出记录头的位置，DEFERRED/BINARY模式下整体作为一条TEXT记录放进记录的环
+    static const size_t HEAD = sizeof(LogRecord::Head);
+    thread_local char local[LINE_SIZE];
+    char* line = local + HEAD;
+    struct tm t;
+    size_t n = FormatPrefix_(line, level, &t);
+
     va_list vaList;
+    va_start(vaList, format);
+    int m = vsnprintf(line + n, LINE_SIZE - HEAD - n - 1, format, vaList); // 留出换行符的位置
+    va_end(vaList);
+    if(m < 0) {
+        m = 0;
+    }
+    unique_ptr<char[]> big;
+    if((size_t)m >= LINE_SIZE - HEAD - n - 1) {
+        // 超长的行临时分配后重新格式化
+        big.reset(new char[HEAD + n + m + 2]);
+        memcpy(big.get() + HEAD, line, n);
+        line = big.get() + HEAD;
+        va_start(vaList, format);
+        vsnprintf(line + n, m + 1, format, vaList);
+        va_end(vaList);
+    }
+    size_t len = n + m;
+    line[len++] = '\n';
 
-    /* 日志日期 日志行数 */
-    // 判断日期，以及lineCount是否超出最大值
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
-    {
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-        // 
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
-
-        if (toDay_ != t.tm_mday)
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
-        }
-        else {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
+    if(isAsync_ && len <= RING_SIZE / 2) {
+        if(deferred_) {
+            LogRecord::Head head = TextHead_(len);
+            memcpy(line - HEAD, &head, HEAD);
+            flusher_.Push(LocalRing_(true), line - HEAD, HEAD + len);
+        } else {
+            flusher_.Push(LocalRing_(false), line, len);
         }
-        
-        locker.lock();
+        return;
+    }
+    if(isAsync_) {
+        // 放不进环的行：先等本线程之前的日志写出，保持顺序
         flush();
-        fclose(fp_);//关闭fp_
-        // 重新打开一个新文件
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
     }
-    // 具体的写数据在下面
-    {
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-                    
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);
+    WriteDirect_(line, len, t);
+}
 
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-        va_end(vaList);
+Log::Ring* Log::LocalRing_(bool records) {
+    static thread_local RingFlusher::Holder holder[2];
+    return flusher_.Local(holder[records], records ? RECORD_RING : TEXT_RING);
+}
 
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
+void Log::WriteDirect_(const char* line, size_t len, const struct tm& t) {
+    LogRecord::Head head = TextHead_(len);
+    struct iovec iov[2] = { { &head, sizeof(head) }, { (void*)line, len } };
+    lock_guard<mutex> locker(mtx_);
+    Rotate_(t);
+    if(fileBinary_) {
+        WriteFile_(iov, 2);
+    } else {
+        WriteFile_(iov + 1, 1);
+    }
+    lineCount_++;
+    fileLines_++;
+    linesCount_++;
+    directCount_++;
+}
 
-        if(isAsync_ && deque_ && !deque_->full()) {
-            deque_->push_back(buff_.RetrieveAllToStr());
-        } else {
-            fputs(buff_.Peek(), fp_);
+void Log::Rotate_(const struct tm& t) {
+    if(toDay_ == t.tm_mday && fileLines_ < MAX_LINES) {
+        return;
+    }
+    char newFile[LOG_NAME_LEN];
+    char tail[36] = {0};
+    snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+
+    if (toDay_ != t.tm_mday)
+    {
+        snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
+        toDay_ = t.tm_mday;
+        lineCount_ = 0;
+    }
+    else {
+        snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (int)(lineCount_  / MAX_LINES), suffix_);
+    }
+    fileLines_ = 0;
+    // 重新打开一个新文件
+    OpenFile_(newFile);
+}
+
+void Log::WriteFile_(struct iovec* iov, int cnt) {
+    size_t bytes = 0;
+    while(cnt > 0) {
+        ssize_t n = writev(fd_, iov, cnt);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            break; // 磁盘满等错误：丢弃这一批，不让写日志的线程一直等待
+        }
+        bytes += n;
+        // 部分写：跳过已经写完的分段
+        while(cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
         }
-        buff_.RetrieveAll();
     }
+    batchCount_++;
+    bytesCount_ += bytes;
+}
+
+LogRecord::Head Log::TextHead_(size_t len) {
+    LogRecord::Head head;
+    head.size = (uint32_t)(sizeof(head) + len);
+    head.id = LogRecord::TEXT_ID;
+    head.usec = 0;
+    head.level = 1;
+    head.argc = 0;
+    return head;
 }
 
-void Log::AppendLogLevelTitle_(int level) {
-    switch(level) {
-    case 0:
-        buff_.Append("[debug]: ", 9);
-        break;
-    case 1:
-        buff_.Append("[info] : ", 9);
-        break;
-    case 2:
-        buff_.Append("[warn] : ", 9);
-        break;
-    case 3:
-        buff_.Append("[error]: ", 9);
-        break;
-    default:
-        buff_.Append("[info] : ", 9);
-        break;
+void Log::CopyOut_(const Ring* ring, size_t pos, char* dst, size_t len) {
+    size_t off = pos & (ring->capacity - 1);
+    size_t first = min(len, ring->capacity - off);
+    memcpy(dst, ring->data + off, first);
+    if(first < len) {
+        memcpy(dst + first, ring->data, len - first);
     }
 }
 
-void Log::flush() {
-    if(isAsync_) { 
-        deque_->flush(); 
+void Log::AppendDef_(uint32_t id) {
+    FormatInfo* info = formats_[id].load(memory_order_acquire);
+    if(!info) {
+        return;
     }
-    fflush(fp_);
+    size_t fileLen = strlen(info->file) + 1;
+    size_t formatLen = strlen(info->format) + 1;
+    LogRecord::Head head;
+    head.size = (uint32_t)(sizeof(head) + 8 + fileLen + formatLen);
+    head.id = LogRecord::DEF_ID;
+    head.usec = 0;
+    head.level = 0;
+    head.argc = 0;
+    int32_t line = info->line;
+    text_.append((const char*)&head, sizeof(head));
+    text_.append((const char*)&id, sizeof(id));
+    text_.append((const char*)&line, sizeof(line));
+    text_.append(info->file, fileLen);
+    text_.append(info->format, formatLen);
+    defined_[id] = true;
 }
 
-void Log::AsyncWrite_() {
-    string str = "";
-    // 从队列取
-    while(deque_->pop(str)) {
-        // 加锁
-        lock_guard<mutex> locker(mtx_);
-        // 写
-        fputs(str.c_str(), fp_);
+void Log::Collect_(Ring* ring, size_t tail, size_t head) {
+    size_t start = text_.size();
+    if(ring->kind == RECORD_RING) {
+        for(size_t pos = tail; pos < head; ) {
+            LogRecord::Head rec;
+            CopyOut_(ring, pos, (char*)&rec, sizeof(rec));
+            if(rec.size < sizeof(rec) || rec.size > head - pos) {
+                break; // 不会出现：记录由Record完整写入
+            }
+            recordCount_++;
+            if(fileBinary_) {
+                // 二进制文件：记录原样写出，之前补上本文件中第一次出现的格式串定义
+                if(rec.id != LogRecord::TEXT_ID && rec.id < MAX_FORMATS && !defined_[rec.id]) {
+                    AppendDef_(rec.id);
+                }
+            } else if(rec.id == LogRecord::TEXT_ID) {
+                // 已经格式化好的文本行(含前缀和换行)
+                size_t textLen = rec.size - sizeof(rec);
+                size_t old = text_.size();
+                text_.resize(old + textLen);
+                CopyOut_(ring, pos + sizeof(rec), &text_[old], textLen);
+            } else {
+                // 文本文件：在刷写线程中格式化
+                record_.resize(rec.size);
+                CopyOut_(ring, pos, &record_[0], rec.size);
+                char prefix[64];
+                text_.append(prefix, LogRecord::Prefix(prefix, rec.usec, rec.level, timeCache_));
+                FormatInfo* info = rec.id < MAX_FORMATS ? formats_[rec.id].load(memory_order_acquire) : nullptr;
+                if(info) {
+                    LogRecord::Format(info->format, record_.data() + sizeof(rec), rec.size - sizeof(rec), text_);
+                }
+                text_ += '\n';
+            }
+            pos += rec.size;
+        }
+        if(!fileBinary_) {
+            segments_.push_back({ nullptr, start, text_.size() - start });
+            return;
+        }
+    } else if(fileBinary_) {
+        // 二进制文件中的文本行整体作为一条TEXT记录
+        LogRecord::Head text = TextHead_(head - tail);
+        text_.append((const char*)&text, sizeof(text));
+    }
+    if(text_.size() > start) {
+        segments_.push_back({ nullptr, start, text_.size() - start });
+    }
+    // 环中的数据不复制，直接交给writev
+    size_t pos = tail & (ring->capacity - 1);
+    size_t len = head - tail;
+    size_t first = min(len, ring->capacity - pos);
+    segments_.push_back({ ring->data, pos, first });
+    if(first < len) {
+        segments_.push_back({ ring->data, 0, len - first });
     }
 }
 
+size_t Log::CutLines_(const Ring* ring, size_t tail, size_t head, uint64_t room, uint64_t* lines) {
+    uint64_t n = 0;
+    size_t pos = tail;
+    if(ring->kind == RECORD_RING) {
+        // 每条记录解码为一行
+        while(pos < head && n < room) {
+            LogRecord::Head rec;
+            CopyOut_(ring, pos, (char*)&rec, sizeof(rec));
+            if(rec.size < sizeof(rec) || rec.size > head - pos) {
+                pos = head;
+                break;
+            }
+            pos += rec.size;
+            n++;
+        }
+    } else {
+        // 文本按换行符计数(一次调用中带换行符的消息也按文件中的实际行数)
+        while(pos < head && n < room) {
+            size_t off = pos & (ring->capacity - 1);
+            size_t span = min(head - pos, ring->capacity - off);
+            const char* p = (const char*)memchr(ring->data + off, '\n', span);
+            if(!p) {
+                pos += span;
+                continue;
+            }
+            pos += p - (ring->data + off) + 1;
+            n++;
+        }
+    }
+    *lines = n;
+    return pos;
+}
+
+size_t Log::Drain_(vector<Ring*>& rings) {
+    struct iovec iov[MAX_IOV];
+    size_t total = 0;
+    size_t begin = 0;
+    while(begin < rings.size()) {
+        size_t first = begin;
+        while(first < rings.size() && rings[first]->head.load(memory_order_acquire) ==
+              rings[first]->tail.load(memory_order_relaxed)) {
+            first++;
+        }
+        if(first == rings.size()) {
+            break; // 没有要写的，不检查切换文件
+        }
+        // 每个环最多占三段(记录头或格式串定义、绕回的两段)，一次writev写出所有环中已提交的数据
+        uint64_t lines = 0;
+        size_t end = begin;
+        bool split = false; // 本轮在最后一个环的中间切开，下一轮从这个环继续
+        time_t timer = time(nullptr);
+        struct tm t;
+        localtime_r(&timer, &t);
+        // 解码和补充的定义取决于当前文件的格式，在文件锁内进行
+        unique_lock<mutex> locker(mtx_);
+        Rotate_(t);
+        segments_.clear();
+        text_.clear();
+        // 当前文件还能写的行数：写满时在这一行处切开，剩下的下一轮写入新文件
+        uint64_t room = MAX_LINES - fileLines_;
+        for(; end < rings.size() && segments_.size() + 3 <= (size_t)MAX_IOV; end++) {
+            Ring* ring = rings[end];
+            size_t tail = ring->tail.load(memory_order_relaxed);
+            size_t head = ring->head.load(memory_order_acquire);
+            ring->drainHead = head;
+            if(head == tail) {
+                continue;
+            }
+            uint64_t n = 0;
+            size_t cut = CutLines_(ring, tail, head, room - lines, &n);
+            ring->drainHead = cut;
+            Collect_(ring, tail, cut);
+            lines += n;
+            total += cut - tail;
+            if(lines == room) {
+                split = cut < head;
+                end++;
+                break;
+            }
+        }
+        if(!segments_.empty()) {
+            // text_不再增长，分段换成地址
+            int cnt = 0;
+            for(const Segment& seg : segments_) {
+                iov[cnt].iov_base = (void*)((seg.base ? seg.base : text_.data()) + seg.off);
+                iov[cnt++].iov_len = seg.len;
+            }
+            WriteFile_(iov, cnt);
+            lineCount_ += lines;
+            fileLines_ += lines;
+            linesCount_ += lines;
+        }
+        locker.unlock();
+        for(size_t i = begin; i < end; i++) {
+            rings[i]->tail.store(rings[i]->drainHead, memory_order_release);
+        }
+        begin = split ? end - 1 : end;
+    }
+    return total;
+}
+
+void Log::flush() {
+    // 同步模式直接写文件，没有缓冲；异步模式等刷写线程完整地跑完一轮
+    flusher_.flush();
+}
+
+void Log::DumpStats(string& out) {
+    size_t rings = 0;
+    uint64_t lines = 0, waits = 0;
+    flusher_.Counts(&rings, &lines, &waits);
+    Stats::Line(out, "log_level", GetLevel());
+    Stats::Line(out, "log_mode", GetMode());
+    Stats::Line(out, "log_formats", formatCount_);
+    Stats::Line(out, "log_records", recordCount_);
+    Stats::Line(out, "log_rings", rings);
+    Stats::Line(out, "log_lines", linesCount_);
+    Stats::Line(out, "log_bytes", bytesCount_);
+    Stats::Line(out, "log_batches", batchCount_);
+    Stats::Line(out, "log_direct_lines", directCount_);
+    Stats::Line(out, "log_ring_waits", waits);
+    Stats::Line(out, "log_wakeups", flusher_.Wakeups());
+    Stats::Line(out, "log_flush_interval_ms", flusher_.IntervalMs());
+    Stats::Line(out, "log_flush_bytes", flusher_.WakeBytes());
+}
+
 Log* Log::Instance() {
     static Log inst;
     return &inst;
 }
-
-void Log::FlushLogThread() {
-    // 异步写
-    Log::Instance()->AsyncWrite_();
-}
\ No newline at end of file
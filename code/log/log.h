@@ -2,84 +2,204 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #ifndef LOG_H
 #define LOG_H
 
 #include <mutex>
 #include <string>
-#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
 #include <sys/time.h>
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         //mkdir
-#include "blockqueue.h"
-#include "../buffer/buffer.h"
+#include "logrecord.h"
+#include "ringflusher.h"
 
+// 编译期的最低日志级别，低于它的LOG_*在预处理时就被去掉(参数也不求值)；
+// 发布构建用 -DLOG_MIN_LEVEL=1 去掉所有LOG_DEBUG
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// 异步模式下每个写日志的线程有自己的环形缓冲区(RingFlusher，单生产者单消费者，无锁)，
+// 格式化好的行放进自己的环，唯一的刷写线程把所有环中的数据用一次writev批量写入文件；
+// 同步模式(队列容量为0)时格式化后在锁内直接写文件
 class Log {
 public:
-    void init(int level, const char* path = "./log", 
+    enum Mode {
+        TEXT, // 写日志的线程格式化
+        DEFERRED, // 写日志的线程只记录格式串编号和参数(LogRecord)，刷写线程格式化为文本
+        BINARY, // 记录原样写入"日志文件名.bin"，用logdecode工具还原为文本
+    };
+
+    void init(int level, const char* path = "./log",
                 const char* suffix =".log",
                 int maxQueueCapacity = 1024);
 
     static Log* Instance();
-    static void FlushLogThread();
 
     void write(int level, const char *format,...);
+    // DEFERRED/BINARY模式下LOG_BASE调用：id是调用点第一次执行时登记的格式串编号
+    template<typename... Args>
+    void Record(int level, uint32_t id, const char* format, Args... args) {
+        if(id == 0) {
+            write(level, format, args...); // 编号已经用完
+            return;
+        }
+        char* buf = RecordBuffer_();
+        LogRecord::Writer writer(buf, formats_[id].load(std::memory_order_relaxed)->bounds);
+        int expand[] = { 0, (writer.Put(args), 0)... };
+        (void)expand;
+        size_t len = writer.Finish(level, id, NowUs_());
+        flusher_.Push(LocalRing_(true), buf, len);
+    }
+    // 登记调用点的格式串，返回编号(从1开始，用完时返回0)；format必须是字符串常量
+    static uint32_t Register(const char* format, const char* file, int line);
+    // 等待已写入各个环的日志全部落盘
     void flush();
 
-    int GetLevel();
-    void SetLevel(int level);
-    bool IsOpen() { return isOpen_; }
-    
+    // 原子变量，LOG_BASE判断级别时不加锁
+    int GetLevel() const { return level_.load(std::memory_order_relaxed); }
+    void SetLevel(int level) { level_.store(level, std::memory_order_relaxed); }
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+    // 可以在init前后调用；DEFERRED/BINARY只在异步模式下生效，同步模式仍然是TEXT
+    void SetMode(Mode mode);
+    Mode GetMode() const { return (Mode)mode_.load(std::memory_order_relaxed); }
+    bool IsDeferred() const { return deferred_.load(std::memory_order_relaxed); }
+    // 异步模式的攒批：刷写线程每intervalMs毫秒写一次，某个线程的环中积压达到bytes时提前唤醒；
+    // intervalMs为0时每行都唤醒刷写线程(不攒批)
+    void SetFlushPolicy(int intervalMs, size_t bytes);
+
+    void DumpStats(std::string& out);
+
 private:
+    typedef RingFlusher::Ring Ring;
+    // 每个线程的文本和记录各用一个环；DEFERRED/BINARY模式下回到文本的行(格式串编号用完等)
+    // 作为TEXT_ID记录放进记录的环，和本线程的其他记录保持先后顺序。只在切换模式的时刻，
+    // 两个环中的行可能不按先后写出
+    enum RingKind {
+        TEXT_RING, // TEXT模式下格式化好的文本行
+        RECORD_RING, // LogRecord记录
+    };
+    struct FormatInfo {
+        const char* format;
+        const char* file;
+        int line;
+        LogRecord::Bounds bounds; // 字符串参数的精度
+    };
+    // 刷写线程本轮要写出的一段：ring为空时是text_中从off开始的数据
+    struct Segment {
+        const char* base;
+        size_t off;
+        size_t len;
+    };
+
     Log();
-    void AppendLogLevelTitle_(int level);
     virtual ~Log();
-    void AsyncWrite_();
+    // 在buf中生成"日期 时间.微秒 [级别]: "前缀，返回长度；日期时间部分每个线程按秒缓存
+    static size_t FormatPrefix_(char* buf, int level, struct tm* t);
+    static uint64_t NowUs_();
+    static char* RecordBuffer_(); // 线程局部的编码缓冲区，LogRecord::MAX_SIZE字节
+    Ring* LocalRing_(bool records); // 当前线程的环，第一次调用时创建并登记
+    void WriteDirect_(const char* line, size_t len, const struct tm& t); // 同步模式和超长的行：在锁内直接写文件
+    size_t Drain_(std::vector<Ring*>& rings); // 刷写线程中把各环中已提交的数据写入文件，返回写入的字节数
+    // 把环中[tail, head)的数据加入本轮的分段：文本文件中解码记录，二进制文件中补上格式串定义
+    void Collect_(Ring* ring, size_t tail, size_t head);
+    // 从tail开始最多取room行，返回结束位置，lines是实际的行数
+    static size_t CutLines_(const Ring* ring, size_t tail, size_t head, uint64_t room, uint64_t* lines);
+    static void CopyOut_(const Ring* ring, size_t pos, char* dst, size_t len); // 处理绕回
+    static LogRecord::Head TextHead_(size_t len); // 记录的环和二进制文件中的文本行前面加上TEXT_ID记录头
+    void AppendDef_(uint32_t id); // 二进制文件中第一次出现的格式串
+    void Rotate_(const struct tm& t); // 在锁内检查日期和行数，需要时切换文件
+    void OpenFile_(const char* fileName); // 二进制模式时文件名加上BINARY_SUFFIX
+    void WriteFile_(struct iovec* iov, int cnt); // 在锁内写入，处理部分写
 
 private:
     static const int LOG_PATH_LEN = 256; // 日志路径的长度
     static const int LOG_NAME_LEN = 256; // 日志名字的长度
-    static const int MAX_LINES = 50000; // 日志的长度
+    static const int MAX_LINES = 50000; // 每个文件的行数，批量写入时在这一行处切开
+    static const size_t RING_SIZE = 64 * 1024; // 每个线程的环的容量
+    static const size_t LINE_SIZE = 1024; // 线程局部的格式化缓冲区，超过时临时分配
+    static const int FLUSH_INTERVAL_MS = 20; // 默认的攒批间隔
+    static const size_t FLUSH_BYTES = 16 * 1024; // 默认的提前唤醒积压量(环的1/4)
+    static const int MAX_IOV = 1024;
+    static const uint32_t MAX_FORMATS = 4096; // 格式串编号的上限，用完后回到TEXT
+    static const char* BINARY_SUFFIX;
 
     const char* path_;
     const char* suffix_;
 
     int MAX_LINES_;
 
-    int lineCount_; // 记录写的行数
+    uint64_t lineCount_; // 当前日期已经写入的行数
+    uint64_t fileLines_; // 当前文件已经写入的行数，达到MAX_LINES时切换到新文件
     int toDay_; // 记录当前的日期
 
-    bool isOpen_;
- 
-    Buffer buff_; // 同读写使用的Buffer
-    int level_;
-    bool isAsync_;
+    std::atomic<bool> isOpen_;
+    std::atomic<int> level_;
+    std::atomic<bool> isAsync_;
+    std::atomic<int> mode_;
+    std::atomic<bool> deferred_; // mode_不是TEXT且是异步模式
+    bool fileBinary_; // 当前文件是二进制格式，在mtx_内读写
+    std::vector<bool> defined_; // 当前文件中已经写过定义的格式串编号
+    std::string fileName_; // 当前文件名(不含BINARY_SUFFIX)，切换模式时重新打开
+
+    int fd_;
+    std::mutex mtx_; // 保护文件(fd_、切换文件)，同步写和刷写线程的批量写都在锁内
+
+    RingFlusher flusher_; // 各线程的环和刷写线程
+    std::vector<Segment> segments_; // 刷写线程本轮的分段
+    std::string text_; // 刷写线程解码出的文本和补充的记录头
+    std::string record_; // 刷写线程取出的一条记录(可能在环中绕回)
+    LogRecord::TimeCache timeCache_; // 刷写线程解码时的时间缓存
+
+    /* 统计 */
+    std::atomic<uint64_t> linesCount_; // 写入文件的行数
+    std::atomic<uint64_t> batchCount_; // writev的次数
+    std::atomic<uint64_t> bytesCount_; // 写入文件的字节数
+    std::atomic<uint64_t> directCount_; // 不经过环直接写入的行数(同步模式或超长的行)
+    std::atomic<uint64_t> recordCount_; // 刷写线程处理的记录数
 
-    FILE* fp_;
-    std::unique_ptr<BlockDeque<std::string>> deque_;  // 阻塞队列
-    std::unique_ptr<std::thread> writeThread_; // 写的子线程
-    std::mutex mtx_; // 互斥锁
+    static std::atomic<FormatInfo*> formats_[MAX_FORMATS]; // 下标是编号，登记后不释放
+    static std::atomic<uint32_t> formatCount_;
 };
 
 // 定义宏函数
-// 判断GetLevel()<=level，判断是否在写日志的范围内
-// 调用log->write写
-// 调用log->flush刷新
+// 判断GetLevel()<=level，判断是否在写日志的范围内(原子读，不加锁)
+// TEXT模式调用log->write格式化后写入当前线程的环；DEFERRED/BINARY模式调用log->Record，
+// 调用点的静态变量保存格式串编号，只记录参数的原始值。都由刷写线程批量写文件
 #define LOG_BASE(level, format, ...) \
     do {\
         Log* log = Log::Instance();\
-        if (log->IsOpen() && log->GetLevel() <= level) {\
-            log->write(level, format, ##__VA_ARGS__); \
-            log->flush();\
+        if (level >= LOG_MIN_LEVEL && log->IsOpen() && log->GetLevel() <= level) {\
+            if (log->IsDeferred()) {\
+                static const uint32_t logFormatId = Log::Register(format, __FILE__, __LINE__);\
+                log->Record(level, logFormatId, format, ##__VA_ARGS__);\
+            } else {\
+                log->write(level, format, ##__VA_ARGS__); \
+            }\
         }\
     } while(0);
 
+#if LOG_MIN_LEVEL > 0
+#define LOG_DEBUG(format, ...) do {} while(0);
+#else
 #define LOG_DEBUG(format, ...) do {LOG_BASE(0, format, ##__VA_ARGS__)} while(0);
+#endif
+#if LOG_MIN_LEVEL > 1
+#define LOG_INFO(format, ...) do {} while(0);
+#else
 #define LOG_INFO(format, ...) do {LOG_BASE(1, format, ##__VA_ARGS__)} while(0);
+#endif
+#if LOG_MIN_LEVEL > 2
+#define LOG_WARN(format, ...) do {} while(0);
+#else
 #define LOG_WARN(format, ...) do {LOG_BASE(2, format, ##__VA_ARGS__)} while(0);
+#endif
 #define LOG_ERROR(format, ...) do {LOG_BASE(3, format, ##__VA_ARGS__)} while(0);
 
-#endif //LOG_H
\ No newline at end of file
+#endif //LOG_H
@@ -0,0 +1,286 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "logrecord.h"
+
+#include <stdio.h>
+#include <ctype.h>
+
+using namespace std;
+
+const char LogRecord::FILE_MAGIC[8] = { 'W', 'S', 'L', 'O', 'G', 'B', '0', '1' };
+
+size_t LogRecord::Prefix(char* buf, uint64_t usec, int level, TimeCache& cache) {
+    static const char* titles[] = { "[debug]: ", "[info] : ", "[warn] : ", "[error]: " };
+    time_t sec = (time_t)(usec / 1000000);
+    if(sec != cache.sec) {
+        // 同一秒内的日志复用已经格式化好的日期和时间，只填微秒
+        cache.sec = sec;
+        localtime_r(&sec, &cache.t);
+        cache.len = snprintf(cache.text, sizeof(cache.text), "%d-%02d-%02d %02d:%02d:%02d.",
+                    cache.t.tm_year + 1900, cache.t.tm_mon + 1, cache.t.tm_mday,
+                    cache.t.tm_hour, cache.t.tm_min, cache.t.tm_sec);
+    }
+    memcpy(buf, cache.text, cache.len);
+    size_t n = cache.len;
+    uint64_t us = usec % 1000000;
+    for(int i = 5; i >= 0; i--) {
+        buf[n + i] = '0' + us % 10;
+        us /= 10;
+    }
+    n += 6;
+    buf[n++] = ' ';
+    memcpy(buf + n, titles[(level >= 0 && level <= 3) ? level : 1], 9);
+    return n + 9;
+}
+
+void LogRecord::Writer::Put(const char* s) {
+    if(!s) { s = "(null)"; }
+    if(pos_ + 3 > MAX_SIZE) { return; }
+    size_t max = MAX_SIZE - pos_ - 3;
+    int64_t precision = argc_ < Bounds::MAX_ARGS ? bounds_->precision[argc_] : -1;
+    if(precision == Bounds::STAR) {
+        precision = last_; // 负数和printf一样表示没有精度
+    }
+    if(precision >= 0 && (uint64_t)precision < max) {
+        max = (size_t)precision;
+    }
+    uint16_t len = (uint16_t)strnlen(s, max);
+    buf_[pos_] = STRING;
+    memcpy(buf_ + pos_ + 1, &len, sizeof(len));
+    memcpy(buf_ + pos_ + 3, s, len);
+    pos_ += 3 + len;
+    argc_++;
+}
+
+size_t LogRecord::Writer::Finish(int level, uint32_t id, uint64_t usec) {
+    Head head;
+    head.size = (uint32_t)pos_;
+    head.id = id;
+    head.usec = usec;
+    head.level = level;
+    head.argc = argc_;
+    memcpy(buf_, &head, sizeof(head));
+    return pos_;
+}
+
+// 按顺序读出记录中的参数
+class ArgReader {
+public:
+    ArgReader(const char* args, size_t len) : p_(args), end_(args + len) {}
+
+    char Tag() const { return p_ < end_ ? *p_ : 0; }
+    void Skip() {
+        switch(Tag()) {
+        case LogRecord::INT: p_ += 5; break;
+        case LogRecord::STRING: {
+            uint16_t len = 0;
+            if(p_ + 3 <= end_) { memcpy(&len, p_ + 1, sizeof(len)); }
+            p_ += 3 + len;
+            break;
+        }
+        case 0: return;
+        default: p_ += 9; break;
+        }
+        if(p_ > end_) { p_ = end_; }
+    }
+    // INT、LONG、POINTER都按整数读出；类型不符时返回false，不前进
+    bool Integer(int64_t* value) {
+        if(Tag() == LogRecord::INT && p_ + 5 <= end_) {
+            int32_t v;
+            memcpy(&v, p_ + 1, sizeof(v));
+            *value = v;
+        } else if((Tag() == LogRecord::LONG || Tag() == LogRecord::POINTER) && p_ + 9 <= end_) {
+            memcpy(value, p_ + 1, sizeof(*value));
+        } else {
+            return false;
+        }
+        Skip();
+        return true;
+    }
+    bool Double(double* value) {
+        if(Tag() != LogRecord::DOUBLE || p_ + 9 > end_) { return false; }
+        memcpy(value, p_ + 1, sizeof(*value));
+        Skip();
+        return true;
+    }
+    bool String(string* value) {
+        if(Tag() != LogRecord::STRING || p_ + 3 > end_) { return false; }
+        uint16_t len;
+        memcpy(&len, p_ + 1, sizeof(len));
+        if(p_ + 3 + len > end_) { return false; }
+        value->assign(p_ + 3, len);
+        Skip();
+        return true;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+// 用一个参数格式化spec，stars是宽度、精度中'*'对应的值
+template<typename T>
+static void AppendSpec(string& out, const char* spec, const int* star, int stars, T value) {
+    char buf[256];
+    int n;
+    switch(stars) {
+    case 0: n = snprintf(buf, sizeof(buf), spec, value); break;
+    case 1: n = snprintf(buf, sizeof(buf), spec, star[0], value); break;
+    default: n = snprintf(buf, sizeof(buf), spec, star[0], star[1], value); break;
+    }
+    if(n < 0) { return; }
+    if((size_t)n < sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    size_t old = out.size();
+    out.resize(old + n + 1);
+    switch(stars) {
+    case 0: snprintf(&out[old], n + 1, spec, value); break;
+    case 1: snprintf(&out[old], n + 1, spec, star[0], value); break;
+    default: snprintf(&out[old], n + 1, spec, star[0], star[1], value); break;
+    }
+    out.resize(old + n);
+}
+
+void LogRecord::Format(const char* format, const char* args, size_t len, string& out) {
+    ArgReader reader(args, len);
+    const char* p = format;
+    string str;
+    while(*p) {
+        const char* pct = strchr(p, '%');
+        if(!pct) {
+            out.append(p);
+            break;
+        }
+        out.append(p, pct - p);
+        p = pct + 1;
+        if(*p == '%') {
+            out += '%';
+            p++;
+            continue;
+        }
+        // 标志、宽度、精度原样保留，长度修饰按记录中的类型重新生成
+        char spec[40];
+        size_t n = 0;
+        int star[2];
+        int stars = 0;
+        spec[n++] = '%';
+        while(*p && strchr("-+ #0", *p)) {
+            if(n < 8) { spec[n++] = *p; }
+            p++;
+        }
+        for(int part = 0; part < 2; part++) {
+            if(part == 1) {
+                if(*p != '.') { break; }
+                spec[n++] = *p++;
+            }
+            if(*p == '*') {
+                int64_t v = 0;
+                reader.Integer(&v);
+                star[stars++] = (int)v;
+                spec[n++] = '*';
+                p++;
+            }
+            while(isdigit((unsigned char)*p)) {
+                if(n < 28) { spec[n++] = *p; }
+                p++;
+            }
+        }
+        while(*p && strchr("hlLqjzt", *p)) { p++; }
+        char conv = *p;
+        if(!conv) { break; }
+        p++;
+
+        int64_t iv;
+        double dv;
+        switch(conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c': {
+            char tag = reader.Tag();
+            if(!reader.Integer(&iv)) {
+                out += '?';
+                reader.Skip();
+            } else if(tag == INT || conv == 'c') {
+                spec[n++] = conv; spec[n] = '\0';
+                AppendSpec(out, spec, star, stars, (int)iv);
+            } else {
+                spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = conv; spec[n] = '\0';
+                AppendSpec(out, spec, star, stars, (long long)iv);
+            }
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            if(reader.Double(&dv)) {
+                spec[n++] = conv; spec[n] = '\0';
+                AppendSpec(out, spec, star, stars, dv);
+            } else {
+                out += '?';
+                reader.Skip();
+            }
+            break;
+        case 's':
+            if(reader.String(&str)) {
+                spec[n++] = conv; spec[n] = '\0';
+                AppendSpec(out, spec, star, stars, str.c_str());
+            } else {
+                out += '?';
+                reader.Skip();
+            }
+            break;
+        case 'p':
+            if(reader.Integer(&iv)) {
+                spec[n++] = conv; spec[n] = '\0';
+                AppendSpec(out, spec, star, stars, (void*)(uintptr_t)iv);
+            } else {
+                out += '?';
+                reader.Skip();
+            }
+            break;
+        case 'n':
+            reader.Skip(); // 不输出，参数也不用
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void LogRecord::BoundedStrings(const char* format, Bounds* bounds) {
+    for(int i = 0; i < Bounds::MAX_ARGS; i++) {
+        bounds->precision[i] = -1;
+    }
+    int index = 0;
+    for(const char* p = strchr(format, '%'); p; p = strchr(p, '%')) {
+        p++;
+        if(*p == '%') {
+            p++;
+            continue;
+        }
+        int32_t precision = -1;
+        while(*p && strchr("-+ #0", *p)) { p++; }
+        if(*p == '*') { index++; p++; }
+        while(isdigit((unsigned char)*p)) { p++; }
+        if(*p == '.') {
+            p++;
+            precision = 0; // "%.s"的精度是0
+            if(*p == '*') { index++; p++; precision = Bounds::STAR; }
+            while(isdigit((unsigned char)*p)) {
+                // 超过记录上限的精度不起作用，不用继续累加
+                if(precision >= 0 && precision < (int32_t)MAX_SIZE) {
+                    precision = precision * 10 + (*p - '0');
+                }
+                p++;
+            }
+        }
+        while(*p && strchr("hlLqjzt", *p)) { p++; }
+        if(!*p) { break; }
+        if(*p == 's' && index < Bounds::MAX_ARGS) {
+            bounds->precision[index] = precision;
+        }
+        index++;
+        p++;
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <string>
+#include <cstddef>
+#include <type_traits>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// 二进制日志记录：DEFERRED/BINARY模式下LOG_*只保存格式串编号和参数的原始值，
+// 由刷写线程(或logdecode工具)按格式串还原为文本。记录按本机字节序保存，只在同一种机器上解码
+//   记录 = Head + 参数；每个参数是1字节类型标记加上值，字符串是2字节长度加上内容(不含'\0')
+//   二进制日志文件 = FILE_MAGIC + 记录；文件中还有格式串定义(DEF_ID)和已格式化的文本(TEXT_ID)
+class LogRecord {
+public:
+    struct Head {
+        uint32_t size; // 整个记录的字节数，含头部
+        uint32_t id; // 格式串编号
+        uint64_t usec; // 时间(微秒)
+        int32_t level;
+        uint32_t argc;
+    };
+
+    enum {
+        TEXT_ID = 0, // 内容是已经格式化好的文本(含换行)
+        DEF_ID = 0xFFFFFFFF, // 格式串定义：uint32编号、int32行号、源文件名'\0'、格式串'\0'
+    };
+
+    enum Tag {
+        INT = 'i', // 不超过32位的整数(包括char、bool、枚举)
+        LONG = 'l', // 64位整数
+        DOUBLE = 'd',
+        STRING = 's',
+        POINTER = 'p',
+    };
+
+    static const size_t MAX_SIZE = 4096; // 一条记录的上限，超长的字符串被截断
+    static const char FILE_MAGIC[8];
+
+    // 每个线程(或解码器)按秒缓存已经格式化好的日期和时间
+    struct TimeCache {
+        time_t sec = -1;
+        struct tm t;
+        char text[32];
+        size_t len = 0;
+    };
+    // 在buf中生成"日期 时间.微秒 [级别]: "前缀，返回长度(buf至少64字节)
+    static size_t Prefix(char* buf, uint64_t usec, int level, TimeCache& cache);
+
+    // 按格式串和记录中的参数生成消息追加到out；参数类型与格式不符时输出'?'
+    static void Format(const char* format, const char* args, size_t len, std::string& out);
+
+    // 格式串中各个参数对应的%s精度(第i项表示第i个参数)："%.Ns"是N，"%.*s"是STAR(由前一个参数限定)，
+    // 其余是-1；有精度的字符串记录时按精度截取，和vsnprintf一样不要求以'\0'结尾
+    struct Bounds {
+        enum { MAX_ARGS = 64, STAR = -2 };
+        int32_t precision[MAX_ARGS];
+    };
+    static void BoundedStrings(const char* format, Bounds* bounds);
+
+    // 在调用线程中把参数编码为一条记录
+    class Writer {
+    public:
+        Writer(char* buf, const Bounds& bounds) : buf_(buf), pos_(sizeof(Head)), argc_(0),
+            last_(0), bounds_(&bounds) {}
+
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+        Put(T value) {
+            if(sizeof(T) <= 4) {
+                int32_t v = (int32_t)value;
+                Scalar_(INT, &v, sizeof(v));
+            } else {
+                int64_t v = (int64_t)value;
+                Scalar_(LONG, &v, sizeof(v));
+            }
+            last_ = (int64_t)value;
+        }
+        void Put(double value) { Scalar_(DOUBLE, &value, sizeof(value)); }
+        void Put(const char* s);
+        void Put(char* s) { Put((const char*)s); }
+        void Put(std::nullptr_t) { Put((const char*)nullptr); }
+        template<typename T>
+        void Put(const T* p) {
+            uint64_t v = (uint64_t)(uintptr_t)p;
+            Scalar_(POINTER, &v, sizeof(v));
+        }
+
+        // 填写头部，返回记录的长度
+        size_t Finish(int level, uint32_t id, uint64_t usec);
+
+    private:
+        void Scalar_(char tag, const void* value, size_t len) {
+            if(pos_ + 1 + len > MAX_SIZE) { return; } // 放不下的参数丢弃，解码时输出'?'
+            buf_[pos_] = tag;
+            memcpy(buf_ + pos_ + 1, value, len);
+            pos_ += 1 + len;
+            argc_++;
+        }
+
+        char* buf_;
+        size_t pos_;
+        uint32_t argc_;
+        int64_t last_; // 上一个整数参数，"%.*s"的长度
+        const Bounds* bounds_;
+    };
+};
+
+#endif //LOG_RECORD_H
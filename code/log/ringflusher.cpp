@@ -0,0 +1,231 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "ringflusher.h"
+
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+RingFlusher::Ring::Ring(size_t cap, int k) : data(new char[cap]), capacity(cap), head(0), lines(0),
+    waits(0), closed(false), kind(k), tail(0), drainHead(0) {
+    assert((cap & (cap - 1)) == 0);
+}
+
+RingFlusher::Ring::~Ring() {
+    delete[] data;
+}
+
+RingFlusher::Holder::~Holder() {
+    if(ring) {
+        ring->closed.store(true, memory_order_release);
+    }
+}
+
+RingFlusher::RingFlusher(size_t ringSize) : ringSize_(ringSize), spaceWaiters_(0), sleeping_(false),
+    stop_(false), intervalMs_(0), wakeBytes_(0), drainRounds_(0), flushTarget_(0),
+    retiredLines_(0), retiredWaits_(0), wakeCount_(0) {}
+
+RingFlusher::~RingFlusher() {
+    Stop();
+    // 仍在运行的线程退出时还会标记自己的环，只释放已经关闭的
+    for(Ring* ring : rings_) {
+        if(ring->closed) {
+            delete ring;
+        }
+    }
+}
+
+void RingFlusher::Start(const Drainer& drainer) {
+    if(thread_) {
+        return;
+    }
+    drainer_ = drainer;
+    stop_ = false;
+    thread_.reset(new thread(&RingFlusher::Loop_, this));
+}
+
+void RingFlusher::Stop() {
+    if(!thread_) {
+        return;
+    }
+    {
+        lock_guard<mutex> locker(flushMtx_);
+        stop_ = true;
+        flushCond_.notify_one();
+        spaceCond_.notify_all();
+    }
+    // 写线程写完所有环之后才退出
+    thread_->join();
+    thread_.reset();
+}
+
+RingFlusher::Ring* RingFlusher::Local(Holder& holder, int kind) {
+    if(!holder.ring) {
+        holder.ring = new Ring(ringSize_, kind);
+        lock_guard<mutex> locker(ringMtx_);
+        rings_.push_back(holder.ring);
+    }
+    return holder.ring;
+}
+
+void RingFlusher::Push(Ring* ring, const char* data, size_t len) {
+    size_t head = ring->head.load(memory_order_relaxed);
+    size_t cap = ring->capacity;
+    size_t pending = head - ring->tail.load(memory_order_acquire);
+    if(cap - pending < len) {
+        // 环满：唤醒写线程，等它腾出空间(不丢数据)；
+        // 先让出几次CPU，仍然没有空间时在spaceCond_上阻塞，写线程每写完一轮唤醒
+        ring->waits.fetch_add(1, memory_order_relaxed);
+        for(int spin = 0; cap - pending < len; spin++) {
+            if(stop_) { return; } // 写线程已经停止，丢弃
+            if(spin < FULL_SPINS) {
+                Notify_();
+                this_thread::yield();
+            } else {
+                unique_lock<mutex> locker(flushMtx_);
+                spaceWaiters_++;
+                flushCond_.notify_one();
+                spaceCond_.wait(locker, [&] {
+                    return stop_ || cap - (head - ring->tail.load(memory_order_acquire)) >= len;
+                });
+                spaceWaiters_--;
+            }
+            pending = head - ring->tail.load(memory_order_acquire);
+        }
+    }
+    size_t pos = head & (cap - 1);
+    size_t first = min(len, cap - pos);
+    memcpy(ring->data + pos, data, first);
+    if(first < len) {
+        memcpy(ring->data, data + first, len - first);
+    }
+    ring->lines.store(ring->lines.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    ring->head.store(head + len, memory_order_release);
+    // 攒批：只在积压刚达到阈值时唤醒，其余的等写线程按间隔醒来一起写
+    size_t threshold = Threshold_();
+    if(threshold == 0 || (pending < threshold && pending + len >= threshold)) {
+        Notify_();
+    }
+}
+
+void RingFlusher::Notify_() {
+    // 与写线程设置sleeping_后再检查各环的顺序配对，保证不会漏掉唤醒
+    atomic_thread_fence(memory_order_seq_cst);
+    if(sleeping_.load(memory_order_relaxed)) {
+        lock_guard<mutex> locker(flushMtx_);
+        flushCond_.notify_one();
+        wakeCount_++;
+    }
+}
+
+void RingFlusher::flush() {
+    if(!thread_) {
+        return;
+    }
+    // 等写线程完整地跑完一轮(开始于调用之后)，调用之前提交的数据都已写出
+    unique_lock<mutex> locker(flushMtx_);
+    uint64_t target = drainRounds_ + 2;
+    flushTarget_ = max(flushTarget_, target);
+    flushCond_.notify_one();
+    drainedCond_.wait(locker, [&] { return drainRounds_ >= target || stop_; });
+}
+
+void RingFlusher::SetPolicy(int intervalMs, size_t bytes) {
+    intervalMs_ = intervalMs > 0 ? intervalMs : 0;
+    wakeBytes_ = bytes;
+    lock_guard<mutex> locker(flushMtx_);
+    flushCond_.notify_one(); // 按新的间隔重新等待
+}
+
+size_t RingFlusher::Threshold_() const {
+    return intervalMs_ > 0 ? wakeBytes_.load() : 0;
+}
+
+bool RingFlusher::Pending_(size_t bytes) {
+    lock_guard<mutex> locker(ringMtx_);
+    for(Ring* ring : rings_) {
+        size_t pending = ring->head.load(memory_order_acquire) - ring->tail.load(memory_order_relaxed);
+        if(pending > 0 && pending >= bytes) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RingFlusher::Release_() {
+    lock_guard<mutex> locker(ringMtx_);
+    for(size_t i = 0; i < rings_.size(); ) {
+        Ring* ring = rings_[i];
+        if(ring->closed.load(memory_order_acquire) &&
+           ring->head.load(memory_order_acquire) == ring->tail.load(memory_order_relaxed)) {
+            retiredLines_ += ring->lines;
+            retiredWaits_ += ring->waits;
+            delete ring;
+            rings_[i] = rings_.back();
+            rings_.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+void RingFlusher::Loop_() {
+    while(true) {
+        {
+            lock_guard<mutex> locker(ringMtx_);
+            draining_ = rings_;
+        }
+        size_t n = drainer_(draining_);
+        bool closed = false;
+        for(Ring* ring : draining_) {
+            closed = closed || ring->closed.load(memory_order_relaxed);
+        }
+        draining_.clear();
+        if(closed) {
+            Release_();
+        }
+        unique_lock<mutex> locker(flushMtx_);
+        drainRounds_++;
+        drainedCond_.notify_all();
+        if(spaceWaiters_ > 0) {
+            spaceCond_.notify_all(); // 环满而阻塞的线程
+        }
+        if(stop_) {
+            if(n > 0) {
+                continue; // 退出前把剩下的写完
+            }
+            break;
+        }
+        // 写完一批后等一个攒批间隔，积压达到阈值或flush()时提前醒来；
+        // 不攒批时写的过程中可能又有新的数据，直接再写一轮
+        int interval = intervalMs_;
+        if(interval <= 0) {
+            interval = IDLE_WAIT_MS;
+        }
+        size_t threshold = Threshold_();
+        if((n > 0 && threshold == 0) || drainRounds_ < flushTarget_) {
+            continue;
+        }
+        sleeping_.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(!Pending_(threshold)) {
+            flushCond_.wait_for(locker, chrono::milliseconds(interval));
+        }
+        sleeping_.store(false, memory_order_relaxed);
+    }
+}
+
+void RingFlusher::Counts(size_t* rings, uint64_t* lines, uint64_t* waits) {
+    *lines = retiredLines_;
+    *waits = retiredWaits_;
+    lock_guard<mutex> locker(ringMtx_);
+    *rings = rings_.size();
+    for(Ring* ring : rings_) {
+        *lines += ring->lines;
+        *waits += ring->waits;
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef RING_FLUSHER_H
+#define RING_FLUSHER_H
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+// 每个线程一个环(单生产者单消费者，无锁)，唯一的写线程按间隔批量取出所有环中的数据；
+// Log和AccessLogWriter共用：环的登记和释放、环满时的等待、写线程的攒批和flush()的握手都在这里，
+// 取出的数据怎么写(解码、writev、切换文件)由使用者传入的Drainer决定
+class RingFlusher {
+public:
+    // 生产者只推进head，写线程只推进tail，head和tail只增不减，对容量取模得到位置；
+    // 整条写完才推进head，写线程不会看到半条
+    struct Ring {
+        Ring(size_t capacity, int kind);
+        ~Ring();
+
+        char* data;
+        size_t capacity; // 2的幂
+        std::atomic<size_t> head; // 已提交的字节数
+        std::atomic<uint64_t> lines; // 已提交的条数
+        std::atomic<uint64_t> waits; // 环满时等待的次数
+        std::atomic<bool> closed; // 线程已退出，写完剩余数据后释放
+        int kind; // 使用者区分环中数据的类型(Log的文本行和LogRecord记录)
+        char pad[64]; // 生产者和消费者各自修改的字段不在同一个缓存行
+        std::atomic<size_t> tail; // 已写出的字节数
+        size_t drainHead; // 只由写线程使用：本轮写到的位置
+    };
+    // 使用者的线程局部对象，线程退出时把环标记为closed
+    struct Holder {
+        Ring* ring = nullptr;
+        ~Holder();
+    };
+    // 写线程每轮调用一次：写出rings中[tail, head)的数据并推进tail，返回写出的字节数；
+    // 没有数据时也会调用(按时间切换文件等)
+    typedef std::function<size_t(std::vector<Ring*>& rings)> Drainer;
+
+    explicit RingFlusher(size_t ringSize);
+    ~RingFlusher();
+
+    // 启动写线程；Stop之后可以再次Start
+    void Start(const Drainer& drainer);
+    // 写完所有环之后停止写线程
+    void Stop();
+    bool IsRunning() const { return thread_ != nullptr; }
+
+    // 当前线程在holder中的环，第一次调用时创建并登记
+    Ring* Local(Holder& holder, int kind = 0);
+    // 放入一条(len不超过环的容量)：环满时唤醒写线程，短暂让出CPU后阻塞等待，写线程每写完一轮唤醒；
+    // 停止时丢弃
+    void Push(Ring* ring, const char* data, size_t len);
+    // 等待调用之前提交的数据全部写出
+    void flush();
+
+    // 攒批：写线程每intervalMs毫秒写一次，某个环的积压达到bytes时提前唤醒；
+    // intervalMs为0时每条都唤醒写线程(不攒批)
+    void SetPolicy(int intervalMs, size_t bytes);
+    int IntervalMs() const { return intervalMs_; }
+    size_t WakeBytes() const { return wakeBytes_; }
+
+    // 统计：登记的环数，所有环(含已释放的)的条数和环满等待次数，生产者唤醒写线程的次数
+    void Counts(size_t* rings, uint64_t* lines, uint64_t* waits);
+    uint64_t Wakeups() const { return wakeCount_; }
+
+private:
+    void Loop_(); // 写线程
+    void Notify_();
+    bool Pending_(size_t bytes); // 是否有环中没写出的数据达到bytes(0表示有数据即可)
+    size_t Threshold_() const; // 提前唤醒写线程的积压字节数，0表示每条都唤醒
+    void Release_(); // 释放线程已经退出且数据已经写完的环
+
+    static const int IDLE_WAIT_MS = 100; // 不攒批时写线程空闲的最长等待(没有新数据时也定期检查退出)
+    static const int FULL_SPINS = 16; // 环满时先让出CPU的次数，之后阻塞等待
+
+    const size_t ringSize_;
+    Drainer drainer_;
+
+    std::mutex ringMtx_; // 保护rings_的登记和释放
+    std::vector<Ring*> rings_;
+    std::vector<Ring*> draining_; // 写线程本轮处理的环(rings_的副本)
+
+    std::mutex flushMtx_; // 写线程和唤醒它的生产者之间的条件变量
+    std::condition_variable flushCond_; // 有新数据或要退出
+    std::condition_variable drainedCond_; // 一轮写完，flush()在这上面等待
+    std::condition_variable spaceCond_; // 一轮写完，环满的生产者在这上面等待
+    int spaceWaiters_; // 在spaceCond_上等待的生产者数，在flushMtx_内读写
+    std::atomic<bool> sleeping_; // 写线程正在(或即将)等待，生产者提交后需要唤醒
+    std::atomic<bool> stop_;
+    std::atomic<int> intervalMs_;
+    std::atomic<size_t> wakeBytes_;
+    uint64_t drainRounds_; // 写线程完成的轮数，flush()等它前进
+    uint64_t flushTarget_; // flush()等待的轮数，没到之前写线程不攒批
+    std::unique_ptr<std::thread> thread_;
+
+    std::atomic<uint64_t> retiredLines_; // 已释放的环的条数
+    std::atomic<uint64_t> retiredWaits_; // 已释放的环的等待次数
+    std::atomic<uint64_t> wakeCount_;
+};
+
+#endif //RING_FLUSHER_H
@@ -0,0 +1,52 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-04
+ * @copyleft Apache 2.0
+ */
+#include "stats.h"
+
+using namespace std;
+
+const char* Stats::PATH = "/server-status";
+
+Stats* Stats::Instance() {
+    static Stats inst;
+    return &inst;
+}
+
+void Stats::Register(const string& module, const Provider& provider) {
+    lock_guard<mutex> locker(mtx_);
+    // 同一个模块重复注册时替换旧的输出函数
+    for(auto& item: providers_) {
+        if(item.first == module) {
+            item.second = provider;
+            return;
+        }
+    }
+    providers_.push_back({ module, provider });
+}
+
+string Stats::Dump() {
+    lock_guard<mutex> locker(mtx_);
+    string out;
+    for(auto& item: providers_) {
+        item.second(out);
+    }
+    return out;
+}
+
+vector<Stats::Provider> Stats::Providers() {
+    lock_guard<mutex> locker(mtx_);
+    vector<Provider> providers;
+    for(auto& item: providers_) {
+        providers.push_back(item.second);
+    }
+    return providers;
+}
+
+void Stats::Line(string& out, const char* name, uint64_t value) {
+    out += name;
+    out += ' ';
+    out += to_string(value);
+    out += '\n';
+}
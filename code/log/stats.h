@@ -0,0 +1,39 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-04
+ * @copyleft Apache 2.0
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+
+// 运行状态统计：各模块注册自己的计数输出函数，通过 GET /server-status 以文本形式导出
+// 每行一个 "名称 数值"
+class Stats {
+public:
+    typedef std::function<void(std::string&)> Provider;
+
+    static Stats* Instance();
+
+    void Register(const std::string& module, const Provider& provider);
+
+    std::string Dump();
+    // 当前注册的输出函数的副本，供逐个模块分段输出
+    std::vector<Provider> Providers();
+
+    static void Line(std::string& out, const char* name, uint64_t value);
+
+    static const char* PATH; // 状态页的请求路径
+
+private:
+    Stats() = default;
+
+    std::mutex mtx_;
+    std::vector<std::pair<std::string, Provider>> providers_;
+};
+
+#endif //STATS_H
@@ -6,14 +6,33 @@
 #include <unistd.h>
 #include "server/webserver.h"
 
-int main() {
+int main(int argc, char* argv[]) {
     /* 守护进程 后台运行 */
     //daemon(1, 0); 
 
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 1, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        argc > 1 ? argv[1] : nullptr);     /* 资源包(可选，不指定时直接读取resources目录) */
+    server.SetKeepAlive(15000, 100);             /* 空闲连接超时ms 每个连接最多请求数 */
+    server.SetWritePolicy(256 * 1024, true, 0);  /* 每轮写出上限 剩余最少优先 每连接限速(0不限) */
+    server.SetHeartbeat(30000);                  /* WebSocket/SSE空闲心跳间隔ms */
+    server.SetMemoryLimit(1024 * 1024 * 1024);   /* 缓冲区、缓存、推送队列的内存上限(0不限制) */
+    server.SetLogMode(Log::DEFERRED, 20, 16 * 1024); /* 日志在刷写线程格式化(BINARY写二进制) 攒批间隔ms 提前写的积压字节 */
+    /* 反向代理示例：/api开头的请求转发给两个上游，活跃连接少的优先，每2秒检查一次/health */
+    // server.AddProxy("/api", {"127.0.0.1:8081", "127.0.0.1:8082"}, ProxyRoute::LEAST_CONN);
+    // server.SetProxyHealthCheck("/health", 2000);
+    /* 访问日志示例：Combined格式，64MB或一天切换，切换下来的文件用gzip压缩(只启用AccessLog中间件时写入运行日志) */
+    // server.SetAccessLog("./log/access.log", AccessLogWriter::COMBINED, 64 << 20, 86400, AccessLogWriter::GZIP);
+    /* 中间件示例：每个地址每秒100个请求(突发50)，/server-status需要认证 */
+    // ServerPipeline* pipeline = ServerPipeline::Instance();
+    // pipeline->Get<RateLimit>().Configure(100, 50);
+    // pipeline->Get<BasicAuth>().Protect("/server-status", "status", "admin:admin");
+    // pipeline->Get<ResponseHeaders>().Add("X-Content-Type-Options", "nosniff");
+#ifdef USE_TLS
+    server.SetTls(1317, "./cert/server.crt", "./cert/server.key"); /* HTTPS端口 证书 私钥(make cert生成自签名证书) */
+#endif
     server.Start();
 } 
   
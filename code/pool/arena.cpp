@@ -0,0 +1,113 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+using namespace std;
+
+Arena::Arena(size_t blockSize) : cur_(0), ptr_(nullptr), end_(nullptr) {
+    blockSize_ = ChunkPool::ChunkSize(blockSize);
+    assert(blockSize_ > 0);
+}
+
+Arena::~Arena() {
+    for(const Block& block : blocks_) {
+        Free_(block);
+    }
+}
+
+void* Arena::Allocate(size_t bytes, size_t align) {
+    char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~(uintptr_t)(align - 1));
+    if(ptr_ && p + bytes <= end_) {
+        ptr_ = p + bytes;
+        return p;
+    }
+    return AllocateSlow_(bytes, align);
+}
+
+void* Arena::AllocateSlow_(size_t bytes, size_t align) {
+    // 先用Reset时保留下来的后续块，不够时再取新块；超过块大小的分配单独取一块
+    while(cur_ + 1 < blocks_.size()) {
+        cur_++;
+        ptr_ = blocks_[cur_].data;
+        end_ = ptr_ + blocks_[cur_].size;
+        char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~(uintptr_t)(align - 1));
+        if(p + bytes <= end_) {
+            ptr_ = p + bytes;
+            return p;
+        }
+    }
+    Block block;
+    size_t need = bytes + align;
+    block.size = need <= blockSize_ ? blockSize_ : ChunkPool::ChunkSize(need);
+    if(block.size == 0) {
+        block.size = need; // 超过池中最大的块，直接malloc
+    }
+    if(ChunkPool::ChunkSize(block.size) == block.size) {
+        block.data = ChunkPool::Instance()->Acquire(block.size);
+    } else {
+        block.data = static_cast<char*>(malloc(block.size));
+    }
+    blocks_.push_back(block);
+    cur_ = blocks_.size() - 1;
+    ptr_ = block.data;
+    end_ = block.data + block.size;
+    char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~(uintptr_t)(align - 1));
+    ptr_ = p + bytes;
+    return p;
+}
+
+char* Arena::Copy(const char* data, size_t len) {
+    char* p = static_cast<char*>(Allocate(len + 1, 1));
+    memcpy(p, data, len);
+    p[len] = '\0';
+    return p;
+}
+
+void Arena::Reset() {
+    size_t keep = 0;
+    for(size_t i = 0; i < blocks_.size(); i++) {
+        // 只保留普通大小的块，为某个大请求单独分配的块还回去
+        if(keep < KEEP_BLOCKS && blocks_[i].size == blockSize_) {
+            blocks_[keep++] = blocks_[i];
+        } else {
+            Free_(blocks_[i]);
+        }
+    }
+    blocks_.resize(keep);
+    cur_ = 0;
+    ptr_ = keep > 0 ? blocks_[0].data : nullptr;
+    end_ = keep > 0 ? ptr_ + blocks_[0].size : nullptr;
+}
+
+size_t Arena::Used() const {
+    size_t used = 0;
+    for(size_t i = 0; i < cur_ && i < blocks_.size(); i++) {
+        used += blocks_[i].size;
+    }
+    if(cur_ < blocks_.size()) {
+        used += ptr_ - blocks_[cur_].data;
+    }
+    return used;
+}
+
+size_t Arena::Capacity() const {
+    size_t total = 0;
+    for(const Block& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+void Arena::Free_(const Block& block) {
+    if(ChunkPool::ChunkSize(block.size) == block.size) {
+        ChunkPool::Instance()->Release(block.data, block.size);
+    } else {
+        free(block.data);
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "../buffer/chunkpool.h"
+
+// 请求作用域的内存：只移动指针分配，不单独释放，Reset时整体回到开头
+// 块来自ChunkPool(按线程缓存)，Reset保留前几块供下一个请求使用，稳定后每个请求不再调用malloc
+class Arena {
+public:
+    explicit Arena(size_t blockSize = ChunkPool::MIN_CHUNK);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+    // 拷贝len字节并补上'\0'
+    char* Copy(const char* data, size_t len);
+    // 回到第一块的开头，多出的块还给池
+    void Reset();
+
+    size_t Used() const; // 已分配的字节数
+    size_t Capacity() const; // 持有的块的总大小
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    void* AllocateSlow_(size_t bytes, size_t align);
+    static void Free_(const Block& block);
+
+    size_t blockSize_;
+    std::vector<Block> blocks_;
+    size_t cur_; // 正在使用的块
+    char* ptr_;
+    char* end_;
+
+    static const size_t KEEP_BLOCKS = 2; // Reset后保留的块数
+};
+
+#endif //ARENA_H
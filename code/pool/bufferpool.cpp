@@ -0,0 +1,39 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-13
+ * @copyleft Apache 2.0
+ */
+#include "bufferpool.h"
+
+BufferPool* BufferPool::Instance() {
+    static BufferPool pool;
+    return &pool;
+}
+
+BufferPool::BufferPtr BufferPool::Acquire() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(!free_.empty()) {
+            BufferPtr buff = std::move(free_.back());
+            free_.pop_back();
+            return buff;
+        }
+    }
+    return BufferPtr(new std::string());
+}
+
+void BufferPool::Release(BufferPtr buff) {
+    if(!buff || buff->capacity() > MAX_CAPACITY) {
+        return;
+    }
+    buff->clear(); // 只清空内容，保留容量
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(free_.size() < MAX_FREE) {
+        free_.push_back(std::move(buff));
+    }
+}
+
+size_t BufferPool::FreeCount() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return free_.size();
+}
@@ -0,0 +1,36 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-13
+ * @copyleft Apache 2.0
+ */
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 可复用的消息缓冲：归还时保留已分配的容量放回空闲链表，
+// 下一个消息直接使用，不必重新分配并随着追加逐步扩容
+class BufferPool {
+public:
+    typedef std::unique_ptr<std::string> BufferPtr;
+
+    static BufferPool* Instance();
+
+    BufferPtr Acquire(); // 内容为空，容量可能来自之前的消息
+    void Release(BufferPtr buff);
+    size_t FreeCount();
+
+private:
+    BufferPool() = default;
+
+    std::mutex mtx_;
+    std::vector<BufferPtr> free_;
+
+    static const size_t MAX_FREE = 256; // 空闲链表的最大长度
+    static const size_t MAX_CAPACITY = 256 * 1024; // 容量更大的缓冲直接释放，不长期占用内存
+};
+
+#endif //BUFFERPOOL_H
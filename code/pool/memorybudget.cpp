@@ -0,0 +1,94 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#include "memorybudget.h"
+
+#include "../buffer/chunkpool.h"
+#include "../log/stats.h"
+using namespace std;
+
+atomic<uint64_t> MemoryBudget::pauseCount;
+atomic<uint64_t> MemoryBudget::resumeCount;
+atomic<uint64_t> MemoryBudget::rejectCount;
+atomic<uint64_t> MemoryBudget::dropCount;
+atomic<uint64_t> MemoryBudget::shedCount;
+
+MemoryBudget* MemoryBudget::Instance() {
+    // 不析构：静态对象(缓存、日志)析构时仍然会登记
+    static MemoryBudget* budget = new MemoryBudget();
+    return budget;
+}
+
+MemoryBudget::MemoryBudget() : limit_(0) {
+    for(int i = 0; i < CATEGORY_COUNT; i++) {
+        bytes_[i] = 0;
+    }
+}
+
+const char* MemoryBudget::Name(Category category) {
+    static const char* names[CATEGORY_COUNT] = {
+        "memory_conn_buffer_bytes", "memory_content_cache_bytes", "memory_variant_cache_bytes",
+        "memory_push_queue_bytes", "memory_pool_idle_bytes" };
+    return names[category];
+}
+
+int64_t MemoryBudget::Bytes(Category category) const {
+    if(category == POOL_IDLE) {
+        // 从系统申请的块中没有被缓冲区使用的部分(全局空闲链表和各线程的缓存)
+        int64_t idle = (int64_t)ChunkPool::allocBytes - (int64_t)ChunkPool::inUseBytes;
+        return idle > 0 ? idle : 0;
+    }
+    return bytes_[category];
+}
+
+int64_t MemoryBudget::Total() const {
+    int64_t total = 0;
+    for(int i = 0; i < POOL_IDLE; i++) {
+        total += bytes_[i];
+    }
+    return total;
+}
+
+MemoryBudget::Level MemoryBudget::GetLevel() const {
+    size_t limit = limit_;
+    if(limit == 0) {
+        return NORMAL;
+    }
+    int64_t total = Total();
+    if(total >= (int64_t)limit) {
+        return CRITICAL;
+    }
+    return total >= (int64_t)(limit / 100 * HIGH_WATER) ? PRESSURE : NORMAL;
+}
+
+bool MemoryBudget::BelowLowWater() const {
+    size_t limit = limit_;
+    return limit == 0 || Total() < (int64_t)(limit / 100 * LOW_WATER);
+}
+
+size_t MemoryBudget::PauseThreshold() const {
+    switch(GetLevel()) {
+    case PRESSURE:
+        return PRESSURE_PAUSE;
+    case CRITICAL:
+        return CRITICAL_PAUSE;
+    default:
+        return 0;
+    }
+}
+
+void MemoryBudget::DumpStats(string& out) {
+    Stats::Line(out, "memory_limit_bytes", limit_);
+    Stats::Line(out, "memory_total_bytes", Total());
+    for(int i = 0; i < CATEGORY_COUNT; i++) {
+        Stats::Line(out, Name((Category)i), Bytes((Category)i));
+    }
+    Stats::Line(out, "memory_level", GetLevel());
+    Stats::Line(out, "memory_reads_paused", pauseCount);
+    Stats::Line(out, "memory_reads_resumed", resumeCount);
+    Stats::Line(out, "memory_conns_rejected", rejectCount);
+    Stats::Line(out, "memory_push_dropped", dropCount);
+    Stats::Line(out, "memory_shed", shedCount);
+}
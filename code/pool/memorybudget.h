@@ -0,0 +1,74 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+// 进程级的内存预算：连接缓冲区、内容缓存、压缩变体缓存、推送队列各自登记占用的字节数
+// 总量接近上限时由WebServer施加反压(暂停占用最多的连接的EPOLLIN)并按优先级从低到高丢弃工作，
+// 而不是等内核的OOM killer结束整个进程
+class MemoryBudget {
+public:
+    enum Category {
+        CONN_BUFFER, // 连接的读写缓冲区
+        CONTENT_CACHE, // 热点小文件缓存
+        VARIANT_CACHE, // 压缩变体缓存
+        PUSH_QUEUE, // WebSocket待发送的数据
+        POOL_IDLE, // ChunkPool中空闲的块(不登记，读取时计算；有上限且可以复用，只导出，不计入总量)
+        CATEGORY_COUNT,
+    };
+
+    enum Level {
+        NORMAL,
+        PRESSURE, // 超过高水位：回收空闲内存，暂停大连接的读
+        CRITICAL, // 超过上限：清空缓存，拒绝新连接和新的推送消息
+    };
+
+    static MemoryBudget* Instance();
+
+    // limit为0表示不限制(只统计)
+    void SetLimit(size_t limit) { limit_ = limit; }
+    size_t Limit() const { return limit_; }
+
+    // 各模块在占用变化时登记差值，可以在任何线程中调用
+    void Charge(Category category, int64_t delta) { bytes_[category] += delta; }
+    int64_t Bytes(Category category) const;
+    int64_t Total() const; // 登记的各类之和，与上限比较
+
+    Level GetLevel() const;
+    // 已经回落到低水位以下，可以恢复暂停的连接
+    bool BelowLowWater() const;
+    // 当前级别下缓冲区超过这个大小的连接暂停读，NORMAL时返回0表示不暂停
+    size_t PauseThreshold() const;
+
+    void DumpStats(std::string& out);
+
+    static const char* Name(Category category);
+
+    /* 统计 */
+    static std::atomic<uint64_t> pauseCount; // 暂停读的次数
+    static std::atomic<uint64_t> resumeCount; // 恢复读的次数
+    static std::atomic<uint64_t> rejectCount; // 内存不足时拒绝的连接数
+    static std::atomic<uint64_t> dropCount; // 内存不足时丢弃的推送消息数
+    static std::atomic<uint64_t> shedCount; // 回收缓存和空闲块的次数
+
+    static const int HIGH_WATER = 90; // 百分比，超过时进入PRESSURE
+    static const int LOW_WATER = 75; // 百分比，回落到这以下恢复暂停的连接
+    static const size_t PRESSURE_PAUSE = 64 * 1024; // PRESSURE时暂停读的连接缓冲区大小
+    static const size_t CRITICAL_PAUSE = 4 * 1024; // CRITICAL时暂停读的连接缓冲区大小
+
+private:
+    MemoryBudget();
+
+    std::atomic<size_t> limit_;
+    std::atomic<int64_t> bytes_[CATEGORY_COUNT];
+};
+
+#endif //MEMORY_BUDGET_H
@@ -34,6 +34,26 @@ bool Epoller::ModFd(int fd, uint32_t events) {
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
 
+bool Epoller::AddFd(int fd, uint32_t events, int owner) {
+    if(fd < 0 || owner < 0) return false;
+    epoll_event ev = {0};
+    ev.data.u64 = Pack_(fd, owner);
+    ev.events = events;
+    return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+}
+
+bool Epoller::ModFd(int fd, uint32_t events, int owner) {
+    if(fd < 0 || owner < 0) return false;
+    epoll_event ev = {0};
+    ev.data.u64 = Pack_(fd, owner);
+    ev.events = events;
+    return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+}
+
+uint64_t Epoller::Pack_(int fd, int owner) {
+    return (static_cast<uint64_t>(owner + 1) << 32) | static_cast<uint32_t>(fd);
+}
+
 bool Epoller::DelFd(int fd) {
     if(fd < 0) return false;
     epoll_event ev = {0};
@@ -48,10 +68,15 @@ int Epoller::Wait(int timeoutMs) {
 // 获取第i个元素的事件的描述符
 int Epoller::GetEventFd(size_t i) const {
     assert(i < events_.size() && i >= 0);
-    return events_[i].data.fd;
+    return static_cast<int>(static_cast<uint32_t>(events_[i].data.u64));
 }
 // 获取第i个元素的事件
 uint32_t Epoller::GetEvents(size_t i) const {
     assert(i < events_.size() && i >= 0);
     return events_[i].events;
-}
\ No newline at end of file
+}
+
+int Epoller::GetEventOwner(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return static_cast<int>(events_[i].data.u64 >> 32) - 1;
+}
@@ -25,6 +25,11 @@ public:
 
     bool ModFd(int fd, uint32_t events);
 
+    // 注册代理连接的上游fd：事件中同时带上所属客户端的fd，用GetEventOwner取出
+    bool AddFd(int fd, uint32_t events, int owner);
+
+    bool ModFd(int fd, uint32_t events, int owner);
+
     bool DelFd(int fd);
 
     // 调用内核检测
@@ -33,8 +38,13 @@ public:
     int GetEventFd(size_t i) const;
     // 获取事件
     uint32_t GetEvents(size_t i) const;
+    // 获取事件所属的客户端fd，不是上游fd时返回-1
+    int GetEventOwner(size_t i) const;
         
 private:
+    // data.u64低32位是fd，高32位是owner+1(普通fd为0)
+    static uint64_t Pack_(int fd, int owner);
+
     // epoll_create()创建epoll对象，返回值就是epollfd，用于操作epoll对象
     int epollFd_;
     // 检测到的事件的集合
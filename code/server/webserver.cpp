@@ -12,7 +12,7 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize, const char* resArchive):
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
             timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
     {
@@ -22,11 +22,43 @@ WebServer::WebServer(
     HttpConn::userCount = 0; // HttpConn对象用于保存连接的客户端信息，userCount
     HttpConn::srcDir = srcDir_; // srcDir
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+#ifdef USE_CORO
+    AsyncCall::SetThreads(connPoolNum); // 每个数据库连接一个后台线程执行阻塞的查询
+#endif
+    notifyFd_ = -1;
+    tlsListenFd_ = -1;
+    heartbeatMS_ = 30000;
+    shortestFirst_ = false;
+    keepAliveMS_ = 0;
+    shed_ = false;
+    lastShedMs_ = 0;
+    acceptCount_ = idleCloseCount_ = timeoutCloseCount_ = pingCloseCount_ = 0;
+    if(resArchive) {
+        // 资源包模式：启动时整体mmap，之后不再访问资源目录
+        if(!ResArchive::Instance()->Open(resArchive)) { isClose_ = true; }
+    } else {
+        VariantCache::Instance()->Init(); // 压缩变体缓存，启动后台压缩线程
+        notifyFd_ = ContentCache::Instance()->Init(srcDir_); // 热点小文件内存缓存
+    }
+    size_t immutable = HttpResponse::LoadManifest(srcDir_); // assetpipe生成的带哈希资源
+    InitHandlers_();
 
     // 初始化事件模式
     InitEventMode_(trigMode);
     // 初始化套接字socket
-    if(!InitSocket_()) { isClose_ = true;} // 如果初始化socket失败则关闭服务器
+    if(!InitSocket_(port_, &listenFd_)) { isClose_ = true;} // 如果初始化socket失败则关闭服务器
+    if(notifyFd_ >= 0) { epoller_->AddFd(notifyFd_, EPOLLIN); }
+    // 其他线程推送WebSocket消息或SSE事件时写eventfd，主线程再为对应的连接登记写事件
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ >= 0) {
+        epoller_->AddFd(wakeFd_, EPOLLIN);
+        int wakeFd = wakeFd_;
+        PushTarget::SetNotifier([wakeFd]() {
+            uint64_t one = 1;
+            ssize_t ret = ::write(wakeFd, &one, sizeof(one));
+            (void)ret;
+        });
+    }
     // 正常情况下，socket初始化成功，则开始监听描述符，注意是否有客户端连接
     // 判断是否打开日志
     if(openLog) {
@@ -40,17 +72,25 @@ WebServer::WebServer(
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
-            LOG_INFO("srcDir: %s", HttpConn::srcDir);
+            LOG_INFO("srcDir: %s", resArchive ? resArchive : HttpConn::srcDir);
+            if(immutable) { LOG_INFO("Asset manifest: %d immutable files", (int)immutable); }
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
         }
     }
 }
 
 WebServer::~WebServer() {
+    ProxyRoute::StopHealthCheck();
     close(listenFd_);
+    if(tlsListenFd_ >= 0) { close(tlsListenFd_); }
+    if(wakeFd_ >= 0) {
+        PushTarget::SetNotifier(nullptr);
+        close(wakeFd_);
+    }
     isClose_ = true;
     free(srcDir_);
     SqlConnPool::Instance()->ClosePool();
+    AccessLogWriter::Instance()->Close(); // 写完剩余的访问日志
 }
 
 // 设置监听的文件描述符和通信的文件描述符的模式
@@ -87,6 +127,217 @@ void WebServer::InitEventMode_(int trigMode) {
     HttpConn::isET = (connEvent_ & EPOLLET);
 }
 
+void WebServer::SetWritePolicy(size_t quantum, bool shortestFirst, size_t rateLimit) {
+    HttpConn::writeQuantum = std::max<size_t>(quantum, 4096);
+    HttpConn::rateLimit = rateLimit;
+    shortestFirst_ = shortestFirst;
+    LOG_INFO("Write quantum: %zu, shortest first: %s, rate limit: %zu B/s",
+             HttpConn::writeQuantum, shortestFirst ? "true" : "false", rateLimit);
+}
+
+bool WebServer::SetTls(int port, const char* certFile, const char* keyFile) {
+#ifdef USE_TLS
+    // 用户态加密时OpenSSL用write()写socket，客户端断开会触发SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    // 证书加载失败时只关闭HTTPS端口，HTTP端口照常服务
+    if(!TlsContext::Instance()->Init(certFile, keyFile) || !InitSocket_(port, &tlsListenFd_)) {
+        LOG_ERROR("TLS listener on port %d disabled", port);
+        return false;
+    }
+    return true;
+#else
+    LOG_ERROR("TLS port %d: built without USE_TLS", port);
+    return false;
+#endif
+}
+
+void WebServer::SetKeepAlive(int idleTimeoutMS, int maxRequests) {
+    keepAliveMS_ = std::max(idleTimeoutMS, 0);
+    HttpConn::maxRequests = std::max(maxRequests, 0);
+    HttpResponse::keepAliveTimeout = keepAliveMS_ / 1000;
+    LOG_INFO("Keep-alive idle timeout: %dms, max requests: %d", keepAliveMS_, HttpConn::maxRequests);
+}
+
+bool WebServer::AddProxy(const string& prefix, const vector<string>& backends, ProxyRoute::Balance balance) {
+    return ProxyRoute::Add(prefix, backends, balance);
+}
+
+void WebServer::SetProxyHealthCheck(const string& path, int intervalMS) {
+    ProxyRoute::StartHealthCheck(path, intervalMS);
+    LOG_INFO("Proxy health check: %s every %dms", path.c_str(), intervalMS);
+}
+
+void WebServer::SetLogMode(Log::Mode mode, int flushMS, size_t flushBytes) {
+    Log::Instance()->SetMode(mode);
+    Log::Instance()->SetFlushPolicy(flushMS, flushBytes);
+    LOG_INFO("Log mode: %d, flush every %dms or %zu bytes", (int)mode, flushMS, flushBytes);
+}
+
+bool WebServer::SetAccessLog(const string& path, AccessLogWriter::Format format,
+                             size_t maxBytes, int maxSeconds, AccessLogWriter::Compress compress) {
+    if(!AccessLogWriter::Instance()->Open(path, format, maxBytes, maxSeconds, compress)) {
+        return false;
+    }
+    ServerPipeline::Instance()->Get<AccessLog>().Enable(true);
+    LOG_INFO("Access log: %s, format %d, rotate at %zu bytes / %ds, compress %d",
+             path.c_str(), (int)format, maxBytes, maxSeconds, (int)compress);
+    return true;
+}
+
+void WebServer::SetMemoryLimit(size_t bytes) {
+    MemoryBudget::Instance()->SetLimit(bytes);
+    LOG_INFO("Memory limit: %zu bytes", bytes);
+}
+
+void WebServer::SetHeartbeat(int pingMS) {
+    heartbeatMS_ = std::max(pingMS, 0);
+    LOG_INFO("WebSocket/SSE heartbeat interval: %dms", heartbeatMS_);
+}
+
+void WebServer::InitHandlers_() {
+    // 连接复用统计
+    Stats::Instance()->Register("connections", [this](string& out) {
+        Stats::Line(out, "connections_accepted", acceptCount_);
+        Stats::Line(out, "connections_active", HttpConn::userCount);
+        Stats::Line(out, "requests", HttpConn::requestCount);
+        Stats::Line(out, "requests_reused", HttpConn::reuseCount);
+        Stats::Line(out, "closed_max_requests", HttpConn::maxRequestCloseCount);
+        Stats::Line(out, "closed_idle", idleCloseCount_);
+        Stats::Line(out, "closed_timeout", timeoutCloseCount_);
+    });
+    Stats::Instance()->Register("buffers", [](string& out) {
+        Stats::Line(out, "buffer_bytes_allocated", ChunkPool::allocBytes);
+        Stats::Line(out, "buffer_bytes_in_use", ChunkPool::inUseBytes);
+        Stats::Line(out, "buffer_bytes_free", ChunkPool::Instance()->FreeBytes());
+        Stats::Line(out, "buffer_chunks_acquired", ChunkPool::acquireCount);
+        Stats::Line(out, "buffer_chunks_global", ChunkPool::globalCount);
+        Stats::Line(out, "conn_memory_bytes", MemoryBudget::Instance()->Bytes(MemoryBudget::CONN_BUFFER));
+        const char* names[HttpConn::MEMORY_BUCKETS] = {
+            "conn_memory_empty", "conn_memory_le_4k", "conn_memory_le_16k", "conn_memory_le_64k", "conn_memory_gt_64k" };
+        for(int i = 0; i < HttpConn::MEMORY_BUCKETS; i++) {
+            Stats::Line(out, names[i], HttpConn::memoryConns[i]);
+        }
+    });
+    Stats::Instance()->Register("memory", [](string& out) {
+        MemoryBudget::Instance()->DumpStats(out);
+    });
+    Stats::Instance()->Register("log", [](string& out) {
+        Log::Instance()->DumpStats(out);
+    });
+    Stats::Instance()->Register("access_log", [](string& out) {
+        AccessLogWriter::Instance()->DumpStats(out);
+    });
+    Stats::Instance()->Register("http2", [](string& out) {
+        Stats::Line(out, "http2_connections", Http2Session::sessionCount);
+        Stats::Line(out, "http2_streams", Http2Session::streamCount);
+        Stats::Line(out, "http2_streams_reset", Http2Session::resetCount);
+        Stats::Line(out, "http2_goaway", Http2Session::goawayCount);
+    });
+    Stats::Instance()->Register("websocket", [this](string& out) {
+        Stats::Line(out, "websocket_connections", WebSocket::openCount);
+        Stats::Line(out, "websocket_active", WebSocket::activeCount);
+        Stats::Line(out, "websocket_messages_in", WebSocket::messageInCount);
+        Stats::Line(out, "websocket_messages_out", WebSocket::messageOutCount);
+        Stats::Line(out, "websocket_pings", WebSocket::pingCount);
+        Stats::Line(out, "websocket_closed_ping", pingCloseCount_);
+        Stats::Line(out, "websocket_buffers_free", BufferPool::Instance()->FreeCount());
+    });
+    Stats::Instance()->Register("sse", [](string& out) {
+        Stats::Line(out, "sse_subscribers", EventStream::subscriberCount);
+        Stats::Line(out, "sse_events_published", EventStream::publishCount);
+        Stats::Line(out, "sse_events_queued", EventStream::deliverCount);
+        Stats::Line(out, "sse_events_coalesced", EventStream::coalesceCount);
+        Stats::Line(out, "sse_subscribers_dropped", EventStream::dropCount);
+    });
+    Stats::Instance()->Register("proxy", [](string& out) {
+        Stats::Line(out, "proxy_requests", ProxyConn::requestCount);
+        Stats::Line(out, "proxy_errors", ProxyConn::errorCount);
+        Stats::Line(out, "proxy_retries", ProxyConn::retryCount);
+        Stats::Line(out, "proxy_splice_bytes", ProxyConn::spliceBytes);
+        ProxyRoute::Dump(out);
+    });
+#ifdef USE_CORO
+    Stats::Instance()->Register("async", [](string& out) {
+        Stats::Line(out, "async_started", AsyncCall::startCount);
+        Stats::Line(out, "async_suspends", AsyncCall::suspendCount);
+        Stats::Line(out, "async_active", AsyncCall::activeCount);
+    });
+#endif
+    Stats::Instance()->Register("middleware", [](string& out) {
+        Stats::Line(out, "middleware_rate_limited", RateLimit::rejectCount);
+        Stats::Line(out, "middleware_auth_rejected", BasicAuth::rejectCount);
+    });
+
+    // 回显：收到的消息原样发回，用于测试和示例
+    WebSocket::Handler echo;
+    echo.onMessage = [](const WebSocket::Ptr& ws, const char* data, size_t len, bool binary) {
+        ws->Send(data, len, binary);
+    };
+    WebSocket::Register("/ws/echo", echo);
+
+    // SSE示例：/ws/publish收到的文本消息广播给/events的所有订阅者
+    EventStream::Register("/events");
+    WebSocket::Handler publish;
+    publish.onMessage = [](const WebSocket::Ptr&, const char* data, size_t len, bool binary) {
+        if(!binary) { EventStream::Publish("/events", string(data, len), "message"); }
+    };
+    WebSocket::Register("/ws/publish", publish);
+
+    // 默认网页的别名：/ -> /index.html，/login -> /login.html等
+    Router* router = Router::Instance();
+    router->Alias("/", "/index.html");
+    for(const char* page: { "/index", "/register", "/login", "/welcome", "/video", "/picture" }) {
+        router->Alias(page, string(page) + ".html");
+    }
+    // 注册、登录表单：验证之后改为返回欢迎页或错误页
+    for(bool isLogin: { false, true }) {
+        router->Rewrite("POST", isLogin ? "/login.html" : "/register.html", [isLogin](HttpRequest& request) {
+            if(request.GetHeader("Content-Type") != "application/x-www-form-urlencoded") {
+                return;
+            }
+            auto start = chrono::steady_clock::now();
+            bool ok = HttpRequest::UserVerify(request.GetPost("username"), request.GetPost("password"), isLogin);
+            request.AddDbTime(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+            request.path() = ok ? "/welcome.html" : "/error.html";
+        });
+    }
+
+#ifdef USE_CORO
+    // 异步处理函数示例：等待期间不占用工作线程
+    router->AddAsync("GET", "/async/sleep/:ms", [](const HttpRequest& request) -> Task<Reply> {
+        int ms = std::min(atoi(request.Param("ms").c_str()), 10000);
+        co_await Async::Sleep(ms);
+        Reply reply;
+        reply.type = "text/plain";
+        reply.body = "slept " + to_string(ms) + "ms\n";
+        co_return reply;
+    });
+    router->AddAsync("GET", "/async/users", [](const HttpRequest&) -> Task<Reply> {
+        Async::QueryResult result = co_await Async::Query("SELECT COUNT(*) FROM user");
+        Reply reply;
+        reply.type = "text/plain";
+        if(!result.ok || result.rows.empty()) {
+            reply.code = 503;
+            reply.body = "database unavailable\n";
+        } else {
+            reply.body = "users " + result.rows[0][0] + "\n";
+        }
+        co_return reply;
+    });
+#endif
+
+    // 运行状态页：每个模块的计数作为一段发送
+    router->Add("GET", Stats::PATH, [](const HttpRequest&, string& type) -> HttpStream::Producer {
+        type = "text/plain";
+        return [providers = Stats::Instance()->Providers(), i = size_t(0)](string& chunk) mutable {
+            if(i < providers.size()) {
+                providers[i++](chunk);
+            }
+            return i < providers.size();
+        };
+    });
+}
+
 void WebServer::Start() {
     int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
     // 打印日志
@@ -98,18 +349,33 @@ void WebServer::Start() {
         // 计算剩余时间最大的节点，得到小根堆最宽裕时间的长度，返回到webserver.cpp中的Start()的epoller_->Wait(timeMs)的timeMs
         // epoll_wait参数使用timeMs，如果timeMs内没有事件发生，则解除阻塞，否则epoll_wait不设置timeout的话就不会解除阻塞，会一直等待事件发生
         // 这里的事件是DealRead_和DealWrite_，只要这些事件发生，就会解除阻塞，如果这些事件没有发生，那么就会在超时事件后解除阻塞
-        if(timeoutMS_ > 0) {
-            timeMS = timer_->GetNextTick();
+        // 限速的连接也用定时器恢复发送，所以没有设置超时也要检查定时器
+        timeMS = timer_->GetNextTick();
+        // 有因内存不足暂停读的连接时定期醒来检查，内存回落后及时恢复
+        if(HasPaused_() && (timeMS < 0 || timeMS > PAUSE_CHECK_MS)) {
+            timeMS = PAUSE_CHECK_MS;
         }
         // 通过封装的epoll_wait获取检测事件的个数
         int eventCnt = epoller_->Wait(timeMS);
+        std::vector<HttpConn*> writers; // 本轮就绪的写事件
+        bool wakeup = false;
         // 遍历事件
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
             int fd = epoller_->GetEventFd(i); // 获取fd
             uint32_t events = epoller_->GetEvents(i); // 获取事件
-            if(fd == listenFd_) {
-                DealListen_(); // 处理事件监听，建立新连接
+            int owner = epoller_->GetEventOwner(i);
+            if(owner >= 0) {
+                DealUpstream_(owner, fd); // 代理的上游连接，错误和关闭也交给代理处理
+            }
+            else if(fd == listenFd_ || fd == tlsListenFd_) {
+                DealListen_(fd); // 处理事件监听，建立新连接
+            }
+            else if(fd == notifyFd_) {
+                ContentCache::Instance()->HandleNotify(); // 资源文件被修改，使缓存失效
+            }
+            else if(fd == wakeFd_) {
+                wakeup = true; // 等本轮的事件分发完再处理
             }
             // 出现特定错误
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -124,14 +390,125 @@ void WebServer::Start() {
             // 事件不是监听的，并且是EPOLLOUT
             else if(events & EPOLLOUT) {
                 assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]); // 处理写操作
+                writers.push_back(&users_[fd]);
             } else {
                 LOG_ERROR("Unexpected event");
             }
         }
+        // 剩余最少的先发：小响应不用排在大文件传输之后
+        // EPOLLONESHOT保证此时没有工作线程在操作这些连接
+        if(shortestFirst_ && writers.size() > 1) {
+            std::stable_sort(writers.begin(), writers.end(), [](HttpConn* a, HttpConn* b) {
+                return a->ToWriteBytes() < b->ToWriteBytes();
+            });
+        }
+        for(HttpConn* client: writers) {
+            DealWrite_(client); // 处理写操作
+        }
+        // 本轮已分发给工作线程的连接不在登记状态，唤醒时不会重复登记
+        if(wakeup) {
+            DealWakeup_();
+        }
+        CheckMemory_();
     }
 }
 
+bool WebServer::HasPaused_() {
+    lock_guard<mutex> locker(pauseMtx_);
+    return !paused_.empty();
+}
+
+bool WebServer::PauseRead_(HttpConn* client) {
+    // 只暂停缓冲区超过当前级别阈值的连接：停止读就不会继续增长，空闲连接的缓冲区已经还给池，不受影响
+    size_t threshold = MemoryBudget::Instance()->PauseThreshold();
+    if(threshold == 0 || client->MemoryBytes() <= threshold) {
+        return false;
+    }
+    // 仍然登记EPOLLRDHUP，对端关闭时照常释放；登记和恢复在同一把锁内，不会覆盖主线程的恢复
+    lock_guard<mutex> locker(pauseMtx_);
+    paused_.emplace_back(client, client->Serial());
+    epoller_->ModFd(client->GetFd(), connEvent_);
+    MemoryBudget::pauseCount++;
+    LOG_WARN("Client[%d] read paused, buffer %zu bytes", client->GetFd(), client->MemoryBytes());
+    return true;
+}
+
+void WebServer::CheckMemory_() {
+    MemoryBudget* budget = MemoryBudget::Instance();
+    if(budget->Limit() == 0) {
+        return;
+    }
+    MemoryBudget::Level level = budget->GetLevel();
+    int64_t now = HttpConn::NowMs();
+    if(level != MemoryBudget::NORMAL && now - lastShedMs_ >= SHED_INTERVAL_MS) {
+        lastShedMs_ = now;
+        Shed_(level);
+    }
+    if(!budget->BelowLowWater()) {
+        return;
+    }
+    if(shed_) {
+        shed_ = false;
+        ChunkPool::Instance()->Trim(ChunkPool::MAX_FREE_BYTES);
+    }
+    lock_guard<mutex> locker(pauseMtx_);
+    for(auto& item: paused_) {
+        HttpConn* client = item.first;
+        // 暂停期间连接可能已经超时关闭，fd也可能被新连接复用
+        if(client->IsClosed() || client->Serial() != item.second) {
+            continue;
+        }
+        MemoryBudget::resumeCount++;
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+    }
+    paused_.clear();
+}
+
+void WebServer::Shed_(MemoryBudget::Level level) {
+    // 按优先级从低到高回收：池中的空闲块、可以重新压缩的变体、热点文件缓存(只在超过上限时)
+    MemoryBudget* budget = MemoryBudget::Instance();
+    int64_t before = budget->Total();
+    shed_ = true;
+    MemoryBudget::shedCount++;
+    ChunkPool::Instance()->Trim(0);
+    VariantCache* variants = VariantCache::Instance();
+    variants->Trim(level == MemoryBudget::CRITICAL ? 0 : variants->Bytes() / 2);
+    if(level == MemoryBudget::CRITICAL) {
+        ContentCache::Instance()->Trim(0);
+    }
+    LOG_WARN("Memory %s: %lld -> %lld bytes (limit %zu)", level == MemoryBudget::CRITICAL ? "critical" : "pressure",
+             (long long)before, (long long)budget->Total(), budget->Limit());
+}
+
+void WebServer::DealWakeup_() {
+    uint64_t cnt;
+    ssize_t ret = ::read(wakeFd_, &cnt, sizeof(cnt));
+    (void)ret;
+    for(const PushTarget::Ptr& target: PushTarget::TakeWakeups()) {
+        target->Wake([this](int fd) {
+            epoller_->ModFd(fd, connEvent_ | EPOLLIN | EPOLLOUT);
+        });
+    }
+#ifdef USE_CORO
+    // 异步处理函数的Sleep：到期后和后台任务完成一样经唤醒列表恢复；定时器id与超时、限速错开
+    for(auto& timer: AsyncCall::TakeTimers()) {
+        AsyncCall::Ptr call = timer.first;
+        timer_->add(call->Fd() + 2 * MAX_FD, timer.second, [call]() { call->Complete(); });
+    }
+#endif
+}
+
+void WebServer::DealUpstream_(int owner, int fd) {
+    auto it = users_.find(owner);
+    // 客户端已经关闭(上游连接随之关闭)或者已经换了上游连接的过期事件
+    if(it == users_.end() || it->second.IsClosed() || it->second.UpstreamFd() != fd) {
+        return;
+    }
+    HttpConn* client = &it->second;
+    ExtentTime_(client);
+    threadpool_->AddTask(std::bind(&WebServer::OnUpstream_, this, client));
+}
+
 void WebServer::SendError_(int fd, const char*info) {
     assert(fd > 0);
     int ret = send(fd, info, strlen(info), 0);
@@ -148,13 +525,20 @@ void WebServer::CloseConn_(HttpConn* client) {
     client->Close();
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+void WebServer::AddClient_(int fd, sockaddr_in addr, bool tls) {
     assert(fd > 0);
-    users_[fd].init(fd, addr); // users_是哈希表集合，保存的个数以及客户端信息
+    users_[fd].init(fd, addr, tls); // users_是哈希表集合，保存的个数以及客户端信息
+    if(tls && !users_[fd].IsTls()) {
+        LOG_WARN("Client[%d] TLS session create failed", fd);
+        users_[fd].Close();
+        return;
+    }
+    acceptCount_++;
     // 如果超时
-    if(timeoutMS_ > 0) {
-        // 超时则通过add调用CloseConn_断联
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+    if(TimerInterval_() > 0) {
+        // 超时则通过OnTimeout_判断是空闲超时还是请求超时，再断联
+        users_[fd].SetLastActiveMs(HttpConn::NowMs());
+        timer_->add(fd, TimerInterval_(), std::bind(&WebServer::OnTimeout_, this, &users_[fd]));
     }
     // 对新连接的客户端监听是否有数据到达，所以EPOLLIN
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
@@ -163,20 +547,26 @@ void WebServer::AddClient_(int fd, sockaddr_in addr) {
 }
 
 // 处理监听事件
-void WebServer::DealListen_() {
+void WebServer::DealListen_(int listenFd) {
     struct sockaddr_in addr; // 保存连接的客户端的信息
     socklen_t len = sizeof(addr); // 获取len，accept使用
     // 为什么先do，先获取到所有的连接客户端的描述符，再进行监听事件和ET的判断
     do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        int fd = accept(listenFd, (struct sockaddr *)&addr, &len);
         if(fd <= 0) { return;} // fd<=0，失败或断联
         else if(HttpConn::userCount >= MAX_FD) { // 连接数量>=最大预设数
             SendError_(fd, "Server busy!");
             LOG_WARN("Clients is full!");
             return;
         }
+        else if(MemoryBudget::Instance()->GetLevel() == MemoryBudget::CRITICAL) { // 内存超过预算，新连接最先被拒绝
+            MemoryBudget::rejectCount++;
+            SendError_(fd, "Server busy!");
+            LOG_WARN("Memory limit exceeded!");
+            return;
+        }
         // 添加客户端
-        AddClient_(fd, addr);
+        AddClient_(fd, addr, listenFd == tlsListenFd_);
     } while(listenEvent_ & EPOLLET); // ET模式下非阻塞
 }
 
@@ -184,6 +574,7 @@ void WebServer::DealListen_() {
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
+    client->DisarmPush();
     // 线程池添加任务，添加的是，Onread_操作
     threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
 }
@@ -191,12 +582,83 @@ void WebServer::DealRead_(HttpConn* client) {
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
+    client->DisarmPush();
+    // 超出速率的连接暂不分发，到时间后由定时器恢复；定时器id与超时定时器错开
+    int delay = client->ThrottleDelayMs();
+    if(delay > 0) {
+        timer_->add(client->GetFd() + MAX_FD, delay,
+                    std::bind(&WebServer::ResumeWrite_, this, client, client->Serial()));
+        return;
+    }
+    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+}
+
+void WebServer::ResumeWrite_(HttpConn* client, uint64_t serial) {
+    assert(client);
+    // 等待期间连接可能已关闭，fd也可能被新连接复用
+    if(client->IsClosed() || client->Serial() != serial) {
+        return;
+    }
     threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
 }
 
 void WebServer::ExtentTime_(HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(TimerInterval_() > 0) {
+        client->SetLastActiveMs(HttpConn::NowMs());
+        timer_->adjust(client->GetFd(), TimerInterval_());
+    }
+}
+
+int WebServer::TimerInterval_() const {
+    // 取各项超时中大于0的最小值
+    int interval = 0;
+    for(int ms: { timeoutMS_, keepAliveMS_, heartbeatMS_ }) {
+        if(ms > 0 && (interval == 0 || ms < interval)) { interval = ms; }
+    }
+    return interval;
+}
+
+// 主线程中的定时器回调
+// 空闲的保持连接(上一个响应已发完)超过keepAliveMS_关闭；处理中的连接超过timeoutMS_没有读写事件关闭
+void WebServer::OnTimeout_(HttpConn* client) {
+    assert(client);
+    if(client->IsClosed()) {
+        return;
+    }
+    int64_t now = HttpConn::NowMs();
+    int64_t idleSince = client->IdleSinceMs();
+    int64_t left;
+    if(client->IsPush()) {
+        // WebSocket和SSE长期空闲是正常的，用心跳检测对端是否还在
+        left = heartbeatMS_ > 0 ? client->LastActiveMs() + heartbeatMS_ - now : TimerInterval_();
+        if(left <= 0) {
+            if(!client->Heartbeat()) {
+                pingCloseCount_++;
+                CloseConn_(client);
+                return;
+            }
+            left = heartbeatMS_;
+        }
+    } else if(idleSince > 0 && keepAliveMS_ > 0) {
+        left = idleSince + keepAliveMS_ - now;
+        if(left <= 0) {
+            idleCloseCount_++;
+            CloseConn_(client);
+            return;
+        }
+    } else if(timeoutMS_ > 0) {
+        left = client->LastActiveMs() + timeoutMS_ - now;
+        if(left <= 0) {
+            timeoutCloseCount_++;
+            CloseConn_(client);
+            return;
+        }
+    } else {
+        left = keepAliveMS_; // 只限制空闲时间，连接正在处理时稍后再检查
+    }
+    timer_->add(client->GetFd(), std::min<int64_t>(left, TimerInterval_()),
+                std::bind(&WebServer::OnTimeout_, this, client));
 }
 
 // client(客户端)
@@ -217,19 +679,72 @@ void WebServer::OnRead_(HttpConn* client) {
 
 void WebServer::OnProcess(HttpConn* client) {
     // 调用client的process()处理业务逻辑
-    if(client->process()) {
+    Rearm_(client, client->process());
+}
+
+void WebServer::OnUpstream_(HttpConn* client) {
+    assert(client);
+    Rearm_(client, client->ProcessUpstream());
+}
+
+void WebServer::Rearm_(HttpConn* client, bool writing) {
+    client->UpdateMemory(); // 登记之后连接可能已经在其他线程中
+    if(client->IsPush()) {
+        // 登记事件和检查推送队列在同一把锁内，其他线程在这之后推送的数据会唤醒reactor
+        uint32_t events = connEvent_ | EPOLLIN | (writing ? EPOLLOUT : 0);
+        client->ArmPush([this, client, events](bool pending) {
+            epoller_->ModFd(client->GetFd(), events | (pending ? EPOLLOUT : 0));
+        });
+        return;
+    }
+    if(!writing && client->IsProxying()) {
+        ProxyConn::Want want = client->ProxyWant();
+        if(want == ProxyConn::UPSTREAM_READ || want == ProxyConn::UPSTREAM_WRITE) {
+            ArmUpstream_(client, client->UpstreamFd(), want == ProxyConn::UPSTREAM_WRITE);
+            return;
+        }
+    }
+    if(!writing && client->IsAsync()) {
+        bool write = false;
+        int fd = client->AsyncWaitFd(&write);
+        if(fd >= 0) {
+            ArmUpstream_(client, fd, write);
+        } else {
+            // 与推送连接一样，登记和检查事件是否已经到达在同一把锁内；等待期间不读后续的请求
+            client->ArmAsync([this, client](bool pending) {
+                epoller_->ModFd(client->GetFd(), connEvent_ | (pending ? EPOLLIN | EPOLLOUT : 0));
+            });
+        }
+        return;
+    }
+    if(writing) {
         // 修改业务逻辑成功，修改client的Fd，改为EPOLLOUT等待写，回到主线程的客户端检测，检测到写则变为OnWrite_
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-    } else {
+        // HTTP/2写响应期间还要读WINDOW_UPDATE和新的请求，同时关注EPOLLIN
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT | (client->IsHttp2() ? EPOLLIN : 0));
+    } else if(!PauseRead_(client)) {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
     }
 }
 
+void WebServer::ArmUpstream_(HttpConn* client, int fd, bool write) {
+    // 等待上游期间不登记客户端fd；上游fd登记时带上客户端fd，就绪后找到这个连接
+    uint32_t events = EPOLLONESHOT | (write ? EPOLLOUT : EPOLLIN);
+    if(!epoller_->ModFd(fd, events, client->GetFd()) &&
+       !epoller_->AddFd(fd, events, client->GetFd())) {
+        LOG_ERROR("Client[%d] upstream %d epoll error: %d", client->GetFd(), fd, errno);
+        CloseConn_(client);
+    }
+}
+
 void WebServer::OnWrite_(HttpConn* client) {
     assert(client);
     int ret = -1;
     int writeErrno = 0;
     ret = client->write(&writeErrno);
+    if(client->ToWriteBytes() == 0 && client->IsProxying() && (ret >= 0 || writeErrno == EAGAIN)) {
+        Rearm_(client, false); // 已转发的部分发完，继续等待上游或客户端
+        return;
+    }
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
         if(client->IsKeepAlive()) {
@@ -237,30 +752,31 @@ void WebServer::OnWrite_(HttpConn* client) {
             return;
         }
     }
-    else if(ret < 0) {
-        if(writeErrno == EAGAIN) {
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
-        }
+    else if(ret > 0 || writeErrno == EAGAIN) {
+        /* 继续传输(LT模式下一轮只写一部分，剩下的等下次EPOLLOUT) */
+        // HTTP/2和推送连接写的同时也要读
+        bool duplex = client->IsHttp2() || client->IsPush();
+        client->UpdateMemory();
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT | (duplex ? EPOLLIN : 0));
+        return;
     }
     CloseConn_(client);
 }
 
 /* Create listenFd */
-bool WebServer::InitSocket_() {
+bool WebServer::InitSocket_(int port, int* listenFd) {
     int ret;
     // 创建客户端信息存储的结构体
     struct sockaddr_in addr;
     // 判断端口
-    if(port_ > 65535 || port_ < 1024) {
-        LOG_ERROR("Port:%d error!",  port_);
+    if(port > 65535 || port < 1024) {
+        LOG_ERROR("Port:%d error!",  port);
         return false;
     }
     // 
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);//htonl字节序转换
-    addr.sin_port = htons(port_);
+    addr.sin_port = htons(port);
     struct linger optLinger = { 0 };
     if(openLinger_) {
         /* 优雅关闭: 直到所剩数据发送完毕或超时 */
@@ -268,52 +784,53 @@ bool WebServer::InitSocket_() {
         optLinger.l_linger = 1;
     }
     // 创建监听描述符
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
-        LOG_ERROR("Create socket error!", port_);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) {
+        LOG_ERROR("Create socket error!", port);
         return false;
     }
     // 
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
-        close(listenFd_);
-        LOG_ERROR("Init linger error!", port_);
+        close(fd);
+        LOG_ERROR("Init linger error!", port);
         return false;
     }
 
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
+        close(fd);
         return false;
     }
     // 绑定，并检测ret是否错误
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
     if(ret < 0) {
-        LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
+        LOG_ERROR("Bind Port:%d error!", port);
+        close(fd);
         return false;
     }
     // 监听
-    ret = listen(listenFd_, 6);
+    ret = listen(fd, 6);
     if(ret < 0) {
-        LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
+        LOG_ERROR("Listen port:%d error!", port);
+        close(fd);
         return false;
     }
     // 调用AddFd，
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
+    ret = epoller_->AddFd(fd,  listenEvent_ | EPOLLIN);
     if(ret == 0) {
         LOG_ERROR("Add listen error!");
-        close(listenFd_);
+        close(fd);
         return false;
     }
     // 设置非阻塞
-    SetFdNonblock(listenFd_);
-    LOG_INFO("Server port:%d", port_);
+    SetFdNonblock(fd);
+    LOG_INFO("Server port:%d", port);
+    *listenFd = fd;
     return true;
 }
 
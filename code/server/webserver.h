@@ -11,17 +11,22 @@
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>      // signal()
 #include <sys/socket.h>
+#include <sys/eventfd.h> // eventfd()
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "epoller.h"
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
 #include "../http/httpconn.h"
+#include "../cache/contentcache.h"
+#include "../log/stats.h"
 
 class WebServer {
 public:
@@ -30,38 +35,100 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        const char* resArchive = nullptr);
 
     // 析构函数
     ~WebServer();
     void Start();
 
+    // 写调度策略(在Start之前调用)：quantum为每轮最多写出的字节数；
+    // shortestFirst为true时，同一轮就绪的写事件按剩余字节数从少到多分发；
+    // rateLimit为每个连接的发送速率上限(字节/秒)，0表示不限速
+    void SetWritePolicy(size_t quantum, bool shortestFirst, size_t rateLimit);
+    // 保持连接的限制(在Start之前调用)：空闲超过idleTimeoutMS毫秒关闭，
+    // 每个连接最多处理maxRequests个请求；0表示不限制
+    void SetKeepAlive(int idleTimeoutMS, int maxRequests);
+    // 在port上开启HTTPS(在Start之前调用，需要以USE_TLS编译)
+    bool SetTls(int port, const char* certFile, const char* keyFile);
+    // WebSocket/SSE连接没有读写超过pingMS毫秒时发送心跳(ping或注释行)，
+    // WebSocket下一次检查时还没有回应则关闭；0表示不发送
+    void SetHeartbeat(int pingMS);
+    // 反向代理(在Start之前调用)：目标以prefix开头的请求按balance转发给backends("host:port")之一
+    bool AddProxy(const std::string& prefix, const std::vector<std::string>& backends,
+                  ProxyRoute::Balance balance = ProxyRoute::ROUND_ROBIN);
+    // 每intervalMS毫秒请求一次各个上游的path，连续失败的上游暂停分配请求
+    void SetProxyHealthCheck(const std::string& path, int intervalMS);
+    // 连接缓冲区、缓存和推送队列合计的内存上限，0表示不限制；接近上限时暂停读大连接并丢弃低优先级的工作
+    void SetMemoryLimit(size_t bytes);
+    // 日志格式化的位置：TEXT在工作线程，DEFERRED在刷写线程，BINARY写二进制记录(logdecode解码)；
+    // 刷写线程每flushMS毫秒写一批，某个线程积压flushBytes字节时提前写，flushMS为0时每行都唤醒刷写线程
+    void SetLogMode(Log::Mode mode, int flushMS, size_t flushBytes);
+    // 访问日志(在Start之前调用)：每个请求一行写入path，反向代理的请求也记录；
+    // 文件达到maxBytes字节或已写maxSeconds秒时改名切换(0表示不按该条件)，切换下来的文件在后台压缩
+    bool SetAccessLog(const std::string& path, AccessLogWriter::Format format,
+                      size_t maxBytes, int maxSeconds, AccessLogWriter::Compress compress);
+
 private:
-    bool InitSocket_(); 
+    bool InitSocket_(int port, int* listenFd); 
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
+    void InitHandlers_(); // 注册动态处理函数和运行状态输出
+    void AddClient_(int fd, sockaddr_in addr, bool tls);
   
-    void DealListen_();
+    void DealListen_(int listenFd);
     void DealWrite_(HttpConn* client);
     void DealRead_(HttpConn* client);
+    void ResumeWrite_(HttpConn* client, uint64_t serial); // 限速等待结束，继续发送
+    void DealWakeup_(); // 其他线程向空闲的推送连接推送了数据，登记写事件
+    void DealUpstream_(int owner, int fd); // 代理连接的上游fd就绪，owner是客户端fd
 
     void SendError_(int fd, const char*info);
     void ExtentTime_(HttpConn* client);
+    int TimerInterval_() const; // 连接定时器的检查间隔
+    void OnTimeout_(HttpConn* client);
     void CloseConn_(HttpConn* client);
 
     void OnRead_(HttpConn* client);
     void OnWrite_(HttpConn* client);
     void OnProcess(HttpConn* client);
+    void OnUpstream_(HttpConn* client);
+    // 处理之后按连接的状态登记下一个事件：推送、等待上游、写响应或读请求
+    void Rearm_(HttpConn* client, bool writing);
+    // 登记连接等待的其他fd(代理的上游、异步处理函数等待的fd)，带上客户端fd
+    void ArmUpstream_(HttpConn* client, int fd, bool write);
+
+    // 工作线程：内存紧张时缓冲区较大的连接只登记EPOLLRDHUP不登记读事件，返回true表示已暂停
+    bool PauseRead_(HttpConn* client);
+    // 主线程每轮检查内存预算：超过高水位时回收缓存，回落到低水位以下时恢复暂停的连接
+    void CheckMemory_();
+    void Shed_(MemoryBudget::Level level);
+    bool HasPaused_();
 
     static const int MAX_FD = 65536; // 最大的文件描述符的个数
+    static const int PAUSE_CHECK_MS = 100; // 有暂停的连接时检查内存的间隔
+    static const int SHED_INTERVAL_MS = 1000; // 两次回收缓存的最小间隔
 
     static int SetFdNonblock(int fd); // 设置文件描述符非阻塞
 
     int port_; // 端口
     bool openLinger_; // 是否打开优雅关闭
     int timeoutMS_;  /* 毫秒MS */
+    int keepAliveMS_; // 空闲的保持连接的超时时间
     bool isClose_; // 是否关闭
     int listenFd_; // 监听的文件描述符
+    int tlsListenFd_; // HTTPS监听的文件描述符，-1表示未开启
+    int notifyFd_; // 资源目录的inotify描述符，文件变化时使内存缓存失效
+    int wakeFd_; // eventfd，WebSocket/SSE推送时唤醒epoll_wait
+    int heartbeatMS_; // WebSocket/SSE空闲多久发送心跳
+    bool shortestFirst_; // 写事件按剩余字节数排序分发
+    std::atomic<uint64_t> acceptCount_; // 建立的连接数
+    std::atomic<uint64_t> idleCloseCount_; // 空闲超时关闭的连接数
+    std::atomic<uint64_t> timeoutCloseCount_; // 请求处理超时关闭的连接数
+    std::atomic<uint64_t> pingCloseCount_; // ping没有回应而关闭的WebSocket连接数
+    std::mutex pauseMtx_;
+    std::vector<std::pair<HttpConn*, uint64_t>> paused_; // 因内存不足暂停读的连接和当时的序号
+    bool shed_; // 回收过缓存，恢复时还原空闲块的上限
+    int64_t lastShedMs_;
     char* srcDir_; // 资源的目录
     
     uint32_t listenEvent_; // 监听的文件描述符的事件
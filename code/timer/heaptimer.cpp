@@ -7,12 +7,12 @@
 
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;
-    while(j >= 0) {
+    // size_t不会小于0，必须在到达堆顶时停止，否则(0 - 1) / 2会越界访问
+    while(i > 0) {
+        size_t j = (i - 1) / 2;
         if(heap_[j] < heap_[i]) { break; }
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -76,8 +76,8 @@ void HeapTimer::doWork(int id) {
     }
     size_t i = ref_[id];
     TimerNode node = heap_[i];
-    node.cb();
     del_(i);
+    node.cb();
 }
 
 void HeapTimer::del_(size_t index) {
@@ -119,8 +119,9 @@ void HeapTimer::tick() {
         if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) { 
             break; 
         }
-        node.cb();
+        // 先删除再回调，回调中可以为同一个id重新添加定时器
         pop();
+        node.cb();
     }
 }
 
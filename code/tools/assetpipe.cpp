@@ -0,0 +1,377 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-08
+ * @copyleft Apache 2.0
+ */
+// 静态资源构建工具：压缩HTML/CSS、按内容哈希重命名资源、改写引用、生成.gz/.br和清单
+// 用法：assetpipe <资源目录> <输出目录>
+//   例如 ./bin/assetpipe resources dist && ./bin/packres dist resources.pack
+//
+// 除HTML外的资源(css/js/图片/字体)重命名为 name.<哈希>.ext，内容不变名字就不变，
+// 服务器读取输出目录中的asset-manifest.txt，对这些文件返回 Cache-Control: immutable
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../cache/resarchive.h"
+#include "../cache/variantcache.h"
+#include "../http/mimetype.h"
+
+using namespace std;
+
+static const char* MANIFEST = "asset-manifest.txt";
+
+static bool ReadFile(const string& file, string& out) {
+    FILE* fp = fopen(file.c_str(), "rb");
+    if(!fp) { return false; }
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static bool WriteFile(const string& file, const string& data) {
+    // 逐级创建目录
+    for(size_t i = 1; i < file.size(); i++) {
+        if(file[i] == '/') {
+            mkdir(file.substr(0, i).c_str(), 0755);
+        }
+    }
+    FILE* fp = fopen(file.c_str(), "wb");
+    if(!fp) {
+        fprintf(stderr, "open %s: %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    return (fclose(fp) == 0) && ok;
+}
+
+// 收集目录下的文件，路径以/开头；跳过隐藏文件、已有的压缩文件和旧清单
+static void Collect(const string& root, const string& rel, map<string, string>& files) {
+    DIR* d = opendir((root + rel).c_str());
+    if(!d) { return; }
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_name[0] == '.') { continue; }
+        string path = rel + "/" + ent->d_name;
+        struct stat st;
+        if(stat((root + path).c_str(), &st) < 0) { continue; }
+        if(S_ISDIR(st.st_mode)) {
+            Collect(root, path, files);
+            continue;
+        }
+        string suffix = FileSuffix(path);
+        if(!S_ISREG(st.st_mode) || suffix == ".gz" || suffix == ".br" || suffix == ".zst"
+            || path == string("/") + MANIFEST) {
+            continue;
+        }
+        ReadFile(root + path, files[path]);
+    }
+    closedir(d);
+}
+
+/* ---------- 压缩 ---------- */
+
+// CSS：去掉注释，合并空白，去掉{};,>前后以及:后面的空白，去掉}前多余的;
+// 字符串原样保留；+和~两侧的空白不能去(calc()中有意义)
+static string MinifyCss(const string& in) {
+    static const char* TIGHT = "{};,>";
+    string out;
+    size_t i = 0, n = in.size();
+    while(i < n) {
+        char c = in[i];
+        if(c == '/' && i + 1 < n && in[i + 1] == '*') {
+            size_t end = in.find("*/", i + 2);
+            i = (end == string::npos) ? n : end + 2;
+            continue;
+        }
+        if(c == '"' || c == '\'') {
+            size_t j = i + 1;
+            while(j < n && in[j] != c) {
+                if(in[j] == '\\') { j++; }
+                j++;
+            }
+            out.append(in, i, j + 1 - i);
+            i = j + 1;
+            continue;
+        }
+        if(isspace((unsigned char)c)) {
+            while(i < n && isspace((unsigned char)in[i])) { i++; }
+            if(!out.empty() && i < n && !strchr(TIGHT, out.back()) && out.back() != ':'
+                && !strchr(TIGHT, in[i]) && !(in[i] == '/' && i + 1 < n && in[i + 1] == '*')) {
+                out += ' ';
+            }
+            continue;
+        }
+        if(c == '}' && !out.empty() && out.back() == ';') {
+            out.pop_back();
+        }
+        if(strchr(TIGHT, c) && !out.empty() && out.back() == ' ') {
+            out.pop_back();
+        }
+        out += c;
+        i++;
+    }
+    return out;
+}
+
+static bool StartsWithNoCase(const string& s, size_t pos, const char* prefix) {
+    return strncasecmp(s.c_str() + pos, prefix, strlen(prefix)) == 0;
+}
+
+// HTML：去掉注释(保留IE条件注释)，空白串合并为一个字符(含换行则保留换行)
+// pre/textarea/script/style中的内容原样保留
+static string MinifyHtml(const string& in) {
+    static const char* RAW[] = { "pre", "textarea", "script", "style" };
+    string out;
+    size_t i = 0, n = in.size();
+    while(i < n) {
+        char c = in[i];
+        if(c == '<') {
+            if(in.compare(i, 4, "<!--") == 0 && in.compare(i, 7, "<!--[if") != 0) {
+                size_t end = in.find("-->", i + 4);
+                i = (end == string::npos) ? n : end + 3;
+                continue;
+            }
+            bool raw = false;
+            for(const char* tag: RAW) {
+                size_t len = strlen(tag);
+                if(StartsWithNoCase(in, i + 1, tag) && i + 1 + len < n
+                    && (in[i + 1 + len] == '>' || isspace((unsigned char)in[i + 1 + len]))) {
+                    string close = string("</") + tag;
+                    size_t end = i + 1;
+                    while((end = in.find("</", end)) != string::npos && !StartsWithNoCase(in, end, close.c_str())) {
+                        end += 2;
+                    }
+                    end = (end == string::npos) ? n : end;
+                    out.append(in, i, end - i);
+                    i = end;
+                    raw = true;
+                    break;
+                }
+            }
+            if(raw) { continue; }
+        }
+        if(isspace((unsigned char)c)) {
+            bool newline = false;
+            while(i < n && isspace((unsigned char)in[i])) {
+                newline = newline || in[i] == '\n';
+                i++;
+            }
+            out += newline ? '\n' : ' ';
+            continue;
+        }
+        out += c;
+        i++;
+    }
+    return out;
+}
+
+/* ---------- 引用改写 ---------- */
+
+static bool IsExternal(const string& ref) {
+    return ref.empty() || ref[0] == '#' || ref.compare(0, 2, "//") == 0
+        || ref.find(':') != string::npos; // http: https: data: mailto: ...
+}
+
+// 把dir(以/开头的目录)下的相对引用解析为以/开头的路径，并处理.和..
+static string Resolve(const string& dir, const string& ref) {
+    string full = ref[0] == '/' ? ref : dir + "/" + ref;
+    vector<string> parts;
+    size_t i = 0;
+    while(i <= full.size()) {
+        size_t j = full.find('/', i);
+        if(j == string::npos) { j = full.size(); }
+        string part = full.substr(i, j - i);
+        if(part == "..") {
+            if(!parts.empty()) { parts.pop_back(); }
+        } else if(!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+        i = j + 1;
+    }
+    string res;
+    for(auto& part: parts) {
+        res += "/" + part;
+    }
+    return res;
+}
+
+static string DirOf(const string& path) {
+    return path.substr(0, path.rfind('/'));
+}
+
+static string BaseOf(const string& path) {
+    return path.substr(path.rfind('/') + 1);
+}
+
+// 只替换引用中的文件名，保持原来的相对/绝对写法以及?和#后缀
+static string RewriteRef(const string& dir, const string& ref, const map<string, string>& renamed) {
+    if(IsExternal(ref)) {
+        return ref;
+    }
+    size_t q = ref.find_first_of("?#");
+    string path = ref.substr(0, q);
+    string tail = (q == string::npos) ? "" : ref.substr(q);
+    if(path.empty()) {
+        return ref;
+    }
+    auto it = renamed.find(Resolve(dir, path));
+    if(it == renamed.end()) {
+        return ref;
+    }
+    size_t slash = path.rfind('/');
+    string prefix = (slash == string::npos) ? "" : path.substr(0, slash + 1);
+    return prefix + BaseOf(it->second) + tail;
+}
+
+// CSS中的url(...)，引号可有可无
+static string RewriteCss(const string& path, const string& css, const map<string, string>& renamed) {
+    string out;
+    size_t i = 0;
+    while(true) {
+        size_t pos = css.find("url(", i);
+        if(pos == string::npos) { break; }
+        size_t begin = pos + 4;
+        size_t end = css.find(')', begin);
+        if(end == string::npos) { break; }
+        string inner = css.substr(begin, end - begin);
+        char quote = 0;
+        if(!inner.empty() && (inner[0] == '"' || inner[0] == '\'') && inner.back() == inner[0]) {
+            quote = inner[0];
+            inner = inner.substr(1, inner.size() - 2);
+        }
+        out.append(css, i, begin - i);
+        if(quote) { out += quote; }
+        out += RewriteRef(DirOf(path), inner, renamed);
+        if(quote) { out += quote; }
+        i = end;
+    }
+    out.append(css, i, string::npos);
+    return out;
+}
+
+// HTML中的src="..."和href="..."
+static string RewriteHtml(const string& path, const string& html, const map<string, string>& renamed) {
+    string out;
+    size_t i = 0, n = html.size();
+    while(i < n) {
+        size_t pos = string::npos;
+        size_t attrLen = 0;
+        for(const char* attr: { "src=", "href=" }) {
+            size_t p = html.find(attr, i);
+            if(p < pos) {
+                pos = p;
+                attrLen = strlen(attr);
+            }
+        }
+        if(pos == string::npos || pos + attrLen >= n) { break; }
+        size_t begin = pos + attrLen;
+        char quote = html[begin];
+        if(quote != '"' && quote != '\'') {
+            out.append(html, i, begin - i);
+            i = begin;
+            continue;
+        }
+        size_t end = html.find(quote, begin + 1);
+        if(end == string::npos) { break; }
+        out.append(html, i, begin + 1 - i);
+        out += RewriteRef(DirOf(path), html.substr(begin + 1, end - begin - 1), renamed);
+        i = end;
+    }
+    out.append(html, i, string::npos);
+    return out;
+}
+
+static string Fingerprint(const string& path, const string& data) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)ResArchive::Hash(data.data(), data.size()));
+    string suffix = FileSuffix(path);
+    return path.substr(0, path.size() - suffix.size()) + "." + string(hash, 8) + suffix;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <resources dir> <output dir>\n", argv[0]);
+        return 1;
+    }
+    string src = argv[1], dst = argv[2];
+    while(src.size() > 1 && src.back() == '/') { src.pop_back(); }
+    while(dst.size() > 1 && dst.back() == '/') { dst.pop_back(); }
+    map<string, string> files;
+    Collect(src, "", files);
+    if(files.empty()) {
+        fprintf(stderr, "no files in %s\n", src.c_str());
+        return 1;
+    }
+
+    size_t before = 0;
+    for(auto& f: files) {
+        before += f.second.size();
+        string suffix = FileSuffix(f.first);
+        if(suffix == ".html") { f.second = MinifyHtml(f.second); }
+        else if(suffix == ".css") { f.second = MinifyCss(f.second); }
+    }
+
+    // 先给不引用其他资源的文件命名，再改写CSS中的url并命名CSS，最后改写HTML
+    map<string, string> renamed; // 原路径 -> 带哈希的路径
+    for(auto& f: files) {
+        string suffix = FileSuffix(f.first);
+        if(suffix != ".html" && suffix != ".css") {
+            renamed[f.first] = Fingerprint(f.first, f.second);
+        }
+    }
+    for(auto& f: files) {
+        if(FileSuffix(f.first) == ".css") {
+            f.second = RewriteCss(f.first, f.second, renamed);
+            renamed[f.first] = Fingerprint(f.first, f.second);
+        }
+    }
+    for(auto& f: files) {
+        if(FileSuffix(f.first) == ".html") {
+            f.second = RewriteHtml(f.first, f.second, renamed);
+        }
+    }
+
+    size_t after = 0, compressed = 0;
+    string manifest;
+    for(auto& f: files) {
+        auto it = renamed.find(f.first);
+        string path = (it == renamed.end()) ? f.first : it->second;
+        if(!WriteFile(dst + path, f.second)) {
+            return 1;
+        }
+        after += f.second.size();
+        if(it != renamed.end()) {
+            manifest += f.first + " " + it->second + "\n";
+        }
+        // 文本类资源生成预压缩文件，服务器按Accept-Encoding直接发送
+        if(IsCompressibleType(MimeType(FileSuffix(path))) && !f.second.empty()) {
+            for(const string& enc: { string("gzip"), string("br") }) {
+                string out;
+                if(VariantCache::Encode(enc, f.second.data(), f.second.size(), out) && out.size() < f.second.size()) {
+                    if(!WriteFile(dst + path + VariantCache::Suffix(enc), out)) {
+                        return 1;
+                    }
+                    compressed++;
+                }
+            }
+        }
+    }
+    if(!WriteFile(dst + "/" + MANIFEST, manifest)) {
+        return 1;
+    }
+    printf("%zu files, %zu fingerprinted, %zu compressed variants, %zu -> %zu bytes\n",
+           files.size(), renamed.size(), compressed, before, after);
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-19
+ * @copyleft Apache 2.0
+ */
+// 二进制日志解码工具：把Log::BINARY模式写出的日志还原为文本，输出到标准输出
+// 用法：logdecode [-v] <日志文件.bin>...
+//   例如 ./bin/logdecode log/2020_07_19.log.bin | grep error
+//   -v 在每行末尾附上LOG_*所在的源文件和行号
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <unordered_map>
+
+#include "../log/logrecord.h"
+
+using namespace std;
+
+struct Def {
+    string file;
+    int line;
+    string format;
+};
+
+static bool ReadFile(const char* file, string& out) {
+    FILE* fp = fopen(file, "rb");
+    if(!fp) { return false; }
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static bool Decode(const char* file, bool verbose) {
+    string data;
+    if(!ReadFile(file, data)) {
+        fprintf(stderr, "read %s: %s\n", file, strerror(errno));
+        return false;
+    }
+    if(data.size() < sizeof(LogRecord::FILE_MAGIC) ||
+       memcmp(data.data(), LogRecord::FILE_MAGIC, sizeof(LogRecord::FILE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a binary log\n", file);
+        return false;
+    }
+    // 格式串定义在每个文件中第一次使用之前写出
+    unordered_map<uint32_t, Def> defs;
+    LogRecord::TimeCache cache;
+    string line;
+    size_t pos = sizeof(LogRecord::FILE_MAGIC);
+    while(pos + sizeof(LogRecord::Head) <= data.size()) {
+        LogRecord::Head head;
+        memcpy(&head, data.data() + pos, sizeof(head));
+        if(head.size < sizeof(head) || head.size > data.size() - pos) {
+            fprintf(stderr, "%s: broken record at offset %zu\n", file, pos);
+            return false;
+        }
+        const char* body = data.data() + pos + sizeof(head);
+        size_t len = head.size - sizeof(head);
+        pos += head.size;
+
+        if(head.id == LogRecord::TEXT_ID) {
+            fwrite(body, 1, len, stdout);
+        } else if(head.id == LogRecord::DEF_ID) {
+            if(len < 8) { continue; }
+            uint32_t id;
+            int32_t ln;
+            memcpy(&id, body, sizeof(id));
+            memcpy(&ln, body + 4, sizeof(ln));
+            const char* fileName = body + 8;
+            const char* end = body + len;
+            const char* format = (const char*)memchr(fileName, '\0', end - fileName);
+            if(!format || !memchr(format + 1, '\0', end - format - 1)) { continue; }
+            Def& def = defs[id];
+            def.file = fileName;
+            def.line = ln;
+            def.format = format + 1;
+        } else {
+            char prefix[64];
+            line.assign(prefix, LogRecord::Prefix(prefix, head.usec, head.level, cache));
+            auto it = defs.find(head.id);
+            if(it == defs.end()) {
+                line += "<unknown format ";
+                line += to_string(head.id);
+                line += '>';
+            } else {
+                LogRecord::Format(it->second.format.c_str(), body, len, line);
+                if(verbose) {
+                    line += "  (";
+                    line += it->second.file;
+                    line += ':';
+                    line += to_string(it->second.line);
+                    line += ')';
+                }
+            }
+            line += '\n';
+            fwrite(line.data(), 1, line.size(), stdout);
+        }
+    }
+    if(pos != data.size()) {
+        fprintf(stderr, "%s: truncated record at offset %zu\n", file, pos);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    bool verbose = false;
+    int first = 1;
+    if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+        verbose = true;
+        first = 2;
+    }
+    if(first >= argc) {
+        fprintf(stderr, "usage: %s [-v] <log.bin>...\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for(int i = first; i < argc; i++) {
+        ok = Decode(argv[i], verbose) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-06
+ * @copyleft Apache 2.0
+ */
+// 资源打包工具：把资源目录打包成WebServer启动时mmap的资源包
+// 用法：packres <资源目录> <输出文件>
+//   例如 ./bin/packres resources resources.pack && ./bin/server resources.pack
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../cache/resarchive.h"
+#include "../cache/variantcache.h"
+#include "../http/mimetype.h"
+
+using namespace std;
+
+struct PackFile {
+    string path; // 以/开头的请求路径
+    string mime;
+    string etag;
+    int64_t mtime;
+    string data;
+    string gzip;
+    string br;
+    uint64_t hash;
+};
+
+static bool ReadFile(const string& file, string& out) {
+    FILE* fp = fopen(file.c_str(), "rb");
+    if(!fp) { return false; }
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+// 递归收集目录下的普通文件，跳过已有的.gz/.br预压缩文件(压缩版本由打包时生成)
+static bool Collect(const string& root, const string& rel, vector<PackFile>& files) {
+    DIR* d = opendir((root + rel).c_str());
+    if(!d) {
+        fprintf(stderr, "opendir %s: %s\n", (root + rel).c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_name[0] == '.') { continue; }
+        string path = rel + "/" + ent->d_name;
+        struct stat st;
+        if(stat((root + path).c_str(), &st) < 0) { continue; }
+        if(S_ISDIR(st.st_mode)) {
+            ok = Collect(root, path, files) && ok;
+            continue;
+        }
+        string suffix = FileSuffix(path);
+        if(!S_ISREG(st.st_mode) || suffix == ".gz" || suffix == ".br" || suffix == ".zst") {
+            continue;
+        }
+        PackFile f;
+        f.path = path;
+        f.mime = MimeType(suffix);
+        f.mtime = st.st_mtime;
+        if(!ReadFile(root + path, f.data)) {
+            fprintf(stderr, "read %s failed\n", (root + path).c_str());
+            ok = false;
+            continue;
+        }
+        char etag[32];
+        snprintf(etag, sizeof(etag), "\"p%016llx\"",
+                 (unsigned long long)ResArchive::Hash(f.data.data(), f.data.size()));
+        f.etag = etag;
+        f.hash = ResArchive::Hash(f.path.data(), f.path.size());
+        // 文本类资源预先压缩，没有变小则不保存
+        if(IsCompressibleType(f.mime) && !f.data.empty()) {
+            if(!VariantCache::Encode("gzip", f.data.data(), f.data.size(), f.gzip)
+                || f.gzip.size() >= f.data.size()) {
+                f.gzip.clear();
+            }
+            if(!VariantCache::Encode("br", f.data.data(), f.data.size(), f.br)
+                || f.br.size() >= f.data.size()) {
+                f.br.clear();
+            }
+        }
+        files.push_back(std::move(f));
+    }
+    closedir(d);
+    return ok;
+}
+
+static uint64_t Align(uint64_t off) {
+    return (off + ResArchive::ALIGN - 1) / ResArchive::ALIGN * ResArchive::ALIGN;
+}
+
+static uint32_t AddString(string& strings, const string& str) {
+    uint32_t off = strings.size();
+    strings += str;
+    return off;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <resources dir> <output archive>\n", argv[0]);
+        return 1;
+    }
+    string root = argv[1];
+    while(root.size() > 1 && root.back() == '/') { root.pop_back(); }
+    vector<PackFile> files;
+    if(!Collect(root, "", files)) {
+        return 1;
+    }
+    sort(files.begin(), files.end(), [](const PackFile& a, const PackFile& b) {
+        return a.hash < b.hash;
+    });
+
+    /* 先排布索引和字符串区，再依次对齐放置数据 */
+    ArchiveHeader head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, ResArchive::MAGIC, sizeof(head.magic));
+    head.version = ResArchive::VERSION;
+    head.count = files.size();
+    head.indexOffset = sizeof(ArchiveHeader);
+
+    vector<ArchiveEntry> index(files.size());
+    string strings;
+    for(size_t i = 0; i < files.size(); i++) {
+        ArchiveEntry& e = index[i];
+        memset(&e, 0, sizeof(e));
+        e.hash = files[i].hash;
+        e.pathOff = AddString(strings, files[i].path);
+        e.pathLen = files[i].path.size();
+        e.mimeOff = AddString(strings, files[i].mime);
+        e.mimeLen = files[i].mime.size();
+        e.etagOff = AddString(strings, files[i].etag);
+        e.etagLen = files[i].etag.size();
+        e.mtime = files[i].mtime;
+    }
+    head.stringsOffset = head.indexOffset + index.size() * sizeof(ArchiveEntry);
+    head.dataOffset = Align(head.stringsOffset + strings.size());
+
+    uint64_t off = head.dataOffset;
+    vector<pair<uint64_t, const string*>> blobs;
+    auto place = [&](ArchiveSlice& slice, const string& blob) {
+        if(blob.empty()) { return; }
+        slice.offset = off;
+        slice.length = blob.size();
+        blobs.push_back({ off, &blob });
+        off = Align(off + blob.size());
+    };
+    for(size_t i = 0; i < files.size(); i++) {
+        place(index[i].data, files[i].data);
+        place(index[i].gzip, files[i].gzip);
+        place(index[i].br, files[i].br);
+        if(files[i].data.empty()) {
+            index[i].data.offset = head.dataOffset; // 空文件也要有合法的偏移
+        }
+    }
+    head.fileSize = off;
+
+    string tmp = string(argv[2]) + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if(!fp) {
+        fprintf(stderr, "open %s: %s\n", tmp.c_str(), strerror(errno));
+        return 1;
+    }
+    string out((size_t)head.fileSize, '\0');
+    memcpy(&out[0], &head, sizeof(head));
+    if(!index.empty()) {
+        memcpy(&out[head.indexOffset], index.data(), index.size() * sizeof(ArchiveEntry));
+    }
+    memcpy(&out[head.stringsOffset], strings.data(), strings.size());
+    for(auto& blob: blobs) {
+        memcpy(&out[blob.first], blob.second->data(), blob.second->size());
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    ok = (fclose(fp) == 0) && ok;
+    // 写完后再rename，运行中的服务器不会读到写了一半的资源包
+    if(!ok || rename(tmp.c_str(), argv[2]) < 0) {
+        fprintf(stderr, "write %s failed\n", argv[2]);
+        unlink(tmp.c_str());
+        return 1;
+    }
+    size_t gz = 0, br = 0;
+    for(auto& f: files) {
+        gz += !f.gzip.empty();
+        br += !f.br.empty();
+    }
+    printf("packed %zu files (%zu gzip, %zu br) into %s, %llu bytes\n",
+           files.size(), gz, br, argv[2], (unsigned long long)head.fileSize);
+    return 0;
+}
@@ -4,13 +4,72 @@
  * @copyleft Apache 2.0
  */ 
 #include "../code/log/log.h"
+#include "../code/log/accesslog.h"
 #include "../code/pool/threadpool.h"
-#include <features.h>
-
-#if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
+#include "../code/http/httprequest.h"
+#include "../code/http/httpresponse.h"
+#include "../code/http/hpack.h"
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <assert.h>
 #include <sys/syscall.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <condition_variable>
+#include <new>
+
+// glibc 2.30之前没有gettid()，之后也要_GNU_SOURCE才声明，直接用系统调用
 #define gettid() syscall(SYS_gettid)
-#endif
+
+// 计数的operator new：只统计打开了计数的线程，检查请求处理路径上的堆分配
+static thread_local bool countNew = false;
+static size_t newCount = 0;
+
+void* operator new(size_t size) {
+    if(countNew) { newCount++; }
+    void* p = malloc(size ? size : 1);
+    if(!p) { throw std::bad_alloc(); }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// 删除上次运行留下的文件
+static void ClearDir(const char* dir) {
+    DIR* d = opendir(dir);
+    for(struct dirent* e = d ? readdir(d) : nullptr; e; e = readdir(d)) {
+        unlink((std::string(dir) + "/" + e->d_name).c_str());
+    }
+    if(d) { closedir(d); }
+}
+
+// 目录中每个日志文件都不超过maxLines行(批量写入在行数上限处切开)，返回总行数
+static int CountLogLines(const char* dir, int maxLines) {
+    int total = 0;
+    DIR* d = opendir(dir);
+    assert(d);
+    for(struct dirent* e = readdir(d); e; e = readdir(d)) {
+        if(e->d_name[0] == '.') { continue; }
+        FILE* fp = fopen((std::string(dir) + "/" + e->d_name).c_str(), "r");
+        assert(fp);
+        int lines = 0;
+        for(int c = getc(fp); c != EOF; c = getc(fp)) {
+            lines += c == '\n';
+        }
+        fclose(fp);
+        assert(lines <= maxLines);
+        total += lines;
+    }
+    closedir(d);
+    return total;
+}
 
 void TestLog() {
     int cnt = 0, level = 0;
@@ -24,6 +83,7 @@ void TestLog() {
         }
     }
     cnt = 0;
+    ClearDir("./testlog2");
     Log::Instance()->init(level, "./testlog2", ".log", 5000);
     for(level = 0; level < 4; level++) {
         Log::Instance()->SetLevel(level);
@@ -33,6 +93,77 @@ void TestLog() {
             }
         }
     }
+    cnt = 0;
+    // 延迟格式化：只记录格式串编号和参数，由刷写线程格式化
+    Log::Instance()->flush();
+    // 每个级别写入10000*4行，级别0到3共100000行，每个文件50000行
+    assert(CountLogLines("./testlog2", 50000) == 100000);
+    Log::Instance()->SetMode(Log::DEFERRED);
+    ClearDir("./testlog3");
+    Log::Instance()->init(level, "./testlog3", ".log", 5000);
+    for(level = 0; level < 4; level++) {
+        Log::Instance()->SetLevel(level);
+        for(int j = 0; j < 10000; j++ ){
+            for(int i = 0; i < 4; i++) {
+                LOG_BASE(i,"%s 333333333 %d %.*s %5.2f %zu ============= ", "Test", cnt++, 3, "abcdef", j / 4.0, sizeof(j));
+            }
+        }
+    }
+    Log::Instance()->flush();
+    assert(CountLogLines("./testlog3", 50000) == 100000);
+    // 回到文本格式化的行(write)和本线程的记录在同一个环中，按调用的先后写出
+    cnt = 0;
+    ClearDir("./testlog4");
+    Log::Instance()->init(1, "./testlog4", ".log", 5000);
+    for(int i = 0; i < 1000; i++) {
+        if(i % 2) {
+            LOG_INFO("order %d", i);
+        } else {
+            Log::Instance()->write(1, "order %d", i);
+        }
+    }
+    Log::Instance()->flush();
+    DIR* d = opendir("./testlog4");
+    assert(d);
+    for(struct dirent* e = readdir(d); e; e = readdir(d)) {
+        if(e->d_name[0] == '.') { continue; }
+        FILE* fp = fopen((std::string("./testlog4/") + e->d_name).c_str(), "r");
+        assert(fp);
+        char line[256];
+        while(fgets(line, sizeof(line), fp)) {
+            const char* order = strstr(line, "order ");
+            assert(order && atoi(order + 6) == cnt);
+            cnt++;
+        }
+        fclose(fp);
+    }
+    closedir(d);
+    assert(cnt == 1000);
+    Log::Instance()->SetMode(Log::TEXT);
+}
+
+void TestLogRecord() {
+    // 有精度的%s按精度截取，不读到参数的缓冲区之外(缓冲区不以'\0'结尾)
+    const char* format = "%.3s|%.*s|%-4.2s|%s|%.s";
+    LogRecord::Bounds bounds;
+    LogRecord::BoundedStrings(format, &bounds);
+    assert(bounds.precision[0] == 3 && bounds.precision[1] == -1 &&
+           bounds.precision[2] == LogRecord::Bounds::STAR && bounds.precision[3] == 2 &&
+           bounds.precision[4] == -1 && bounds.precision[5] == 0);
+    std::unique_ptr<char[]> abc(new char[3]);
+    memcpy(abc.get(), "abc", 3);
+    std::unique_ptr<char[]> buf(new char[LogRecord::MAX_SIZE]);
+    LogRecord::Writer writer(buf.get(), bounds);
+    writer.Put(abc.get());
+    writer.Put(2);
+    writer.Put(abc.get());
+    writer.Put(abc.get());
+    writer.Put("xyz");
+    writer.Put(abc.get());
+    size_t len = writer.Finish(1, 1, 0);
+    std::string out;
+    LogRecord::Format(format, buf.get() + sizeof(LogRecord::Head), len - sizeof(LogRecord::Head), out);
+    assert(out == "abc|ab|ab  |xyz|");
 }
 
 void ThreadLogTask(int i, int cnt) {
@@ -50,7 +181,462 @@ void TestThreadPool() {
     getchar();
 }
 
+// 读出一个访问日志文件(切换下来压缩过的.gz或者明文，gzgets都能读)，检查每一行，记录出现过的(i, j)
+static int CheckAccessFile(const std::string& file, std::vector<bool>& seen) {
+    static const char REQUEST[] = "] \"GET /index.html HTTP/1.1\" 200 ";
+    gzFile gz = gzopen(file.c_str(), "rb");
+    assert(gz);
+    int lines = 0;
+    char line[1024];
+    while(gzgets(gz, line, sizeof(line))) {
+        // 127.0.0.1 - - [19/Jul/2020:10:00:00 +0800] "GET /index.html HTTP/1.1" 200 j "-" "test" i - -
+        size_t len = strlen(line);
+        assert(len > 0 && line[len - 1] == '\n');
+        assert(strncmp(line, "127.0.0.1 - - [", 15) == 0);
+        const char* p = strstr(line, REQUEST);
+        assert(p);
+        p += sizeof(REQUEST) - 1;
+        int bytes = -1, i = -1, end = 0;
+        sscanf(p, "%d \"-\" \"test\" %d - -\n%n", &bytes, &i, &end);
+        assert(end > 0 && p[end] == '\0');
+        assert(bytes >= 0 && bytes < 10000 && i >= 0 && i < 5);
+        assert(!seen[i * 10000 + bytes]);
+        seen[i * 10000 + bytes] = true;
+        lines++;
+    }
+    gzclose(gz);
+    return lines;
+}
+
+static void WriteAccess(AccessLogWriter* writer, const sockaddr_in& peer, int i, int cnt) {
+    for(int j = 0; j < cnt; j++) {
+        AccessLogWriter::Entry entry;
+        entry.peer = &peer;
+        entry.method = "GET";
+        entry.target = "/index.html";
+        entry.version = "1.1";
+        entry.status = 200;
+        entry.bytes = j;
+        entry.durationUs = i;
+        entry.userAgent = "test";
+        writer->Write(entry);
+    }
+}
+
+void TestAccessLog() {
+    // 每个线程写入自己的环，文件超过64KB时切换，切换下来的文件在后台压缩为.gz；
+    // Close会放弃还没有压缩的文件，先等压缩完成
+    const char* dir = "./testaccess";
+    ClearDir(dir);
+
+    AccessLogWriter* writer = AccessLogWriter::Instance();
+    bool opened = writer->Open("./testaccess/access.log", AccessLogWriter::COMBINED, 64 * 1024, 0, AccessLogWriter::GZIP);
+    assert(opened);
+    sockaddr_in peer = { 0 };
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::mutex mtx;
+    std::condition_variable cond;
+    int running = 4;
+    {
+        ThreadPool threadpool(4);
+        for(int i = 0; i < 4; i++) {
+            threadpool.AddTask([&, i] {
+                WriteAccess(writer, peer, i, 10000);
+                std::lock_guard<std::mutex> locker(mtx);
+                running--;
+                cond.notify_one();
+            });
+        }
+        std::unique_lock<std::mutex> locker(mtx);
+        cond.wait(locker, [&] { return running == 0; });
+    }
+    writer->WaitCompressed();
+    writer->Close();
+    // Close之后可以重新打开，继续追加到同一个文件
+    opened = writer->Open("./testaccess/access.log", AccessLogWriter::COMBINED, 64 * 1024, 0, AccessLogWriter::GZIP);
+    assert(opened);
+    WriteAccess(writer, peer, 4, 100);
+    writer->Close();
+
+    // 读出.gz和当前的明文文件
+    std::vector<bool> seen(5 * 10000, false);
+    int lines = 0, gzFiles = 0;
+    DIR* d = opendir(dir);
+    assert(d);
+    for(struct dirent* e = readdir(d); e; e = readdir(d)) {
+        std::string name = e->d_name;
+        if(name.compare(0, 10, "access.log") == 0) {
+            assert(name.size() < 4 || name.compare(name.size() - 4, 4, ".tmp") != 0);
+            // 切换下来的文件(约30个，不超过压缩积压的上限)都已压缩
+            if(name != "access.log") {
+                assert(name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0);
+                // 确实是gzip格式(gzgets对明文也能读)
+                FILE* fp = fopen((std::string(dir) + "/" + name).c_str(), "rb");
+                assert(fp && getc(fp) == 0x1f && getc(fp) == 0x8b);
+                fclose(fp);
+                gzFiles++;
+            }
+            lines += CheckAccessFile(std::string(dir) + "/" + name, seen);
+        }
+    }
+    closedir(d);
+    assert(lines == 40100 && gzFiles > 0);
+}
+
+void TestRequest() {
+    // 流水线：一次读到的两个请求逐个解析，第一个不会把第二个的请求行当作请求体
+    HttpRequest request;
+    Buffer buff;
+    buff.Append("GET /a.html HTTP/1.1\r\nHost: x\r\n\r\nGET /b.html HTTP/1.1\r\nHost: x\r\n\r\nGET /c");
+    assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+    assert(request.path() == "/a.html" && request.GetHeader("host") == "x");
+    request.Init();
+    assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+    assert(request.path() == "/b.html");
+    // 不完整的请求不消费缓冲区，数据到齐之后从头解析
+    request.Init();
+    assert(request.parse(buff) == HttpRequest::NO_REQUEST);
+    assert(buff.RetrieveAllToStr() == "GET /c");
+
+    // 请求体在之后的读取中到达：按Content-Length等待，多出的数据属于下一个请求
+    const char head[] = "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                        "Content-Length: 19\r\n\r\n";
+    request.Init();
+    buff.Append(head);
+    assert(request.parse(buff) == HttpRequest::NO_REQUEST);
+    assert(buff.ReadableBytes() == strlen(head));
+    buff.Append("user=mark&pa");
+    request.Init();
+    assert(request.parse(buff) == HttpRequest::NO_REQUEST);
+    buff.Append("ss=word\r\nGET / HTTP/1.0\r\n\r\n");
+    request.Init();
+    assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+    assert(request.GetPost("user") == "mark" && request.GetPost("pass") == "word");
+    request.Init();
+    assert(request.parse(buff) == HttpRequest::GET_REQUEST); // 请求之间多余的空行被忽略
+    assert(request.version() == "1.0" && buff.ReadableBytes() == 0);
+
+    // 格式错误
+    const char* bad[] = {
+        "GET /\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+    };
+    for(const char* req: bad) {
+        request.Init();
+        buff.RetrieveAll();
+        buff.Append(req);
+        assert(request.parse(buff) == HttpRequest::BAD_REQUEST);
+    }
+}
+
+void TestRouter() {
+    // 与WebServer中的注册方式相同：表单提交到别名，验证的改写函数注册在别名的目标上
+    Router* router = Router::Instance();
+    router->Alias("/testlogin", "/testlogin.html");
+    router->Rewrite("POST", "/testlogin.html", [](HttpRequest& request) {
+        request.path() = request.GetPost("username") == "mark" ? "/welcome.html" : "/error.html";
+    });
+    router->Alias("/testloop-a", "/testloop-b");
+    router->Alias("/testloop-b", "/testloop-a");
+    router->Add("GET", "/testuser/:id", [](const HttpRequest&, std::string&) { return HttpStream::Producer(); });
+    router->Alias("/testme", "/testuser/42");
+
+    struct Case {
+        const char* request;
+        const char* path; // 改写之后的路径
+        bool handler; // 最终匹配到处理函数
+    };
+    const Case cases[] = {
+        { "POST /testlogin HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+          "Content-Length: 24\r\n\r\nusername=mark&password=1", "/welcome.html", false },
+        { "POST /testlogin.html HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+          "Content-Length: 24\r\n\r\nusername=kram&password=1", "/error.html", false },
+        { "GET /testlogin HTTP/1.1\r\n\r\n", "/testlogin.html", false }, // 验证只针对POST
+        { "GET /testloop-a HTTP/1.1\r\n\r\n", "/testloop-a", false }, // 循环的别名在有限次之后停止
+        { "GET /testme HTTP/1.1\r\n\r\n", "/testuser/42", true },
+    };
+    for(const Case& c: cases) {
+        HttpRequest request;
+        Buffer buff;
+        buff.Append(c.request);
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+        assert(request.path() == c.path);
+        const Router::Route* route = request.GetRoute();
+        assert((route && route->handler) == c.handler);
+        if(c.handler) {
+            assert(request.Param("id") == "42");
+        }
+    }
+}
+
+void TestArena() {
+    // 保持连接上的请求：预热之后解析请求和生成内存缓存命中的响应不再分配堆内存
+    mkdir("./testarena", 0755);
+    FILE* fp = fopen("./testarena/arena.html", "w");
+    assert(fp);
+    fputs("<html>arena</html>", fp);
+    fclose(fp);
+    const std::string req = "GET /arena.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: test\r\n"
+                            "Accept: text/html\r\nAccept-Language: zh-CN,zh;q=0.9\r\nCookie: a=b\r\n\r\n";
+    HttpRequest request;
+    HttpResponse response;
+    Buffer in, out;
+    for(int i = 0; i < 100; i++) {
+        if(i == 10) {
+            newCount = 0;
+            countNew = true;
+        }
+        in.Append(req);
+        request.Init();
+        HttpRequest::HTTP_CODE parsed = request.parse(in);
+        response.Init("./testarena/", request.path(), true, -1, &request);
+        response.MakeResponse(out);
+        out.RetrieveAll();
+        assert(parsed == HttpRequest::GET_REQUEST && response.Code() == 200);
+    }
+    countNew = false;
+    assert(newCount == 0);
+    unlink("./testarena/arena.html");
+    rmdir("./testarena");
+}
+
+static std::string Unhex(const char* hex) {
+    std::string out;
+    for(size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+        out.push_back((char)std::stoi(std::string(hex + i, 2), nullptr, 16));
+    }
+    return out;
+}
+
+static bool HpackDecode(Hpack& hpack, const std::string& block, std::vector<Hpack::Header>& headers) {
+    return hpack.Decode((const uint8_t*)block.data(), block.size(), headers);
+}
+
+static void CheckHpack(Hpack& hpack, const char* hex, const std::vector<Hpack::Header>& expect) {
+    std::vector<Hpack::Header> headers;
+    bool ok = HpackDecode(hpack, Unhex(hex), headers);
+    assert(ok && headers == expect);
+}
+
+// RFC 7541 附录C的示例
+void TestHpack() {
+    typedef std::vector<Hpack::Header> Headers;
+    /* C.2 字面值的几种表示，每个示例一个新的解码器 */
+    {
+        Hpack hpack;
+        CheckHpack(hpack, "400a637573746f6d2d6b65790d637573746f6d2d686561646572", {{ "custom-key", "custom-header" }});
+        CheckHpack(hpack, "be", {{ "custom-key", "custom-header" }}); // 增量索引的项进入了动态表
+    }
+    {
+        Hpack hpack;
+        CheckHpack(hpack, "040c2f73616d706c652f70617468", {{ ":path", "/sample/path" }});
+        Headers headers;
+        assert(!HpackDecode(hpack, Unhex("be"), headers)); // 不索引的项不进入动态表
+    }
+    {
+        Hpack hpack;
+        CheckHpack(hpack, "100870617373776f726406736563726574", {{ "password", "secret" }});
+        CheckHpack(hpack, "82", {{ ":method", "GET" }});
+    }
+
+    /* C.3/C.4 同一连接上的三个请求，不用和使用Huffman编码；编码端的输出应当与C.4一致 */
+    const Headers requests[3] = {
+        {{ ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" }},
+        {{ ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+         { "cache-control", "no-cache" }},
+        {{ ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" }, { ":authority", "www.example.com" },
+         { "custom-key", "custom-value" }},
+    };
+    const char* plain[3] = {
+        "828684410f7777772e6578616d706c652e636f6d",
+        "828684be58086e6f2d6361636865",
+        "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+    };
+    const char* huffman[3] = {
+        "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+        "828684be5886a8eb10649cbf",
+        "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+    };
+    {
+        Hpack plainDecoder, huffmanDecoder, encoder;
+        for(int i = 0; i < 3; i++) {
+            CheckHpack(plainDecoder, plain[i], requests[i]);
+            CheckHpack(huffmanDecoder, huffman[i], requests[i]);
+            std::string block;
+            encoder.Encode(requests[i], block);
+            assert(block == Unhex(huffman[i]));
+        }
+        // 大小更新为0清空动态表，之后引用动态表的索引是错误
+        Headers headers;
+        assert(!HpackDecode(plainDecoder, Unhex("20be"), headers));
+    }
+
+    /* C.5/C.6 三个响应，动态表上限256字节，插入时驱逐最早的项 */
+    const Headers responses[3] = {
+        {{ ":status", "302" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+         { "location", "https://www.example.com" }},
+        {{ ":status", "307" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+         { "location", "https://www.example.com" }},
+        {{ ":status", "200" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:22 GMT" },
+         { "location", "https://www.example.com" }, { "content-encoding", "gzip" },
+         { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" }},
+    };
+    const char* plainResp[3] = {
+        "4803333032580770726976617465611d4d6f6e2c203231204f637420323031332032303a31333a323120474d54"
+        "6e1768747470733a2f2f7777772e6578616d706c652e636f6d",
+        "4803333037c1c0bf",
+        "88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d54c05a04677a69707738666f6f3d"
+        "4153444a4b48514b425a584f5157454f50495541585157454f49553b206d61782d6167653d333630303b207665"
+        "7273696f6e3d31",
+    };
+    const char* huffmanResp[3] = {
+        "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+        "4883640effc1c0bf",
+        "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af2708"
+        "7f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+    };
+    for(const char** blocks: { plainResp, huffmanResp }) {
+        Hpack hpack(256);
+        for(int i = 0; i < 3; i++) {
+            CheckHpack(hpack, blocks[i], responses[i]);
+        }
+        // 此时动态表中只剩set-cookie、content-encoding和date三项
+        CheckHpack(hpack, "c0", {{ "date", "Mon, 21 Oct 2013 20:13:22 GMT" }});
+        Headers headers;
+        assert(!HpackDecode(hpack, Unhex("c1"), headers));
+    }
+
+    /* C.1 整数表示：大小更新的5位前缀，1337 = 1f 9a 0a */
+    {
+        Hpack hpack;
+        Headers headers;
+        assert(HpackDecode(hpack, Unhex("3f9a0a"), headers) && headers.empty());
+        assert(!HpackDecode(hpack, Unhex("3fe21f"), headers)); // 4097超过SETTINGS的上限
+        assert(!HpackDecode(hpack, Unhex("823f9a0a"), headers)); // 大小更新只能在头部块开头
+        assert(!HpackDecode(hpack, Unhex("3f9a"), headers)); // 整数被截断
+        assert(!HpackDecode(hpack, Unhex("0081ff"), headers)); // Huffman填充超过7位
+    }
+    {
+        // 编码端：上限先缩小再恢复，两次都要通知对端(256 = 1f e1 01，4096 = 1f e1 1f)
+        Hpack encoder, decoder;
+        encoder.SetMaxTableSize(256);
+        encoder.SetMaxTableSize(4096);
+        Headers headers = {{ "x-long", std::string(1337, 'a') }, { "content-length", "1337" }};
+        std::string block;
+        encoder.Encode(headers, block);
+        assert(block.compare(0, 6, Unhex("3fe1013fe11f")) == 0);
+        Headers decoded;
+        assert(HpackDecode(decoder, block, decoded) && decoded == headers);
+    }
+}
+
+// 对testrange/range.txt发出一个请求，返回状态码；head是响应头，body是各响应体分段(缓存块中还带实体头)
+static int RangeRequest(const char* method, const std::string& headers, std::string* head, std::string* body) {
+    HttpRequest request;
+    Buffer in;
+    in.Append(std::string(method) + " /range.txt HTTP/1.1\r\nHost: test\r\n" + headers + "\r\n");
+    HttpRequest::HTTP_CODE parsed = request.parse(in);
+    assert(parsed == HttpRequest::GET_REQUEST);
+    HttpResponse response;
+    std::string path = request.path();
+    response.Init("./testrange/", path, false, -1, &request);
+    Buffer out;
+    response.MakeResponse(out);
+    *head = out.RetrieveAllToStr();
+    body->clear();
+    for(const struct iovec& iov: response.BodyIov()) {
+        body->append((const char*)iov.iov_base, iov.iov_len);
+    }
+    return response.Code();
+}
+
+static int CountOf(const std::string& str, const char* sub) {
+    int n = 0;
+    for(size_t i = str.find(sub); i != std::string::npos; i = str.find(sub, i + 1)) { n++; }
+    return n;
+}
+
+static std::string HeaderOf(const std::string& str, const char* name) {
+    size_t i = str.find(name);
+    assert(i != std::string::npos);
+    i += strlen(name);
+    return str.substr(i, str.find("\r\n", i) - i);
+}
+
+void TestRange() {
+    mkdir("./testrange", 0755);
+    FILE* fp = fopen("./testrange/range.txt", "w");
+    assert(fp);
+    fputs("0123456789abcdefghij", fp); // 20字节
+    fclose(fp);
+
+    std::string head, body;
+    int code = RangeRequest("GET", "", &head, &body);
+    assert(code == 200);
+    std::string etag = HeaderOf(head + body, "ETag: ");
+    std::string date = HeaderOf(head + body, "Last-Modified: ");
+    std::string sixteen = "bytes=0-0", seventeen;
+    for(int i = 1; i < 16; i++) { sixteen += "," + std::to_string(i) + "-" + std::to_string(i); }
+    seventeen = sixteen + ",16-16";
+
+    struct Case {
+        const char* method;
+        std::string range;
+        std::string ifRange;
+        int code;
+        int parts; // 响应中Content-Range的个数
+        const char* body; // 单段206的响应体，nullptr表示不检查
+    };
+    const Case cases[] = {
+        { "GET", "bytes=0-4", "", 206, 1, "01234" },
+        { "GET", "bytes=15-", "", 206, 1, "fghij" },
+        { "GET", "bytes=10-100", "", 206, 1, "abcdefghij" },   // 结尾越界截断到文件末尾
+        { "GET", "bytes=-5", "", 206, 1, "fghij" },            // 后缀范围
+        { "GET", "bytes=-50", "", 206, 1, "0123456789abcdefghij" },
+        { "GET", "bytes= 0-1 , 18-", "", 206, 2, nullptr },
+        { "GET", "bytes=20-30", "", 416, 1, nullptr },         // 全部越界
+        { "GET", "bytes=-0", "", 416, 1, nullptr },
+        { "GET", "bytes=20-,30-40", "", 416, 1, nullptr },
+        { "GET", "bytes=25-30,0-0", "", 206, 1, "0" },         // 越界的分段跳过
+        { "GET", "bytes=5-3", "", 200, 0, nullptr },           // 语法错误按普通请求处理
+        { "GET", "bytes=a-b", "", 200, 0, nullptr },
+        { "GET", "items=0-4", "", 200, 0, nullptr },
+        { "GET", sixteen, "", 206, 16, nullptr },
+        { "GET", seventeen, "", 200, 0, nullptr },             // 超过MAX_RANGES返回整个文件
+        { "GET", "bytes=0-4", etag, 206, 1, "01234" },
+        { "GET", "bytes=0-4", "W/" + etag, 200, 0, nullptr },  // If-Range只接受强验证器
+        { "GET", "bytes=0-4", "\"0-0-0\"", 200, 0, nullptr },
+        { "GET", "bytes=0-4", date, 206, 1, "01234" },
+        { "GET", "bytes=0-4", "Thu, 01 Jan 1970 00:00:00 GMT", 200, 0, nullptr },
+        { "GET", "bytes=0-4", "yesterday", 200, 0, nullptr },
+        { "HEAD", "bytes=0-4", "", 200, 0, nullptr },          // HEAD忽略Range
+    };
+    for(const Case& c: cases) {
+        std::string headers = "Range: " + c.range + "\r\n";
+        if(!c.ifRange.empty()) { headers += "If-Range: " + c.ifRange + "\r\n"; }
+        code = RangeRequest(c.method, headers, &head, &body);
+        assert(code == c.code);
+        assert(CountOf(head + body, "Content-Range: ") == c.parts);
+        if(c.code == 206 && c.parts > 1) {
+            assert(head.find("Content-type: multipart/byteranges; boundary=") != std::string::npos);
+        }
+        if(c.body) {
+            assert(body == c.body);
+        }
+    }
+    unlink("./testrange/range.txt");
+    rmdir("./testrange");
+}
+
 int main() {
     TestLog();
+    TestLogRecord();
+    TestAccessLog();
+    TestRequest();
+    TestRouter();
+    TestArena();
+    TestHpack();
+    TestRange();
     TestThreadPool();
 }
\ No newline at end of file